@@ -73,18 +73,9 @@ ClientProxy::~ClientProxy()
 void ClientProxy::ReadSignal()
 {
   PRINT("read " << *this);
-  // only emit a signal when the interface has received data
-  if (GetVar(mInfo->datatime) > GetVar(mLastTime))
-  {
-    {
-      scoped_lock_t lock(mPc->mMutex);
-      mFresh = true;
-      mLastTime = mInfo->datatime;
-    }
 #ifdef HAVE_BOOST_SIGNALS
-    mReadSignal();
+  mReadSignal();
 #endif
-  }
 }
 
 // add replace rule
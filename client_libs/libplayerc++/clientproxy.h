@@ -61,9 +61,71 @@
   #define PLAYERCC_EXPORT
 #endif
 
+#if defined (WIN32)
+  // MemoryBarrier() comes with windows.h, via playerc.h
+  #define PLAYERCC_MEMORY_BARRIER() MemoryBarrier()
+#else
+  #define PLAYERCC_MEMORY_BARRIER() __sync_synchronize()
+#endif
+
 namespace PlayerCc
 {
 
+/** @brief The latest sample from a device, readable without locking
+ *
+ * A sequence-locked copy of a plain-old-data sample.  There is a single
+ * writer, the thread doing the @ref PlayerClient::Read(), which never
+ * waits; readers never take a lock and simply retry in the rare case that
+ * they overlap with a write.  This lets a control loop pick up the latest
+ * data without contending with the client thread for
+ * @ref PlayerClient::mMutex.
+ */
+template<typename T>
+class LatestSample
+{
+  public:
+
+    LatestSample() : mSequence(0), mSample(), mTime(0) {};
+
+    /// Store a new sample, taken at @p aTime [s]
+    void Set(const T& aSample, double aTime)
+    {
+      // an odd sequence number marks a write in progress
+      ++mSequence;
+      PLAYERCC_MEMORY_BARRIER();
+      mSample = aSample;
+      mTime = aTime;
+      PLAYERCC_MEMORY_BARRIER();
+      ++mSequence;
+    }
+
+    /// Copy out the latest sample, and optionally the time it was taken
+    /// [s].  The time is 0 if no sample has been stored yet.
+    T Get(double* aTime=NULL) const
+    {
+      T sample;
+      double time;
+      unsigned int seq;
+      do
+      {
+        while ((seq = mSequence) & 1)
+          ;
+        PLAYERCC_MEMORY_BARRIER();
+        sample = mSample;
+        time = mTime;
+        PLAYERCC_MEMORY_BARRIER();
+      } while (seq != mSequence);
+      if (aTime)
+        *aTime = time;
+      return sample;
+    }
+
+  private:
+    volatile unsigned int mSequence;
+    T mSample;
+    double mTime;
+};
+
 /** @brief The client proxy base class
  *
  * Base class for all proxy devices. Access to a device is provided by a
@@ -124,6 +186,11 @@ class PLAYERCC_EXPORT ClientProxy
     // This needs to be defined for every proxy.
     virtual void Unsubscribe() {};
 
+    // Store the data just read into any LatestSample the proxy offers.
+    // Called by PlayerClient::Read(), with the client locked, whenever
+    // the device has new data.
+    virtual void PublishSample() {};
+
     // The controlling client object.
     PlayerClient* mPc;
 
@@ -183,7 +250,8 @@ class PLAYERCC_EXPORT ClientProxy
     //
     read_signal_t mReadSignal;
 
-    // Outputs the signal if there is new data
+    // Outputs the signal; PlayerClient::Read() calls it once the proxy
+    // has new data
     void ReadSignal();
 
   public:
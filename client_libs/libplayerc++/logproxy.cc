@@ -140,6 +140,15 @@ LogProxy::Rewind()
   return;
 }
 
+void
+LogProxy::Seek(double aTime, bool aRelative)
+{
+  scoped_lock_t lock(mPc->mMutex);
+  if (0 != playerc_log_set_read_seek(mDevice,aTime,aRelative ? 1 : 0))
+    throw PlayerError("LogProxy::Seek()", "error seeking");
+  return;
+}
+
 void
 LogProxy::SetFilename(const std::string aFilename)
 {
@@ -1612,6 +1612,10 @@ class PLAYERCC_EXPORT LogProxy : public ClientProxy
     /// Rewind the log file.
     void Rewind();
 
+    /// Jump to a time in the log file: seconds from the start of the log
+    /// if aRelative is true, otherwise a log timestamp.
+    void Seek(double aTime, bool aRelative=true);
+
     /// Set the name of the logfile to write to.
     void SetFilename(const std::string aFilename);
 };
@@ -2036,6 +2040,10 @@ class PLAYERCC_EXPORT Position2dProxy : public ClientProxy
     // libplayerc data structure
     playerc_position2d_t *mDevice;
 
+    // the last odometry read, for GetLatestData()
+    LatestSample<player_position2d_data_t> mLatest;
+    void PublishSample();
+
   public:
 
     /// Constructor
@@ -2184,6 +2192,15 @@ class PLAYERCC_EXPORT Position2dProxy : public ClientProxy
     /// Is the device stalled?
     bool GetStall() const { return GetVar(mDevice->stall) != 0 ? true : false; };
 
+    /// @brief Latest odometry, without locking
+    ///
+    /// Returns the pose, velocity and stall flag last read, and optionally
+    /// when they were read [s].  Unlike the other accessors this never
+    /// waits for the client lock, so a control loop can call it while
+    /// another thread runs the client.
+    player_position2d_data_t GetLatestData(double* aTime=NULL) const
+      { return mLatest.Get(aTime); };
+
 };
 
 /**
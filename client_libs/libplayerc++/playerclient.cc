@@ -48,6 +48,9 @@
 #include <iostream>
 #include <algorithm>
 #include <functional>
+#include <vector>
+#include <cerrno>
+#include <cstring>
 
 #include <time.h>
 
@@ -60,6 +63,15 @@
 #if !HAVE_NANOSLEEP
   #include <replace.h>
 #endif
+#if HAVE_POLL
+  #include <sys/poll.h>
+#else
+  #include <replace.h>  // for poll(2)
+#endif
+
+// How long the event-driven thread waits for data at a time, so that it
+// notices StopThread() [ms]
+#define PLAYERCC_EVENT_WAIT 100
 
 using namespace PlayerCc;
 
@@ -73,6 +85,7 @@ PlayerClient::PlayerClient(const std::string aHostname, uint32_t aPort,
 #ifdef HAVE_BOOST_THREAD
   mIsStop=true;
   mThread = NULL;
+  mEventDriven = false;
 #endif
   Connect(mHostname, mPort);
 }
@@ -126,13 +139,16 @@ void PlayerClient::Disconnect()
   }
 }
 
-void PlayerClient::StartThread()
+void PlayerClient::StartThread(bool aEventDriven)
 {
 #ifdef HAVE_BOOST_THREAD
   assert(NULL == mThread);
+  mEventDriven = aEventDriven;
   mThread = new boost::thread(boost::bind(&PlayerClient::RunThread, this));
   mIsStop = false;
 #else
+  // This line is here to prevent compiler warnings of "unused varaibles"
+  aEventDriven = aEventDriven;
   throw PlayerError("PlayerClient::StartThread","Thread support not included");
 #endif
 }
@@ -159,6 +175,14 @@ void PlayerClient::RunThread()
   PRINT("starting run");
   while (!mIsStop)
   {
+    if (mEventDriven)
+    {
+      if (WaitForData(PLAYERCC_EVENT_WAIT))
+      {
+        Read();
+      }
+      continue;
+    }
     if( mClient->mode == PLAYER_DATAMODE_PUSH){
       if (Peek())
       {
@@ -221,6 +245,39 @@ bool PlayerClient::Peek(uint32_t aTimeout)
 }
 
 
+bool PlayerClient::WaitForData(uint32_t aTimeout)
+{
+  struct pollfd fd;
+  {
+    ClientProxy::scoped_lock_t lock(mMutex);
+    if (0!=playerc_client_requestdata_nowait(mClient))
+    {
+      throw PlayerError("PlayerClient::WaitForData()", playerc_error_str());
+    }
+    // anything already received is ready now
+    if (mClient->qlen > 0 || mClient->read_xdrdata_len > 0)
+    {
+      return true;
+    }
+    fd.fd = mClient->sock;
+  }
+
+  // The lock is released while we wait, so that proxies can be used from
+  // other threads in the meantime
+  fd.events = POLLIN | POLLHUP;
+  fd.revents = 0;
+  int ret = poll(&fd, 1, aTimeout);
+  if (ret < 0)
+  {
+    if (errno == EINTR)
+    {
+      return false;
+    }
+    throw PlayerError("PlayerClient::WaitForData()", strerror(errno));
+  }
+  return ret > 0;
+}
+
 void PlayerClient::ReadIfWaiting()
 {
   if (Peek())
@@ -231,6 +288,7 @@ void PlayerClient::Read()
 {
   assert(NULL!=mClient);
   PRINT("read()");
+  std::vector<ClientProxy*> fresh;
   // first read the data
   {
     ClientProxy::scoped_lock_t lock(mMutex);
@@ -242,10 +300,26 @@ void PlayerClient::Read()
     {
         throw PlayerError("PlayerClient::Read()", "Overflow on server");
     }
+
+    // then pick out the proxies that got something since they last
+    // looked; libplayerc's own fresh flag is left to the user
+    for (std::list<ClientProxy*>::iterator it = mProxyList.begin();
+         it != mProxyList.end(); ++it)
+    {
+      playerc_device_t* info = (*it)->mInfo;
+      if (NULL != info && info->datatime > (*it)->mLastTime)
+      {
+        (*it)->mLastTime = info->datatime;
+        (*it)->mFresh = true;
+        (*it)->PublishSample();
+        fresh.push_back(*it);
+      }
+    }
   }
 
-  std::for_each(mProxyList.begin(),
-                mProxyList.end(),
+  // and signal only those
+  std::for_each(fresh.begin(),
+                fresh.end(),
                 std::mem_fun(&ClientProxy::ReadSignal));
 }
 
@@ -158,9 +158,16 @@ class PLAYERCC_EXPORT PlayerClient
     // This is the thread where we run @ref Run()
     thread_t* mThread;
 
+    // Does the thread block on the connection rather than polling it?
+    bool mEventDriven;
+
     // A helper function for starting the thread
     void RunThread();
 
+    // Wait up to aTimeout ms, without holding mMutex, for something to
+    // read; in pull mode, first ask the server for it
+    bool WaitForData(uint32_t aTimeout);
+
   public:
 
     /// Make a client and connect it as indicated.
@@ -184,8 +191,13 @@ class PLAYERCC_EXPORT PlayerClient
     // (with their code) because it's under development
     //boost::read_write_mutex mMutex;
 
-    /// Start the run thread
-    void StartThread();
+    /// @brief Start the run thread
+    ///
+    /// By default the thread polls the connection.  If @p aEventDriven is
+    /// set it instead sleeps until data arrives, without holding @ref
+    /// mMutex while it waits, and then reads it; in pull mode it asks for
+    /// the next round of data as soon as the last one is in.
+    void StartThread(bool aEventDriven=false);
 
     /// Stop the run thread
     void StopThread();
@@ -233,6 +245,8 @@ class PLAYERCC_EXPORT PlayerClient
     /// whether any data is currently waiting.
     /// In pull mode, this will block until all data waiting on the server has
     /// been received, ensuring as up to date data as possible.
+    /// Only the proxies that received new data have their read signals
+    /// emitted.
     void Read();
 
     /// @brief A nonblocking Read
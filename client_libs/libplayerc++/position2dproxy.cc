@@ -82,6 +82,20 @@ Position2dProxy::Unsubscribe()
   mDevice = NULL;
 }
 
+void
+Position2dProxy::PublishSample()
+{
+  player_position2d_data_t data;
+  data.pos.px = mDevice->px;
+  data.pos.py = mDevice->py;
+  data.pos.pa = mDevice->pa;
+  data.vel.px = mDevice->vx;
+  data.vel.py = mDevice->vy;
+  data.vel.pa = mDevice->va;
+  data.stall = mDevice->stall;
+  mLatest.Set(data, mDevice->info.datatime);
+}
+
 std::ostream&
 std::operator << (std::ostream &os, const PlayerCc::Position2dProxy &c)
 {
@@ -43,6 +43,9 @@
  * CVS: $Id$
  **************************************************************************/
 #include <config.h>
+#if HAVE_RECVMMSG
+  #define _GNU_SOURCE  // for recvmmsg()
+#endif
 
 #include <assert.h>
 #include <math.h>
@@ -57,6 +60,9 @@
 #include <errno.h>
 #include <time.h>
 #include <fcntl.h>
+#if HAVE_Z
+  #include <zlib.h>
+#endif
 #if !defined (WIN32)
   #include <sys/socket.h>
   #include <netinet/in.h>
@@ -101,6 +107,22 @@ void dummy(int sig)
 
 // Local functions
 int playerc_client_get_driverinfo(playerc_client_t *client);
+static int playerc_client_negotiate_encoding(playerc_client_t *client);
+static int playerc_client_negotiate_compression(playerc_client_t *client);
+static int playerc_client_uncompress(playerc_client_t *client,
+                                     char **body, uint32_t *bodylen);
+static int playerc_client_reserve_write(playerc_client_t *client, size_t size);
+static void playerc_client_hashdevice(playerc_client_t *client, int i);
+static int playerc_client_claim_reply(playerc_client_t *client,
+                                      player_msghdr_t *header);
+static void playerc_client_expire_requests(playerc_client_t *client,
+                                           int all);
+static int playerc_client_fill_udp(playerc_client_t *client, size_t need);
+static void playerc_client_reassemble(playerc_client_t *client,
+                                      const char *dgram, size_t len);
+static void playerc_client_count_seq(playerc_client_t *client,
+                                     player_msghdr_t *header);
+static int playerc_client_send_udp(playerc_client_t *client, size_t len);
 int playerc_client_readpacket(playerc_client_t *client,
                               player_msghdr_t *header,
                               char *data);
@@ -150,6 +172,7 @@ int timed_recv(int s, void *buf, size_t len, int flags, int timeout)
 playerc_client_t *playerc_client_create(playerc_mclient_t *mclient, const char *host, int port)
 {
   playerc_client_t *client;
+  int i;
 #if defined (WIN32)
   // Initialise Windows sockets API (this can safely be done as many times as we like)
   // Thus must be called once for every client creation, in order to match the calls on
@@ -186,7 +209,10 @@ playerc_client_t *playerc_client_create(playerc_mclient_t *mclient, const char *
   // TODO: make this memory allocation more conservative
   client->data = (char*)malloc(PLAYER_MAX_MESSAGE_SIZE);
   client->read_xdrdata = (char*)malloc(PLAYERXDR_MAX_MESSAGE_SIZE);
+  client->read_xdrdata_off = 0;
   client->read_xdrdata_len = 0;
+  client->write_xdrdata = NULL;
+  client->write_xdrdata_size = 0;
   assert(client->data);
   assert(client->read_xdrdata);
 
@@ -194,11 +220,24 @@ playerc_client_t *playerc_client_create(playerc_mclient_t *mclient, const char *
   client->qlen = 0;
   client->qsize = sizeof(client->qitems) / sizeof(client->qitems[0]);
 
+  for (i = 0; i < PLAYERC_DEVICE_HASH_SIZE; i++)
+    client->device_hash[i] = -1;
+
   client->datatime = 0;
   client->lasttime = 0;
 
   /* this is the server's default */
   client->mode = PLAYER_DATAMODE_PUSH;
+  client->encoding = PLAYER_ENCODING_XDR;
+  client->wanted_encoding = PLAYER_ENCODING_XDR;
+  client->same_byteorder = 0;
+  client->negotiable = 0;
+  client->compression = PLAYER_COMPRESSION_NONE;
+  client->wanted_compression = PLAYER_COMPRESSION_NONE;
+  client->compression_threshold = 0;
+  client->zstream = NULL;
+  client->zdata = NULL;
+  client->zdata_size = 0;
   client->transport = PLAYERC_TRANSPORT_TCP;
   client->data_requested = 0;
   client->data_received = 0;
@@ -216,6 +255,7 @@ playerc_client_t *playerc_client_create(playerc_mclient_t *mclient, const char *
 void playerc_client_destroy(playerc_client_t *client)
 {
   player_msghdr_t header;
+  int i;
   // Pop everything off the queue.
   while (!playerc_client_pop(client, &header, client->data))
   {
@@ -228,8 +268,22 @@ void playerc_client_destroy(playerc_client_t *client)
     PLAYERC_ERR1 ("Failed to clean up Windows sockets API with error %s", WSAGetLastError ());
 #endif
 
+  for (i = 0; i < client->qsize; i++)
+    free(client->qitems[i].data);
   free(client->data);
   free(client->read_xdrdata);
+  free(client->write_xdrdata);
+  free(client->udp_dgrams);
+  free(client->udp_read_frags);
+  free(client->pending);
+#if HAVE_Z
+  if (client->zstream)
+  {
+    inflateEnd((z_stream*)client->zstream);
+    free(client->zstream);
+  }
+#endif
+  free(client->zdata);
   free(client->host);
   free(client);
   return;
@@ -252,7 +306,9 @@ int playerc_client_connect(playerc_client_t *client)
   struct hostent* entp = NULL;
 #endif
   char banner[PLAYER_IDENT_STRLEN];
-  int ret;
+  uint8_t byteorder[4];
+  int ret, i;
+  int rcvbuf;
   //double t;
   /*
   struct timeval last;
@@ -267,6 +323,13 @@ int playerc_client_connect(playerc_client_t *client)
 #endif
   struct sockaddr_in clientaddr;
 
+  // A new connection has no replies outstanding
+  client->connect_count++;
+  client->data_requested = 0;
+  // and the server numbers its messages afresh
+  for (i = 0; i < client->device_count; i++)
+    client->device[i]->next_seq = 0;
+
   // Construct socket
   if(client->transport == PLAYERC_TRANSPORT_UDP)
   {
@@ -296,6 +359,13 @@ int playerc_client_connect(playerc_client_t *client)
       STRERROR(PLAYERC_ERR2, "bind() failed with error [%d: %s]");
       return -1;
     }
+
+    // A large message arrives as a burst of datagrams, which mustn't
+    // overflow the socket before they are read
+    rcvbuf = PLAYERC_UDP_RCVBUF;
+    if(setsockopt(client->sock, SOL_SOCKET, SO_RCVBUF,
+                  (const char*)&rcvbuf, sizeof(rcvbuf)) < 0)
+      PLAYERC_WARN("failed to enlarge the UDP receive buffer");
   }
   else
   {
@@ -489,6 +559,24 @@ int playerc_client_connect(playerc_client_t *client)
     return -1;
   }
 
+  // every connection starts out XDR encoded
+  client->encoding = PLAYER_ENCODING_XDR;
+  playerxdr_native_byteorder(byteorder);
+  client->same_byteorder = !memcmp(banner + PLAYER_IDENT_BYTEORDER,
+                                   byteorder, sizeof(byteorder));
+  memset(byteorder, 0, sizeof(byteorder));
+  client->negotiable = memcmp(banner + PLAYER_IDENT_BYTEORDER,
+                              byteorder, sizeof(byteorder)) != 0;
+  if((client->wanted_encoding != PLAYER_ENCODING_XDR) &&
+     (playerc_client_negotiate_encoding(client) != 0))
+    PLAYERC_WARN("server refused the wire encoding; staying with XDR");
+
+  // and uncompressed
+  client->compression = PLAYER_COMPRESSION_NONE;
+  if((client->wanted_compression != PLAYER_COMPRESSION_NONE) &&
+     (playerc_client_negotiate_compression(client) != 0))
+    PLAYERC_WARN("server refused compression; staying uncompressed");
+
   //set the datamode to pull
   playerc_client_datamode(client, PLAYER_DATAMODE_PULL);
 
@@ -522,7 +610,11 @@ int playerc_client_disconnect_retry(playerc_client_t *client)
     else
     {
       /* Clean out buffers */
+      client->read_xdrdata_off = 0;
       client->read_xdrdata_len = 0;
+      client->udp_read_msglen = 0;
+      client->udp_seq_first = 0;
+      client->udp_seq_count = 0;
 
       /* TODO: re-establish replacement rules, delivery modes, etc. */
 
@@ -587,6 +679,14 @@ int playerc_client_disconnect(playerc_client_t *client)
 #endif
   client->sock = -1;
   client->connected = 0;
+  client->read_xdrdata_off = 0;
+  client->read_xdrdata_len = 0;
+  client->udp_read_msglen = 0;
+  client->udp_seq_first = 0;
+  client->udp_seq_count = 0;
+
+  // Nothing more will be answered
+  playerc_client_expire_requests(client, 1);
   return 0;
 }
 
@@ -624,6 +724,89 @@ int playerc_client_datamode(playerc_client_t *client, uint8_t mode)
   return 0;
 }
 
+// Ask the server for the wanted wire encoding
+static int playerc_client_negotiate_encoding(playerc_client_t *client)
+{
+  player_device_encoding_req_t req;
+
+  /* don't ask servers that would not understand, or could not agree */
+  if ((client->wanted_encoding == PLAYER_ENCODING_NATIVE) &&
+      !client->same_byteorder)
+    return -1;
+
+  req.encoding = client->wanted_encoding;
+  playerxdr_native_byteorder(req.byteorder);
+
+  if (playerc_client_request(client, NULL, PLAYER_PLAYER_REQ_ENCODING, &req, NULL) < 0)
+    return -1;
+
+  /* the acknowledgement was the last message in the old encoding */
+  client->encoding = client->wanted_encoding;
+
+  return 0;
+}
+
+// Change the wire encoding
+int playerc_client_encoding(playerc_client_t *client, uint32_t encoding)
+{
+  client->wanted_encoding = encoding;
+  if (!client->connected || (client->encoding == encoding))
+    return 0;
+
+  if (playerc_client_negotiate_encoding(client) != 0)
+  {
+    client->wanted_encoding = client->encoding;
+    return -1;
+  }
+
+  return 0;
+}
+
+// Ask the server for the wanted compression
+static int playerc_client_negotiate_compression(playerc_client_t *client)
+{
+  player_device_compression_req_t req;
+
+  if (!client->negotiable)
+    return -1;
+#if !HAVE_Z
+  if (client->wanted_compression != PLAYER_COMPRESSION_NONE)
+    return -1;
+#endif
+
+  req.method = client->wanted_compression;
+  req.threshold = client->compression_threshold;
+
+  if (playerc_client_request(client, NULL, PLAYER_PLAYER_REQ_COMPRESSION, &req, NULL) < 0)
+    return -1;
+
+  client->compression = client->wanted_compression;
+
+  return 0;
+}
+
+// Change the compression of messages from the server
+int playerc_client_compression(playerc_client_t *client, uint32_t method,
+                               uint32_t threshold)
+{
+  uint32_t old_threshold = client->compression_threshold;
+
+  client->wanted_compression = method;
+  client->compression_threshold = threshold;
+  if (!client->connected ||
+      ((client->compression == method) && (old_threshold == threshold)))
+    return 0;
+
+  if (playerc_client_negotiate_compression(client) != 0)
+  {
+    client->wanted_compression = client->compression;
+    client->compression_threshold = old_threshold;
+    return -1;
+  }
+
+  return 0;
+}
+
 // Request a round of data; only valid when in a request/reply
 // (aka PULL) mode
 int
@@ -644,12 +827,42 @@ playerc_client_requestdata(playerc_client_t* client)
   return(ret);
 }
 
+// The reply to a data request made without waiting
+static void playerc_client_data_reply(void *userdata, int result,
+                                      player_msghdr_t *header, void *data)
+{
+  playerc_client_t *client = (playerc_client_t*) userdata;
+
+  if (result != 0)
+  {
+    PLAYERC_ERR("data request failed");
+    client->data_requested = 0;
+  }
+}
+
+// Request a round of data without waiting for the reply
+int
+playerc_client_requestdata_nowait(playerc_client_t* client)
+{
+  if(client->mode != PLAYER_DATAMODE_PULL || client->data_requested)
+    return(0);
+
+  if(playerc_client_request_async(client, NULL, PLAYER_PLAYER_REQ_DATA, NULL,
+                                  playerc_client_data_reply, client) < 0)
+    return(-1);
+
+  client->data_requested = 1;
+  client->data_received = 0;
+  return(0);
+}
+
 // Test to see if there is pending data. Send a data request if one has
 // not been sent already.
 int playerc_client_peek(playerc_client_t *client, int timeout)
 {
-  // First check the message queue
-  if (client->qlen > 0)
+  // First check the message queue, and what has been received but not
+  // yet read
+  if ((client->qlen > 0) || (client->read_xdrdata_len > 0))
     return(1);
 
   // In case we're in PULL mode, first request a round of data.
@@ -671,6 +884,10 @@ int playerc_client_internal_peek(playerc_client_t *client, int timeout)
     return -1;
   }
 
+  // There may be more messages left from the last receive
+  if (client->read_xdrdata_len > 0)
+    return 1;
+
   fd.fd = client->sock;
   //fd.events = POLLIN | POLLHUP;
   fd.events = POLLIN | POLLPRI | POLLERR | POLLHUP | POLLNVAL;
@@ -743,6 +960,9 @@ int playerc_client_read_nonblock_withproxy(playerc_client_t *client, void ** pro
   player_msghdr_t header;
   int ret;
 
+  if (client->pending_count > 0)
+    playerc_client_expire_requests(client, 0);
+
   while (true)
   {
     // See if there is any queued data.
@@ -769,6 +989,8 @@ int playerc_client_read_nonblock_withproxy(playerc_client_t *client, void ** pro
     }
     // One way or another, we got a new packet into (header,client->data),
     // so process it
+    if (playerc_client_claim_reply(client, &header))
+      continue;
     switch(header.type)
     {
       case PLAYER_MSGTYPE_RESP_ACK:
@@ -913,6 +1135,8 @@ int playerc_client_request(playerc_client_t *client,
     if(playerc_client_readpacket(client, &rep_header, client->data) < 0)
       return -1;
 
+    if (playerc_client_claim_reply(client, &rep_header))
+      continue;
     if (rep_header.type == PLAYER_MSGTYPE_DATA || rep_header.type == PLAYER_MSGTYPE_SYNCH)
     {
       // Queue up any incoming data and sync packets for later processing
@@ -959,6 +1183,171 @@ int playerc_client_request(playerc_client_t *client,
   return -1;
 }
 
+// Issue request without waiting for the reply
+int playerc_client_request_async(playerc_client_t *client,
+                                 playerc_device_t *deviceinfo,
+                                 uint8_t subtype, const void *req_data,
+                                 playerc_reply_fn_t callback, void *userdata)
+{
+  player_msghdr_t req_header;
+  playerc_client_pending_t *pending;
+  struct timeval curr;
+  int size;
+
+  memset(&req_header, 0, sizeof(req_header));
+  if(deviceinfo == NULL)
+    req_header.addr.interf = PLAYER_PLAYER_CODE;
+  else
+    req_header.addr = deviceinfo->addr;
+  req_header.type = PLAYER_MSGTYPE_REQ;
+  req_header.subtype = subtype;
+
+  // Make room to remember it first, so that a request is never sent
+  // without a record of it
+  if (client->pending_count == client->pending_size)
+  {
+    size = client->pending_size ? 2 * client->pending_size : 16;
+    pending = (playerc_client_pending_t*) realloc(client->pending,
+                                                  size * sizeof(pending[0]));
+    if (!pending)
+    {
+      PLAYERC_ERR("failed to allocate space for request");
+      return -1;
+    }
+    client->pending = pending;
+    client->pending_size = size;
+  }
+
+  if (playerc_client_writepacket(client, &req_header, req_data) < 0)
+    return -1;
+
+  gettimeofday(&curr, NULL);
+  pending = client->pending + client->pending_count++;
+  pending->addr = req_header.addr;
+  pending->subtype = subtype;
+  pending->deadline = curr.tv_sec + curr.tv_usec / 1e6 + client->request_timeout;
+  pending->callback = callback;
+  pending->userdata = userdata;
+  return 0;
+}
+
+// Hand a reply to the oldest outstanding asynchronous request it answers.
+// Returns non-zero if there was one (in which case the reply has been
+// dealt with), zero otherwise.
+static int playerc_client_claim_reply(playerc_client_t *client,
+                                      player_msghdr_t *header)
+{
+  int i, result;
+  playerc_client_pending_t pending;
+  void *data;
+
+  if (header->type != PLAYER_MSGTYPE_RESP_ACK &&
+      header->type != PLAYER_MSGTYPE_RESP_NACK)
+    return 0;
+
+  // Using TCP, we only need to check the interface and index
+  for (i = 0; i < client->pending_count; i++)
+  {
+    if (client->pending[i].addr.interf == header->addr.interf &&
+        client->pending[i].addr.index == header->addr.index &&
+        client->pending[i].subtype == header->subtype)
+      break;
+  }
+  if (i == client->pending_count)
+    return 0;
+
+  // Take it off the list before the callback, which may make more requests
+  pending = client->pending[i];
+  memmove(client->pending + i, client->pending + i + 1,
+          (client->pending_count - i - 1) * sizeof(client->pending[0]));
+  client->pending_count--;
+
+  // The callback gets its own copy of the reply, since any request it
+  // makes reads into client->data
+  result = (header->type == PLAYER_MSGTYPE_RESP_ACK) ? 0 : -2;
+  data = NULL;
+  if (pending.callback && !result && header->size)
+    data = playerxdr_clone_message(client->data, header->addr.interf,
+                                   header->type, header->subtype);
+  playerxdr_cleanup_message(client->data, header->addr.interf, header->type, header->subtype);
+
+  if (pending.callback)
+    (*pending.callback) (pending.userdata, result,
+                         result ? NULL : header, data);
+  if (data)
+    playerxdr_free_message(data, header->addr.interf, header->type, header->subtype);
+  return 1;
+}
+
+// Give up on asynchronous requests that are past their deadline (or on all
+// of them)
+static void playerc_client_expire_requests(playerc_client_t *client, int all)
+{
+  int i;
+  double now;
+  struct timeval curr;
+  playerc_client_pending_t pending;
+
+  gettimeofday(&curr, NULL);
+  now = curr.tv_sec + curr.tv_usec / 1e6;
+
+  i = 0;
+  while (i < client->pending_count)
+  {
+    if (!all && client->pending[i].deadline > now)
+    {
+      i++;
+      continue;
+    }
+    pending = client->pending[i];
+    memmove(client->pending + i, client->pending + i + 1,
+            (client->pending_count - i - 1) * sizeof(client->pending[0]));
+    client->pending_count--;
+
+    PLAYERC_ERR3("gave up waiting for server reply to request %s:%d:%d",
+                 interf_to_str(pending.addr.interf), pending.addr.index,
+                 pending.subtype);
+    if (pending.callback)
+      (*pending.callback) (pending.userdata, -1, NULL, NULL);
+  }
+}
+
+// Wait for the replies to asynchronous requests
+int playerc_client_wait_requests(playerc_client_t *client)
+{
+  int peek;
+  player_msghdr_t header;
+
+  while (client->pending_count > 0)
+  {
+    playerc_client_expire_requests(client, 0);
+    if (client->pending_count == 0)
+      break;
+
+    if ((peek = playerc_client_internal_peek(client, 10)) < 0)
+      return -1;
+    else if (peek == 0)
+      continue;
+
+    if (playerc_client_readpacket(client, &header, client->data) < 0)
+      return -1;
+
+    if (playerc_client_claim_reply(client, &header))
+      continue;
+    if (header.type == PLAYER_MSGTYPE_DATA || header.type == PLAYER_MSGTYPE_SYNCH)
+    {
+      // Queue up any incoming data and sync packets for later processing
+      playerc_client_push(client, &header, client->data);
+    }
+    else
+    {
+      PLAYERC_WARN ("Discarding unclaimed reply");
+      playerxdr_cleanup_message(client->data, header.addr.interf, header.type, header.subtype);
+    }
+  }
+  return 0;
+}
+
 // Add a device proxy
 int playerc_client_adddevice(playerc_client_t *client, playerc_device_t *device)
 {
@@ -968,7 +1357,8 @@ int playerc_client_adddevice(playerc_client_t *client, playerc_device_t *device)
     return -1;
   }
   device->fresh = 0;
-  client->device[client->device_count++] = device;
+  client->device[client->device_count] = device;
+  playerc_client_hashdevice(client, client->device_count++);
   return 0;
 }
 
@@ -985,6 +1375,12 @@ int playerc_client_deldevice(playerc_client_t *client, playerc_device_t *device)
       memmove(client->device + i, client->device + i + 1,
               (client->device_count - i - 1) * sizeof(client->device[0]));
       client->device_count--;
+
+      // The devices after it have moved down, so index them all afresh
+      for (i = 0; i < PLAYERC_DEVICE_HASH_SIZE; i++)
+        client->device_hash[i] = -1;
+      for (i = 0; i < client->device_count; i++)
+        playerc_client_hashdevice(client, i);
       return 0;
     }
   }
@@ -993,6 +1389,26 @@ int playerc_client_deldevice(playerc_client_t *client, playerc_device_t *device)
 }
 
 
+// Bucket that devices with the given address go in
+#define PLAYERC_DEVICE_HASH(interf, index) \
+  (((interf) * 31 + (index)) & (PLAYERC_DEVICE_HASH_SIZE - 1))
+
+// Add the device at position i of the list to the end of its bucket, so
+// that each bucket stays in list order
+static void playerc_client_hashdevice(playerc_client_t *client, int i)
+{
+  int *link;
+  playerc_device_t *device = client->device[i];
+
+  link = client->device_hash +
+         PLAYERC_DEVICE_HASH(device->addr.interf, device->addr.index);
+  while (*link >= 0)
+    link = client->device_next + *link;
+  *link = i;
+  client->device_next[i] = -1;
+}
+
+
 // Get the list of available device ids.  The data is written into the
 // proxy structure rather than returned to the caller.
 int playerc_client_get_devlist(playerc_client_t *client)
@@ -1155,14 +1571,333 @@ int playerc_client_delcallback(playerc_client_t *client, playerc_device_t *devic
 }
 
 
+// Make sure at least @p need bytes of incoming data are buffered.  Each
+// receive takes as much as the socket has (up to PLAYERC_READAHEAD_SIZE
+// beyond what is needed), so that a burst of messages is read in one go.  Returns 0 on success, 1 if the connection had to be
+// re-established (and anything buffered was lost), -1 on error.
+static int playerc_client_fill(playerc_client_t *client, size_t need)
+{
+  int nbytes;
+  char *end;
+  size_t room;
+
+  if (client->read_xdrdata_len >= need)
+    return 0;
+  if (client->transport == PLAYERC_TRANSPORT_UDP)
+    return playerc_client_fill_udp(client, need);
+
+  // Move what's left of the last receive to the front, if the rest of the
+  // message wouldn't fit after it
+  if (client->read_xdrdata_off + need > PLAYERXDR_MAX_MESSAGE_SIZE)
+  {
+    memmove(client->read_xdrdata,
+            client->read_xdrdata + client->read_xdrdata_off,
+            client->read_xdrdata_len);
+    client->read_xdrdata_off = 0;
+  }
+
+  while (client->read_xdrdata_len < need)
+  {
+    end = client->read_xdrdata + client->read_xdrdata_off +
+          client->read_xdrdata_len;
+    room = PLAYERXDR_MAX_MESSAGE_SIZE - client->read_xdrdata_off -
+           client->read_xdrdata_len;
+    if (room > need - client->read_xdrdata_len + PLAYERC_READAHEAD_SIZE)
+      room = need - client->read_xdrdata_len + PLAYERC_READAHEAD_SIZE;
+#ifdef MSG_DONTWAIT
+    // Usually the data is already there, so try for it before polling
+    nbytes = recv(client->sock, end, room, MSG_DONTWAIT);
+    if ((nbytes < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK)))
+      nbytes = timed_recv(client->sock, end, room, 0,
+                          (int) client->request_timeout * 1000);
+#else
+    nbytes = timed_recv(client->sock, end, room, 0,
+                        (int) client->request_timeout * 1000);
+#endif
+    if (nbytes < 0 && errno == EINTR)
+      continue;
+    if (nbytes == 0)
+      return -1;
+    if (nbytes < 0)
+    {
+      STRERROR (PLAYERC_ERR2, "recv failed with error [%d: %s]");
+      //playerc_client_disconnect(client);
+      if(playerc_client_disconnect_retry(client) < 0)
+        return(-1);
+      return(1);
+    }
+    client->read_xdrdata_len += nbytes;
+  }
+  return 0;
+}
+
+// Step over a message that has been dealt with
+static void playerc_client_consume(playerc_client_t *client, size_t len)
+{
+  client->read_xdrdata_off += len;
+  client->read_xdrdata_len -= len;
+  // (a message being reassembled from datagrams stays where it is)
+  if (!client->read_xdrdata_len && !client->udp_read_msglen)
+    client->read_xdrdata_off = 0;
+}
+
+
+// Step over a message too big for the read buffer, receiving and dropping
+// the part of it that hasn't arrived yet.  Over UDP, where the buffer only
+// holds whole messages, everything buffered is dropped instead.
+static void playerc_client_skip(playerc_client_t *client, size_t len)
+{
+  size_t n;
+
+  if (client->transport == PLAYERC_TRANSPORT_UDP)
+  {
+    playerc_client_consume(client, client->read_xdrdata_len);
+    // The dropped messages' sequence numbers go with them
+    client->udp_seq_first = 0;
+    client->udp_seq_count = 0;
+    return;
+  }
+  while (len > 0)
+  {
+    if (!client->read_xdrdata_len && (playerc_client_fill(client, 1) != 0))
+      return;
+    n = client->read_xdrdata_len < len ? client->read_xdrdata_len : len;
+    playerc_client_consume(client, n);
+    len -= n;
+  }
+}
+// Receive datagrams over UDP until at least @p need bytes of whole
+// messages are buffered, putting back together the messages that came in
+// several.  Returns as playerc_client_fill() does.
+static int playerc_client_fill_udp(playerc_client_t *client, size_t need)
+{
+  int i, num;
+  size_t lens[PLAYERC_UDP_BATCH];
+#if HAVE_RECVMMSG
+  struct mmsghdr msgs[PLAYERC_UDP_BATCH];
+  struct iovec iov[PLAYERC_UDP_BATCH];
+  struct pollfd ufd;
+#endif
+
+  if (!client->udp_dgrams)
+  {
+    client->udp_dgrams = (char*)malloc(PLAYERC_UDP_BATCH * PLAYER_UDP_DATAGRAM_SIZE);
+    if (!client->udp_dgrams)
+    {
+      PLAYERC_ERR("failed to allocate datagram buffer");
+      return -1;
+    }
+  }
+
+  while (client->read_xdrdata_len < need)
+  {
+#if HAVE_RECVMMSG
+    // Take everything that is waiting, up to a batch, at once
+    memset(msgs, 0, sizeof(msgs));
+    for (i = 0; i < PLAYERC_UDP_BATCH; i++)
+    {
+      iov[i].iov_base = client->udp_dgrams + i * PLAYER_UDP_DATAGRAM_SIZE;
+      iov[i].iov_len = PLAYER_UDP_DATAGRAM_SIZE;
+      msgs[i].msg_hdr.msg_iov = iov + i;
+      msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    num = recvmmsg(client->sock, msgs, PLAYERC_UDP_BATCH, MSG_DONTWAIT, NULL);
+    if ((num < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK)))
+    {
+      // Nothing yet; wait for it
+      ufd.fd = client->sock;
+      ufd.events = POLLIN;
+      num = poll(&ufd, 1, (int) client->request_timeout * 1000);
+      if (num == 0)
+      {
+        PLAYERC_ERR("poll call timed out with no data to recieve");
+        return -1;
+      }
+      if (num > 0)
+        continue;
+    }
+    for (i = 0; i < num; i++)
+      lens[i] = msgs[i].msg_len;
+#else
+    num = timed_recv(client->sock, client->udp_dgrams, PLAYER_UDP_DATAGRAM_SIZE,
+                     0, (int) client->request_timeout * 1000);
+    if (num == 0)
+      return -1;
+    if (num > 0)
+    {
+      lens[0] = num;
+      num = 1;
+    }
+#endif
+    if (num < 0 && errno == EINTR)
+      continue;
+    if (num < 0)
+    {
+      STRERROR (PLAYERC_ERR2, "recv failed with error [%d: %s]");
+      if(playerc_client_disconnect_retry(client) < 0)
+        return(-1);
+      return(1);
+    }
+    for (i = 0; i < num; i++)
+      playerc_client_reassemble(client,
+                                client->udp_dgrams + i * PLAYER_UDP_DATAGRAM_SIZE,
+                                lens[i]);
+  }
+  return 0;
+}
+
+static uint32_t playerc_client_get_uint32(const char *buf)
+{
+  uint32_t val;
+  memcpy(&val, buf, sizeof(val));
+  return ntohl(val);
+}
+
+static void playerc_client_put_uint32(char *buf, uint32_t val)
+{
+  val = htonl(val);
+  memcpy(buf, &val, sizeof(val));
+}
+
+// Fit a datagram into the message being reassembled after what is
+// buffered; once the message is whole, it joins the buffered ones
+static void playerc_client_reassemble(playerc_client_t *client,
+                                      const char *dgram, size_t len)
+{
+  const size_t payload = PLAYER_UDP_DATAGRAM_SIZE - PLAYER_UDP_HDR_SIZE;
+  uint32_t msgseq, devseq;
+  size_t off, msglen, frag, nbytes;
+  char *end;
+
+  if (len < PLAYER_UDP_HDR_SIZE)
+  {
+    PLAYERC_WARN1("dropping short datagram (%lu bytes)", (unsigned long) len);
+    return;
+  }
+  msgseq = playerc_client_get_uint32(dgram);
+  devseq = playerc_client_get_uint32(dgram + 4);
+  off = playerc_client_get_uint32(dgram + 8);
+  msglen = playerc_client_get_uint32(dgram + 12);
+  dgram += PLAYER_UDP_HDR_SIZE;
+  len -= PLAYER_UDP_HDR_SIZE;
+  // Every datagram of a message but the last carries a full payload
+  if ((msglen < PLAYERXDR_MSGHDR_SIZE) ||
+      (msglen > PLAYERXDR_MAX_MESSAGE_SIZE) || (off + len > msglen) ||
+      (off % payload) || ((len != payload) && (off + len != msglen)))
+  {
+    PLAYERC_WARN("dropping malformed datagram");
+    return;
+  }
+
+  if (!client->udp_read_msglen || (client->udp_read_msgseq != msgseq))
+  {
+    // A new message; anything left of the last one has been lost
+    client->udp_read_msgseq = msgseq;
+    client->udp_read_msglen = msglen;
+    client->udp_read_msggot = 0;
+
+    // Make room for it after what is buffered
+    if (client->read_xdrdata_off + client->read_xdrdata_len + msglen >
+        PLAYERXDR_MAX_MESSAGE_SIZE)
+    {
+      memmove(client->read_xdrdata,
+              client->read_xdrdata + client->read_xdrdata_off,
+              client->read_xdrdata_len);
+      client->read_xdrdata_off = 0;
+    }
+    if ((client->read_xdrdata_len + msglen > PLAYERXDR_MAX_MESSAGE_SIZE) ||
+        (client->udp_seq_count == PLAYERC_UDP_BATCH))
+    {
+      PLAYERC_WARN("no room for incoming message; dropping it");
+      client->udp_read_msglen = 0;
+      return;
+    }
+
+    // None of its datagrams have come yet
+    nbytes = (msglen / payload + 8) / 8;
+    if (nbytes > client->udp_read_frags_size)
+    {
+      client->udp_read_frags = realloc(client->udp_read_frags, nbytes);
+      if (!client->udp_read_frags)
+      {
+        PLAYERC_ERR("failed to allocate datagram map");
+        client->udp_read_frags_size = 0;
+        client->udp_read_msglen = 0;
+        return;
+      }
+      client->udp_read_frags_size = nbytes;
+    }
+    memset(client->udp_read_frags, 0, nbytes);
+  }
+  else if (client->udp_read_msglen != msglen)
+  {
+    PLAYERC_WARN("dropping datagram that disagrees on its message's length");
+    return;
+  }
+
+  // A duplicate datagram mustn't count towards the message twice
+  frag = off / payload;
+  if (client->udp_read_frags[frag / 8] & (1 << (frag % 8)))
+    return;
+  client->udp_read_frags[frag / 8] |= 1 << (frag % 8);
+
+  end = client->read_xdrdata + client->read_xdrdata_off +
+        client->read_xdrdata_len;
+  memcpy(end + off, dgram, len);
+  client->udp_read_msggot += len;
+  if (client->udp_read_msggot < client->udp_read_msglen)
+    return;
+
+  client->read_xdrdata_len += client->udp_read_msglen;
+  client->udp_read_msglen = 0;
+  client->udp_seqs[(client->udp_seq_first + client->udp_seq_count++) %
+                   PLAYERC_UDP_BATCH] = devseq;
+}
+
+// Check the sequence number of a message that came over UDP against the
+// last from the same device, counting those that went missing in between
+static void playerc_client_count_seq(playerc_client_t *client,
+                                     player_msghdr_t *header)
+{
+  int i;
+  uint32_t seq;
+  playerc_device_t *device;
+
+  if (!client->udp_seq_count)
+    return;
+  seq = client->udp_seqs[client->udp_seq_first];
+  client->udp_seq_first = (client->udp_seq_first + 1) % PLAYERC_UDP_BATCH;
+  client->udp_seq_count--;
+
+  for (i = client->device_hash[PLAYERC_DEVICE_HASH(header->addr.interf,
+                                                  header->addr.index)];
+       i >= 0; i = client->device_next[i])
+  {
+    device = client->device[i];
+    if (device->addr.interf != header->addr.interf ||
+        device->addr.index != header->addr.index)
+      continue;
+    // (a late arrival neither counts as lost nor moves the count back)
+    if ((int32_t)(seq - device->next_seq) < 0)
+      continue;
+    device->lost_count += seq - device->next_seq;
+    device->next_seq = seq + 1;
+  }
+}
+
 // Read a raw packet
 int playerc_client_readpacket(playerc_client_t *client,
                               player_msghdr_t *header,
                               char *data)
 {
-  int nbytes;
+  int ret;
   player_pack_fn_t packfunc;
   int decode_msglen;
+  int op;
+  int compressed;
+  size_t msglen;
+  char *body;
+  uint32_t bodylen;
 
   if (client->sock < 0)
   {
@@ -1170,77 +1905,53 @@ int playerc_client_readpacket(playerc_client_t *client,
     return -1;
   }
 
-  while(client->read_xdrdata_len < PLAYERXDR_MSGHDR_SIZE)
+  op = PLAYERXDR_DECODE;
+  if (client->encoding == PLAYER_ENCODING_NATIVE)
+    op |= PLAYERXDR_NATIVE;
+
+  if ((ret = playerc_client_fill(client, PLAYERXDR_MSGHDR_SIZE)) != 0)
   {
-    nbytes = timed_recv(client->sock,
-                        client->read_xdrdata + client->read_xdrdata_len,
-                        PLAYERXDR_MSGHDR_SIZE - client->read_xdrdata_len,
-                        0, (int) client->request_timeout * 1000);
-    if (nbytes <= 0)
-    {
-      if(nbytes == 0)
-        return -1;
-      if(errno == EINTR)
-        continue;
-      else
-      {
-        STRERROR (PLAYERC_ERR2, "recv failed with error [%d: %s]");
-        //playerc_client_disconnect(client);
-        if(playerc_client_disconnect_retry(client) < 0)
-          return(-1);
-        else
-          continue;
-      }
-    }
-    client->read_xdrdata_len += nbytes;
+    /* Need to start over; the easiest way is to recursively call
+     * myself.  Might be problematic... */
+    return (ret < 0) ? -1 : playerc_client_readpacket(client,header,data);
   }
 
   // Unpack the header
-  if(player_msghdr_pack(client->read_xdrdata,
+  if(player_msghdr_pack(client->read_xdrdata + client->read_xdrdata_off,
                         PLAYERXDR_MSGHDR_SIZE,
-                        header, PLAYERXDR_DECODE) < 0)
+                        header, op) < 0)
   {
     PLAYERC_ERR("failed to unpack header");
     return -1;
   }
+  if (client->transport == PLAYERC_TRANSPORT_UDP)
+    playerc_client_count_seq(client, header);
+  compressed = (header->size & PLAYER_COMPRESSED_SIZE_FLAG) != 0;
+  header->size &= ~PLAYER_COMPRESSED_SIZE_FLAG;
   if (header->size > PLAYERXDR_MAX_MESSAGE_SIZE - PLAYERXDR_MSGHDR_SIZE)
   {
-    PLAYERC_WARN1("packet is too large, %d bytes", header->size);
+    PLAYERC_ERR1("skipping packet that is too large, %d bytes", header->size);
+    playerc_client_skip(client, PLAYERXDR_MSGHDR_SIZE + (size_t) header->size);
+    return -1;
   }
 
-  // Slide over the header
-  memmove(client->read_xdrdata,
-          client->read_xdrdata + PLAYERXDR_MSGHDR_SIZE,
-          client->read_xdrdata_len - PLAYERXDR_MSGHDR_SIZE);
-  client->read_xdrdata_len -= PLAYERXDR_MSGHDR_SIZE;
+  // Wait for the whole of the body, which is then decoded from where it
+  // was received
+  msglen = PLAYERXDR_MSGHDR_SIZE + header->size;
+  if ((ret = playerc_client_fill(client, msglen)) != 0)
+    return (ret < 0) ? -1 : playerc_client_readpacket(client,header,data);
 
-  while(client->read_xdrdata_len < header->size)
+  body = client->read_xdrdata + client->read_xdrdata_off + PLAYERXDR_MSGHDR_SIZE;
+  bodylen = header->size;
+  if (compressed && (playerc_client_uncompress(client, &body, &bodylen) < 0))
   {
-    nbytes = timed_recv(client->sock,
-                        client->read_xdrdata + client->read_xdrdata_len,
-                        header->size - client->read_xdrdata_len,
-                        0, (int) client->request_timeout*1000);
-    if (nbytes <= 0)
-    {
-      if(errno == EINTR)
-        continue;
-      {
-        STRERROR (PLAYERC_ERR2, "recv failed with error [%d: %s]");
-        //playerc_client_disconnect(client);
-        if(playerc_client_disconnect_retry(client) < 0)
-          return(-1);
-        else
-        {
-          /* Need to start over; the easiest way is to recursively call
-           * myself.  Might be problematic... */
-          return(playerc_client_readpacket(client,header,data));
-        }
-      }
-    }
-    client->read_xdrdata_len += nbytes;
+    PLAYERC_ERR4("skipping message from %s:%u with type %s:%u that failed to uncompress",
+                 interf_to_str(header->addr.interf), header->addr.index, msgtype_to_str(header->type), header->subtype);
+    playerc_client_consume(client, msglen);
+    return(-1);
   }
 
-  if (header->size)
+  if (bodylen)
   {
   // Locate the appropriate unpacking function for the message body
     if(!(packfunc = playerxdr_get_packfunc(header->addr.interf, header->type,
@@ -1250,22 +1961,16 @@ int playerc_client_readpacket(playerc_client_t *client,
       // messages
       PLAYERC_ERR4("skipping message from %s:%u with unsupported type %s:%u",
                  interf_to_str(header->addr.interf), header->addr.index, msgtype_to_str(header->type), header->subtype);
-
-      // Slide over the body
-      memmove(client->read_xdrdata,
-            client->read_xdrdata + header->size,
-            client->read_xdrdata_len - header->size);
-      client->read_xdrdata_len -= header->size;
-
+      playerc_client_consume(client, msglen);
       return(-1);
     }
 
     // Unpack the body
-    if((decode_msglen = (*packfunc)(client->read_xdrdata,
-                                  header->size, data, PLAYERXDR_DECODE)) < 0)
+    if((decode_msglen = (*packfunc)(body, bodylen, data, op)) < 0)
     {
       PLAYERC_ERR4("decoding failed on message from %s:%u with type %s:%u",
                  interf_to_str(header->addr.interf), header->addr.index, msgtype_to_str(header->type), header->subtype);
+      playerc_client_consume(client, msglen);
       return(-1);
     }
   }
@@ -1273,11 +1978,7 @@ int playerc_client_readpacket(playerc_client_t *client,
   {
     decode_msglen = 0;
   }
-  // Slide over the body
-  memmove(client->read_xdrdata,
-          client->read_xdrdata + header->size,
-          client->read_xdrdata_len - header->size);
-  client->read_xdrdata_len -= header->size;
+  playerc_client_consume(client, msglen);
 
   // Rewrite the header with the decoded message length
   header->size = decode_msglen;
@@ -1286,48 +1987,124 @@ int playerc_client_readpacket(playerc_client_t *client,
 }
 
 
+// Uncompress a message body in place of the compressed one
+static int playerc_client_uncompress(playerc_client_t *client,
+                                     char **body, uint32_t *bodylen)
+{
+#if HAVE_Z
+  z_stream *zs;
+  uint32_t len;
+  const unsigned char *in = (const unsigned char*)*body;
+
+  if (*bodylen < 4)
+    return -1;
+  len = ((uint32_t)in[0] << 24) | ((uint32_t)in[1] << 16) |
+        ((uint32_t)in[2] << 8) | (uint32_t)in[3];
+  if (len > PLAYERXDR_MAX_MESSAGE_SIZE)
+    return -1;
+
+  // The context and buffer are kept for the next message
+  if (!client->zstream)
+  {
+    zs = (z_stream*)calloc(1, sizeof(z_stream));
+    if (!zs || (inflateInit(zs) != Z_OK))
+    {
+      free(zs);
+      return -1;
+    }
+    client->zstream = zs;
+  }
+  zs = (z_stream*)client->zstream;
+  if (len > client->zdata_size)
+  {
+    char *zdata = (char*)realloc(client->zdata, len);
+    if (!zdata)
+      return -1;
+    client->zdata = zdata;
+    client->zdata_size = len;
+  }
+
+  inflateReset(zs);
+  zs->next_in = (Bytef*)in + 4;
+  zs->avail_in = *bodylen - 4;
+  zs->next_out = (Bytef*)client->zdata;
+  zs->avail_out = len;
+  if ((inflate(zs, Z_FINISH) != Z_STREAM_END) || (zs->total_out != len))
+    return -1;
+
+  *body = client->zdata;
+  *bodylen = len;
+  return 0;
+#else
+  return -1;
+#endif
+}
+
 // Write a raw packet
 int playerc_client_writepacket(playerc_client_t *client,
                                player_msghdr_t *header, const char *data)
 {
   int bytes, ret, length;
-  player_pack_fn_t packfunc;
+  playerxdr_function_t *ftrow = NULL;
   int encode_msglen;
+  int op;
+  size_t need;
   struct timeval curr;
-  char *write_xdrdata = (char *)malloc(sizeof(char[PLAYERXDR_MAX_MESSAGE_SIZE]));
 
   if (client->sock < 0)
   {
     PLAYERC_WARN("no socket to write to");
-    free(write_xdrdata);
     return -1;
   }
 
-  // Encode the body first, if it's non-NULL
-  if(data)
+  op = PLAYERXDR_ENCODE;
+  if (client->encoding == PLAYER_ENCODING_NATIVE)
+    op |= PLAYERXDR_NATIVE;
+
+  // Make sure the encode buffer can take the message.  4 times the
+  // message (including dynamic data) is a safe upper bound.
+  need = PLAYERXDR_MSGHDR_SIZE;
+  if (data)
   {
     // Locate the appropriate packing function for the message body
-    if(!(packfunc = playerxdr_get_packfunc(header->addr.interf,
-                                       header->type,
-                                       header->subtype)))
+    ftrow = playerxdr_get_ftrow(header->addr.interf, header->type,
+                                header->subtype);
+    if (!ftrow || !ftrow->packfunc)
     {
       // TODO: Allow the user to register a callback to handle unsupported
       // messages
       PLAYERC_ERR4("skipping message to %s:%u with unsupported type %s:%u",
                    interf_to_str(header->addr.interf), header->addr.index, msgtype_to_str(header->type), header->subtype);
-      free(write_xdrdata);
       return(-1);
     }
+    if (ftrow->sizeoffunc)
+      need += 4 * (size_t)(*ftrow->sizeoffunc)((void*) data);
+    else
+      need = PLAYERXDR_MAX_MESSAGE_SIZE;
+    if (need > PLAYERXDR_MAX_MESSAGE_SIZE)
+      need = PLAYERXDR_MAX_MESSAGE_SIZE;
+  }
+  if (playerc_client_reserve_write(client, need) < 0)
+    return(-1);
 
-    if((encode_msglen =
-        (*packfunc)(write_xdrdata + PLAYERXDR_MSGHDR_SIZE,
-                    PLAYER_MAX_MESSAGE_SIZE - PLAYERXDR_MSGHDR_SIZE,
-                    (void*) data, PLAYERXDR_ENCODE)) < 0)
+  // Encode the body first, if it's non-NULL, leaving room for the header
+  // in front of it so that the two go out together
+  if(data)
+  {
+    while((encode_msglen =
+           (*ftrow->packfunc)(client->write_xdrdata + PLAYERXDR_MSGHDR_SIZE,
+                              client->write_xdrdata_size - PLAYERXDR_MSGHDR_SIZE,
+                              (void*) data, op)) < 0)
     {
-      PLAYERC_ERR4("encoding failed on message from %s:%u with type %s:%u",
-                   interf_to_str(header->addr.interf), header->addr.index, msgtype_to_str(header->type), header->subtype);
-      free(write_xdrdata);
-      return(-1);
+      // the estimate should never fall short, but try the largest buffer
+      // before giving up
+      if ((client->write_xdrdata_size >= PLAYERXDR_MAX_MESSAGE_SIZE) ||
+          (playerc_client_reserve_write(client, PLAYERXDR_MAX_MESSAGE_SIZE) < 0))
+      {
+        PLAYERC_ERR4("encoding failed on message from %s:%u with type %s:%u",
+                     interf_to_str(header->addr.interf), header->addr.index, msgtype_to_str(header->type), header->subtype);
+        return(-1);
+      }
     }
   }
   else
@@ -1338,39 +2115,115 @@ int playerc_client_writepacket(playerc_client_t *client,
   gettimeofday(&curr,NULL);
   header->timestamp = curr.tv_sec + curr.tv_usec / 1e6;
   // Pack the header
-  if(player_msghdr_pack(write_xdrdata, PLAYERXDR_MSGHDR_SIZE,
-                        header, PLAYERXDR_ENCODE) < 0)
+  if(player_msghdr_pack(client->write_xdrdata, PLAYERXDR_MSGHDR_SIZE,
+                        header, op) < 0)
   {
     PLAYERC_ERR("failed to pack header");
-    free(write_xdrdata);
     return -1;
   }
 
   // Send the message
   length = PLAYERXDR_MSGHDR_SIZE + encode_msglen;
+  if (client->transport == PLAYERC_TRANSPORT_UDP)
+    return playerc_client_send_udp(client, length);
   bytes = PLAYERXDR_MSGHDR_SIZE + encode_msglen;
   do
   {
-    ret = send(client->sock, &write_xdrdata[length-bytes],
+    ret = send(client->sock, &client->write_xdrdata[length-bytes],
                bytes, 0);
     if (ret > 0)
     {
       bytes -= ret;
     }
 #if defined (WIN32)
-    else if (ret < 0 && (errno != ERRNO_EAGAIN && errno != WSAEINPROGRESS))
+    else if (ret < 0 && (errno == ERRNO_EAGAIN || errno == WSAEINPROGRESS))
 #else
-    else if (ret < 0 && (errno != ERRNO_EAGAIN && errno != EINPROGRESS && errno != EWOULDBLOCK))
+    else if (ret < 0 && (errno == ERRNO_EAGAIN || errno == EINPROGRESS || errno == EWOULDBLOCK))
 #endif
+    {
+      // The socket is full; wait for room rather than spin
+      struct pollfd ufd;
+      ufd.fd = client->sock;
+      ufd.events = POLLOUT;
+      poll(&ufd, 1, (int) client->request_timeout * 1000);
+    }
+    else if (ret < 0)
     {
       STRERROR (PLAYERC_ERR2, "send on body failed with error [%d: %s]");
       //playerc_client_disconnect(client);
-      free(write_xdrdata);
       return(playerc_client_disconnect_retry(client));
     }
   } while (bytes);
 
-  free(write_xdrdata);
+  return 0;
+}
+
+// Send the encoded message over UDP, in as many datagrams as it takes
+static int playerc_client_send_udp(playerc_client_t *client, size_t len)
+{
+  char dgram[PLAYER_UDP_DATAGRAM_SIZE];
+  size_t done, n;
+  uint32_t msgseq;
+  int ret;
+
+  msgseq = client->udp_msgseq++;
+  for (done = 0; done < len; done += n)
+  {
+    n = len - done;
+    if (n > PLAYER_UDP_DATAGRAM_SIZE - PLAYER_UDP_HDR_SIZE)
+      n = PLAYER_UDP_DATAGRAM_SIZE - PLAYER_UDP_HDR_SIZE;
+    playerc_client_put_uint32(dgram, msgseq);
+    playerc_client_put_uint32(dgram + 4, 0);
+    playerc_client_put_uint32(dgram + 8, done);
+    playerc_client_put_uint32(dgram + 12, len);
+    memcpy(dgram + PLAYER_UDP_HDR_SIZE, client->write_xdrdata + done, n);
+    while ((ret = send(client->sock, dgram, PLAYER_UDP_HDR_SIZE + n, 0)) < 0)
+    {
+#if defined (WIN32)
+      if (errno == ERRNO_EAGAIN || errno == WSAEINPROGRESS)
+#else
+      if (errno == ERRNO_EAGAIN || errno == EINPROGRESS || errno == EWOULDBLOCK)
+#endif
+      {
+        // The socket is full; wait for room rather than spin
+        struct pollfd ufd;
+        ufd.fd = client->sock;
+        ufd.events = POLLOUT;
+        poll(&ufd, 1, (int) client->request_timeout * 1000);
+      }
+      else if (errno != EINTR)
+      {
+        STRERROR (PLAYERC_ERR2, "send on body failed with error [%d: %s]");
+        return(playerc_client_disconnect_retry(client));
+      }
+    }
+  }
+  return 0;
+}
+
+// Make the encode buffer at least @p size bytes long
+static int playerc_client_reserve_write(playerc_client_t *client, size_t size)
+{
+  char *buffer;
+
+  if (size <= client->write_xdrdata_size)
+    return 0;
+  // Grow by at least half as much again, so that a stream of commands of
+  // creeping size doesn't reallocate every time
+  if (size < client->write_xdrdata_size + client->write_xdrdata_size / 2)
+    size = client->write_xdrdata_size + client->write_xdrdata_size / 2;
+  if (size < PLAYERC_WRITEBUFFER_SIZE)
+    size = PLAYERC_WRITEBUFFER_SIZE;
+  if (size > PLAYERXDR_MAX_MESSAGE_SIZE)
+    size = PLAYERXDR_MAX_MESSAGE_SIZE;
+  buffer = (char*)realloc(client->write_xdrdata, size);
+  if (!buffer)
+  {
+    PLAYERC_ERR1("failed to allocate %lu bytes to encode into", (unsigned long) size);
+    return -1;
+  }
+  client->write_xdrdata = buffer;
+  client->write_xdrdata_size = size;
   return 0;
 }
 
@@ -1381,25 +2234,33 @@ void playerc_client_push(playerc_client_t *client,
 {
   playerc_client_item_t *item;
 
-  // Check for queue overflow; this will leak mem.
+  // Check for queue overflow
   if (client->qlen == client->qsize)
   {
     PLAYERC_ERR("queue overflow; discarding packets");
+    item = client->qitems + client->qfirst;
+    if (item->header.size)
+      playerxdr_cleanup_message(item->data, item->header.addr.interf,
+                                item->header.type, item->header.subtype);
     client->qfirst = (client->qfirst + 1) % client->qsize;
     client->qlen -=1;
   }
 
+  // The slot's storage is reused, and only grown when a bigger message
+  // comes through it
   item = client->qitems + (client->qfirst + client->qlen) % client->qsize;
   item->header = *header;
-  if (header->size && data)
+  if (!data)
+    item->header.size = 0;
+  if (item->header.size > item->data_size)
   {
-    item->data = malloc(header->size);
-    memcpy(item->data, data, header->size);
-  }
-  else
-  {
-    item->data = NULL;
+    free(item->data);
+    item->data = malloc(item->header.size);
+    assert(item->data);
+    item->data_size = item->header.size;
   }
+  if (item->header.size)
+    memcpy(item->data, data, item->header.size);
 
   client->qlen +=1;
 
@@ -1420,7 +2281,6 @@ int playerc_client_pop(playerc_client_t *client,
   item = client->qitems + client->qfirst;
   *header = item->header;
   memcpy(data, item->data, header->size);
-  free(item->data);
 
   client->qfirst = (client->qfirst + 1) % client->qsize;
   client->qlen -= 1;
@@ -1439,7 +2299,9 @@ void *playerc_client_dispatch(playerc_client_t *client,
   void *ret = NULL;
 
   // Look for a device proxy to handle this data
-  for (i = 0; i < client->device_count; i++)
+  for (i = client->device_hash[PLAYERC_DEVICE_HASH(header->addr.interf,
+                                                  header->addr.index)];
+       i >= 0; i = client->device_next[i])
   {
     device = client->device[i];
 
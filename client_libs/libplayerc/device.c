@@ -66,6 +66,8 @@ void playerc_device_init(playerc_device_t *device, playerc_client_t *client,
   device->subscribed = 0;
   device->callback_count = 0;
   device->putmsg = putmsg;
+  device->lost_count = 0;
+  device->next_seq = 0;
 
   if (device->client)
     playerc_client_adddevice(device->client, device);
@@ -43,6 +43,8 @@
  * CVS: $Id$
  **************************************************************************/
 
+#include <config.h>
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -53,6 +55,9 @@
   #include <netdb.h>       // for gethostbyname()
   #include <netinet/in.h>  // for struct sockaddr_in, htons(3)
 #endif
+#if HAVE_SYS_EPOLL_H
+  #include <sys/epoll.h>
+#endif
 
 #include <replace/replace.h>  /* for poll */
 
@@ -63,6 +68,9 @@
   #define snprintf _snprintf
 #endif
 
+// Initial room for clients; it is doubled whenever it runs out
+#define PLAYERC_MCLIENT_SIZE 16
+
 // Create a multi-client
 playerc_mclient_t *playerc_mclient_create()
 {
@@ -70,8 +78,12 @@ playerc_mclient_t *playerc_mclient_create()
 
   mclient = malloc(sizeof(playerc_mclient_t));
   memset(mclient, 0, sizeof(playerc_mclient_t));
-  mclient->pollfd = calloc(128,sizeof(struct pollfd));
   mclient->time = 0.0;
+  mclient->epollfd = -1;
+#if HAVE_SYS_EPOLL_H
+  if ((mclient->epollfd = epoll_create(PLAYERC_MCLIENT_SIZE)) < 0)
+    PLAYERC_WARN1("epoll_create failed [%s]; using poll", strerror(errno));
+#endif
 
   return mclient;
 }
@@ -80,7 +92,15 @@ playerc_mclient_t *playerc_mclient_create()
 // Destroy a multi-client
 void playerc_mclient_destroy(playerc_mclient_t *mclient)
 {
+#if HAVE_SYS_EPOLL_H
+  if (mclient->epollfd >= 0)
+    close(mclient->epollfd);
+#endif
+  free(mclient->client);
   free(mclient->pollfd);
+  free(mclient->epoll_sock);
+  free(mclient->epoll_connect);
+  free(mclient->epoll_events);
   free(mclient);
 }
 
@@ -88,41 +108,154 @@ void playerc_mclient_destroy(playerc_mclient_t *mclient)
 // Add a client to this multi-client
 int playerc_mclient_addclient(playerc_mclient_t *mclient, playerc_client_t *client)
 {
-  if (mclient->client_count >= sizeof(mclient->client) / sizeof(mclient->client[0]))
+  int size;
+
+  if (mclient->client_count == mclient->client_size)
   {
-    PLAYERC_ERR("too many clients in multi-client; ignoring new client");
-    return -1;
+    size = mclient->client_size ? 2 * mclient->client_size : PLAYERC_MCLIENT_SIZE;
+    if (!(mclient->client = realloc(mclient->client, size * sizeof(mclient->client[0]))) ||
+        !(mclient->pollfd = realloc(mclient->pollfd, size * sizeof(mclient->pollfd[0]))) ||
+        !(mclient->epoll_sock = realloc(mclient->epoll_sock, size * sizeof(mclient->epoll_sock[0]))) ||
+        !(mclient->epoll_connect = realloc(mclient->epoll_connect, size * sizeof(mclient->epoll_connect[0]))))
+    {
+      PLAYERC_ERR("failed to allocate space for client in multi-client");
+      return -1;
+    }
+#if HAVE_SYS_EPOLL_H
+    if (!(mclient->epoll_events = realloc(mclient->epoll_events, size * sizeof(struct epoll_event))))
+    {
+      PLAYERC_ERR("failed to allocate space for client in multi-client");
+      return -1;
+    }
+#endif
+    mclient->client_size = size;
   }
 
   mclient->client[mclient->client_count] = client;
+  mclient->epoll_sock[mclient->client_count] = -1;
+  mclient->epoll_connect[mclient->client_count] = 0;
   mclient->client_count++;
 
   return 0;
 }
 
 
-// Test to see if there is pending data.
-// Returns -1 on error, 0 or 1 otherwise.
-int playerc_mclient_peek(playerc_mclient_t *mclient, int timeout)
+// Has the client got data that has already been received?
+static int playerc_mclient_pending(playerc_client_t *client)
+{
+  return client->qlen || client->read_xdrdata_len;
+}
+
+
+// Wait for incoming data on any of the clients, leaving the sockets that
+// have some marked in pollfd[].revents.  Returns the number of them, or -1
+// on error.
+static int playerc_mclient_wait(playerc_mclient_t *mclient, int timeout)
 {
   int i, count;
+  playerc_client_t *client;
 
-  // Configure poll structure to wait for incoming data 
+#if HAVE_SYS_EPOLL_H
+  if ((mclient->epollfd >= 0) && (mclient->client_count > 0))
+  {
+    struct epoll_event ev;
+    struct epoll_event *events = (struct epoll_event*) mclient->epoll_events;
+
+    // Keep the set up to date with clients that have (re)connected since
+    // the last time.  A socket that was closed has already left the set.
+    // All the stale sockets are removed before any is added, as a new
+    // connection may have been given a number another client had.
+    for (i = 0; i < mclient->client_count; i++)
+    {
+      client = mclient->client[i];
+      mclient->pollfd[i].revents = 0;
+      if ((client->sock == mclient->epoll_sock[i]) &&
+          (client->connect_count == mclient->epoll_connect[i]))
+        continue;
+      if (mclient->epoll_sock[i] >= 0)
+        epoll_ctl(mclient->epollfd, EPOLL_CTL_DEL, mclient->epoll_sock[i], &ev);
+      mclient->epoll_sock[i] = -1;
+    }
+    for (i = 0; i < mclient->client_count; i++)
+    {
+      client = mclient->client[i];
+      if ((mclient->epoll_sock[i] < 0) && (client->sock >= 0))
+      {
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.u32 = i;
+        if (epoll_ctl(mclient->epollfd, EPOLL_CTL_ADD, client->sock, &ev) < 0)
+        {
+          PLAYERC_ERR1("epoll_ctl failed [%s]", strerror(errno));
+          return -1;
+        }
+        mclient->epoll_sock[i] = client->sock;
+        mclient->epoll_connect[i] = client->connect_count;
+      }
+    }
+
+    count = epoll_wait(mclient->epollfd, events, mclient->client_count, timeout);
+    if (count < 0)
+    {
+      if (errno == EINTR)
+        return 0;
+      PLAYERC_ERR1("epoll_wait returned error [%s]", strerror(errno));
+      return -1;
+    }
+    for (i = 0; i < count; i++)
+      mclient->pollfd[events[i].data.u32].revents = POLLIN;
+    return count;
+  }
+#endif
+
+  // Configure poll structure to wait for incoming data
   for (i = 0; i < mclient->client_count; i++)
   {
-    playerc_client_requestdata(mclient->client[i]);
     mclient->pollfd[i].fd = mclient->client[i]->sock;
     mclient->pollfd[i].events = POLLIN;
     mclient->pollfd[i].revents = 0;
   }
-
-  // Wait for incoming data 
   count = poll(mclient->pollfd, mclient->client_count, timeout);
   if (count < 0)
   {
     PLAYERC_ERR1("poll returned error [%s]", strerror(errno));
     return -1;
   }
+  return count;
+}
+
+
+// Ask every client in a PULL mode for a round of data, all at once
+static void playerc_mclient_requestdata(playerc_mclient_t *mclient)
+{
+  int i;
+
+  for (i = 0; i < mclient->client_count; i++)
+  {
+    if (playerc_mclient_pending(mclient->client[i]))
+      continue;
+    if (playerc_client_requestdata_nowait(mclient->client[i]) < 0)
+      PLAYERC_ERR("playerc_client_requestdata_nowait errored");
+  }
+}
+
+
+// Test to see if there is pending data.
+// Returns -1 on error, 0 or 1 otherwise.
+int playerc_mclient_peek(playerc_mclient_t *mclient, int timeout)
+{
+  int i, count;
+
+  playerc_mclient_requestdata(mclient);
+
+  // Don't wait if something has already been received
+  for (i = 0; i < mclient->client_count; i++)
+    if (playerc_mclient_pending(mclient->client[i]))
+      return 1;
+
+  // Wait for incoming data
+  if ((count = playerc_mclient_wait(mclient, timeout)) < 0)
+    return -1;
 
   return (count > 0);
 }
@@ -131,54 +264,42 @@ int playerc_mclient_peek(playerc_mclient_t *mclient, int timeout)
 // Read from a bunch of clients
 int playerc_mclient_read(playerc_mclient_t *mclient, int timeout)
 {
-  int i, count;
+  int i, count, ret;
+
+  // In case the clients are in a PULL mode, first request a round of data.
+  playerc_mclient_requestdata(mclient);
 
-  // Configure poll structure to wait for incoming data 
+  // Don't wait if something has already been received
   for (i = 0; i < mclient->client_count; i++)
-  {
-    mclient->pollfd[i].fd = mclient->client[i]->sock;
-    mclient->pollfd[i].events = POLLIN;
-    mclient->pollfd[i].revents = 0;
-    if(!mclient->client[i]->qlen)
-    {
-      // In case the client is in a PULL mode, first request a round of data.
-      if(playerc_client_requestdata(mclient->client[i]) < 0)
-        PLAYERC_ERR("playerc_client_requestdata errored");
-    }
-  }
+    if (playerc_mclient_pending(mclient->client[i]))
+      timeout = 0;
 
-  // Wait for incoming data 
-  count = poll(mclient->pollfd, mclient->client_count, timeout);
-  if (count < 0)
-  {
-    PLAYERC_ERR1("poll returned error [%s]", strerror(errno));
+  // Wait for incoming data
+  if (playerc_mclient_wait(mclient, timeout) < 0)
     return -1;
-  }
 
-  // Now read from each of the waiting sockets 
+  // Now read from each of the waiting sockets
   count = 0;
   for (i = 0; i < mclient->client_count; i++)
   {
-    if(mclient->client[i]->qlen ||
+    if(playerc_mclient_pending(mclient->client[i]) ||
        (mclient->pollfd[i].revents & POLLIN) > 0)
     {
-      if(playerc_client_read_nonblock(mclient->client[i])>0)
+      if((ret = playerc_client_read_nonblock(mclient->client[i])) > 0)
       {
         // cache the latest timestamp
         if(mclient->client[i]->datatime > mclient->time)
           mclient->time = mclient->client[i]->datatime;
         count++;
       }
-      else
+      else if(ret < 0)
       {
-        // got no message even though poll() said there was something there, which 
-        // almost certainly means that we lost the connection
+        // the connection has most likely been lost
         return(-1);
       }
+      // otherwise all there was was the reply to the data request, or
+      // only part of a message
     }
   }
   return count;
 }
-
-
-
@@ -116,6 +116,25 @@ extern "C" {
 
 #define PLAYERC_QUEUE_RING_SIZE 512
 
+/** Number of buckets that device proxies are hashed into by address
+    (must be a power of 2) */
+#define PLAYERC_DEVICE_HASH_SIZE 256
+
+/** Smallest buffer that outgoing packets are encoded into */
+#define PLAYERC_WRITEBUFFER_SIZE 4096
+
+/** Most that is received ahead of the message being read.  Whatever is
+    read ahead has left the socket, so the server can no longer tell that
+    the client is falling behind; this keeps that hidden backlog small. */
+#define PLAYERC_READAHEAD_SIZE 65536
+
+/** Most datagrams received in one go over UDP */
+#define PLAYERC_UDP_BATCH 32
+
+/** Receive buffer asked of the kernel for UDP, so that a burst of
+    datagrams carrying a large message isn't dropped before it is read */
+#define PLAYERC_UDP_RCVBUF (4 * 1024 * 1024)
+
 /** @} */
 
 /**
@@ -430,19 +449,31 @@ typedef struct
 {
   player_msghdr_t header;
   void *data;
+  /* Space allocated at data, which is kept for the next item that uses
+     this slot. */
+  size_t data_size;
 } playerc_client_item_t;
 
 
 /* Multi-client data*/
 typedef struct
 {
-  /* List of clients being managed*/
+  /* List of clients being managed, which grows as needed*/
   int client_count;
-  struct _playerc_client_t *client[128];
+  struct _playerc_client_t **client;
+  int client_size;
 
-  /* Poll info*/
+  /* Poll info; only revents is used when there is an epoll set*/
   struct pollfd* pollfd;
 
+  /* epoll set that the clients' sockets are in (-1 if there is none), the
+     socket and connection of each client when it was put in the set, and
+     room for the events it returns*/
+  int epollfd;
+  int *epoll_sock;
+  unsigned int *epoll_connect;
+  void *epoll_events;
+
   /* Latest time received from any server*/
   double time;
 
@@ -487,6 +518,34 @@ PLAYERC_EXPORT typedef void (*playerc_putmsg_fn_t) (void *device, char *header,
 /** @brief Typedef for proxy callback function */
 PLAYERC_EXPORT typedef void (*playerc_callback_fn_t) (void *data);
 
+/** @brief Typedef for the function called with the reply to a request
+    made by playerc_client_request_async().
+
+@p result is 0 for an ACK, -2 for a NACK and -1 if the request timed out
+or the connection was lost.  For an ACK, @p header and @p data describe
+the reply; the data is a copy that is only valid for the duration of the
+call, and is freed afterwards.  Otherwise they are NULL.  The callback may
+make further requests, synchronous or not. */
+PLAYERC_EXPORT typedef void (*playerc_reply_fn_t) (void *userdata, int result,
+                                                   player_msghdr_t *header,
+                                                   void *data);
+
+/** @brief A request that has been sent but not yet answered. @internal */
+typedef struct
+{
+  /** Where the request went, and what it was. */
+  player_devaddr_t addr;
+  uint8_t subtype;
+
+  /** Time by which the reply must arrive. */
+  double deadline;
+
+  /** Who to tell when it does. */
+  playerc_reply_fn_t callback;
+  void *userdata;
+
+} playerc_client_pending_t;
+
 
 /** @brief Info about an available (but not necessarily subscribed)
     device.
@@ -535,6 +594,11 @@ typedef struct _playerc_client_t
   /** @internal Socket descriptor */
   int sock;
 
+  /** @internal Number of times the client has connected, so that a
+   * multi-client can tell a new socket from an old one with the same
+   * descriptor */
+  unsigned int connect_count;
+
   /** @internal Data delivery mode */
   uint8_t mode;
 
@@ -546,6 +610,40 @@ typedef struct _playerc_client_t
    * received any data in this round? */
   int data_received;
 
+  /** @internal Requests waiting for replies, in the order they were
+   * sent */
+  playerc_client_pending_t *pending;
+  int pending_count, pending_size;
+
+  /** @internal Wire encoding (PLAYER_ENCODING_*) of the connection */
+  uint32_t encoding;
+
+  /** @internal Wire encoding asked for with playerc_client_encoding(),
+   * negotiated again whenever the client (re)connects */
+  uint32_t wanted_encoding;
+
+  /** @internal Does the server's byte order (from its banner) match ours? */
+  int same_byteorder;
+
+  /** @internal Does the server understand wire negotiation requests (is
+   * there a byte order marker in its banner)? */
+  int negotiable;
+
+  /** @internal Compression (PLAYER_COMPRESSION_*) of messages from the
+   * server, and the one asked for with playerc_client_compression() */
+  uint32_t compression;
+  uint32_t wanted_compression;
+
+  /** @internal Smallest message body the server is asked to compress */
+  uint32_t compression_threshold;
+
+  /** @internal Decompression context (a z_stream), made on first use */
+  void *zstream;
+
+  /** @internal Buffer for decompressed message bodies */
+  char *zdata;
+  size_t zdata_size;
+
 
   /** List of available (but not necessarily subscribed) devices.
       This list is filled in by playerc_client_get_devlist(). */
@@ -556,14 +654,46 @@ typedef struct _playerc_client_t
   struct _playerc_device_t *device[PLAYER_MAX_DEVICES];
   int device_count;
 
+  /** @internal Index of the device list by address: the first device in
+   * each bucket, and the next device in the same bucket after each one
+   * (-1 at the end), in list order. */
+  int device_hash[PLAYERC_DEVICE_HASH_SIZE];
+  int device_next[PLAYER_MAX_DEVICES];
+
   /** @internal A circular queue used to buffer incoming data packets. */
   playerc_client_item_t qitems[PLAYERC_QUEUE_RING_SIZE];
   int qfirst, qlen, qsize;
 
   /** @internal Temp buffers for incoming / outgoing packets. */
   char *data;
+  /** @internal Incoming bytes are received in bulk into read_xdrdata;
+   * read_xdrdata_len of them, starting at read_xdrdata_off, are yet to be
+   * decoded. */
   char *read_xdrdata;
+  size_t read_xdrdata_off;
   size_t read_xdrdata_len;
+  /** @internal Buffer that outgoing packets are encoded into; it is kept
+   * from one packet to the next, and grown as needed. */
+  char *write_xdrdata;
+  size_t write_xdrdata_size;
+  /** @internal UDP only: the number for the next message to the server,
+   * and the message being reassembled from datagrams after what is
+   * buffered in read_xdrdata: its number, length (0 if none) and how much
+   * of it has come. */
+  uint32_t udp_msgseq;
+  uint32_t udp_read_msgseq;
+  size_t udp_read_msglen;
+  size_t udp_read_msggot;
+  /** @internal UDP only: a bit for each of that message's datagrams,
+   * set once it has come, so that duplicates are only counted once. */
+  unsigned char *udp_read_frags;
+  size_t udp_read_frags_size;
+  /** @internal UDP only: room for a batch of incoming datagrams. */
+  char *udp_dgrams;
+  /** @internal UDP only: the sequence numbers of the whole messages
+   * buffered in read_xdrdata, oldest first. */
+  uint32_t udp_seqs[PLAYERC_UDP_BATCH];
+  int udp_seq_first, udp_seq_count;
 
 
   /** Server time stamp on the last packet. */
@@ -653,6 +783,51 @@ playerc_error_str() to get a descriptive error message.
 */
 PLAYERC_EXPORT int playerc_client_datamode(playerc_client_t *client, uint8_t mode);
 
+/** @brief Change the wire encoding of the connection.
+
+By default messages are XDR encoded, which byte swaps every field on
+little-endian machines.  A client running on a machine with the same byte
+order as the server can ask for PLAYER_ENCODING_NATIVE instead, which
+leaves the fields in host order and copies suitable arrays as they stand.
+The choice is remembered: if the client is not connected yet, or connects
+again later, the encoding is negotiated as part of connecting.
+
+@param client Pointer to client object.
+
+@param encoding PLAYER_ENCODING_XDR or PLAYER_ENCODING_NATIVE.
+
+@returns Returns 0 on success, non-zero if the byte orders differ, the
+server predates the request or it refused, in which case the connection
+stays XDR encoded.
+
+*/
+PLAYERC_EXPORT int playerc_client_encoding(playerc_client_t *client, uint32_t encoding);
+
+/** @brief Ask the server to compress large messages.
+
+Over a slow link, large messages such as camera images, point clouds and
+maps can be sent compressed: with PLAYER_COMPRESSION_ZLIB, the server
+compresses message bodies of at least @p threshold bytes (once encoded)
+when that makes them smaller, and they are uncompressed as they are read.
+Like the encoding, the choice is remembered and negotiated again when the
+client connects.
+
+@param client Pointer to client object.
+
+@param method PLAYER_COMPRESSION_NONE or PLAYER_COMPRESSION_ZLIB.
+
+@param threshold Smallest body worth compressing, in bytes, or 0 for the
+server's default.
+
+@returns Returns 0 on success, non-zero if the server predates the request
+or refused it, or this library was built without zlib; messages then
+stay uncompressed.
+
+*/
+PLAYERC_EXPORT int playerc_client_compression(playerc_client_t *client,
+                                              uint32_t method,
+                                              uint32_t threshold);
+
 /** @brief Request a round of data.
 
 @param client Pointer to client object.
@@ -666,6 +841,17 @@ Use @ref playerc_client_datamode to change modes.
 */
 PLAYERC_EXPORT int playerc_client_requestdata(playerc_client_t* client);
 
+/** @brief Request a round of data, without waiting for the reply.
+
+@param client Pointer to client object.
+
+As @ref playerc_client_requestdata, but returns as soon as the request is
+sent (see @ref playerc_client_request_async).  This lets a multi-client ask all of its servers for data at
+once, instead of waiting on each in turn.
+
+*/
+PLAYERC_EXPORT int playerc_client_requestdata_nowait(playerc_client_t* client);
+
 /** @brief Set a replace rule for the client queue on the server
 
 If a rule with the same pattern already exists, it will be replaced with
@@ -746,6 +932,45 @@ PLAYERC_EXPORT int playerc_client_request(playerc_client_t *client,
                            struct _playerc_device_t *device, uint8_t reqtype,
                            const void *req_data, void **rep_data);
 
+/** @brief Issue a request to the server without waiting for the reply.
+
+@param client Pointer to client object.
+@param device The device the request is for (NULL for the server itself).
+@param reqtype The request subtype.
+@param req_data The request body, or NULL.
+@param callback Function to call with the reply (may be NULL).
+@param userdata Passed to @p callback.
+
+Any number of requests may be outstanding at once, so that, for example,
+the geometry of many devices can be fetched in a single round trip.
+Replies are matched to requests by device address and subtype; requests
+with the same address and subtype are answered in the order they were
+sent.  The callback is called from whichever of @ref playerc_client_read,
+@ref playerc_client_request or @ref playerc_client_wait_requests reads
+the reply.
+
+@returns Returns 0 if the request was sent, -1 otherwise (in which case
+the callback is not called).
+
+*/
+PLAYERC_EXPORT int playerc_client_request_async(playerc_client_t *client,
+                                 struct _playerc_device_t *device, uint8_t reqtype,
+                                 const void *req_data,
+                                 playerc_reply_fn_t callback, void *userdata);
+
+/** @brief Wait for the replies to all outstanding asynchronous requests.
+
+@param client Pointer to client object.
+
+Data that arrives in the meantime is queued for the next
+@ref playerc_client_read.  Requests that are not answered within the
+request timeout are given up on.
+
+@returns Returns 0 once nothing is outstanding, -1 on error.
+
+*/
+PLAYERC_EXPORT int playerc_client_wait_requests(playerc_client_t *client);
+
 
 /* @brief Wait for response from server (blocking).
 
@@ -899,6 +1124,13 @@ typedef struct _playerc_device_t
       set it to 0 after using the data. */
   int freshconfig;
 
+  /** Number of messages from the device that were lost on the way (UDP
+      only), as told by the gaps in their sequence numbers. */
+  uint32_t lost_count;
+  /** @internal The sequence number the next message from the device
+      should have (UDP only). */
+  uint32_t next_seq;
+
   /**  Standard message callback for this device.  @internal */
   playerc_putmsg_fn_t putmsg;
 
@@ -2507,6 +2739,15 @@ PLAYERC_EXPORT int playerc_log_set_read_state(playerc_log_t* device, int state);
 /** @brief Rewind playback */
 PLAYERC_EXPORT int playerc_log_set_read_rewind(playerc_log_t* device);
 
+/** @brief Jump playback to a time in the log.
+
+If relative is non-zero, time is in seconds from the start of the log;
+otherwise it is a log timestamp.
+
+*/
+PLAYERC_EXPORT int playerc_log_set_read_seek(playerc_log_t* device,
+                                             double time, int relative);
+
 /** @brief Get logging/playback state.
 
 The result is written into the proxy.
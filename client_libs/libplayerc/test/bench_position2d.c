@@ -0,0 +1,115 @@
+/*
+ *  Player - One Hell of a Robot Server
+ *  Copyright (C) Andrew Howard 2003
+ *
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+/***************************************************************************
+ * Desc: Command latency benchmark for the position2d device
+ **************************************************************************/
+
+#include <sys/time.h>
+
+#include "test.h"
+#include "playerc.h"
+
+
+// Current time in microseconds
+static double bench_now(void)
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec * 1e6 + tv.tv_usec;
+}
+
+static int bench_compare(const void *a, const void *b)
+{
+  double da = *(const double*) a, db = *(const double*) b;
+  return (da > db) - (da < db);
+}
+
+// Print min / median / max of a set of samples (which get sorted)
+static void bench_report(const char *what, double *samples, int count)
+{
+  qsort(samples, count, sizeof(double), bench_compare);
+  printf("%-24s %8d  min %9.1f us  median %9.1f us  max %9.1f us\n", what,
+         count, samples[0], samples[count / 2], samples[count - 1]);
+}
+
+
+// Time velocity commands on their own, and each followed by a request
+// that the server answers itself and that changes nothing (the device
+// list), so that the round trip is through the transport and not paced by
+// the driver.  Data that arrives meanwhile is processed between samples,
+// as a client's main loop would.
+int bench_position2d(playerc_client_t *client, int index, int count)
+{
+  int i;
+  double start, *samples;
+  playerc_position2d_t *device;
+
+  printf("device [position2d] index [%d] commands [%d]\n", index, count);
+
+  if (count < 1)
+    return -1;
+  samples = (double*) malloc(count * sizeof(double));
+  if (!samples)
+    return -1;
+
+  device = playerc_position2d_create(client, index);
+
+  TEST("subscribing (read/write)");
+  if (playerc_position2d_subscribe(device, PLAYER_OPEN_MODE) < 0)
+  {
+    FAIL();
+    free(samples);
+    playerc_position2d_destroy(device);
+    return -1;
+  }
+  PASS();
+
+  for (i = 0; i < count; i++)
+  {
+    start = bench_now();
+    playerc_position2d_set_cmd_vel(device, 0.1, 0.0, 0.0, 1);
+    samples[i] = bench_now() - start;
+    while (playerc_client_read_nonblock(client) > 0);
+  }
+  bench_report("command write", samples, count);
+
+  for (i = 0; i < count; i++)
+  {
+    start = bench_now();
+    playerc_position2d_set_cmd_vel(device, 0.1, 0.0, 0.0, 1);
+    playerc_client_get_devlist(client);
+    samples[i] = bench_now() - start;
+    while (playerc_client_read_nonblock(client) > 0);
+  }
+  bench_report("command + round trip", samples, count);
+
+  playerc_position2d_set_cmd_vel(device, 0.0, 0.0, 0.0, 1);
+
+  TEST("unsubscribing");
+  if (playerc_position2d_unsubscribe(device) != 0)
+    FAIL();
+  else
+    PASS();
+
+  playerc_position2d_destroy(device);
+  free(samples);
+
+  return 0;
+}
@@ -39,11 +39,13 @@ int main(int argc, const char *argv[])
   char *arg;
   const char *opt, *val;
   const char *device, *sindex; int index;
+  int bench;
 
   // Default host, port
   host = "localhost";
   port = 6665;
   all = 1;
+  bench = 0;
 
   // Read program options (host and port).
   for (i = 1; i < argc - 1; i += 2)
@@ -54,6 +56,8 @@ int main(int argc, const char *argv[])
       host = val;
     else if (strcmp(opt, "-p") == 0)
       port = atoi(val);
+    else if (strcmp(opt, "-b") == 0)
+      bench = atoi(val);
   }
 
   // If there are individual device arguments, dont do all tests.
@@ -86,6 +90,8 @@ int main(int argc, const char *argv[])
       return -1;
     }
     PASS();
+
+    test_request_async(client);
   }
   else
   {
@@ -131,7 +137,10 @@ int main(int argc, const char *argv[])
 
 	// Position device
       case PLAYER_POSITION2D_CODE:
-        test_position2d(client, client->devinfos[i].addr.index);
+        if (bench > 0)
+          bench_position2d(client, client->devinfos[i].addr.index, bench);
+        else
+          test_position2d(client, client->devinfos[i].addr.index);
         break;
 
 	// Position device
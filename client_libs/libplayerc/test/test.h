@@ -62,6 +62,12 @@ extern int test_speech(playerc_client_t *client, int index);
 extern int test_wsn(playerc_client_t *client, int index);
 extern int test_coopobject(playerc_client_t *client, int index);
 
+// Test for asynchronous requests
+extern int test_request_async(playerc_client_t *client);
+
+// Command latency benchmarks
+extern int bench_position2d(playerc_client_t *client, int index, int count);
+
 
 #if 0
 // Basic test for BPS device.i
@@ -0,0 +1,118 @@
+/*
+ *  Player - One Hell of a Robot Server
+ *  Copyright (C) Andrew Howard 2003
+ *
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+/***************************************************************************
+ * Desc: Test for asynchronous requests
+ **************************************************************************/
+
+#include "test.h"
+#include "playerc.h"
+
+
+// What the reply callback is given, and what it found
+typedef struct
+{
+  playerc_client_t *client;
+  int called;
+  int result;
+  int nested;
+  int intact;
+} test_request_state_t;
+
+
+// Reply to an asynchronous device list request.  It makes a synchronous
+// request of its own, which must leave the reply it was given alone.
+static void test_request_reply(void *userdata, int result,
+                               player_msghdr_t *header, void *data)
+{
+  test_request_state_t *state = (test_request_state_t*) userdata;
+  player_device_devlist_t *devlist = (player_device_devlist_t*) data;
+  player_device_devlist_t before;
+  player_device_driverinfo_t req, *rep;
+
+  state->called++;
+  state->result = result;
+  if (result != 0 || !devlist)
+    return;
+
+  // Ask for something that decodes differently (there is always at least
+  // the device list itself to ask for again)
+  before = *devlist;
+  if (devlist->devices_count > 0)
+  {
+    memset(&req, 0, sizeof(req));
+    req.addr = devlist->devices[0];
+    rep = NULL;
+    state->nested = playerc_client_request(state->client, NULL,
+                                           PLAYER_PLAYER_REQ_DRIVERINFO,
+                                           &req, (void**) &rep);
+    if (rep)
+      player_device_driverinfo_t_free(rep);
+  }
+  else
+    state->nested = playerc_client_get_devlist(state->client);
+
+  state->intact = (memcmp(&before, devlist, sizeof(before)) == 0);
+}
+
+
+// Make an asynchronous request whose callback makes a synchronous one
+int test_request_async(playerc_client_t *client)
+{
+  test_request_state_t state;
+
+  memset(&state, 0, sizeof(state));
+  state.client = client;
+
+  TEST("asynchronous request");
+  if (playerc_client_request_async(client, NULL, PLAYER_PLAYER_REQ_DEVLIST,
+                                   NULL, test_request_reply, &state) < 0)
+  {
+    FAIL();
+    return -1;
+  }
+  PASS();
+
+  TEST("waiting for the reply");
+  if (playerc_client_wait_requests(client) < 0 || state.called != 1 ||
+      state.result != 0)
+  {
+    FAIL();
+    return -1;
+  }
+  PASS();
+
+  TEST("synchronous request from the reply callback");
+  if (state.nested != 0)
+  {
+    FAIL();
+    return -1;
+  }
+  PASS();
+
+  TEST("reply intact after the nested request");
+  if (!state.intact)
+  {
+    FAIL();
+    return -1;
+  }
+  PASS();
+
+  return 0;
+}
@@ -37,6 +37,25 @@ MACRO (PLAYER_ADD_EXECUTABLE _name)
 ENDMACRO (PLAYER_ADD_EXECUTABLE)
 
 
+###############################################################################
+# PLAYER_ADD_TEST (_name _exe source1 [source2 ...])
+# Adds a test program and runs it as the test _name. Unlike the installed
+# executables it is built with the build tree's rpath, so it finds the
+# libraries it links to without installing them; it can include
+# playertest.h for reporting.
+MACRO (PLAYER_ADD_TEST _name _exe)
+    INCLUDE_DIRECTORIES (${PROJECT_SOURCE_DIR}/libplayercommon/test)
+    ADD_EXECUTABLE (${_exe} ${ARGN})
+    SET_TARGET_PROPERTIES (${_exe} PROPERTIES BUILD_WITH_INSTALL_RPATH FALSE)
+    IF (PLAYER_OS_LINUX OR PLAYER_OS_BSD)
+        # The libraries carry their install rpath, so the test has to load
+        # their dependencies itself, even the ones it makes no calls to
+        SET_TARGET_PROPERTIES (${_exe} PROPERTIES LINK_FLAGS "-Wl,--no-as-needed")
+    ENDIF (PLAYER_OS_LINUX OR PLAYER_OS_BSD)
+    ADD_TEST (${_name} ${_exe})
+ENDMACRO (PLAYER_ADD_TEST)
+
+
 ###############################################################################
 # PLAYER_ADD_INCLUDE_DIR (dir1 [dir2 ...])
 # Add include directories for stuff that uses the core libraries.
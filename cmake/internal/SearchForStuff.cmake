@@ -65,6 +65,10 @@ CHECK_INCLUDE_FILES (stdint.h HAVE_STDINT_H)
 CHECK_INCLUDE_FILES (strings.h HAVE_STRINGS_H)
 CHECK_INCLUDE_FILES (dns_sd.h HAVE_DNS_SD)
 CHECK_INCLUDE_FILES (sys/filio.h HAVE_SYS_FILIO_H)
+CHECK_INCLUDE_FILES (sys/eventfd.h HAVE_SYS_EVENTFD_H)
+CHECK_INCLUDE_FILES (sys/epoll.h HAVE_SYS_EPOLL_H)
+CHECK_INCLUDE_FILES (sys/uio.h HAVE_SYS_UIO_H)
+CHECK_INCLUDE_FILES (linux/sockios.h HAVE_LINUX_SOCKIOS_H)
 CHECK_INCLUDE_FILES (ieeefp.h HAVE_IEEEFP_H)
 IF (HAVE_DNS_SD)
     CHECK_LIBRARY_EXISTS (dns_sd DNSServiceRefDeallocate "${PLAYER_EXTRA_LIB_DIRS}" HAVE_DNS_SD)
@@ -81,6 +85,9 @@ ELSE (PLAYER_OS_SOLARIS)
 ENDIF (PLAYER_OS_SOLARIS)
 
 CHECK_FUNCTION_EXISTS (poll HAVE_POLL)
+CHECK_FUNCTION_EXISTS (sendmmsg HAVE_SENDMMSG)
+CHECK_FUNCTION_EXISTS (recvmmsg HAVE_RECVMMSG)
+CHECK_SYMBOL_EXISTS (UDP_SEGMENT netinet/udp.h HAVE_UDP_SEGMENT)
 IF (PLAYER_OS_WIN)
     CHECK_SYMBOL_EXISTS (POLLIN winsock2.h HAVE_POLLIN)
     # This macro will have been pulled in by the previous usage on Windows
@@ -0,0 +1,52 @@
+/*
+ *  Player - One Hell of a Robot Server
+ *  Copyright (C) 2000
+ *     Brian Gerkey, Kasper Stoy, Richard Vaughan, & Andrew Howard
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+/*
+ * $Id$
+ *
+ * Pass/fail reporting for the library test programs.  Each program
+ * check()s what it expects and returns test_result() from main(), which
+ * is what ctest looks at.
+ */
+
+#ifndef PLAYERTEST_H
+#define PLAYERTEST_H
+
+#include <stdio.h>
+
+static int failures = 0;
+
+static void
+check(int cond, const char* what)
+{
+  printf("%s: %s\n", cond ? "pass" : "FAIL", what);
+  if(!cond)
+    failures++;
+}
+
+static int
+test_result(void)
+{
+  return(failures ? 1 : 0);
+}
+
+#endif
@@ -2268,6 +2268,24 @@ ConfigFile::ParseDriver(int section)
   if (driver)
     driver->alwayson = this->ReadInt(section, "alwayson", driver->alwayson) ? true : false;
 
+  // Does it only need updating when there are messages for it?
+  if (driver)
+    driver->event_driven = this->ReadInt(section, "event_driven", driver->event_driven) ? true : false;
+
+  // How should the driver's incoming queue be implemented?
+  if (driver)
+  {
+    const char* queuetype = this->ReadString(section, "queuetype", "list");
+    if (strcmp(queuetype, "ring") == 0)
+    {
+      if (!driver->InQueue->EnableRing())
+        PLAYER_WARN1("driver \"%s\" already has queued messages; not using a ring queue",
+                     drivername);
+    }
+    else if (strcmp(queuetype, "list") != 0)
+      PLAYER_WARN1("unknown queuetype \"%s\"; using \"list\"", queuetype);
+  }
+
   return true;
 }
 
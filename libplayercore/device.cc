@@ -66,7 +66,8 @@
 Device::Device(player_devaddr_t addr, Driver *device) :
 	next(NULL),
 	addr(addr),
-	driver(device)
+	driver(device),
+	update_watch(false)
 {
   pthread_mutex_init(&accessMutex,NULL);
   memset(this->drivername, 0, sizeof(this->drivername));
@@ -144,6 +145,8 @@ Device::Subscribe(QueuePointer &sub_queue)
       Unlock();
       return(retval);
     }
+    if(!this->update_watch)
+      deviceTable->WatchDriver(this);
   }
   Unlock();
 
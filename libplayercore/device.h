@@ -236,6 +236,10 @@ class PLAYERCORE_EXPORT Device
     /// Pointer to the underlying driver
     Driver* driver;
 
+    /// Is the server watching InQueue, to update a non-threaded driver?
+    /// Set by the DeviceTable, on one of the driver's devices.
+    bool update_watch;
+
   private:
     /** @brief Mutex used to lock access, via Lock() and Unlock(), to
     device internals, like the list of subscribed queues. */
@@ -49,16 +49,84 @@
 #include <libplayerinterface/interface_util.h>
 #include <libplayerinterface/addr_util.h>
 #include <libplayercore/devicetable.h>
+#include <libplayercore/filewatcher.h>
+#include <libplayercore/globals.h>
 
 #if defined WIN32
   #define strdup _strdup
+  #include <windows.h>
 #endif
 
+// Initial number of slots in the device index (a power of 2)
+#define DEVICEINDEX_MIN_SIZE 64
+
+struct DeviceIndex
+{
+  // Open-addressed slots; NULL marks an empty one
+  Device** slots;
+  size_t mask;
+  // Next (smaller, retired) index
+  DeviceIndex* next;
+};
+
+static inline void*
+LoadPointer(void** ptr)
+{
+#if defined (WIN32)
+  void* value = *(void* volatile*)ptr;
+  MemoryBarrier();
+  return(value);
+#elif defined (__ATOMIC_ACQUIRE)
+  return(__atomic_load_n(ptr, __ATOMIC_ACQUIRE));
+#else
+  void* value = *(void* volatile*)ptr;
+  __sync_synchronize();
+  return(value);
+#endif
+}
+
+static inline void
+StorePointer(void** ptr, void* value)
+{
+#if defined (WIN32)
+  MemoryBarrier();
+  *(void* volatile*)ptr = value;
+#elif defined (__ATOMIC_RELEASE)
+  __atomic_store_n(ptr, value, __ATOMIC_RELEASE);
+#else
+  __sync_synchronize();
+  *(void* volatile*)ptr = value;
+#endif
+}
+
+static size_t
+DeviceAddrHash(player_devaddr_t addr)
+{
+  // Device::MatchDeviceAddress() treats 0 and localhost as the same host
+  unsigned int hash = (addr.host == LOCALHOST_ADDR) ? 0 : addr.host;
+  hash = hash * 31 + addr.robot;
+  hash = hash * 31 + addr.interf;
+  hash = hash * 31 + addr.index;
+  return(hash * 2654435761u);
+}
+
+static DeviceIndex*
+DeviceIndexCreate(size_t size)
+{
+  DeviceIndex* index = new DeviceIndex;
+  index->slots = new Device*[size];
+  memset(index->slots, 0, size * sizeof(Device*));
+  index->mask = size - 1;
+  index->next = NULL;
+  return(index);
+}
+
 // initialize the table
 DeviceTable::DeviceTable()
 {
   this->numdevices = 0;
   this->head = NULL;
+  this->index = DeviceIndexCreate(DEVICEINDEX_MIN_SIZE);
   pthread_mutex_init(&this->mutex,NULL);
   this->remote_driver_fn = NULL;
   this->remote_driver_arg = NULL;
@@ -74,7 +142,12 @@ DeviceTable::~DeviceTable()
     thisentry->driver->Terminate();
 
   pthread_mutex_lock(&mutex);
-  // Second, delete each device
+  // Second, stop watching driver queues and delete each device
+  for (thisentry=head;thisentry;thisentry = thisentry->next)
+  {
+    if(thisentry->update_watch && fileWatcher)
+      fileWatcher->RemoveFileWatch(thisentry->InQueue->GetNotifyFd());
+  }
   thisentry=head;
   while(thisentry)
   {
@@ -83,6 +156,13 @@ DeviceTable::~DeviceTable()
     numdevices--;
     thisentry = tmpentry;
   }
+  while(index)
+  {
+    DeviceIndex* tmpindex = index->next;
+    delete [] index->slots;
+    delete index;
+    index = tmpindex;
+  }
   pthread_mutex_unlock(&mutex);
 
   // destroy the mutex.
@@ -101,13 +181,7 @@ DeviceTable::AddDevice(player_devaddr_t addr,
     pthread_mutex_lock(&mutex);
 
   // Check for duplicate entries (not allowed)
-  for(thisentry = head,preventry=NULL; thisentry;
-      preventry=thisentry, thisentry=thisentry->next)
-  {
-    if(Device::MatchDeviceAddress(thisentry->addr, addr))
-      break;
-  }
-  if(thisentry)
+  if(this->LookupDevice(addr))
   {
     PLAYER_ERROR4("duplicate device addr %X:%d:%s:%d",
                   addr.host, addr.robot,
@@ -118,7 +192,9 @@ DeviceTable::AddDevice(player_devaddr_t addr,
     return(NULL);
   }
 
-  // Create a new device entry
+  // Create a new device entry, at the end of the list
+  for(thisentry = head,preventry=NULL; thisentry;
+      preventry=thisentry, thisentry=thisentry->next);
   thisentry = new Device(addr, driver);
   thisentry->next = NULL;
   if(preventry)
@@ -126,12 +202,38 @@ DeviceTable::AddDevice(player_devaddr_t addr,
   else
     head = thisentry;
   numdevices++;
+  this->IndexDevice(thisentry);
 
   if(!havelock)
     pthread_mutex_unlock(&mutex);
   return(thisentry);
 }
 
+// The server loop updates non-threaded drivers, so it must wake up when a
+// message is queued for one.  This can't be decided in AddDevice(): that
+// is called from the Driver constructor, before a ThreadedDriver is one.
+void
+DeviceTable::WatchDriver(Device* dev)
+{
+  Device* thisentry;
+
+  if(!fileWatcher || !dev->driver ||
+     dynamic_cast<ThreadedDriver*>(dev->driver))
+    return;
+
+  pthread_mutex_lock(&mutex);
+  // A multi-interface driver has one queue, so only watch it once
+  for(thisentry=head;thisentry;thisentry=thisentry->next)
+  {
+    if(thisentry->driver == dev->driver && thisentry->update_watch)
+      break;
+  }
+  if(!thisentry &&
+     fileWatcher->AddFileWatch(dev->driver->InQueue->GetNotifyFd()) == 0)
+    dev->update_watch = true;
+  pthread_mutex_unlock(&mutex);
+}
+
 // find a device entry, based on addr, and return the pointer (or NULL
 // on failure)
 Device*
@@ -141,12 +243,13 @@ DeviceTable::GetDevice(player_devaddr_t addr, bool lookup_remote)
     return NULL;
 
   Device* thisentry;
+  if((thisentry = this->LookupDevice(addr)) ||
+     !lookup_remote || (this->remote_driver_fn == NULL))
+    return(thisentry);
+
   pthread_mutex_lock(&mutex);
-  for(thisentry=head;thisentry;thisentry=thisentry->next)
-  {
-    if(Device::MatchDeviceAddress(thisentry->addr, addr))
-      break;
-  }
+  // Somebody may have added it while we weren't looking
+  thisentry = this->LookupDevice(addr);
 
   // If we didn't find the device, give the application's remote device
   // handler a try
@@ -155,19 +258,13 @@ DeviceTable::GetDevice(player_devaddr_t addr, bool lookup_remote)
     Driver* rdriver = (*this->remote_driver_fn)(addr,this->remote_driver_arg);
     if(rdriver != NULL)
     {
-      if(this->AddDevice(addr, rdriver, true) == NULL)
+      if((thisentry = this->AddDevice(addr, rdriver, true)) == NULL)
       {
         PLAYER_ERROR("failed to add remote device");
         delete rdriver;
       }
       else
       {
-        for(thisentry=head;thisentry;thisentry=thisentry->next)
-        {
-          if(Device::MatchDeviceAddress(thisentry->addr, addr))
-            break;
-        }
-        assert(thisentry);
         strncpy(thisentry->drivername, "remote",
                 sizeof(thisentry->drivername));
       }
@@ -178,6 +275,48 @@ DeviceTable::GetDevice(player_devaddr_t addr, bool lookup_remote)
   return(thisentry);
 }
 
+Device*
+DeviceTable::LookupDevice(player_devaddr_t addr)
+{
+  DeviceIndex* idx = (DeviceIndex*)LoadPointer((void**)&this->index);
+  for(size_t i = DeviceAddrHash(addr) & idx->mask;; i = (i + 1) & idx->mask)
+  {
+    Device* dev = (Device*)LoadPointer((void**)&idx->slots[i]);
+    if(!dev)
+      return(NULL);
+    if(Device::MatchDeviceAddress(dev->addr, addr))
+      return(dev);
+  }
+}
+
+void
+DeviceTable::IndexDevice(Device* dev)
+{
+  DeviceIndex* idx = this->index;
+  // Keep the index at most half full; grow it by building a new one, so
+  // that readers of the old one are undisturbed
+  if((size_t)(2 * this->numdevices) > idx->mask + 1)
+  {
+    DeviceIndex* bigger = DeviceIndexCreate(2 * (idx->mask + 1));
+    for(Device* thisentry=head;thisentry;thisentry=thisentry->next)
+    {
+      if(thisentry == dev)
+        continue;
+      size_t i = DeviceAddrHash(thisentry->addr) & bigger->mask;
+      while(bigger->slots[i])
+        i = (i + 1) & bigger->mask;
+      bigger->slots[i] = thisentry;
+    }
+    bigger->next = idx;
+    StorePointer((void**)&this->index, bigger);
+    idx = bigger;
+  }
+  size_t i = DeviceAddrHash(dev->addr) & idx->mask;
+  while(idx->slots[i])
+    i = (i + 1) & idx->mask;
+  StorePointer((void**)&idx->slots[i], dev);
+}
+
 // find a device, based on id, and return the pointer (or NULL on
 // failure)
 Device* 
@@ -240,20 +379,30 @@ DeviceTable::GetDevice(const char* str_addr,
 //
 // NOTE: this will call Update() once for each subscribed interface to a
 // multi-interface driver.
-void
+int
 DeviceTable::UpdateDevices()
 {
   Device* thisentry;
   Driver* dri;
+  int polled = 0;
 
   // We don't lock here, on the assumption that the caller is also the only
   // thread that can make changes to the device table.
   for(thisentry=head;thisentry;thisentry=thisentry->next)
   {
     dri = thisentry->driver;
+    // Reset the wakeup before the driver looks at its queue, so that
+    // anything queued from here on wakes the server again
+    if(thisentry->update_watch)
+      thisentry->InQueue->ClearNotifyFd();
     if((dri->HasSubscriptions()) || dri->alwayson)
+    {
       dri->Update();
+      if(!dri->event_driven)
+        polled++;
+    }
   }
+  return(polled);
 }
 
 int
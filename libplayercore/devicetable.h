@@ -66,6 +66,8 @@
 
 typedef Driver* (*remote_driver_fn_t) (player_devaddr_t addr, void* arg);
 
+struct DeviceIndex;
+
 class PLAYERCORE_EXPORT DeviceTable
 {
   private:
@@ -74,6 +76,18 @@ class PLAYERCORE_EXPORT DeviceTable
     int numdevices;
     pthread_mutex_t mutex;
 
+    // Hash index of the devices by address.  Devices are never removed
+    // while the table exists, so the index is only ever added to, and
+    // GetDevice() reads it without taking the mutex.  When it fills up, a
+    // bigger copy takes its place and the old one is kept (on its next
+    // list) until the table is destroyed, as a reader may still be in it.
+    DeviceIndex* index;
+
+    // Look up addr in the index (no locking needed)
+    Device* LookupDevice(player_devaddr_t addr);
+    // Add dev to the index (the mutex must be held)
+    void IndexDevice(Device* dev);
+
     // A factory creation function that the application can set (via
     // AddRemoteDevice).  It will be called when GetDevice fails to find a
     // device in the deviceTable
@@ -91,9 +105,17 @@ class PLAYERCORE_EXPORT DeviceTable
     // devicep is the controlling object (e.g., sonarDevice for sonar)
     //  
     Device* AddDevice(player_devaddr_t addr, Driver* driver, bool havelock=false);
+
+    // Have the server loop wake up for messages queued to dev's driver,
+    // unless it is threaded (and so wakes itself).  Called once the
+    // driver is fully constructed, when dev is first subscribed to.
+    void WatchDriver(Device* dev);
     
     // find a device, based on id, and return the pointer (or NULL on
-    // failure)
+    // failure).  This doesn't take the table's lock unless a remote
+    // device has to be added.  The pointer remains valid for the life of
+    // the table, so drivers may resolve the devices they publish on once
+    // (e.g., in Setup()) and pass them to Driver::Publish.
     Device* GetDevice(player_devaddr_t addr, bool lookup_remote=true);
     
     // find a device, based on id, and return the pointer (or NULL on
@@ -111,8 +133,9 @@ class PLAYERCORE_EXPORT DeviceTable
     int Size() {return(numdevices);}
 
     // Call ProcessMessages() on each non-threaded driver with non-zero
-    // subscriptions
-    void UpdateDevices();
+    // subscriptions.  Returns the number of those drivers that are not
+    // event-driven, and so want calling again soon even if nothing arrives.
+    int UpdateDevices();
 
     // Subscribe to each device whose driver is marked 'alwayson'.  Returns
     // 0 on success, -1 on error (at least one driver failed to start).
@@ -87,6 +87,7 @@ Driver::Driver(ConfigFile *cf, int section,
   this->subscriptions = 0;
   this->entries = 0;
   this->alwayson = false;
+  this->event_driven = false;
 
   // Create an interface
   if(this->AddInterface(this->device_addr) != 0)
@@ -109,6 +110,7 @@ Driver::Driver(ConfigFile *cf, int section,
 
   this->subscriptions = 0;
   this->alwayson = false;
+  this->event_driven = false;
   this->entries = 0;
 
   pthread_mutex_init(&this->accessMutex,NULL);
@@ -168,21 +170,31 @@ void
 Driver::Publish(player_msghdr_t* hdr,
                 void* src, bool copy)
 {
-  Device* dev;
+  // the device table can be read without locking
+  this->Publish(deviceTable->GetDevice(hdr->addr,false), hdr, src, copy);
+}
 
-  // lock here, because we're accessing our device's queue list
-  this->Lock();
-  // push onto each queue subscribed to the given device
-  if(!(dev = deviceTable->GetDevice(hdr->addr,false)))
+void
+Driver::Publish(Device* dev,
+                player_msghdr_t* hdr,
+                void* src, bool copy)
+{
+  if(!dev)
   {
     // This is generally ok, because a driver might call Publish on all
     // of its possible interfaces, even though some have not been
     // requested.
     //
     //PLAYER_ERROR2("tried to publish message via non-existent device %d:%d", hdr->addr.interf, hdr->addr.index);
-    this->Unlock();
+    // we were handed the data, so it's ours to free
+    if(!copy && src)
+      playerxdr_free_message(src, hdr->addr.interf, hdr->type, hdr->subtype);
     return;
   }
+
+  // lock here, because we're accessing our device's queue list
+  this->Lock();
+  // push onto each queue subscribed to the given device
   Message msg(*hdr,src,InQueue,copy);
   for(size_t i=0;i<dev->len_queues;i++)
   {
@@ -499,6 +511,9 @@ bool Driver::RegisterProperty(Property *prop, ConfigFile* cf, int section)
 
 bool Driver::Wait(double TimeOut) 
 { 
+	// Let our file watches fire again
+	if(fileWatcher)
+		fileWatcher->ResumeFileWatches(this->InQueue);
 	bool ret = this->InQueue->Wait(TimeOut);
 	return ret;
 }
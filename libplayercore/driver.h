@@ -97,6 +97,7 @@ capability.
 
 // Forward declarations
 class ConfigFile;
+class Device;
 
 /**
 @brief Base class for all drivers.
@@ -229,7 +230,10 @@ class PLAYERCORE_EXPORT Driver
      @param deprecated Used to be the length of the message this is now calculated
      @param timestamp Timestamp for the message body (if NULL, then the
      current time will be filled in)
-     @param copy if set to false the data will be claimed and the caller should no longer use or free it */
+     @param copy if set to false the data will be claimed and the caller should no longer use or free it.
+     The data must then be allocated with malloc(), as the message's free function would.  This
+     avoids cloning large payloads (images, point clouds); the one copy is shared read-only by
+     every subscriber queue, and its XDR encoding by every client connection. */
      virtual void Publish(player_devaddr_t addr,
                   uint8_t type,
                   uint8_t subtype,
@@ -259,11 +263,26 @@ class PLAYERCORE_EXPORT Driver
     assembled and wish to broadcast the message to all subscribed parties.
     @param hdr The message header
     @param src The message body
-    @param copy if set to false the data will be claimed and the caller should no longer use or free it */
+    @param copy if set to false the data will be claimed and the caller should no longer use or free it
+    (see the note on the broadcast form above) */
     virtual void Publish(player_msghdr_t* hdr,
                  void* src,
                  bool copy = true);
 
+    /** @brief Publish a message via one of this driver's interfaces.
+
+    As above, but to the subscribers of a device that has already been
+    looked up, e.g. by calling deviceTable->GetDevice(addr,false) once in
+    Setup().  Device pointers stay valid while the server runs.
+    @param dev The device to publish on; if NULL, the message is discarded
+    @param hdr The message header
+    @param src The message body
+    @param copy if set to false the data will be claimed and the caller should no longer use or free it */
+    virtual void Publish(Device* dev,
+                 player_msghdr_t* hdr,
+                 void* src,
+                 bool copy = true);
+
 
     /** @brief Default device address (single-interface drivers) */
     player_devaddr_t device_addr;
@@ -281,6 +300,17 @@ class PLAYERCORE_EXPORT Driver
     to reflect that setting). */
     bool alwayson;
 
+    /** @brief Event-driven flag.
+
+    The server calls Update() on a non-threaded driver at least every 10ms
+    while the driver is subscribed.  A driver that only does work in
+    response to messages sets this flag, and Update() is then called only
+    when a message arrives for it, which lets the server sleep while
+    nothing is happening.  Threaded drivers set it by default.  The
+    "event_driven" parameter in the config file can be used to set it as
+    well. */
+    bool event_driven;
+
     /** @brief Queue for all incoming messages for this driver */
     QueuePointer InQueue;
 
@@ -26,6 +26,8 @@
  *      Author: tcollett
  */
 
+#include <config.h>
+
 #include <libplayercommon/playercommon.h>
 
 
@@ -35,24 +37,65 @@
 #include <assert.h>
 #include <math.h>
 #include <string.h>
+#include <errno.h>
 #if defined (WIN32)
   #include <windows.h>
 #else
   #include <sys/time.h>
+  #include <unistd.h>
+#endif
+#if HAVE_SYS_EVENTFD_H
+  #include <sys/eventfd.h>
+#endif
+// epoll needs the eventfd too, to be woken
+#if HAVE_SYS_EPOLL_H && HAVE_SYS_EVENTFD_H
+  #define FILEWATCHER_EPOLL 1
+  #include <sys/epoll.h>
 #endif
 
+/// Maximum number of epoll events handled per Wait()
+#define FILEWATCHER_MAX_EVENTS 64
+
 FileWatcher::FileWatcher()
 {
 	WatchedFilesArraySize = INITIAL_WATCHED_FILES_ARRAY_SIZE;
 	WatchedFilesArrayCount = 0;
 	WatchedFiles = reinterpret_cast<struct fd_driver_pair *> (calloc(WatchedFilesArraySize,sizeof(WatchedFiles[0])));
 	assert(WatchedFiles);
+	DisarmedCount = 0;
+	WakeFd = -1;
+	EpollFd = -1;
 	pthread_mutex_init(&this->lock,NULL);
 
+#if HAVE_SYS_EVENTFD_H
+	if ((WakeFd = eventfd(0, EFD_NONBLOCK)) < 0)
+		PLAYER_ERROR1("eventfd() failed in File Watcher: %s",strerror(errno));
+#endif
+#if FILEWATCHER_EPOLL
+	if (WakeFd >= 0)
+	{
+		if ((EpollFd = epoll_create(FILEWATCHER_MAX_EVENTS)) < 0)
+			PLAYER_ERROR1("epoll_create() failed in File Watcher, using select: %s",strerror(errno));
+		else
+		{
+			struct epoll_event ev;
+			memset(&ev,0,sizeof(ev));
+			ev.events = EPOLLIN;
+			ev.data.fd = WakeFd;
+			epoll_ctl(EpollFd,EPOLL_CTL_ADD,WakeFd,&ev);
+		}
+	}
+#endif
 }
 
 FileWatcher::~FileWatcher()
 {
+#if !defined (WIN32)
+	if (EpollFd >= 0)
+		close(EpollFd);
+	if (WakeFd >= 0)
+		close(WakeFd);
+#endif
 	free(WatchedFiles);
 }
 
@@ -67,10 +110,81 @@ void FileWatcher::Unlock()
 }
 
 
+void FileWatcher::Wake()
+{
+#if HAVE_SYS_EVENTFD_H
+	if (WakeFd >= 0)
+		eventfd_write(WakeFd,1);
+#endif
+}
+
+bool FileWatcher::CanWake()
+{
+	return WakeFd >= 0;
+}
+
 int FileWatcher::Wait(double Timeout)
 {
+#if FILEWATCHER_EPOLL
+	if (EpollFd >= 0)
+	{
+		struct epoll_event events[FILEWATCHER_MAX_EVENTS];
+		int ret = epoll_wait(EpollFd,events,FILEWATCHER_MAX_EVENTS,
+		                     Timeout < 0 ? -1 : static_cast<int> (ceil(Timeout * 1e3)));
+		if (ret < 0)
+		{
+			// dont print a warning if we are ctrl+c'd
+			if (errno != EINTR)
+				PLAYER_ERROR2("epoll_wait called failed in File Watcher: %d %s",errno,strerror(errno));
+			return ret;
+		}
+
+		Lock();
+		int queueless_count = 0;
+		for (int jj = 0; jj < ret; ++jj)
+		{
+			int fd = events[jj].data.fd;
+			if (fd == WakeFd)
+			{
+				eventfd_t value;
+				eventfd_read(WakeFd,&value);
+				queueless_count++;
+				continue;
+			}
+			uint32_t revents = events[jj].events;
+			bool disarmed = false;
+			for (unsigned int ii = 0; ii < WatchedFilesArrayCount; ++ii)
+			{
+				if (WatchedFiles[ii].fd != fd || !WatchedFiles[ii].Armed)
+					continue;
+				if ((WatchedFiles[ii].Read && (revents & (EPOLLIN|EPOLLHUP|EPOLLERR))) ||
+						(WatchedFiles[ii].Write && (revents & (EPOLLOUT|EPOLLERR))) ||
+						(WatchedFiles[ii].Except && (revents & EPOLLPRI)))
+				{
+					if (WatchedFiles[ii].queue != NULL)
+					{
+						// disarm first, so that a woken reader sees it
+						WatchedFiles[ii].Armed = false;
+						DisarmedCount++;
+						disarmed = true;
+						WatchedFiles[ii].queue->Wakeup();
+					}
+					else
+					{
+						queueless_count++;
+					}
+				}
+			}
+			if (disarmed)
+				UpdateWatch(fd);
+		}
+		Unlock();
+		return queueless_count;
+	}
+#endif
+
 	Lock();
-	if (WatchedFilesArrayCount == 0)
+	if (WatchedFilesArrayCount == 0 && WakeFd < 0)
 	{
 		PLAYER_ERROR("File watcher wait called with no files to watch");
 		Unlock();
@@ -85,9 +199,15 @@ int FileWatcher::Wait(double Timeout)
 
 	int maxfd = 0;
 
+	if (WakeFd >= 0)
+	{
+		maxfd = WakeFd;
+		FD_SET(WakeFd,&ReadFds);
+	}
+
 	for (unsigned int ii = 0; ii < WatchedFilesArrayCount; ++ii)
 	{
-		if (WatchedFiles[ii].fd >= 0)
+		if (WatchedFiles[ii].fd >= 0 && WatchedFiles[ii].Armed)
 		{
 			if (WatchedFiles[ii].fd > maxfd)
 				maxfd = WatchedFiles[ii].fd;
@@ -109,7 +229,7 @@ int FileWatcher::Wait(double Timeout)
 	// not be able to match an event on a deleted fd, or will get spurious wake ups
 	// on a newly added fd all of which are non fatal
 	Unlock();
-	int ret = select (maxfd+1,&ReadFds,&WriteFds,&ExceptFds,&t);
+	int ret = select (maxfd+1,&ReadFds,&WriteFds,&ExceptFds,Timeout < 0 ? NULL : &t);
 
 	if (ret < 0)
 	{
@@ -128,11 +248,21 @@ int FileWatcher::Wait(double Timeout)
 	int queueless_count = 0;
 	int match_count = 0;
 
+#if HAVE_SYS_EVENTFD_H
+	if (WakeFd >= 0 && FD_ISSET(WakeFd,&ReadFds))
+	{
+		eventfd_t value;
+		eventfd_read(WakeFd,&value);
+		match_count++;
+		queueless_count++;
+	}
+#endif
+
 	for (unsigned int ii = 0; ii < WatchedFilesArrayCount && ret > match_count; ++ii)
 	{
 		int fd = WatchedFiles[ii].fd;
 		QueuePointer &q = WatchedFiles[ii].queue;
-		if (fd > 0 && fd <= maxfd)
+		if (fd > 0 && fd <= maxfd && WatchedFiles[ii].Armed)
 		{
 			if ((WatchedFiles[ii].Read && FD_ISSET(fd,&ReadFds)) ||
 					(WatchedFiles[ii].Write && FD_ISSET(fd,&WriteFds)) ||
@@ -141,7 +271,10 @@ int FileWatcher::Wait(double Timeout)
 				match_count++;
 				if (q != NULL)
 				{
-					q->DataAvailable();
+					// disarm first, so that a woken reader sees it
+					WatchedFiles[ii].Armed = false;
+					DisarmedCount++;
+					q->Wakeup();
 				}
 				else
 				{
@@ -170,6 +303,8 @@ int FileWatcher::AddFileWatch(int fd, bool WatchRead, bool WatchWrite, bool Watc
 
 int FileWatcher::AddFileWatch(int fd, QueuePointer & queue, bool WatchRead, bool WatchWrite, bool WatchExcept)
 {
+	if (fd < 0)
+		return -1;
 	Lock();
 	// find the first available file descriptor
 	struct fd_driver_pair *next_entry = NULL;
@@ -201,6 +336,8 @@ int FileWatcher::AddFileWatch(int fd, QueuePointer & queue, bool WatchRead, bool
 	next_entry->Read = WatchRead;
 	next_entry->Write = WatchWrite;
 	next_entry->Except = WatchExcept;
+	next_entry->Armed = true;
+	UpdateWatch(fd);
 
 	Unlock();
 	return 0;
@@ -226,6 +363,9 @@ int FileWatcher::RemoveFileWatch(int fd, QueuePointer &queue, bool WatchRead, bo
 				WatchedFiles[ii].Except == WatchExcept)
 		{
 			WatchedFiles[ii].fd = -1;
+			if (!WatchedFiles[ii].Armed)
+				DisarmedCount--;
+			UpdateWatch(fd);
 			Unlock();
 			return 0;
 		}
@@ -234,3 +374,65 @@ int FileWatcher::RemoveFileWatch(int fd, QueuePointer &queue, bool WatchRead, bo
 	return -1;
 }
 
+void FileWatcher::ResumeFileWatches(QueuePointer &queue)
+{
+	// Nothing has fired since the last call (the usual case).  A watch is
+	// disarmed before its queue is woken, so one that fires after we look
+	// leaves the caller a wakeup to come back with
+	if (*static_cast<volatile size_t*> (&DisarmedCount) == 0)
+		return;
+
+	Lock();
+	for (unsigned int ii = 0; ii < WatchedFilesArrayCount; ++ii)
+	{
+		if (WatchedFiles[ii].fd >= 0 && !WatchedFiles[ii].Armed &&
+				WatchedFiles[ii].queue == queue)
+		{
+			WatchedFiles[ii].Armed = true;
+			DisarmedCount--;
+			UpdateWatch(WatchedFiles[ii].fd);
+		}
+	}
+	Unlock();
+}
+
+void FileWatcher::UpdateWatch(int fd)
+{
+	if (fd < 0)
+		return;
+#if FILEWATCHER_EPOLL
+	if (EpollFd >= 0)
+	{
+		// One registration per descriptor, for all of its armed watches.
+		// Watches without a queue are level triggered, as the server reads
+		// them itself
+		struct epoll_event ev;
+		memset(&ev,0,sizeof(ev));
+		ev.data.fd = fd;
+		for (unsigned int ii = 0; ii < WatchedFilesArrayCount; ++ii)
+		{
+			if (WatchedFiles[ii].fd != fd || !WatchedFiles[ii].Armed)
+				continue;
+			if (WatchedFiles[ii].Read)
+				ev.events |= EPOLLIN;
+			if (WatchedFiles[ii].Write)
+				ev.events |= EPOLLOUT;
+			if (WatchedFiles[ii].Except)
+				ev.events |= EPOLLPRI;
+		}
+		if (ev.events == 0)
+		{
+			// fails harmlessly if it was never added, or has been closed
+			epoll_ctl(EpollFd,EPOLL_CTL_DEL,fd,&ev);
+		}
+		else if (epoll_ctl(EpollFd,EPOLL_CTL_MOD,fd,&ev) < 0 &&
+				(errno != ENOENT || epoll_ctl(EpollFd,EPOLL_CTL_ADD,fd,&ev) < 0))
+		{
+			PLAYER_ERROR2("Failed to watch file descriptor %d: %s",fd,strerror(errno));
+		}
+		return;
+	}
+#endif
+	// a select() in progress has the old set
+	Wake();
+}
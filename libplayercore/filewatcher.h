@@ -58,6 +58,9 @@ struct fd_driver_pair
 	bool Read;
 	bool Write;
 	bool Except;
+	/// A watch with a queue is disarmed once it has fired, until the
+	/// queue's owner calls FileWatcher::ResumeFileWatches()
+	bool Armed;
 };
 
 const size_t INITIAL_WATCHED_FILES_ARRAY_SIZE = 32;
@@ -68,7 +71,26 @@ public:
 	FileWatcher();
 	virtual ~FileWatcher();
 
+	/** @brief Wait for activity on the watched files.
+
+	A negative Timeout waits until something happens. Watches with a queue
+	have DataAvailable() called on the queue; returns the number of
+	watches without a queue that fired (including a Wake()), or -1 on
+	error. */
 	int Wait(double Timeout = 0);
+	/** @brief Make a Wait() in progress return. Safe to call from another
+	thread or from a signal handler. */
+	void Wake();
+	/** @brief Can Wait() be woken up by Wake() and by queue notifications?
+	If not, callers must poll with a timeout. */
+	bool CanWake();
+	/** @brief Re-arm the watches for queue that have fired.
+
+	Call this before waiting on the queue again. A readable descriptor is
+	reported once, and not again until its reader is done with it, so a
+	reader that leaves data behind is woken straight away rather than
+	having the server spin until it catches up. */
+	void ResumeFileWatches(QueuePointer & queue);
 	int AddFileWatch(int fd, QueuePointer & queue, bool WatchRead = true, bool WatchWrite = false, bool WatchExcept = true);
 	int RemoveFileWatch(int fd, QueuePointer & queue, bool WatchRead = true, bool WatchWrite = false, bool WatchExcept = true);
 	int AddFileWatch(int fd, bool WatchRead = true, bool WatchWrite = false, bool WatchExcept = true);
@@ -78,6 +100,17 @@ private:
 	struct fd_driver_pair * WatchedFiles;
 	size_t WatchedFilesArraySize;
 	size_t WatchedFilesArrayCount;
+	/// Number of watches waiting for ResumeFileWatches()
+	size_t DisarmedCount;
+	/// eventfd written by Wake(), or -1
+	int WakeFd;
+	/// epoll descriptor holding the watched files, or -1 to use select()
+	int EpollFd;
+
+	/** @brief Bring the epoll registration of fd into line with its armed
+	watches; otherwise wake a select() in progress so it picks up the change.
+	Called with the lock held. */
+	void UpdateWatch(int fd);
 
     /** @brief Lock access to watcher internals. */
     virtual void Lock(void);
@@ -43,12 +43,17 @@
  * Author: Toby Collett - Jan 2005
  */
 
+#include <config.h>
+
 #include <pthread.h>
 #include <assert.h>
 #include <string.h>
 #include <stdio.h>
 #include <math.h>
 #include <time.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <new>
 
 #include <libplayerinterface/player.h>
 #include <libplayercommon/playercommon.h>
@@ -56,6 +61,207 @@
 #include <libplayerinterface/playerxdr.h>
 
 #include <libplayercore/message.h>
+
+#if defined (WIN32)
+  #include <windows.h>
+#else
+  #include <unistd.h>
+#endif
+#if HAVE_SYS_EVENTFD_H
+  #include <sys/eventfd.h>
+  #include <poll.h>
+#endif
+
+// Atomic reference count updates, so that copying and releasing a message
+// (or a queue pointer) never has to take a lock.
+static inline unsigned int
+AtomicIncrement(unsigned int* value)
+{
+#if defined (WIN32)
+  return(InterlockedIncrement(reinterpret_cast<volatile LONG*>(value)));
+#else
+  return(__sync_add_and_fetch(value, 1));
+#endif
+}
+
+static inline unsigned int
+AtomicDecrement(unsigned int* value)
+{
+#if defined (WIN32)
+  return(InterlockedDecrement(reinterpret_cast<volatile LONG*>(value)));
+#else
+  return(__sync_sub_and_fetch(value, 1));
+#endif
+}
+
+// Set *ptr to newval if it is currently oldval; returns the previous value
+static inline void*
+AtomicCompareAndSwap(void** ptr, void* oldval, void* newval)
+{
+#if defined (WIN32)
+  return(InterlockedCompareExchangePointer(ptr, newval, oldval));
+#else
+  return(__sync_val_compare_and_swap(ptr, oldval, newval));
+#endif
+}
+
+static inline bool
+AtomicCompareAndSwapUint(unsigned int* ptr, unsigned int oldval, unsigned int newval)
+{
+#if defined (WIN32)
+  return(InterlockedCompareExchange(reinterpret_cast<volatile LONG*>(ptr),
+                                    newval, oldval) == (LONG)oldval);
+#else
+  return(__sync_bool_compare_and_swap(ptr, oldval, newval));
+#endif
+}
+
+// Set *ptr to newval; returns the previous value
+static inline void*
+AtomicExchange(void** ptr, void* newval)
+{
+#if defined (WIN32)
+  return(InterlockedExchangePointer(ptr, newval));
+#else
+  // __sync_lock_test_and_set is only an acquire barrier
+  __sync_synchronize();
+  return(__sync_lock_test_and_set(ptr, newval));
+#endif
+}
+
+static inline void
+MemoryFence(void)
+{
+#if defined (WIN32)
+  MemoryBarrier();
+#else
+  __sync_synchronize();
+#endif
+}
+
+// Load with acquire / store with release semantics
+static inline unsigned int
+AtomicLoad(unsigned int* ptr)
+{
+#if defined (__ATOMIC_ACQUIRE)
+  return(__atomic_load_n(ptr, __ATOMIC_ACQUIRE));
+#else
+  unsigned int value = *(volatile unsigned int*)ptr;
+  MemoryFence();
+  return(value);
+#endif
+}
+
+static inline void*
+AtomicLoadPointer(void** ptr)
+{
+#if defined (__ATOMIC_ACQUIRE)
+  return(__atomic_load_n(ptr, __ATOMIC_ACQUIRE));
+#else
+  void* value = *(void* volatile*)ptr;
+  MemoryFence();
+  return(value);
+#endif
+}
+
+static inline void
+AtomicStore(unsigned int* ptr, unsigned int value)
+{
+#if defined (__ATOMIC_RELEASE)
+  __atomic_store_n(ptr, value, __ATOMIC_RELEASE);
+#else
+  MemoryFence();
+  *(volatile unsigned int*)ptr = value;
+#endif
+}
+
+// The part of a message shared by all of its copies.  The encoded payload,
+// if any, is a MessageEncoding followed by that many bytes.
+struct MessageBody
+{
+  unsigned int refcount;
+  void* encoding;
+};
+
+struct MessageEncoding
+{
+  size_t len;
+  int encoding;
+};
+
+// A pool of fixed size blocks, carved out of slabs that are never given
+// back to the system.  Messages, queue elements and reference counts are
+// created and destroyed for every message delivered to every queue, so they
+// are recycled through pools rather than going to the heap each time.
+struct MessagePool
+{
+  pthread_mutex_t lock;
+  size_t blocksize;
+  void* freelist;
+};
+
+// Number of blocks allocated at once when a pool runs dry
+#define MESSAGEPOOL_SLAB_BLOCKS 256
+// Round block sizes up to this, to keep every block suitably aligned
+#define MESSAGEPOOL_ALIGN 16
+#define MESSAGEPOOL_BLOCKSIZE(x) \
+  ((((x) > sizeof(void*) ? (x) : sizeof(void*)) + MESSAGEPOOL_ALIGN - 1) & \
+   ~(size_t)(MESSAGEPOOL_ALIGN - 1))
+
+static MessagePool messagePool =
+  {PTHREAD_MUTEX_INITIALIZER, MESSAGEPOOL_BLOCKSIZE(sizeof(Message)), NULL};
+static MessagePool elementPool =
+  {PTHREAD_MUTEX_INITIALIZER, MESSAGEPOOL_BLOCKSIZE(sizeof(MessageQueueElement)), NULL};
+static MessagePool refCountPool =
+  {PTHREAD_MUTEX_INITIALIZER, MESSAGEPOOL_BLOCKSIZE(sizeof(unsigned int)), NULL};
+static MessagePool bodyPool =
+  {PTHREAD_MUTEX_INITIALIZER, MESSAGEPOOL_BLOCKSIZE(sizeof(MessageBody)), NULL};
+
+static void*
+MessagePoolAlloc(MessagePool* pool)
+{
+  void* block;
+
+  pthread_mutex_lock(&pool->lock);
+  if(!pool->freelist)
+  {
+    char* slab = (char*)malloc(pool->blocksize * MESSAGEPOOL_SLAB_BLOCKS);
+    if(!slab)
+    {
+      pthread_mutex_unlock(&pool->lock);
+      return(NULL);
+    }
+    for(int i = 0; i < MESSAGEPOOL_SLAB_BLOCKS; i++)
+    {
+      *(void**)(slab + i * pool->blocksize) = pool->freelist;
+      pool->freelist = slab + i * pool->blocksize;
+    }
+  }
+  block = pool->freelist;
+  pool->freelist = *(void**)block;
+  pthread_mutex_unlock(&pool->lock);
+  return(block);
+}
+
+static void
+MessagePoolFree(MessagePool* pool, void* block)
+{
+  if(!block)
+    return;
+  pthread_mutex_lock(&pool->lock);
+  *(void**)block = pool->freelist;
+  pool->freelist = block;
+  pthread_mutex_unlock(&pool->lock);
+}
+
+static unsigned int*
+NewRefCount(void)
+{
+  unsigned int* refcount = (unsigned int*)MessagePoolAlloc(&refCountPool);
+  assert(refcount);
+  *refcount = 1;
+  return(refcount);
+}
 #include <replace/replace.h>
 
 Message::Message(const struct player_msghdr & aHeader,
@@ -75,19 +281,16 @@ Message::Message(const struct player_msghdr & aHeader,
 
 Message::Message(const Message & rhs)
 {
-  assert(rhs.Lock);
-  pthread_mutex_lock(rhs.Lock);
-
-  assert(rhs.RefCount);
-  assert(*(rhs.RefCount));
-  Lock = rhs.Lock;
+  // rhs holds a reference for as long as we are copying it, so the count
+  // can't drop to zero underneath us
+  assert(rhs.Body);
+  assert(rhs.Body->refcount);
   Data = rhs.Data;
+  FuncRow = rhs.FuncRow;
   Header = rhs.Header;
   Queue = rhs.Queue;
-  RefCount = rhs.RefCount;
-  (*RefCount)++;
-
-  pthread_mutex_unlock(rhs.Lock);
+  Body = rhs.Body;
+  AtomicIncrement(&Body->refcount);
 }
 
 Message::~Message()
@@ -95,19 +298,40 @@ Message::~Message()
   this->DecRef();
 }
 
+void*
+Message::operator new(size_t size)
+{
+  if(MESSAGEPOOL_BLOCKSIZE(size) != messagePool.blocksize)
+    return(::operator new(size));
+  void* ptr = MessagePoolAlloc(&messagePool);
+  if(!ptr)
+    throw std::bad_alloc();
+  return(ptr);
+}
+
+void
+Message::operator delete(void* ptr, size_t size)
+{
+  if(MESSAGEPOOL_BLOCKSIZE(size) != messagePool.blocksize)
+    ::operator delete(ptr);
+  else
+    MessagePoolFree(&messagePool, ptr);
+}
+
 void Message::CreateMessage(const struct player_msghdr & aHeader,
                   void * data,
                   bool copy)
 {
-  this->Lock = new pthread_mutex_t;
-  assert(this->Lock);
-  pthread_mutex_init(this->Lock,NULL);
-  this->RefCount = new unsigned int;
-  assert(this->RefCount);
-  *this->RefCount = 1;
+  this->Body = (MessageBody*)MessagePoolAlloc(&bodyPool);
+  assert(this->Body);
+  this->Body->refcount = 1;
+  this->Body->encoding = NULL;
 
   // copy the header and then the data into out message data buffer
   memcpy(&this->Header,&aHeader,sizeof(struct player_msghdr));
+  // Resolve the XDR functions once; sizeof, clone and free below (and the
+  // transports, via GetFunctionRow()) all use this row
+  this->FuncRow = playerxdr_get_ftrow(Header.addr.interf, Header.type, Header.subtype);
   if (data == NULL)
   {
     Data = NULL;
@@ -115,18 +339,16 @@ void Message::CreateMessage(const struct player_msghdr & aHeader,
     return;
   }
   // Force header size to be same as data size
-  player_sizeof_fn_t sizeoffunc;
-  if((sizeoffunc = playerxdr_get_sizeoffunc(Header.addr.interf, Header.type, Header.subtype)) != NULL)
+  if(this->FuncRow && this->FuncRow->sizeoffunc)
   {
-    Header.size = (*sizeoffunc)(data);
+    Header.size = (*this->FuncRow->sizeoffunc)(data);
   }
 
   if (copy)
   {
-    player_clone_fn_t clonefunc = NULL;
-    if((clonefunc = playerxdr_get_clonefunc(Header.addr.interf, Header.type, Header.subtype)) != NULL)
+    if(this->FuncRow && this->FuncRow->clonefunc)
     {
-      if ((this->Data = (uint8_t*)(*clonefunc)(data)) == NULL)
+      if ((this->Data = (uint8_t*)(*this->FuncRow->clonefunc)(data)) == NULL)
       {
         PLAYER_ERROR3 ("failed to clone message %s: %s, %d", interf_to_str (Header.addr.interf), msgtype_to_str (Header.type), Header.subtype);
       }
@@ -157,38 +379,368 @@ Message::Compare(Message &other)
 void
 Message::DecRef()
 {
-  pthread_mutex_lock(Lock);
-  (*RefCount)--;
-  assert((*RefCount) >= 0);
-  if((*RefCount)==0)
+  if(!Body)
+    return;
+  if(AtomicDecrement(&Body->refcount)==0)
   {
-    if (Data)
-      playerxdr_free_message (Data, Header.addr.interf, Header.type, Header.subtype);
-    Data = NULL;
-    delete RefCount;
-    RefCount = NULL;
-    pthread_mutex_unlock(Lock);
-    pthread_mutex_destroy(Lock);
-    delete Lock;
-    Lock = NULL;
+    if (Data && FuncRow && FuncRow->freefunc)
+      (*FuncRow->freefunc)(Data);
+    free(Body->encoding);
+    MessagePoolFree(&bodyPool, Body);
   }
-  else
-    pthread_mutex_unlock(Lock);
+  Data = NULL;
+  Body = NULL;
+}
+
+const char*
+Message::GetEncodedPayload(size_t* len, int encoding)
+{
+  // the swap never succeeds; it's just a read with a full barrier
+  MessageEncoding* cached =
+          (MessageEncoding*)AtomicCompareAndSwap(&Body->encoding, NULL, NULL);
+  if(!cached || (cached->encoding != encoding))
+    return(NULL);
+  *len = cached->len;
+  return((const char*)(cached + 1));
+}
+
+void
+Message::CacheEncodedPayload(const char* buf, size_t len, int encoding)
+{
+  // Not worth keeping if nobody else is going to encode this message
+  if((len < PLAYER_MESSAGE_ENCODING_CACHE_MIN) || (Body->refcount < 2) ||
+     Body->encoding)
+    return;
+
+  MessageEncoding* cached =
+          (MessageEncoding*)malloc(sizeof(MessageEncoding) + len);
+  if(!cached)
+    return;
+  cached->len = len;
+  cached->encoding = encoding;
+  memcpy(cached + 1, buf, len);
+  if(AtomicCompareAndSwap(&Body->encoding, NULL, cached) != NULL)
+    free(cached);
 }
 
 MessageQueueElement::MessageQueueElement()
 {
   msg = NULL;
   prev = next = NULL;
+  hprev = hnext = NULL;
 }
 
 MessageQueueElement::~MessageQueueElement()
 {
 }
 
+void*
+MessageQueueElement::operator new(size_t size)
+{
+  if(MESSAGEPOOL_BLOCKSIZE(size) != elementPool.blocksize)
+    return(::operator new(size));
+  void* ptr = MessagePoolAlloc(&elementPool);
+  if(!ptr)
+    throw std::bad_alloc();
+  return(ptr);
+}
+
+void
+MessageQueueElement::operator delete(void* ptr, size_t size)
+{
+  if(MESSAGEPOOL_BLOCKSIZE(size) != elementPool.blocksize)
+    ::operator delete(ptr);
+  else
+    MessagePoolFree(&elementPool, ptr);
+}
+
+// Hash of a message's (addr,type,subtype) signature
+static inline unsigned int
+MessageSignatureHash(const player_msghdr_t* hdr)
+{
+  unsigned int hash = hdr->addr.host;
+  hash = hash * 31 + hdr->addr.robot;
+  hash = hash * 31 + hdr->addr.interf;
+  hash = hash * 31 + hdr->addr.index;
+  hash = hash * 31 + hdr->type;
+  hash = hash * 31 + hdr->subtype;
+  // Knuth's multiplicative hash, to spread consecutive indices
+  return(hash * 2654435761u);
+}
+
+// Replace rules compiled for lookup (see MessageQueue::CompileReplaceRules()).
+//
+// Rules are grouped by which of their six fields are given (the rest being
+// don't care); that is the rule's mask.  Each rule is stored in one hash
+// table under its mask and its given fields, so a header is looked up by
+// one probe per distinct mask in use.  Where several rules match, the one
+// added first wins, as it did when the rule list was searched in order.
+#define REPLACERULE_HOST     0x01
+#define REPLACERULE_ROBOT    0x02
+#define REPLACERULE_INTERF   0x04
+#define REPLACERULE_INDEX    0x08
+#define REPLACERULE_TYPE     0x10
+#define REPLACERULE_SUBTYPE  0x20
+#define REPLACERULE_MASKS    0x40
+
+struct MessageReplaceEntry
+{
+  bool used;
+  uint8_t mask;
+  uint8_t type;
+  uint8_t subtype;
+  uint16_t interf;
+  uint16_t index;
+  uint32_t host;
+  uint32_t robot;
+  // Position of the rule in the rule list
+  unsigned int order;
+  int replace;
+};
+
+struct MessageReplaceTable
+{
+  MessageReplaceEntry* entries;
+  unsigned int tableMask;
+  // The distinct masks of the rules, in the order first seen
+  uint8_t masks[REPLACERULE_MASKS];
+  unsigned int maskCount;
+  // Next table on the retired list
+  MessageReplaceTable* next;
+};
+
+// Fill in the key fields of entry from hdr, keeping only those in mask;
+// returns the key's hash
+static unsigned int
+MessageReplaceKey(MessageReplaceEntry* entry, const player_msghdr_t* hdr,
+                  uint8_t mask)
+{
+  entry->mask = mask;
+  entry->host = (mask & REPLACERULE_HOST) ? hdr->addr.host : 0;
+  entry->robot = (mask & REPLACERULE_ROBOT) ? hdr->addr.robot : 0;
+  entry->interf = (mask & REPLACERULE_INTERF) ? hdr->addr.interf : 0;
+  entry->index = (mask & REPLACERULE_INDEX) ? hdr->addr.index : 0;
+  entry->type = (mask & REPLACERULE_TYPE) ? hdr->type : 0;
+  entry->subtype = (mask & REPLACERULE_SUBTYPE) ? hdr->subtype : 0;
+
+  player_msghdr_t key;
+  key.addr.host = entry->host;
+  key.addr.robot = entry->robot;
+  key.addr.interf = entry->interf;
+  key.addr.index = entry->index;
+  key.type = entry->type;
+  key.subtype = entry->subtype;
+  return(MessageSignatureHash(&key) + mask);
+}
+
+static inline bool
+MessageReplaceKeyEqual(const MessageReplaceEntry* a, const MessageReplaceEntry* b)
+{
+  return((a->mask == b->mask) && (a->host == b->host) &&
+         (a->robot == b->robot) && (a->interf == b->interf) &&
+         (a->index == b->index) && (a->type == b->type) &&
+         (a->subtype == b->subtype));
+}
+
+static void
+MessageReplaceTableFree(MessageReplaceTable* table)
+{
+  while(table)
+  {
+    MessageReplaceTable* next = table->next;
+    delete [] table->entries;
+    delete table;
+    table = next;
+  }
+}
+
+// Lock-free intake for MessageQueue's ring mode (see
+// MessageQueue::EnableRing()).
+//
+// The ring is a bounded multi-producer, single-consumer queue built from
+// sequence-numbered cells (after Dmitry Vyukov's bounded MPMC queue).  An
+// entry is either a Message* or, with the low bit set, a MessageRingSlot*.
+// A slot holds the latest message for one (addr,type,subtype) signature
+// that is subject to replacement: replacing is an atomic swap on the slot's
+// message, and only the producer that finds the slot empty puts the slot
+// into the ring.  The slot table is sized from the queue; once it is
+// full, further signatures are replaced in the locked list instead.
+#define MESSAGERING_SLOTS 64
+#define MESSAGERING_IS_SLOT(entry) (((size_t)(entry)) & 1)
+#define MESSAGERING_SLOT_ENTRY(slot) ((void*)(((size_t)(slot)) | 1))
+#define MESSAGERING_ENTRY_SLOT(entry) \
+  ((MessageRingSlot*)(((size_t)(entry)) & ~(size_t)1))
+
+struct MessageRingSlot
+{
+  player_devaddr_t addr;
+  uint8_t type;
+  uint8_t subtype;
+  void* msg;
+};
+
+struct MessageRingCell
+{
+  unsigned int seq;
+  void* entry;
+};
+
+struct MessageRing
+{
+  MessageRingCell* cells;
+  unsigned int mask;
+  unsigned int enqueuePos;
+  unsigned int dequeuePos;
+  // Number of entries in the ring
+  unsigned int count;
+  // Set while the consumer is (about to be) asleep in Wait()
+  unsigned int sleeping;
+  // Hash table of replacement slots; filled in, but never emptied
+  void** slots;
+  unsigned int numslots;
+  // Set once a signature has found the slot table full
+  unsigned int slotsfull;
+  // eventfd that the consumer sleeps on, or -1
+  int wakefd;
+};
+
+static MessageRing*
+MessageRingCreate(size_t capacity, size_t numslots)
+{
+  MessageRing* ring = (MessageRing*)calloc(1, sizeof(MessageRing));
+  assert(ring);
+  ring->slots = (void**)calloc(numslots, sizeof(void*));
+  assert(ring->slots);
+  ring->numslots = numslots;
+  unsigned int size = 2;
+  while(size < capacity)
+    size *= 2;
+  ring->cells = (MessageRingCell*)calloc(size, sizeof(MessageRingCell));
+  assert(ring->cells);
+  for(unsigned int i = 0; i < size; i++)
+    ring->cells[i].seq = i;
+  ring->mask = size - 1;
+  ring->wakefd = -1;
+#if HAVE_SYS_EVENTFD_H
+  if((ring->wakefd = eventfd(0, EFD_NONBLOCK)) < 0)
+    PLAYER_WARN1("eventfd() failed, falling back to condition variable: %s",
+                 strerror(errno));
+#endif
+  return(ring);
+}
+
+static bool
+MessageRingEnqueue(MessageRing* ring, void* entry)
+{
+  unsigned int pos = AtomicLoad(&ring->enqueuePos);
+  for(;;)
+  {
+    MessageRingCell* cell = ring->cells + (pos & ring->mask);
+    int dif = (int)(AtomicLoad(&cell->seq) - pos);
+    if(dif == 0)
+    {
+      if(AtomicCompareAndSwapUint(&ring->enqueuePos, pos, pos + 1))
+      {
+        cell->entry = entry;
+        // count before publishing, so the consumer can't take it below 0
+        AtomicIncrement(&ring->count);
+        AtomicStore(&cell->seq, pos + 1);
+        return(true);
+      }
+    }
+    else if(dif < 0)
+      return(false); // full
+    pos = AtomicLoad(&ring->enqueuePos);
+  }
+}
+
+static void*
+MessageRingDequeue(MessageRing* ring)
+{
+  unsigned int pos = ring->dequeuePos;
+  MessageRingCell* cell = ring->cells + (pos & ring->mask);
+  if((int)(AtomicLoad(&cell->seq) - (pos + 1)) < 0)
+    return(NULL); // empty
+  void* entry = cell->entry;
+  ring->dequeuePos = pos + 1;
+  AtomicStore(&cell->seq, pos + ring->mask + 1);
+  AtomicDecrement(&ring->count);
+  return(entry);
+}
+
+// Find (or make) the replacement slot for a message signature; returns NULL
+// if the slot table is full
+static MessageRingSlot*
+MessageRingGetSlot(MessageRing* ring, player_msghdr_t* hdr)
+{
+  unsigned int hash = MessageSignatureHash(hdr);
+
+  MessageRingSlot* fresh = NULL;
+  for(unsigned int i = 0; i < ring->numslots; i++)
+  {
+    void** bucket = ring->slots + ((hash + i) % ring->numslots);
+    MessageRingSlot* slot = (MessageRingSlot*)AtomicLoadPointer(bucket);
+    if(!slot)
+    {
+      if(!fresh)
+      {
+        fresh = (MessageRingSlot*)calloc(1, sizeof(MessageRingSlot));
+        assert(fresh);
+        fresh->addr = hdr->addr;
+        fresh->type = hdr->type;
+        fresh->subtype = hdr->subtype;
+      }
+      if((slot = (MessageRingSlot*)AtomicCompareAndSwap(bucket, NULL, fresh)) == NULL)
+        return(fresh);
+      // somebody else got this bucket first; it might even be our signature
+    }
+    if((slot->addr.host == hdr->addr.host) &&
+       (slot->addr.robot == hdr->addr.robot) &&
+       (slot->addr.interf == hdr->addr.interf) &&
+       (slot->addr.index == hdr->addr.index) &&
+       (slot->type == hdr->type) &&
+       (slot->subtype == hdr->subtype))
+    {
+      free(fresh);
+      return(slot);
+    }
+  }
+  free(fresh);
+  return(NULL);
+}
+
+static void
+MessageRingDestroy(MessageRing* ring)
+{
+  void* entry;
+  while((entry = MessageRingDequeue(ring)))
+  {
+    // slots are emptied below
+    if(!MESSAGERING_IS_SLOT(entry))
+      delete (Message*)entry;
+  }
+  for(unsigned int i = 0; i < ring->numslots; i++)
+  {
+    MessageRingSlot* slot = (MessageRingSlot*)ring->slots[i];
+    if(slot)
+    {
+      delete (Message*)slot->msg;
+      free(slot);
+    }
+  }
+#if HAVE_SYS_EVENTFD_H
+  if(ring->wakefd >= 0)
+    close(ring->wakefd);
+#endif
+  free(ring->slots);
+  free(ring->cells);
+  free(ring);
+}
+
 MessageQueue::MessageQueue(bool _Replace, size_t _Maxlen)
 {
   this->Replace = _Replace;
+  this->coalesce = false;
   this->Maxlen = _Maxlen;
   this->head = this->tail = NULL;
   this->Length = 0;
@@ -198,14 +750,35 @@ MessageQueue::MessageQueue(bool _Replace, size_t _Maxlen)
   this->ClearFilter();
   this->filter_on = false;
   this->replaceRules = NULL;
+  this->replaceTable = NULL;
+  this->retiredTables = NULL;
+  // size the index for a full queue, within reason
+  size_t buckets = 16;
+  while((buckets < this->Maxlen) && (buckets < 1024))
+    buckets *= 2;
+  this->index = new MessageQueueElement*[buckets];
+  memset(this->index, 0, buckets * sizeof(MessageQueueElement*));
+  this->indexMask = buckets - 1;
   this->pull = false;
   this->data_requested = false;
   this->data_delivered = false;
   this->drop_count = 0;
+  this->discard_count = 0;
+  this->ring = NULL;
+  this->notify_fd = -1;
+  this->notify_pending = 0;
+  this->wakeup_pending = 0;
 }
 
 MessageQueue::~MessageQueue()
 {
+  if(this->ring)
+    MessageRingDestroy(this->ring);
+#if HAVE_SYS_EVENTFD_H
+  if(this->notify_fd >= 0)
+    close(this->notify_fd);
+#endif
+
   // clear the queue
   MessageQueueElement *e, *n;
   for(e = this->head; e;)
@@ -225,6 +798,9 @@ MessageQueue::~MessageQueue()
     delete curr;
     curr = tmp;
   }
+  MessageReplaceTableFree(this->replaceTable);
+  MessageReplaceTableFree(this->retiredTables);
+  delete [] this->index;
 
   pthread_mutex_destroy(&this->lock);
   pthread_mutex_destroy(&this->condMutex);
@@ -236,6 +812,7 @@ void
 MessageQueue::AddReplaceRule(int _host, int _robot, int _interf, int _index,
                              int _type, int _subtype, int _replace)
 {
+  this->Lock();
   MessageReplaceRule* curr;
   for(curr=this->replaceRules;curr;curr=curr->next)
   {
@@ -243,6 +820,8 @@ MessageQueue::AddReplaceRule(int _host, int _robot, int _interf, int _index,
     if (curr->Equivalent (_host, _robot, _interf, _index, _type, _subtype))
     {
       curr->replace = _replace;
+      this->CompileReplaceRules();
+      this->Unlock();
       return;
     }
 	if (curr->next == NULL)
@@ -265,6 +844,8 @@ MessageQueue::AddReplaceRule(int _host, int _robot, int _interf, int _index,
     if (!curr->next)
       PLAYER_ERROR ("memory allocation failure; could not add new replace rule");
   }
+  this->CompileReplaceRules();
+  this->Unlock();
 }
 
 /// @brief Add a replacement rule to the list
@@ -276,15 +857,133 @@ MessageQueue::AddReplaceRule(const player_devaddr_t &device,
                         _type, _subtype, _replace);
 }
 
+void
+MessageQueue::CompileReplaceRules()
+{
+  unsigned int count = 0;
+  for(MessageReplaceRule* curr=this->replaceRules;curr;curr=curr->next)
+    count++;
+
+  MessageReplaceTable* table = new MessageReplaceTable;
+  unsigned int size = 8;
+  while(size < 2 * count)
+    size *= 2;
+  table->entries = new MessageReplaceEntry[size];
+  memset(table->entries, 0, size * sizeof(MessageReplaceEntry));
+  table->tableMask = size - 1;
+  table->maskCount = 0;
+  table->next = NULL;
+
+  unsigned int order = 0;
+  for(MessageReplaceRule* curr=this->replaceRules;curr;curr=curr->next,order++)
+  {
+    // A negative field is don't care, as in MessageReplaceRule::Match()
+    player_msghdr_t hdr;
+    uint8_t mask = 0;
+    if(curr->host >= 0)
+    {
+      mask |= REPLACERULE_HOST;
+      hdr.addr.host = (uint32_t)curr->host;
+    }
+    if(curr->robot >= 0)
+    {
+      mask |= REPLACERULE_ROBOT;
+      hdr.addr.robot = (uint32_t)curr->robot;
+    }
+    if(curr->interf >= 0)
+    {
+      mask |= REPLACERULE_INTERF;
+      hdr.addr.interf = (uint16_t)curr->interf;
+    }
+    if(curr->index >= 0)
+    {
+      mask |= REPLACERULE_INDEX;
+      hdr.addr.index = (uint16_t)curr->index;
+    }
+    if(curr->type >= 0)
+    {
+      mask |= REPLACERULE_TYPE;
+      hdr.type = (uint8_t)curr->type;
+    }
+    if(curr->subtype >= 0)
+    {
+      mask |= REPLACERULE_SUBTYPE;
+      hdr.subtype = (uint8_t)curr->subtype;
+    }
+
+    MessageReplaceEntry key;
+    unsigned int hash = MessageReplaceKey(&key, &hdr, mask);
+    MessageReplaceEntry* entry;
+    for(;;)
+    {
+      entry = table->entries + (hash & table->tableMask);
+      if(!entry->used || MessageReplaceKeyEqual(entry, &key))
+        break;
+      hash++;
+    }
+    // An earlier rule with the same effective signature takes precedence
+    if(entry->used)
+      continue;
+    *entry = key;
+    entry->used = true;
+    entry->order = order;
+    entry->replace = curr->replace;
+
+    unsigned int i;
+    for(i = 0; i < table->maskCount; i++)
+    {
+      if(table->masks[i] == mask)
+        break;
+    }
+    if(i == table->maskCount)
+      table->masks[table->maskCount++] = mask;
+  }
+
+  // A ring mode Push() reads the table without the lock, so keep the old
+  // one around until the queue goes away
+  MessageReplaceTable* old = this->replaceTable;
+  AtomicCompareAndSwap((void**)&this->replaceTable, old, table);
+  if(old)
+  {
+    if(this->ring)
+    {
+      old->next = this->retiredTables;
+      this->retiredTables = old;
+    }
+    else
+      MessageReplaceTableFree(old);
+  }
+}
+
 int
 MessageQueue::CheckReplace(player_msghdr_t* hdr)
 {
   // First look through the replacement rules
-  for(MessageReplaceRule* curr=this->replaceRules;curr;curr=curr->next)
+  MessageReplaceTable* table =
+    (MessageReplaceTable*)AtomicLoadPointer((void**)&this->replaceTable);
+  if(table)
   {
-  	assert(curr);
-    if(curr->Match(hdr))
-      return(curr->replace);
+    MessageReplaceEntry* match = NULL;
+    for(unsigned int i = 0; i < table->maskCount; i++)
+    {
+      MessageReplaceEntry key;
+      unsigned int hash = MessageReplaceKey(&key, hdr, table->masks[i]);
+      for(;;)
+      {
+        MessageReplaceEntry* entry = table->entries + (hash & table->tableMask);
+        if(!entry->used)
+          break;
+        if(MessageReplaceKeyEqual(entry, &key))
+        {
+          if(!match || (entry->order < match->order))
+            match = entry;
+          break;
+        }
+        hash++;
+      }
+    }
+    if(match)
+      return(match->replace);
   }
 
   // Didn't find it; follow the default rule
@@ -294,7 +993,10 @@ MessageQueue::CheckReplace(player_msghdr_t* hdr)
      (hdr->type == PLAYER_MSGTYPE_RESP_ACK) ||
      (hdr->type == PLAYER_MSGTYPE_RESP_NACK))
     return(PLAYER_PLAYER_MSG_REPLACE_RULE_ACCEPT);
-  // Replace data and command according to the this->Replace flag
+  // Replace data and command according to the this->Replace flag, and
+  // data while coalescing
+  else if((hdr->type == PLAYER_MSGTYPE_DATA) && this->coalesce)
+    return(PLAYER_PLAYER_MSG_REPLACE_RULE_REPLACE);
   else if((hdr->type == PLAYER_MSGTYPE_DATA) ||
           (hdr->type == PLAYER_MSGTYPE_CMD))
   {
@@ -311,9 +1013,15 @@ MessageQueue::CheckReplace(player_msghdr_t* hdr)
 bool
 MessageQueue::Wait(double TimeOut)
 {
-  bool result = true;
   MessageQueueElement* el;
 
+  // woken while we weren't waiting
+  if(AtomicCompareAndSwapUint(&this->wakeup_pending, 1, 0))
+    return true;
+
+  if(this->ring)
+    return(this->RingWait(TimeOut));
+
   // don't wait if there's data on the queue
   this->Lock();
   // start at the head and traverse the queue until a filter-friendly
@@ -325,7 +1033,15 @@ MessageQueue::Wait(double TimeOut)
   }
   this->Unlock();
   if(el)
-    return result;
+    return true;
+
+  return(this->CondWait(TimeOut, false));
+}
+
+bool
+MessageQueue::CondWait(double TimeOut, bool checkRing)
+{
+  bool result = true;
 
   // need to push this cleanup function, cause if a thread is cancelled while
   // in pthread_cond_wait(), it will immediately relock the mutex.  thus we
@@ -333,7 +1049,13 @@ MessageQueue::Wait(double TimeOut)
   pthread_cleanup_push((void(*)(void*))pthread_mutex_unlock,
                        (void*)&this->condMutex);
   pthread_mutex_lock(&this->condMutex);
-  if (TimeOut > 0)
+  // producers signal under condMutex, so a message that arrived before we
+  // took it is seen here, and one that arrives after will wake us
+  if (checkRing && AtomicLoad(&this->ring->count))
+    result = true;
+  else if (AtomicCompareAndSwapUint(&this->wakeup_pending, 1, 0))
+    result = true;
+  else if (TimeOut > 0)
   {
     struct timespec tp;
     clock_gettime(CLOCK_REALTIME, &tp);
@@ -355,6 +1077,53 @@ MessageQueue::Wait(double TimeOut)
   return result;
 }
 
+bool
+MessageQueue::RingWait(double TimeOut)
+{
+  MessageQueueElement* el;
+
+  // A filtered wait has to look at every message, so move everything that
+  // has come in through the ring over to the list first
+  this->Lock();
+  if(this->filter_on)
+    this->RingDrain();
+  for(el = this->head; el; el = el->next)
+  {
+    if(!this->filter_on || this->Filter(*el->msg))
+      break;
+  }
+  this->Unlock();
+  if(el || (!this->filter_on && AtomicLoad(&this->ring->count)))
+    return(true);
+
+#if HAVE_SYS_EVENTFD_H
+  if(this->ring->wakefd >= 0)
+  {
+    bool result = true;
+    // Say that we're going to sleep, then look again: a producer either
+    // sees the flag and wakes us, or we see its message
+    AtomicStore(&this->ring->sleeping, 1);
+    MemoryFence();
+    if(!AtomicLoad(&this->ring->count) && !AtomicLoad(&this->wakeup_pending))
+    {
+      struct pollfd pfd;
+      pfd.fd = this->ring->wakefd;
+      pfd.events = POLLIN;
+      pfd.revents = 0;
+      int ret = poll(&pfd, 1, (TimeOut > 0) ? (int)ceil(TimeOut * 1000) : -1);
+      if(ret == 0)
+        result = false;
+      eventfd_t value;
+      eventfd_read(this->ring->wakefd, &value);
+    }
+    AtomicStore(&this->ring->sleeping, 0);
+    AtomicStore(&this->wakeup_pending, 0);
+    return(result);
+  }
+#endif
+  return(this->CondWait(TimeOut, true));
+}
+
 bool
 MessageQueue::Filter(Message& msg)
 {
@@ -394,10 +1163,19 @@ MessageQueue::GetLength(void)
   size_t len;
   this->Lock();
   len = this->Length;
+  if(this->ring)
+    len += AtomicLoad(&this->ring->count);
   this->Unlock();
   return(len);
 }
 
+bool
+MessageQueue::Empty()
+{
+  return((this->head == NULL) &&
+         (!this->ring || (AtomicLoad(&this->ring->count) == 0)));
+}
+
 void
 MessageQueue::ClearFilter(void)
 {
@@ -408,9 +1186,65 @@ MessageQueue::ClearFilter(void)
 // Signal that new data is available (calls pthread_cond_broadcast()
 // on this device's condition variable, which will release other
 // devices that are waiting on this one).
+int
+MessageQueue::GetNotifyFd()
+{
+#if HAVE_SYS_EVENTFD_H
+  pthread_mutex_lock(&this->condMutex);
+  if(this->notify_fd < 0)
+  {
+    if((this->notify_fd = eventfd(0, EFD_NONBLOCK)) < 0)
+      PLAYER_ERROR1("eventfd() failed: %s", strerror(errno));
+  }
+  pthread_mutex_unlock(&this->condMutex);
+  return(this->notify_fd);
+#else
+  return(-1);
+#endif
+}
+
+void
+MessageQueue::ClearNotifyFd()
+{
+#if HAVE_SYS_EVENTFD_H
+  if(this->notify_fd < 0)
+    return;
+  // Reset the descriptor before the flag: a DataAvailable() in between
+  // then sees the flag still set and doesn't write, but its message is
+  // already queued for the caller to find
+  eventfd_t value;
+  eventfd_read(this->notify_fd, &value);
+  AtomicStore(&this->notify_pending, 0);
+  MemoryFence();
+#endif
+}
+
+void
+MessageQueue::Wakeup(void)
+{
+  AtomicStore(&this->wakeup_pending, 1);
+  MemoryFence();
+  this->DataAvailable();
+}
+
 void
 MessageQueue::DataAvailable(void)
 {
+#if HAVE_SYS_EVENTFD_H
+  if((this->notify_fd >= 0) &&
+     AtomicCompareAndSwapUint(&this->notify_pending, 0, 1))
+    eventfd_write(this->notify_fd, 1);
+#endif
+#if HAVE_SYS_EVENTFD_H
+  if(this->ring && (this->ring->wakefd >= 0))
+  {
+    // only make the system call if the consumer is asleep
+    MemoryFence();
+    if(AtomicLoad(&this->ring->sleeping))
+      eventfd_write(this->ring->wakefd, 1);
+    return;
+  }
+#endif
   pthread_mutex_lock(&this->condMutex);
   pthread_cond_broadcast(&this->cond);
   pthread_mutex_unlock(&this->condMutex);
@@ -451,6 +1285,15 @@ MessageQueue::PushFront(Message & msg, bool haveLock)
     this->head->prev = newelt;
     this->head = newelt;
   }
+  // the front of the queue is the oldest, so it goes at the end of its bucket
+  MessageQueueElement** bucket =
+    this->index + (MessageSignatureHash(msg.GetHeader()) & this->indexMask);
+  while(*bucket)
+  {
+    newelt->hprev = *bucket;
+    bucket = &(*bucket)->hnext;
+  }
+  *bucket = newelt;
   this->Length++;
   if(!haveLock)
     this->Unlock();
@@ -463,10 +1306,23 @@ MessageQueue::PushFront(Message & msg, bool haveLock)
 void
 MessageQueue::PushBack(Message & msg, bool haveLock)
 {
+  if(this->ring && !haveLock)
+  {
+    this->RingEnqueue(new Message(msg));
+    return;
+  }
   if(!haveLock)
     this->Lock();
+  this->Append(new Message(msg));
+  if(!haveLock)
+    this->Unlock();
+}
+
+void
+MessageQueue::Append(Message* msg)
+{
   MessageQueueElement* newelt = new MessageQueueElement();
-  newelt->msg = new Message(msg);
+  newelt->msg = msg;
   if(!this->tail)
   {
     this->head = this->tail = newelt;
@@ -479,9 +1335,14 @@ MessageQueue::PushBack(Message & msg, bool haveLock)
     newelt->next = NULL;
     this->tail = newelt;
   }
+  MessageQueueElement** bucket =
+    this->index + (MessageSignatureHash(msg->GetHeader()) & this->indexMask);
+  newelt->hprev = NULL;
+  newelt->hnext = *bucket;
+  if(*bucket)
+    (*bucket)->hprev = newelt;
+  *bucket = newelt;
   this->Length++;
-  if(!haveLock)
-    this->Unlock();
 }
 
 bool
@@ -489,7 +1350,9 @@ MessageQueue::Push(Message & msg)
 {
   player_msghdr_t* hdr;
 
-  assert(*msg.RefCount);
+  if(this->ring)
+    return(this->RingPush(msg));
+
   this->Lock();
   hdr = msg.GetHeader();
   // Should we try to replace an older message of the same signature?
@@ -507,39 +1370,216 @@ MessageQueue::Push(Message & msg)
   {
     // record the fact that we are dropping a message
     this->drop_count++;
+    this->discard_count++;
     this->Unlock();
     return(true);
   }
   else if (replaceOp == PLAYER_PLAYER_MSG_REPLACE_RULE_REPLACE)
+    this->RemoveReplaced(msg);
+
+  this->PushBack(msg,true);
+
+  this->Unlock();
+  if(!this->filter_on || this->Filter(msg))
+    this->DataAvailable();
+  return(true);
+}
+
+void
+MessageQueue::RemoveReplaced(Message & msg)
+{
+  // buckets are kept newest first, so this finds the most recent match
+  for(MessageQueueElement* el = this->index[MessageSignatureHash(msg.GetHeader()) & this->indexMask];
+      el != NULL;
+      el = el->hnext)
   {
-    for(MessageQueueElement* el = this->tail;
-        el != NULL;
-        el = el->prev)
+    if(el->msg->Compare(msg))
     {
-      if(el->msg->Compare(msg))
+      this->Remove(el);
+      delete el->msg;
+      delete el;
+      AtomicIncrement(&this->discard_count);
+      break;
+    }
+  }
+}
+
+void
+MessageQueue::SetCoalesce(bool _coalesce)
+{
+  this->Lock();
+  this->coalesce = _coalesce;
+  if(_coalesce)
+  {
+    // Drop every queued data message that has a newer one of the same
+    // signature behind it.  Buckets are kept newest first, so the newer
+    // ones are found through hprev.
+    MessageQueueElement* el = this->head;
+    while(el)
+    {
+      MessageQueueElement* next = el->next;
+      player_msghdr_t* hdr = el->msg->GetHeader();
+      if((hdr->type == PLAYER_MSGTYPE_DATA) &&
+         (this->CheckReplace(hdr) == PLAYER_PLAYER_MSG_REPLACE_RULE_REPLACE))
       {
-        this->Remove(el);
-        delete el->msg;
-        delete el;
-        break;
+        for(MessageQueueElement* newer = el->hprev; newer; newer = newer->hprev)
+        {
+          if(newer->msg->Compare(*el->msg))
+          {
+            this->Remove(el);
+            delete el->msg;
+            delete el;
+            this->discard_count++;
+            break;
+          }
+        }
       }
+      el = next;
     }
   }
+  this->Unlock();
+}
 
-  this->PushBack(msg,true);
+bool
+MessageQueue::RingPush(Message & msg)
+{
+  player_msghdr_t* hdr = msg.GetHeader();
+  int replaceOp = this->CheckReplace(hdr);
+  if (PLAYER_PLAYER_MSG_REPLACE_RULE_IGNORE == replaceOp)
+    return(true);
+  // The length is read without the lock, so the limit is approximate
+  if (PLAYER_PLAYER_MSG_REPLACE_RULE_ACCEPT == replaceOp && (hdr->type == PLAYER_MSGTYPE_DATA ||
+          hdr->type == PLAYER_MSGTYPE_CMD) &&
+      (*(volatile size_t*)&this->Length + AtomicLoad(&this->ring->count) >= this->Maxlen))
+  {
+    AtomicIncrement(&this->drop_count);
+    AtomicIncrement(&this->discard_count);
+    return(true);
+  }
+
+  Message* newmsg = new Message(msg);
+  MessageRingSlot* slot;
+  if(replaceOp != PLAYER_PLAYER_MSG_REPLACE_RULE_REPLACE)
+    this->RingEnqueue(newmsg);
+  else if((slot = MessageRingGetSlot(this->ring, hdr)))
+  {
+    // If the slot already held a message, the slot is already in the ring
+    // and that message has now been replaced; otherwise queue the slot
+    Message* old = (Message*)AtomicExchange(&slot->msg, newmsg);
+    if(old)
+    {
+      delete old;
+      AtomicIncrement(&this->discard_count);
+    }
+    else
+      this->RingEnqueue(MESSAGERING_SLOT_ENTRY(slot));
+  }
+  else
+  {
+    // No slot left for this signature, so replace it in the locked list,
+    // where it stays bounded; it may overtake messages still in the ring
+    if(AtomicCompareAndSwapUint(&this->ring->slotsfull, 0, 1))
+      PLAYER_WARN1("message queue has run out of its %u replacement slots; replacing further messages under the queue lock",
+                   this->ring->numslots);
+    this->Lock();
+    this->RemoveReplaced(msg);
+    this->Append(newmsg);
+    this->Unlock();
+  }
 
-  this->Unlock();
   if(!this->filter_on || this->Filter(msg))
     this->DataAvailable();
   return(true);
 }
 
+void
+MessageQueue::RingEnqueue(void* entry)
+{
+  if(MessageRingEnqueue(this->ring, entry))
+    return;
+
+  // The ring is full, which takes a flood of messages that are never
+  // dropped (requests and replies).  Fall back to the locked list; these
+  // messages may overtake ones still in the ring.
+  Message* msg;
+  if(MESSAGERING_IS_SLOT(entry))
+    msg = (Message*)AtomicExchange(&MESSAGERING_ENTRY_SLOT(entry)->msg, NULL);
+  else
+    msg = (Message*)entry;
+  if(!msg)
+    return;
+  this->Lock();
+  this->Append(msg);
+  this->Unlock();
+}
+
+Message*
+MessageQueue::RingPop()
+{
+  void* entry;
+  while((entry = MessageRingDequeue(this->ring)))
+  {
+    if(!MESSAGERING_IS_SLOT(entry))
+      return((Message*)entry);
+    // An empty slot means the message was moved elsewhere when the ring
+    // overflowed
+    Message* msg = (Message*)AtomicExchange(&MESSAGERING_ENTRY_SLOT(entry)->msg, NULL);
+    if(msg)
+      return(msg);
+  }
+  return(NULL);
+}
+
+void
+MessageQueue::RingDrain()
+{
+  Message* msg;
+  while((msg = this->RingPop()))
+    this->Append(msg);
+}
+
+bool
+MessageQueue::EnableRing()
+{
+  bool result = true;
+  this->Lock();
+  if(!this->ring)
+  {
+    if(this->head)
+      result = false;
+    else
+    {
+      // a slot per message the queue may hold, so that a queue of any
+      // length can replace as many signatures as it can keep
+      size_t numslots = MESSAGERING_SLOTS;
+      while(numslots < this->Maxlen)
+        numslots *= 2;
+      this->ring = MessageRingCreate(2 * (this->Maxlen + numslots), numslots);
+    }
+  }
+  this->Unlock();
+  return(result);
+}
+
 Message*
 MessageQueue::Pop()
 {
   MessageQueueElement* el;
   Lock();
 
+  if(this->ring)
+  {
+    // With nothing in the list and no filter to apply, take the next
+    // message straight off the ring; otherwise move the ring's contents
+    // to the list and carry on as usual
+    if(!this->head && !this->filter_on && !this->pull)
+    {
+      Unlock();
+      return(this->RingPop());
+    }
+    this->RingDrain();
+  }
+
   // Look for the last response in the queue, starting at the tail.
   // If any responses are pending, we always send all messages up to and
   // including the last response.
@@ -624,13 +1664,18 @@ MessageQueue::Remove(MessageQueueElement* el)
     el->next->prev = el->prev;
   else
     this->tail = el->prev;
+  if(el->hprev)
+    el->hprev->hnext = el->hnext;
+  else
+    this->index[MessageSignatureHash(el->msg->GetHeader()) & this->indexMask] = el->hnext;
+  if(el->hnext)
+    el->hnext->hprev = el->hprev;
   this->Length--;
 }
 
 /// Create a null pointer
 QueuePointer::QueuePointer()
 {
-  Lock = NULL;
   RefCount = NULL;
   Queue = NULL;
 }
@@ -638,15 +1683,10 @@ QueuePointer::QueuePointer()
 /// Create an empty message queue and an auto pointer to it.
 QueuePointer::QueuePointer(bool _Replace, size_t _Maxlen)
 {
-  this->Lock = new pthread_mutex_t;
-  assert(this->Lock);
-  pthread_mutex_init(this->Lock,NULL);
   this->Queue = new MessageQueue(_Replace, _Maxlen);
   assert(this->Queue);
 
-  this->RefCount = new unsigned int;
-  assert(this->RefCount);
-  *this->RefCount = 1;
+  this->RefCount = NewRefCount();
 }
 
 /// Destroy our reference to the message queue.
@@ -661,23 +1701,16 @@ QueuePointer::QueuePointer(const QueuePointer & rhs)
 {
   if (rhs.Queue == NULL)
   {
-    Lock = NULL;
     RefCount = NULL;
     Queue = NULL;
   }
   else
   {
-    assert(rhs.Lock);
-    pthread_mutex_lock(rhs.Lock);
-
-    assert(rhs.Queue);
     assert(rhs.RefCount);
     assert(*(rhs.RefCount));
-    Lock = rhs.Lock;
     Queue = rhs.Queue;
     RefCount = rhs.RefCount;
-    (*RefCount)++;
-    pthread_mutex_unlock(Lock);
+    AtomicIncrement(RefCount);
   }
 }
 
@@ -691,17 +1724,11 @@ QueuePointer & QueuePointer::operator = (const QueuePointer & rhs)
   	return *this;
 
   // then copy the rhs
-  assert(rhs.Lock);
-  pthread_mutex_lock(rhs.Lock);
-
-  assert(rhs.Queue);
   assert(rhs.RefCount);
   assert(*(rhs.RefCount));
-  Lock = rhs.Lock;
   Queue = rhs.Queue;
   RefCount = rhs.RefCount;
-  (*RefCount)++;
-  pthread_mutex_unlock(Lock);
+  AtomicIncrement(RefCount);
   return *this;
 }
 
@@ -754,25 +1781,11 @@ void QueuePointer::DecRef()
   if (Queue == NULL)
     return;
 
-  pthread_mutex_lock(Lock);
-  (*RefCount)--;
-  assert((*RefCount) >= 0);
-  if((*RefCount)==0)
+  if(AtomicDecrement(RefCount)==0)
   {
     delete Queue;
-    Queue = NULL;
-    delete RefCount;
-    RefCount = NULL;
-    pthread_mutex_unlock(Lock);
-    pthread_mutex_destroy(Lock);
-    delete Lock;
-    Lock = NULL;
-  }
-  else
-  {
-    Queue = NULL;
-    RefCount = NULL;
-    pthread_mutex_unlock(Lock);
-    Lock = NULL;
+    MessagePoolFree(&refCountPool, RefCount);
   }
+  Queue = NULL;
+  RefCount = NULL;
 }
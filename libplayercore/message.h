@@ -61,8 +61,12 @@
 #include <pthread.h>
 
 #include <libplayerinterface/player.h>
+#include <libplayerinterface/functiontable.h>
 
 class MessageQueue;
+struct MessageBody;
+struct MessageRing;
+struct MessageReplaceTable;
 
 /** @brief An autopointer for the message queue
 
@@ -106,11 +110,8 @@ class PLAYERCORE_EXPORT QueuePointer
     /// The queue we are pointing to
     MessageQueue * Queue;
 
-    /// Reference count.
+    /// Reference count, updated with atomic operations.
     unsigned int * RefCount;
-
-    /// Used to lock access to refcount.
-    pthread_mutex_t * Lock;
 };
 
 
@@ -151,6 +152,11 @@ class PLAYERCORE_EXPORT Message
     /// Destroy message, dec ref counts and delete data if ref count == 0
     ~Message();
 
+    /// Allocate a message from the message pool instead of the heap.
+    static void* operator new(size_t size);
+    /// Return a message to the message pool.
+    static void operator delete(void* ptr, size_t size);
+
     /** @brief Helper for message processing.
 
     Returns true if @p hdr matches the supplied @p type, @p subtype,
@@ -188,17 +194,36 @@ class PLAYERCORE_EXPORT Message
     void* GetPayload() {return (void*)Data;};
     /// Size of message data.
     unsigned int GetDataSize() {return Header.size;};
+    /// Get the XDR function table row for this message's signature, looked
+    /// up once when the message was created (NULL if there is none).
+    playerxdr_function_t* GetFunctionRow() {return FuncRow;};
     /// Compare type, subtype, device, and device_index.
     bool Compare(Message &other);
     /// Decrement ref count
     void DecRef();
 
+    /** @brief Get the encoding of the payload, if a transport has
+    already encoded it.
+
+    Messages are shared read-only by every queue they are delivered to, so
+    the first transport to encode a message can leave the encoded body
+    here for the others.  Returns NULL (and leaves @p len alone) if there
+    is no cached encoding in the wire @p encoding asked for
+    (PLAYER_ENCODING_XDR or PLAYER_ENCODING_NATIVE). */
+    const char* GetEncodedPayload(size_t* len,
+                                  int encoding = PLAYER_ENCODING_XDR);
+    /** @brief Offer the encoding of the payload for reuse.
+
+    The encoding is copied and kept for the life of the message, but only
+    if it is large and other copies of the message are still queued;
+    otherwise the call does nothing.  The first encoding offered wins,
+    whichever wire encoding it is in. */
+    void CacheEncodedPayload(const char* buf, size_t len,
+                             int encoding = PLAYER_ENCODING_XDR);
+
     /// queue to which any response to this message should be directed
     QueuePointer Queue;
 
-    /// Reference count.
-    unsigned int * RefCount;
-
   private:
     void CreateMessage(const struct player_msghdr & Header,
             void* data,
@@ -208,10 +233,17 @@ class PLAYERCORE_EXPORT Message
     player_msghdr_t Header;
     /// Pointer to the message data.
     uint8_t * Data;
-    /// Used to lock access to Data.
-    pthread_mutex_t * Lock;
+    /// Cached XDR function table row for the header signature.
+    playerxdr_function_t * FuncRow;
+    /// State shared by all copies of the message (reference count and
+    /// cached encoding).
+    MessageBody * Body;
 };
 
+/// Encoded payloads at least this many bytes long are kept on the message
+/// for other transports to reuse (see Message::CacheEncodedPayload()).
+#define PLAYER_MESSAGE_ENCODING_CACHE_MIN 4096
+
 /**
  This class is a helper for maintaining doubly-linked queues of Messages.
 */
@@ -223,6 +255,11 @@ class PLAYERCORE_EXPORT MessageQueueElement
     /// Destroy a queue element.
     ~MessageQueueElement();
 
+    /// Allocate a queue element from the element pool instead of the heap.
+    static void* operator new(size_t size);
+    /// Return a queue element to the element pool.
+    static void operator delete(void* ptr, size_t size);
+
     /// The message stored in this queue element.
     Message* msg;
   private:
@@ -230,6 +267,9 @@ class PLAYERCORE_EXPORT MessageQueueElement
     MessageQueueElement * prev;
     /// Pointer to next queue element.
     MessageQueueElement * next;
+    /// Neighbours in the queue's signature index bucket (newer, older).
+    MessageQueueElement * hprev;
+    MessageQueueElement * hnext;
 
     friend class MessageQueue;
 };
@@ -281,6 +321,8 @@ class PLAYERCORE_EXPORT MessageReplaceRule
     int replace;
     // Next rule in the list
     MessageReplaceRule* next;
+
+    friend class MessageQueue;
 };
 
 /** @brief A doubly-linked queue of messages.
@@ -342,7 +384,7 @@ class PLAYERCORE_EXPORT MessageQueue
     /// Destroy a message queue.
     ~MessageQueue();
     /// Check whether a queue is empty
-    bool Empty() { return(this->head == NULL); }
+    bool Empty();
     /** Push a message onto the queue.  Returns the success state of the Push
     operation (true if successful, false otherwise). */
     bool Push(Message& msg);
@@ -367,6 +409,20 @@ class PLAYERCORE_EXPORT MessageQueue
     messages of the same subtype from the same device are replaced in
     the queue. */
     void SetReplace(bool _Replace) { this->Replace = _Replace; };
+    /** @brief Keep only the latest data message of each signature.
+
+    While coalescing, data messages that no replacement rule covers are
+    replaced as if the @p Replace flag were set, and switching it on
+    collapses the data already queued the same way.  Transports use this
+    for clients that cannot keep up, so that they get the newest data
+    rather than a backlog of stale data.  Explicit replacement rules still
+    win. */
+    void SetCoalesce(bool _coalesce);
+    /// @brief Is the queue coalescing data (see SetCoalesce())?
+    bool GetCoalesce() { return this->coalesce; };
+    /** @brief Get the number of messages discarded so far because they
+    were replaced by newer ones, or because the queue was full. */
+    unsigned int GetDiscardCount() { return this->discard_count; };
     /** Add a replacement rule to the list.  The first 6 arguments
      * determine the signature that a message will have to match in order
      * for this rule to be applied.  If an incoming message matches this
@@ -395,6 +451,10 @@ class PLAYERCORE_EXPORT MessageQueue
     /** Signal that new data is available.  Calling this method will
      release any threads currently waiting on this queue. */
     void DataAvailable(void);
+    /** Wake the thread waiting on this queue or, if none is waiting yet,
+     make the next Wait() return straight away.  For events that don't
+     come as messages, such as a watched file becoming readable. */
+    void Wakeup(void);
     /// @brief Check whether a message passes the current filter.
     bool Filter(Message& msg);
     /// @brief Clear (i.e., turn off) message filter.
@@ -411,6 +471,34 @@ class PLAYERCORE_EXPORT MessageQueue
     /// @brief Set the data_requested flag
     void SetDataRequested(bool d, bool haveLock);
 
+    /** @brief Switch the queue over to lock-free ring intake.
+
+    In ring mode Push() never takes the queue lock.  Messages go into a
+    bounded multi-producer, single-consumer ring.  A message that is to
+    replace an older one goes through a slot kept for its (addr,type,subtype)
+    signature, so replacement is an atomic swap and not a list scan; the
+    new message takes the queued message's place in line.  There are as
+    many slots as the queue holds messages; signatures beyond that are
+    replaced in the locked list instead.  Consumers sleep on an eventfd
+    where the platform has one.
+
+    Pop(), Wait() and the filter must then be used from a single thread
+    (the owning driver's).  The queue must be empty when this is called;
+    returns false if it is not. */
+    bool EnableRing();
+
+    /** @brief Get a file descriptor that becomes readable when
+    DataAvailable() is called, so that one thread can wait on many queues
+    with poll() or epoll.  The descriptor is made on the first call.
+    Returns -1 where the platform has no eventfd.
+
+    A consumer must call ClearNotifyFd() before popping the messages it
+    was woken for; only the first DataAvailable() after that makes the
+    descriptor readable again. */
+    int GetNotifyFd();
+    /// @brief Reset the descriptor from GetNotifyFd().
+    void ClearNotifyFd();
+
   private:
     /// @brief Lock the mutex associated with this queue.
     void Lock() {pthread_mutex_lock(&lock);};
@@ -419,6 +507,29 @@ class PLAYERCORE_EXPORT MessageQueue
     /** Remove element @p el from the queue, and rearrange pointers
     appropriately. */
     void Remove(MessageQueueElement* el);
+    /// @brief Append a message to the list; the caller holds the lock.
+    void Append(Message* msg);
+    /// @brief Remove the most recent queued message that @p msg replaces,
+    /// if any; the caller holds the lock.
+    void RemoveReplaced(Message& msg);
+    /// @brief Rebuild replaceTable from replaceRules; the caller holds the
+    /// lock.
+    void CompileReplaceRules();
+    /// @brief Wait on the condition variable.  If @p checkRing is set, the
+    /// ring is checked again under the condition mutex first.
+    bool CondWait(double TimeOut, bool checkRing);
+    /// @brief Ring mode Push().
+    bool RingPush(Message& msg);
+    /// @brief Ring mode Wait().
+    bool RingWait(double TimeOut);
+    /// @brief Put an entry into the ring, spilling over into the list if
+    /// the ring is full.
+    void RingEnqueue(void* entry);
+    /// @brief Take the next message off the ring (consumer only).
+    Message* RingPop();
+    /// @brief Move everything in the ring into the list (consumer only;
+    /// the caller holds the lock).
+    void RingDrain();
     /// @brief Head of the queue.
     MessageQueueElement* head;
     /// @brief Tail of the queue.
@@ -429,9 +540,21 @@ class PLAYERCORE_EXPORT MessageQueue
     size_t Maxlen;
     /// @brief Singly-linked list of replacement rules
     MessageReplaceRule* replaceRules;
+    /// @brief replaceRules compiled into hash tables for CheckReplace()
+    MessageReplaceTable* replaceTable;
+    /// @brief Compiled tables that a lock-free Push() might still be reading
+    MessageReplaceTable* retiredTables;
+    /// @brief Hash index of the queued elements by message signature, so
+    /// that replacement doesn't have to scan the queue
+    MessageQueueElement** index;
+    /// @brief Number of buckets in index, less one
+    size_t indexMask;
     /// @brief When a (data or command) message doesn't match a rule in
     /// replaceRules, should we replace it?
     bool Replace;
+    /// @brief Replace data messages that don't match a rule in
+    /// replaceRules, whatever @p Replace says
+    bool coalesce;
     /// @brief Current length of queue, in elements.
     size_t Length;
     /// @brief A condition variable that can be used to signal, via
@@ -453,7 +576,18 @@ class PLAYERCORE_EXPORT MessageQueue
     /// @brief Flag that data was sent (in PULL mode)
     bool data_delivered;
     /// @brief Count of the number of messages discarded due to queue overflow.
-    bool drop_count;
+    unsigned int drop_count;
+    /// @brief Count of the messages ever replaced or discarded due to
+    /// queue overflow (not reset by synchronisation, unlike drop_count).
+    unsigned int discard_count;
+    /// @brief Lock-free intake ring; NULL unless EnableRing() was called.
+    MessageRing* ring;
+    /// @brief eventfd from GetNotifyFd(), or -1
+    int notify_fd;
+    /// @brief Set when notify_fd has been written since it was last cleared
+    unsigned int notify_pending;
+    /// @brief Set by Wakeup(), until a Wait() returns
+    unsigned int wakeup_pending;
 };
 
 
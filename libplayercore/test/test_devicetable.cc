@@ -0,0 +1,128 @@
+/*
+ *  Player - One Hell of a Robot Server
+ *  Copyright (C) 2000
+ *     Brian Gerkey, Kasper Stoy, Richard Vaughan, & Andrew Howard
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+/*
+ * $Id$
+ *
+ * Checks which drivers the device table has the server loop watch: only
+ * the queues of non-threaded drivers, whichever constructor they use.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <libplayercore/playercore.h>
+#include <libplayerinterface/interface_util.h>
+
+#include "playertest.h"
+
+class TestDriver : public Driver
+{
+  public:
+    TestDriver(ConfigFile* cf, int section)
+      : Driver(cf, section, true, PLAYER_MSGQUEUE_DEFAULT_MAXLEN,
+               PLAYER_POSITION2D_CODE) {}
+    int ProcessMessage(QueuePointer &resp_queue, player_msghdr* hdr,
+                       void* data) { return(-1); }
+};
+
+class TestThreadedDriver : public ThreadedDriver
+{
+  public:
+    TestThreadedDriver(ConfigFile* cf, int section)
+      : ThreadedDriver(cf, section, true, PLAYER_MSGQUEUE_DEFAULT_MAXLEN,
+                       PLAYER_LASER_CODE) {}
+    int ProcessMessage(QueuePointer &resp_queue, player_msghdr* hdr,
+                       void* data) { return(-1); }
+  private:
+    void Main()
+    {
+      for(;;)
+      {
+        this->Wait();
+        pthread_testcancel();
+        this->ProcessMessages();
+      }
+    }
+};
+
+int
+main(int argc, char** argv)
+{
+  char cfgname[] = "/tmp/test_devicetableXXXXXX";
+  int fd;
+  FILE* fp;
+
+  if((fd = mkstemp(cfgname)) < 0 || !(fp = fdopen(fd, "w")))
+  {
+    perror("mkstemp");
+    return(1);
+  }
+  fprintf(fp, "driver\n(\n  name \"test\"\n  provides [\"position2d:0\"]\n)\n");
+  fprintf(fp, "driver\n(\n  name \"threaded\"\n  provides [\"laser:0\"]\n)\n");
+  fclose(fp);
+
+  player_globals_init();
+  itable_init();
+
+  ConfigFile cf;
+  bool loaded = cf.Load(cfgname);
+  unlink(cfgname);
+  if(!loaded)
+  {
+    fprintf(stderr, "failed to load %s\n", cfgname);
+    return(1);
+  }
+
+  // Section 0 is the global section; the drivers follow in file order
+  Driver* plain = new TestDriver(&cf, 1);
+  Driver* threaded = new TestThreadedDriver(&cf, 2);
+  check(plain->GetError() == 0 && threaded->GetError() == 0,
+        "drivers constructed");
+
+  player_devaddr_t addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.interf = PLAYER_POSITION2D_CODE;
+  Device* plain_dev = deviceTable->GetDevice(addr, false);
+  addr.interf = PLAYER_LASER_CODE;
+  Device* threaded_dev = deviceTable->GetDevice(addr, false);
+  check(plain_dev && threaded_dev, "devices added");
+  if(!plain_dev || !threaded_dev)
+    return(1);
+
+  QueuePointer q(false, PLAYER_MSGQUEUE_DEFAULT_MAXLEN);
+  check(plain_dev->Subscribe(q) == 0, "subscribe to non-threaded driver");
+  check(threaded_dev->Subscribe(q) == 0, "subscribe to threaded driver");
+
+  check(plain_dev->update_watch, "non-threaded driver is watched");
+  check(!threaded_dev->update_watch, "threaded driver is not watched");
+
+  plain_dev->Unsubscribe(q);
+  threaded_dev->Unsubscribe(q);
+
+  player_globals_fini();
+  delete plain;
+  delete threaded;
+
+  return(test_result());
+}
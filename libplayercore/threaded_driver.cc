@@ -82,6 +82,8 @@ ThreadedDriver::ThreadedDriver(ConfigFile *cf, int section, bool overwrite_cmds,
 	ThreadState(PLAYER_THREAD_STATE_STOPPED)
 {
 	memset (&driverthread, 0, sizeof (driverthread));
+	// our thread waits on our queue; Update() does nothing
+	this->event_driven = true;
 }
 
 // this is the other constructor, used by multi-interface drivers.
@@ -90,6 +92,8 @@ ThreadedDriver::ThreadedDriver(ConfigFile *cf, int section, bool overwrite_cmds,
 	ThreadState(PLAYER_THREAD_STATE_STOPPED)
 {
 	memset (&driverthread, 0, sizeof (driverthread));
+	// our thread waits on our queue; Update() does nothing
+	this->event_driven = true;
 }
 
 // destructor, to free up allocated queue.
@@ -273,6 +277,9 @@ bool ThreadedDriver::Wait(double TimeOut)
 	int oldstate, ret;
 	pthread_setcancelstate(PTHREAD_CANCEL_ENABLE,&oldstate);
 	pthread_testcancel();
+	// Let our file watches fire again
+	if(fileWatcher)
+		fileWatcher->ResumeFileWatches(this->InQueue);
 	ret = this->InQueue->Wait(TimeOut);
 	pthread_testcancel();
 	pthread_setcancelstate(oldstate,NULL);
@@ -126,32 +126,195 @@ static playerxdr_function_t init_ftable[] =
   {0,0,0,NULL,NULL,NULL}
 };
 
-static playerxdr_function_t* ftable=NULL;
+/* The function table proper.  Rows are never moved once they have been
+ * added (replacement overwrites a row in place), so the row pointers handed
+ * out by playerxdr_get_ftrow() stay valid for the life of the process and
+ * can be cached by callers. */
+static playerxdr_function_t** ftable=NULL;
 static int ftable_len=0;
+static int ftable_size=0;
+
+/* Hash index over the function table, keyed on (interf,type,subtype).  Each
+ * row is entered under its own signature; REQ rows are also entered under
+ * the matching RESP_ACK and RESP_NACK signatures (flagged as aliases) unless
+ * a row was registered for that signature explicitly.  A lookup is then at
+ * most two probes: one for the exact interface and one for the universal
+ * (interface 0) messages. */
+typedef struct
+{
+  uint32_t key;
+  int order;
+  int alias;
+  playerxdr_function_t* row;
+} playerxdr_ftindex_t;
+
+static playerxdr_ftindex_t* ftindex=NULL;
+static uint32_t ftindex_size=0;
+static uint32_t ftindex_bits=0;
+static uint32_t ftindex_used=0;
+
+#define PLAYERXDR_FTINDEX_MINSIZE 1024
+
+static uint32_t
+ftindex_key(uint16_t interf, uint8_t type, uint8_t subtype)
+{
+  return(((uint32_t)interf << 16) | ((uint32_t)type << 8) | subtype);
+}
+
+// Slot for a key.  Knuth's multiplicative hash; the table size is always a
+// power of 2, and the slot is taken from the top bits of the product, as
+// the low bits only depend on the low bits of the key (here the type and
+// subtype, not the interface).
+static uint32_t
+ftindex_hash(uint32_t key)
+{
+  return((key * 2654435761u) >> (32 - ftindex_bits));
+}
+
+static playerxdr_ftindex_t*
+ftindex_find(uint32_t key)
+{
+  uint32_t i;
+
+  if(!ftindex_size)
+    return(NULL);
+
+  for(i = ftindex_hash(key);
+      ftindex[i].row;
+      i = (i + 1) & (ftindex_size - 1))
+  {
+    if(ftindex[i].key == key)
+      return(ftindex + i);
+  }
+  return(NULL);
+}
+
+static void ftindex_rebuild(uint32_t size);
+
+// Enter a row under the given key.  Explicit rows take precedence over
+// aliases; otherwise the earliest row in the table wins, as it did when the
+// table was searched linearly.
+static void
+ftindex_insert(uint32_t key, playerxdr_function_t* row, int order, int alias)
+{
+  uint32_t i;
+
+  // keep the load factor under 1/2
+  if(2 * (ftindex_used + 1) > ftindex_size)
+  {
+    ftindex_rebuild(ftindex_size ? 2 * ftindex_size : PLAYERXDR_FTINDEX_MINSIZE);
+    return;
+  }
+
+  for(i = ftindex_hash(key);
+      ftindex[i].row;
+      i = (i + 1) & (ftindex_size - 1))
+  {
+    if(ftindex[i].key == key)
+    {
+      if(ftindex[i].alias && !alias)
+      {
+        ftindex[i].row = row;
+        ftindex[i].order = order;
+        ftindex[i].alias = 0;
+      }
+      return;
+    }
+  }
+  ftindex[i].key = key;
+  ftindex[i].row = row;
+  ftindex[i].order = order;
+  ftindex[i].alias = alias;
+  ftindex_used++;
+}
+
+// Enter table row number i, along with its RESP_ACK/RESP_NACK aliases
+static void
+ftindex_add_row(int i)
+{
+  playerxdr_function_t* row = ftable[i];
+
+  ftindex_insert(ftindex_key(row->interf, row->type, row->subtype), row, i, 0);
+  if(row->type == PLAYER_MSGTYPE_REQ)
+  {
+    ftindex_insert(ftindex_key(row->interf, PLAYER_MSGTYPE_RESP_ACK,
+                               row->subtype), row, i, 1);
+    ftindex_insert(ftindex_key(row->interf, PLAYER_MSGTYPE_RESP_NACK,
+                               row->subtype), row, i, 1);
+  }
+}
+
+// Throw away the index and rebuild it from the table with the given size
+static void
+ftindex_rebuild(uint32_t size)
+{
+  int i;
+
+  while(2 * (uint32_t)(3 * ftable_len) > size)
+    size *= 2;
+
+  free(ftindex);
+  ftindex = (playerxdr_ftindex_t*)calloc(size, sizeof(playerxdr_ftindex_t));
+  assert(ftindex);
+  ftindex_size = size;
+  for(ftindex_bits = 0; (1u << ftindex_bits) < size; ftindex_bits++);
+  ftindex_used = 0;
+
+  for(i=0;i<ftable_len;i++)
+    ftindex_add_row(i);
+}
+
+// Append a row to the table, growing the row pointer array as needed
+static void
+ftable_append(playerxdr_function_t* row)
+{
+  if(ftable_len == ftable_size)
+  {
+    ftable_size = ftable_size ? 2 * ftable_size : ftable_len + 64;
+    ftable = (playerxdr_function_t**)realloc(ftable,
+                                             ftable_size *
+                                             sizeof(playerxdr_function_t*));
+    assert(ftable);
+  }
+  ftable[ftable_len++] = row;
+}
 
 void
 playerxdr_ftable_init()
 {
   playerxdr_function_t* f;
+  playerxdr_function_t* rows;
+  int i, len;
 
   // if for some reason this method gets called more than once just ignore the call
   if (ftable)
     return;
 
-  ftable_len = 0;
+  len = 0;
   for(f = init_ftable; f->packfunc; f++)
-    ftable_len++;
+    len++;
+
+  rows = (playerxdr_function_t*)calloc(len, sizeof(playerxdr_function_t));
+  assert(rows);
+  memcpy(rows,init_ftable,len*sizeof(playerxdr_function_t));
 
-  ftable = (playerxdr_function_t*)calloc(ftable_len,
-                                         sizeof(playerxdr_function_t));
+  ftable_len = 0;
+  ftable_size = len;
+  ftable = (playerxdr_function_t**)calloc(ftable_size,
+                                          sizeof(playerxdr_function_t*));
   assert(ftable);
+  for(i=0;i<len;i++)
+    ftable[ftable_len++] = rows + i;
 
-  memcpy(ftable,init_ftable,ftable_len*sizeof(playerxdr_function_t));
+  ftindex_rebuild(PLAYERXDR_FTINDEX_MINSIZE);
 }
 
 int
 playerxdr_ftable_add(playerxdr_function_t f, int replace)
 {
+  playerxdr_ftindex_t* entry;
+  playerxdr_function_t* row;
+
   if(playerxdr_get_packfunc(f.interf, f.type, f.subtype))
   {
     // It's already in the table.  Did the caller say to replace?
@@ -162,23 +325,14 @@ playerxdr_ftable_add(playerxdr_function_t f, int replace)
     }
     else
     {
-      // Yes; replace (it's clearly inefficient to iterate through the
-      // table again to find the entry to replace, but the table is pretty
-      // small and this doesn't happen very often)
-      int i;
-      playerxdr_function_t* curr;
-
-      for(i=0;i<ftable_len;i++)
+      // Yes; replace the row in place, so that cached row pointers pick
+      // up the new functions.  The interface, type, and subtype must match
+      // exactly.
+      entry = ftindex_find(ftindex_key(f.interf, f.type, f.subtype));
+      if(entry && !entry->alias)
       {
-        curr = ftable + i;
-        // Make sure the interface, type, and subtype match exactly
-        if((curr->interf == f.interf) &&
-           (curr->subtype == f.subtype) &&
-           (curr->type == f.type))
-        {
-          *curr = f;
-          return(0);
-        }
+        *entry->row = f;
+        return(0);
       }
       // Can't use libplayercommon here because of an unresolved circular build
       // dependency
@@ -190,11 +344,14 @@ playerxdr_ftable_add(playerxdr_function_t f, int replace)
   else
   {
     // Not in the table; add it
-    ftable = (playerxdr_function_t*)realloc(ftable,
-                                            ((ftable_len+1)*
-                                             sizeof(playerxdr_function_t)));
-    assert(ftable);
-    ftable[ftable_len++] = f;
+    row = (playerxdr_function_t*)malloc(sizeof(playerxdr_function_t));
+    assert(row);
+    *row = f;
+    ftable_append(row);
+    if(!ftindex)
+      ftindex_rebuild(PLAYERXDR_FTINDEX_MINSIZE);
+    else
+      ftindex_add_row(ftable_len - 1);
     return(0);
   }
 }
@@ -218,40 +375,44 @@ playerxdr_ftable_add_multi(playerxdr_function_t *flist, int replace)
 playerxdr_function_t*
 playerxdr_get_ftrow(uint16_t interf, uint8_t type, uint8_t subtype)
 {
-  playerxdr_function_t* curr=NULL;
-  int i;
+  playerxdr_ftindex_t* exact;
+  playerxdr_ftindex_t* universal;
 
   if(!ftable_len)
     return(NULL);
 
-  for(i=0;i<ftable_len;i++)
-  {
-    curr = ftable + i;
-    // Make sure the interface and subtype match exactly.
-    // match anyway if interface = 0 (universal data types)
-
-    if((curr->interf == interf || curr->interf == 0) &&
-      curr->type == type &&
-      curr->subtype == subtype)
-      return(curr);
-  }
+  // Look for the interface's own row and for a universal (interface 0) row.
+  // An explicitly registered row beats a RESP_ACK/RESP_NACK alias for a REQ
+  // row; otherwise the row that was added first wins.
+  exact = ftindex_find(ftindex_key(interf, type, subtype));
+  universal = interf ? ftindex_find(ftindex_key(0, type, subtype)) : NULL;
+
+  if(!universal)
+    return(exact ? exact->row : NULL);
+  if(!exact)
+    return(universal->row);
+  if(exact->alias != universal->alias)
+    return(exact->alias ? universal->row : exact->row);
+  return(exact->order < universal->order ? exact->row : universal->row);
+}
 
-  // The supplied type can be RESP_ACK if the registered type is REQ.
-  if (type == PLAYER_MSGTYPE_RESP_ACK || type == PLAYER_MSGTYPE_RESP_NACK)
-    type = PLAYER_MSGTYPE_REQ;
+void
+playerxdr_ftable_stats(int* entries, int* total_probes, int* max_probes)
+{
+  uint32_t i, probes;
 
-  for(i=0;i<ftable_len;i++)
+  *entries = *total_probes = *max_probes = 0;
+  for(i=0;i<ftindex_size;i++)
   {
-    curr = ftable + i;
-    // Make sure the interface and subtype match exactly.
-    // match anyway if interface = 0 (universal data types)
-    if((curr->interf == interf || curr->interf == 0) &&
-      curr->type == type &&
-      curr->subtype == subtype)
-      return(curr);
+    if(!ftindex[i].row)
+      continue;
+    // distance from the entry's own slot, counting wrap-around
+    probes = ((i - ftindex_hash(ftindex[i].key)) & (ftindex_size - 1)) + 1;
+    (*entries)++;
+    *total_probes += probes;
+    if((int)probes > *max_probes)
+      *max_probes = probes;
   }
-
-  return(NULL);
 }
 
 player_pack_fn_t
@@ -101,6 +101,24 @@ typedef struct
   player_sizeof_fn_t sizeoffunc;
 } playerxdr_function_t;
 
+/** @brief Look up the function table row for a given message signature.
+ *
+ * The lookup is a hash probe, not a table scan. Rows registered for
+ * interface 0 match any interface. A RESP_ACK or RESP_NACK signature
+ * with no row of its own falls back to the matching REQ row.
+ *
+ * Rows are never moved or freed once added. The returned pointer can be
+ * cached, and it picks up replacements made by playerxdr_ftable_add().
+ *
+ * @param interf : The interface
+ * @param type : The message type
+ * @param subtype : The message subtype
+ *
+ * @returns A pointer to the table row, or NULL if one cannot be found.
+ */
+PLAYERXDR_EXPORT playerxdr_function_t* playerxdr_get_ftrow(uint16_t interf, uint8_t type,
+                                    uint8_t subtype);
+
 /** @brief Look up the XDR packing function for a given message signature.
  *
  * @param interf : The interface
@@ -157,6 +175,16 @@ PLAYERXDR_EXPORT int playerxdr_ftable_add_multi(playerxdr_function_t *flist, int
  */
 PLAYERXDR_EXPORT void playerxdr_ftable_init(void);
 
+/** @brief Report how well the function table's index is working.
+ *
+ * @param entries : Set to the number of entries in the index.
+ * @param total_probes : Set to the number of slots looked at to find every
+ *                       entry once.
+ * @param max_probes : Set to the most slots looked at to find one entry.
+ */
+PLAYERXDR_EXPORT void playerxdr_ftable_stats(int* entries, int* total_probes,
+                                             int* max_probes);
+
 /** @brief Deep copy a message structure.
  *
  * Copies the dynamically allocated parts of a message structure from src to
@@ -0,0 +1,199 @@
+/*
+ *  Player - One Hell of a Robot Server
+ *  Copyright (C) 2005 -
+ *     Brian Gerkey
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+/********************************************************************
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ ********************************************************************/
+
+/*
+ * An XDR stream for the native wire encoding (PLAYER_ENCODING_NATIVE).
+ *
+ * The stream lays data out exactly as an xdrmem stream would (the same
+ * fields, the same 4-byte units and padding) except that words are kept
+ * in host byte order, so nothing is swapped.  The generated codecs also
+ * store 64-bit values (and arrays whose layout matches) as raw host bytes
+ * when they find themselves writing to one of these streams.  Both ends
+ * must therefore share a byte order, which the encoding request checks.
+ */
+
+#include <string.h>
+
+#include "libplayerinterface/playerxdr.h"
+
+// tirpc passes a non-const stream to x_getpostn; everyone else a const one
+#if defined (_TIRPC_XDR_H)
+  #define NATIVE_POSTN_XDR XDR
+#else
+  #define NATIVE_POSTN_XDR const XDR
+#endif
+
+static bool_t
+native_getbytes(XDR* xdrs, char* addr, u_int len)
+{
+  if(xdrs->x_handy < len)
+    return(FALSE);
+  memcpy(addr, xdrs->x_private, len);
+  xdrs->x_private = (char*)xdrs->x_private + len;
+  xdrs->x_handy -= len;
+  return(TRUE);
+}
+
+static bool_t
+native_putbytes(XDR* xdrs, const char* addr, u_int len)
+{
+  if(xdrs->x_handy < len)
+    return(FALSE);
+  memcpy(xdrs->x_private, addr, len);
+  xdrs->x_private = (char*)xdrs->x_private + len;
+  xdrs->x_handy -= len;
+  return(TRUE);
+}
+
+static bool_t
+native_getlong(XDR* xdrs, long* lp)
+{
+  uint32_t w;
+  if(!native_getbytes(xdrs, (char*)&w, sizeof(w)))
+    return(FALSE);
+  *lp = (long)w;
+  return(TRUE);
+}
+
+static bool_t
+native_putlong(XDR* xdrs, const long* lp)
+{
+  uint32_t w = (uint32_t)*lp;
+  return(native_putbytes(xdrs, (const char*)&w, sizeof(w)));
+}
+
+static u_int
+native_getpostn(NATIVE_POSTN_XDR* xdrs)
+{
+  return((u_int)((char*)xdrs->x_private - (char*)xdrs->x_base));
+}
+
+static bool_t
+native_setpostn(XDR* xdrs, u_int pos)
+{
+  char* last = (char*)xdrs->x_private + xdrs->x_handy;
+  char* addr = (char*)xdrs->x_base + pos;
+
+  if(addr > last)
+    return(FALSE);
+  xdrs->x_private = addr;
+  xdrs->x_handy = (u_int)(last - addr);
+  return(TRUE);
+}
+
+static int32_t*
+native_inline(XDR* xdrs, u_int len)
+{
+  int32_t* buf;
+  if(xdrs->x_handy < len)
+    return(NULL);
+  buf = (int32_t*)xdrs->x_private;
+  xdrs->x_private = (char*)xdrs->x_private + len;
+  xdrs->x_handy -= len;
+  return(buf);
+}
+
+static void
+native_destroy(XDR* xdrs)
+{
+}
+
+// Only the members common to every RPC implementation are filled in
+static struct xdr_ops native_ops =
+{
+  native_getlong,
+  native_putlong,
+  native_getbytes,
+  native_putbytes,
+  native_getpostn,
+  native_setpostn,
+  native_inline,
+  native_destroy
+};
+
+void
+playerxdr_native_create(XDR* xdrs, char* buf, u_int size, enum xdr_op op)
+{
+  memset(xdrs, 0, sizeof(XDR));
+  xdrs->x_op = op;
+  xdrs->x_ops = &native_ops;
+  xdrs->x_private = buf;
+  xdrs->x_base = buf;
+  xdrs->x_handy = size;
+}
+
+int
+playerxdr_native_stream(XDR* xdrs)
+{
+  return(xdrs->x_ops == &native_ops);
+}
+
+void
+playerxdr_native_byteorder(uint8_t order[4])
+{
+  uint32_t w = 0x01020304;
+  memcpy(order, &w, sizeof(w));
+}
+
+// 64-bit values travel as raw host bytes on native streams
+static bool_t
+native_raw(XDR* xdrs, void* data, u_int len)
+{
+  if(xdrs->x_op == XDR_ENCODE)
+    return(native_putbytes(xdrs, (const char*)data, len));
+  else if(xdrs->x_op == XDR_DECODE)
+    return(native_getbytes(xdrs, (char*)data, len));
+  return(TRUE);
+}
+
+bool_t
+playerxdr_double(XDR* xdrs, double* dp)
+{
+  if(xdrs->x_ops == &native_ops)
+    return(native_raw(xdrs, dp, sizeof(double)));
+  return(xdr_double(xdrs, dp));
+}
+
+bool_t
+playerxdr_int64_t(XDR* xdrs, int64_t* lp)
+{
+  if(xdrs->x_ops == &native_ops)
+    return(native_raw(xdrs, lp, sizeof(int64_t)));
+  return(xdr_longlong_t(xdrs, lp));
+}
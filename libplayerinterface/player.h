@@ -78,8 +78,25 @@
 #define PLAYER_IDENT_STRING    "Player v."
 /** Length of string that is spit back as a banner on connection */
 #define PLAYER_IDENT_STRLEN 32
+/** Offset in the banner of the server's byte order marker: the bytes of
+ * the word 0x01020304 as the server stores it.  Servers that set it
+ * understand the wire negotiation requests (PLAYER_PLAYER_REQ_ENCODING and
+ * PLAYER_PLAYER_REQ_COMPRESSION); older servers leave it zero. */
+#define PLAYER_IDENT_BYTEORDER (PLAYER_IDENT_STRLEN - 4)
 /** Length of authentication key */
 #define PLAYER_KEYLEN       32
+/** Size of the header that starts every datagram over UDP (apart from
+ * the banner and the empty datagram a client opens with).  It is four
+ * 32-bit words in network byte order: the sender's number for the
+ * message, the message's number among those the server has sent the
+ * client from the same device (zero from clients), the offset of the
+ * datagram's part in the message, and the length of the message.  A
+ * message longer than one datagram is split into several, in order, each
+ * but the last as large as PLAYER_UDP_DATAGRAM_SIZE allows. */
+#define PLAYER_UDP_HDR_SIZE 16
+/** Largest datagram sent over UDP, header included; it fits in an
+ * Ethernet frame */
+#define PLAYER_UDP_DATAGRAM_SIZE 1472
 /** @} */
 
 /** @ingroup message_basics
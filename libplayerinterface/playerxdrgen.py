@@ -23,6 +23,67 @@ hasdynamic = []    # A list of types that contain dynamic data. During pass 1,
                     # other types, necessary deep copy/clean up functions can
                     # be created and called.
 
+# Wire layout of the primitive types that arrays can be (un)packed in bulk,
+# rather than through xdr_array/xdr_vector calling an xdr_ proc per element:
+# (bytes on the wire, statements to put and get a value in XDR, the same
+# for the native encoding, whether the native form is the value's raw
+# bytes). Every one matches the encoding of its xdr_ proc byte for byte.
+# char and uint8_t arrays already go as opaque bytes, and uint64_t keeps
+# the xdr_u_long quirk, so they are left out.
+rawput = 'memcpy(%(buf)s, &%(val)s, sizeof(%(val)s));'
+rawget = 'memcpy(&%(val)s, %(buf)s, sizeof(%(val)s));'
+bulkprimitives = {
+  'double'   : (8, 'PLAYERXDR_PUT_DOUBLE(%(buf)s, %(val)s);',
+                   'PLAYERXDR_GET_DOUBLE(%(buf)s, %(val)s);',
+                   rawput, rawget, True),
+  'float'    : (4, 'PLAYERXDR_PUT_FLOAT(%(buf)s, %(val)s);',
+                   'PLAYERXDR_GET_FLOAT(%(buf)s, %(val)s);',
+                   rawput, rawget, True),
+  'int64_t'  : (8, 'PLAYERXDR_PUT64(%(buf)s, (uint64_t)%(val)s);',
+                   '%(val)s = (int64_t)PLAYERXDR_GET64(%(buf)s);',
+                   rawput, rawget, True),
+  'int32_t'  : (4, 'PLAYERXDR_PUT32(%(buf)s, (uint32_t)%(val)s);',
+                   '%(val)s = (int32_t)PLAYERXDR_GET32(%(buf)s);',
+                   rawput, rawget, True),
+  'uint32_t' : (4, 'PLAYERXDR_PUT32(%(buf)s, %(val)s);',
+                   '%(val)s = PLAYERXDR_GET32(%(buf)s);',
+                   rawput, rawget, True),
+  'int16_t'  : (4, 'PLAYERXDR_PUT32(%(buf)s, (uint32_t)(int32_t)%(val)s);',
+                   '%(val)s = (int16_t)PLAYERXDR_GET32(%(buf)s);',
+                   'PLAYERXDR_NPUT32(%(buf)s, (uint32_t)(int32_t)%(val)s);',
+                   '%(val)s = (int16_t)PLAYERXDR_NGET32(%(buf)s);', False),
+  'uint16_t' : (4, 'PLAYERXDR_PUT32(%(buf)s, %(val)s);',
+                   '%(val)s = (uint16_t)PLAYERXDR_GET32(%(buf)s);',
+                   'PLAYERXDR_NPUT32(%(buf)s, %(val)s);',
+                   '%(val)s = (uint16_t)PLAYERXDR_NGET32(%(buf)s);', False),
+  'int8_t'   : (4, 'PLAYERXDR_PUT32(%(buf)s, (uint32_t)(int32_t)%(val)s);',
+                   '%(val)s = (int8_t)PLAYERXDR_GET32(%(buf)s);',
+                   'PLAYERXDR_NPUT32(%(buf)s, (uint32_t)(int32_t)%(val)s);',
+                   '%(val)s = (int8_t)PLAYERXDR_NGET32(%(buf)s);', False),
+  'uint8_t'  : (4, 'PLAYERXDR_PUT32(%(buf)s, %(val)s);',
+                   '%(val)s = (uint8_t)PLAYERXDR_GET32(%(buf)s);',
+                   'PLAYERXDR_NPUT32(%(buf)s, %(val)s);',
+                   '%(val)s = (uint8_t)PLAYERXDR_NGET32(%(buf)s);', False),
+  'bool_t'   : (4, 'PLAYERXDR_PUT32(%(buf)s, %(val)s ? 1 : 0);',
+                   '%(val)s = PLAYERXDR_GET32(%(buf)s) != 0;',
+                   'PLAYERXDR_NPUT32(%(buf)s, %(val)s ? 1 : 0);',
+                   '%(val)s = PLAYERXDR_NGET32(%(buf)s) != 0;', False),
+}
+
+bulklayouts = {}   # Types whose arrays can be (un)packed in bulk, mapped to
+                    # their flattened fields as (primitive type, member
+                    # accessor) pairs. Primitives map to themselves; a
+                    # struct is added in pass 1 if all of its members are
+                    # scalars with a layout of their own.
+for t in bulkprimitives:
+  bulklayouts[t] = [(t, '')]
+
+def BulkWireSize(typename):
+  size = 0
+  for (t, accessor) in bulklayouts[typename]:
+    size += bulkprimitives[t][0]
+  return size
+
 class DataTypeMember:
   arraypattern = re.compile('\[(.*?)\]')
   pointerpattern = re.compile('\*')
@@ -112,6 +173,19 @@ class DataType:
     if self.dynamic:
       hasdynamic.append (self.typename)
 
+    layout = []
+    for m in self.members:
+      for v in m.variables:
+        if v.array or m.typename not in bulklayouts:
+          layout = None
+          break
+        for (t, accessor) in bulklayouts[m.typename]:
+          layout.append((t, '.' + v.Name + accessor))
+      if layout is None:
+        break
+    if layout:
+      bulklayouts[self.typename] = layout
+
       
   def GetVarNames(self):
     varnames = []
@@ -133,9 +207,202 @@ class MethodGenerator:
   def __init__(self,headerfile,sourcefile):
     self.headerfile = headerfile
     self.sourcefile = sourcefile
-    
-          
+    self.bulkdone = []
+
+
+  def gen_bulk_helpers(self):
+    self.sourcefile.write("""
+/* Word conversions for the bulk array codecs. Assembling each big-endian
+   XDR word from bytes needs no byte order checks or alignment, and loops
+   of them compile down to (vectorised) byte swaps. */
+#define PLAYERXDR_PUT32(buf, v) do { \\
+    unsigned char* b_ = (unsigned char*)(buf); uint32_t v_ = (v); \\
+    b_[0] = (unsigned char)(v_ >> 24); b_[1] = (unsigned char)(v_ >> 16); \\
+    b_[2] = (unsigned char)(v_ >> 8); b_[3] = (unsigned char)v_; } while(0)
+#define PLAYERXDR_GET32(buf) \\
+    (((uint32_t)((const unsigned char*)(buf))[0] << 24) | \\
+     ((uint32_t)((const unsigned char*)(buf))[1] << 16) | \\
+     ((uint32_t)((const unsigned char*)(buf))[2] << 8) | \\
+     (uint32_t)((const unsigned char*)(buf))[3])
+#define PLAYERXDR_PUT64(buf, v) do { uint64_t w64_ = (v); \\
+    PLAYERXDR_PUT32((buf), (uint32_t)(w64_ >> 32)); \\
+    PLAYERXDR_PUT32((char*)(buf) + 4, (uint32_t)w64_); } while(0)
+#define PLAYERXDR_GET64(buf) \\
+    (((uint64_t)PLAYERXDR_GET32(buf) << 32) | PLAYERXDR_GET32((const char*)(buf) + 4))
+#define PLAYERXDR_PUT_FLOAT(buf, v) do { float f_ = (v); uint32_t w_; \\
+    memcpy(&w_, &f_, sizeof(w_)); PLAYERXDR_PUT32((buf), w_); } while(0)
+#define PLAYERXDR_GET_FLOAT(buf, v) do { uint32_t w_ = PLAYERXDR_GET32(buf); \\
+    memcpy(&(v), &w_, sizeof(w_)); } while(0)
+#define PLAYERXDR_PUT_DOUBLE(buf, v) do { double d_ = (v); uint64_t w_; \\
+    memcpy(&w_, &d_, sizeof(w_)); PLAYERXDR_PUT64((buf), w_); } while(0)
+#define PLAYERXDR_GET_DOUBLE(buf, v) do { uint64_t w_ = PLAYERXDR_GET64(buf); \\
+    memcpy(&(v), &w_, sizeof(w_)); } while(0)
+
+/* Host order words, for the native encoding */
+#define PLAYERXDR_NPUT32(buf, v) do { uint32_t w_ = (v); \\
+    memcpy((buf), &w_, sizeof(w_)); } while(0)
+#define PLAYERXDR_NGET32(buf) playerxdr_nget32(buf)
+
+#if defined (__GNUC__)
+  #define PLAYERXDR_BULK_CODEC static __attribute__((unused)) int
+  #define PLAYERXDR_BULK_INLINE static __attribute__((unused))
+#else
+  #define PLAYERXDR_BULK_CODEC static int
+  #define PLAYERXDR_BULK_INLINE static
+#endif
+
+PLAYERXDR_BULK_INLINE uint32_t playerxdr_nget32(const char* buf)
+{
+  uint32_t w;
+  memcpy(&w, buf, sizeof(w));
+  return(w);
+}
+
+""")
+
+
+  def gen_bulk(self,typename,xdr_proc):
+    # Emitted once per element type, ahead of the first pack function that
+    # uses it. The XDR stream hands out its buffer with XDR_INLINE; streams
+    # that cannot (or run short) fall back to the per-element xdr_ proc.
+    if typename in self.bulkdone:
+      return
+    self.bulkdone.append(typename)
+
+    wiresize = BulkWireSize(typename)
+    puts = ''
+    gets = ''
+    nputs = ''
+    ngets = ''
+    raw = 'sizeof(%s) == %d' % (typename, wiresize)
+    offset = 0
+    for (t, accessor) in bulklayouts[typename]:
+      subs = {'buf' : 'buf + ii * %d + %d' % (wiresize, offset),
+              'val' : 'data[ii]' + accessor}
+      puts += '        ' + bulkprimitives[t][1] % subs + '\n'
+      gets += '        ' + bulkprimitives[t][2] % subs + '\n'
+      nputs += '        ' + bulkprimitives[t][3] % subs + '\n'
+      ngets += '        ' + bulkprimitives[t][4] % subs + '\n'
+      if not bulkprimitives[t][5]:
+        raw = '0'
+      elif accessor != '' and raw != '0':
+        raw += ' &&\n        offsetof(%s, %s) == %d' % (typename, accessor[1:], offset)
+      offset += bulkprimitives[t][0]
+
+    self.sourcefile.write("""
+/* Bulk codec for an array of %(typename)s, identical on the wire to
+   xdr_vector() with %(xdr_proc)s. On a native stream an array laid out
+   in memory as it is on the wire is simply copied. */
+PLAYERXDR_BULK_CODEC playerxdr_bulk_%(typename)s(XDR* xdrs, %(typename)s* data, u_int count)
+{
+  char* buf;
+  u_int ii;
+  if(count == 0)
+    return(1);
+  if((xdrs->x_op == XDR_ENCODE || xdrs->x_op == XDR_DECODE) &&
+     count <= UINT_MAX / %(wiresize)d &&
+     (buf = (char*)XDR_INLINE(xdrs, count * %(wiresize)d)) != NULL)
+  {
+    if(!playerxdr_native_stream(xdrs))
+    {
+      if(xdrs->x_op == XDR_ENCODE)
+      {
+        for(ii = 0; ii < count; ii++)
+        {
+%(puts)s        }
+      }
+      else
+      {
+        for(ii = 0; ii < count; ii++)
+        {
+%(gets)s        }
+      }
+    }
+    else if(%(raw)s)
+    {
+      if(xdrs->x_op == XDR_ENCODE)
+        memcpy(buf, data, count * %(wiresize)d);
+      else
+        memcpy(data, buf, count * %(wiresize)d);
+    }
+    else if(xdrs->x_op == XDR_ENCODE)
+    {
+      for(ii = 0; ii < count; ii++)
+      {
+%(nputs)s      }
+    }
+    else
+    {
+      for(ii = 0; ii < count; ii++)
+      {
+%(ngets)s      }
+    }
+    return(1);
+  }
+  for(ii = 0; ii < count; ii++)
+    if(%(xdr_proc)s(xdrs, &data[ii]) != 1)
+      return(0);
+  return(1);
+}
+
+/* Bulk codec for a counted array of %(typename)s, identical on the wire to
+   xdr_array() with %(xdr_proc)s. */
+PLAYERXDR_BULK_CODEC playerxdr_bulk_array_%(typename)s(XDR* xdrs, %(typename)s** addrp, u_int* sizep, u_int maxsize)
+{
+  if(xdrs->x_op != XDR_ENCODE && xdrs->x_op != XDR_DECODE)
+    return(xdr_array(xdrs, (char**)addrp, sizep, maxsize, sizeof(%(typename)s), (xdrproc_t)%(xdr_proc)s));
+  if(xdr_u_int(xdrs, sizep) != 1)
+    return(0);
+  if(*sizep > maxsize || *sizep > UINT_MAX / sizeof(%(typename)s))
+    return(0);
+  if(*addrp == NULL && xdrs->x_op == XDR_DECODE && *sizep > 0)
+  {
+    if((*addrp = calloc(*sizep, sizeof(%(typename)s))) == NULL)
+      return(0);
+  }
+  return(playerxdr_bulk_%(typename)s(xdrs, *addrp, *sizep));
+}
+""" % {"typename":typename, "xdr_proc":xdr_proc, "wiresize":wiresize,
+       "puts":puts, "gets":gets, "nputs":nputs, "ngets":ngets, "raw":raw})
+
+
+  def get_xdr_proc(self,typename):
+    # Do some name mangling for common types
+    if typename == 'long long':
+      return 'xdr_longlong_t'
+    elif typename == 'int64_t':
+      return 'playerxdr_int64_t'
+    elif typename == 'double':
+      return 'playerxdr_double'
+    elif typename == 'uint64_t':
+      return 'xdr_u_long'
+    elif typename == 'int32_t':
+      return 'xdr_int'
+    elif typename == 'uint32_t':
+      return 'xdr_u_int'
+    elif typename == 'int16_t':
+      return 'xdr_short'
+    elif typename == 'uint16_t':
+      return 'xdr_u_short'
+    elif typename == 'int8_t' or typename == 'char':
+      return 'xdr_char'
+    elif typename == 'uint8_t':
+      return 'xdr_u_char'
+    elif typename == 'bool_t':
+      return 'xdr_bool'
+    else:
+      # rely on a previous declaration of an xdr_ proc for this type
+      return 'xdr_' + typename
+
+
   def gen_internal_pack(self,datatype):
+    for member in datatype.members:
+      xdr_proc = self.get_xdr_proc(member.typename)
+      if member.typename in bulklayouts and xdr_proc != 'xdr_u_char' and xdr_proc != 'xdr_char':
+        for var in member.variables:
+          if var.array:
+            self.gen_bulk(member.typename, xdr_proc)
+
     self.headerfile.write("int xdr_%(typename)s (XDR* xdrs, %(typename)s * msg);\n" % {"typename":datatype.typename})
     
     self.sourcefile.write("""
@@ -145,31 +412,9 @@ int xdr_%(typename)s (XDR* xdrs, %(typename)s * msg)
     sourcefile = self.sourcefile
 
     for member in datatype.members:
-      # Do some name mangling for common types
-      if member.typename == 'long long':
-        xdr_proc = 'xdr_longlong_t'
-      elif member.typename == 'int64_t':
-        xdr_proc = 'xdr_longlong_t'
-      elif member.typename == 'uint64_t':
-        xdr_proc = 'xdr_u_long'
-      elif member.typename == 'int32_t':
-        xdr_proc = 'xdr_int'
-      elif member.typename == 'uint32_t':
-        xdr_proc = 'xdr_u_int'
-      elif member.typename == 'int16_t':
-        xdr_proc = 'xdr_short'
-      elif member.typename == 'uint16_t':
-        xdr_proc = 'xdr_u_short'
-      elif member.typename == 'int8_t' or member.typename == 'char':
-        xdr_proc = 'xdr_char'
-      elif member.typename == 'uint8_t':
-        xdr_proc = 'xdr_u_char'
-      elif member.typename == 'bool_t':
-        xdr_proc = 'xdr_bool'
-      else:
-        # rely on a previous declaration of an xdr_ proc for this type
-        xdr_proc = 'xdr_' + member.typename
-      
+      xdr_proc = self.get_xdr_proc(member.typename)
+      bulk = member.typename in bulklayouts
+
       for var in member.variables:
         if var.array:
           if var.arraysize == '':  # Handle a dynamically allocated array
@@ -191,6 +436,11 @@ int xdr_%(typename)s (XDR* xdrs, %(typename)s * msg)
               sourcefile.write('    ' + member.typename + '* ' + var.pointervar + ' = msg->' + var.Name + ';\n')
               sourcefile.write('    if(xdr_bytes(xdrs, (char**)&' + var.pointervar + ', &msg->' + var.countvar + ', msg->' + var.countvar + ') != 1)\n      return(0);\n')
               sourcefile.write('  }\n')
+            elif bulk:
+              sourcefile.write('  {\n')
+              sourcefile.write('    ' + member.typename + '* ' + var.pointervar + ' = msg->' + var.Name + ';\n')
+              sourcefile.write('    if(playerxdr_bulk_array_' + member.typename + '(xdrs, &' + var.pointervar + ', &msg->' + var.countvar + ', msg->' + var.countvar + ') != 1)\n      return(0);\n')
+              sourcefile.write('  }\n')
             else:
               sourcefile.write('  {\n')
               sourcefile.write('    ' + member.typename + '* ' + var.pointervar + ' = msg->' + var.Name + ';\n')
@@ -216,6 +466,14 @@ int xdr_%(typename)s (XDR* xdrs, %(typename)s * msg)
                                 ', &msg->' + var.countvar +
                                 ', ' + var.arraysize + ') != 1)\n      return(0);\n')
                 sourcefile.write('  }\n')
+              elif bulk:
+                sourcefile.write('  {\n')
+                sourcefile.write('    ' + member.typename + '* ' + var.pointervar +
+                                ' = msg->' + var.Name + ';\n')
+                sourcefile.write('    if(playerxdr_bulk_array_' + member.typename +
+                                '(xdrs, &' + var.pointervar + ', &msg->' + var.countvar +
+                                ', ' + var.arraysize + ') != 1)\n      return(0);\n')
+                sourcefile.write('  }\n')
               else:
                 sourcefile.write('  {\n')
                 sourcefile.write('    ' + member.typename + '* ' + var.pointervar +
@@ -232,6 +490,9 @@ int xdr_%(typename)s (XDR* xdrs, %(typename)s * msg)
               if xdr_proc == 'xdr_u_char' or xdr_proc == 'xdr_char':
                 sourcefile.write('  if(xdr_opaque(xdrs, (char*)&msg->' +
                                   var.Name + ', ' + var.arraysize + ') != 1)\n    return(0);\n')
+              elif bulk:
+                sourcefile.write('  if(playerxdr_bulk_' + member.typename + '(xdrs, msg->' +
+                                  var.Name + ', ' + var.arraysize + ') != 1)\n    return(0);\n')
               else:
                 sourcefile.write('  if(xdr_vector(xdrs, (char*)&msg->' +
                                   var.Name + ', ' + var.arraysize +
@@ -254,7 +515,13 @@ int xdr_%(typename)s (XDR* xdrs, %(typename)s * msg)
   int len;
   if(!buflen)
     return 0;
-  xdrmem_create(&xdrs, buf, buflen, op);
+  if(op & PLAYERXDR_NATIVE)
+  {
+    op &= ~PLAYERXDR_NATIVE;
+    playerxdr_native_create(&xdrs, buf, buflen, op);
+  }
+  else
+    xdrmem_create(&xdrs, buf, buflen, op);
   if(xdr_%(typename)s(&xdrs,msg) != 1)
     return(-1);
   if(op == PLAYERXDR_ENCODE)
@@ -528,15 +795,32 @@ if __name__ == '__main__':
 #endif
 #define PLAYERXDR_ENCODE XDR_ENCODE
 #define PLAYERXDR_DECODE XDR_DECODE
+/* Or'd into the op given to a pack function to use the native wire
+   encoding (PLAYER_ENCODING_NATIVE) rather than XDR */
+#define PLAYERXDR_NATIVE 0x100
 
 #define PLAYERXDR_MSGHDR_SIZE 40
 #define PLAYERXDR_MAX_MESSAGE_SIZE (4*PLAYER_MAX_MESSAGE_SIZE)
+
+/** Set up an XDR stream over @p buf for the native wire encoding: the XDR
+    layout, with host byte order words and raw 64-bit values */
+PLAYERXDR_EXPORT void playerxdr_native_create(XDR* xdrs, char* buf, u_int size, enum xdr_op op);
+/** Is @p xdrs a native encoding stream? */
+PLAYERXDR_EXPORT int playerxdr_native_stream(XDR* xdrs);
+/** Fill in the host's byte order marker for a player_device_encoding_req_t */
+PLAYERXDR_EXPORT void playerxdr_native_byteorder(uint8_t order[4]);
+/** xdr_double(), or the raw value on a native stream */
+PLAYERXDR_EXPORT bool_t playerxdr_double(XDR* xdrs, double* dp);
+/** xdr_longlong_t(), or the raw value on a native stream */
+PLAYERXDR_EXPORT bool_t playerxdr_int64_t(XDR* xdrs, int64_t* lp);
 """)
     sourcefile.write("""
 #include <%(headerfilename)s>
 #include <string.h>
 
 #include <stdlib.h>
+#include <stddef.h>
+#include <limits.h>
 """ % {"headerfilename":headerfilename})
   else:
     ifndefsymbol = '_' + os.path.split (infilenames[0])[1].replace('.','_').replace('/','_').upper() + '_XDR_'
@@ -550,7 +834,9 @@ if __name__ == '__main__':
     sourcefile.write('#include <rpc/xdr.h>\n\n')
     sourcefile.write('#include "' + os.path.split(headerfilename)[-1] + '"\n')
     sourcefile.write('#include <string.h>\n')
-    sourcefile.write('#include <stdlib.h>\n\n')
+    sourcefile.write('#include <stdlib.h>\n')
+    sourcefile.write('#include <stddef.h>\n')
+    sourcefile.write('#include <limits.h>\n')
 
 
   # strip C++-style comments
@@ -576,6 +862,7 @@ if __name__ == '__main__':
 #  pointerpattern = re.compile('[A-Za-z0-9_]+\*|\*[A-Za-z0-9_]+')
 
   gen = MethodGenerator(headerfile,sourcefile)
+  gen.gen_bulk_helpers()
   
   for s in structs:
     # extract prefix for packing function name and type of struct
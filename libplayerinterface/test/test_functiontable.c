@@ -0,0 +1,68 @@
+/*
+ *  Player - One Hell of a Robot Server
+ *  Copyright (C) 2000
+ *     Brian Gerkey, Kasper Stoy, Richard Vaughan, & Andrew Howard
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+/*
+ * $Id$
+ *
+ * Checks that lookups in the XDR function table stay short, with all the
+ * built-in interfaces loaded, and that every row can still be found.
+ */
+
+#include <stdio.h>
+
+#include <libplayerinterface/player.h>
+#include <libplayerinterface/functiontable.h>
+
+#include "playertest.h"
+
+/* With the index kept under half full, a well spread hash finds an entry
+ * in about 1.5 probes on average */
+#define MAX_MEAN_PROBES 2.0
+#define MAX_PROBES 32
+
+int
+main(int argc, char** argv)
+{
+  int entries, total, max;
+  double mean;
+
+  playerxdr_ftable_init();
+  playerxdr_ftable_stats(&entries, &total, &max);
+  mean = entries ? (double)total / entries : 0.0;
+  printf("%d entries, %.2f probes on average, %d at most\n",
+         entries, mean, max);
+
+  check(entries > 0, "the index has entries");
+  check(mean <= MAX_MEAN_PROBES, "few probes on average");
+  check(max <= MAX_PROBES, "few probes for any one entry");
+
+  /* a few well known rows */
+  check(playerxdr_get_packfunc(PLAYER_LASER_CODE, PLAYER_MSGTYPE_DATA,
+                               PLAYER_LASER_DATA_SCAN) &&
+        playerxdr_get_packfunc(PLAYER_POSITION2D_CODE, PLAYER_MSGTYPE_RESP_ACK,
+                               PLAYER_POSITION2D_REQ_GET_GEOM) &&
+        playerxdr_get_packfunc(PLAYER_RANGER_CODE, PLAYER_MSGTYPE_DATA,
+                               PLAYER_RANGER_DATA_RANGE),
+        "built-in rows are found");
+
+  return(test_result());
+}
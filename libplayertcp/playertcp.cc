@@ -51,6 +51,15 @@
 #include <stddef.h>
 #include <time.h>
 #include <fcntl.h>
+#if HAVE_SYS_UIO_H
+  #include <sys/uio.h>
+#endif
+#if HAVE_LINUX_SOCKIOS_H
+  #include <linux/sockios.h>
+#endif
+#if !defined (WIN32)
+  #include <sys/time.h>
+#endif
 #if ENABLE_TCP_NODELAY
   #include <netinet/tcp.h>
 #endif
@@ -59,6 +68,13 @@
   #include <zlib.h>
 #endif
 
+// Network threads need epoll to watch many queues and sockets at once
+#if HAVE_SYS_EPOLL_H && HAVE_SYS_EVENTFD_H
+  #define PLAYERTCP_NETTHREADS 1
+  #include <sys/epoll.h>
+  #include <sys/eventfd.h>
+#endif
+
 #include <replace/replace.h>
 #include <libplayercore/playercore.h>
 #include <libplayerinterface/playerxdr.h>
@@ -79,6 +95,21 @@ typedef struct playertcp_listener
   int port;
 } playertcp_listener_t;
 
+/** @brief A run of encoded bytes waiting to be sent to a client.  The bytes
+ * are in the connection's write buffer or, for a payload whose encoding
+ * another connection cached on the message, on the message itself. */
+typedef struct playertcp_chunk
+{
+  /** Message holding the bytes, or NULL if they are in the write buffer */
+  Message* msg;
+  /** Start of the message's cached encoding, if @p msg is set */
+  const char* data;
+  /** Offset of the first unsent byte, from @p data or the write buffer */
+  size_t off;
+  /** Number of bytes still to send */
+  size_t len;
+} playertcp_chunk_t;
+
 /** @brief A TCP Connection */
 typedef struct playertcp_conn
 {
@@ -108,13 +139,34 @@ typedef struct playertcp_conn
   /** How much of @p readbuffer is currently in use (i.e., holding a
     partial message) */
   int readbufferlen;
-  /** Buffer in which to store partial outgoint messages */
+  /** Buffer in which outgoing messages are encoded */
   char* writebuffer;
   /** Total size of @p writebuffer */
   int writebuffersize;
-  /** How much of @p writebuffer is currently in use (i.e., holding a
-    partial message) */
+  /** How much of @p writebuffer is currently in use (i.e., holding
+    encoded messages that have not all been sent) */
   int writebufferlen;
+  /** Encoded messages waiting to be sent, in order */
+  playertcp_chunk_t writechunks[PLAYERTCP_WRITECHUNKS];
+  /** Number of entries in @p writechunks */
+  int num_writechunks;
+  /** First entry in @p writechunks that has not all been sent */
+  int writechunk;
+  /** Total number of bytes waiting to be sent */
+  size_t writepending;
+  /** Bytes sent to the client so far, and messages encoded for it */
+  uint64_t bytes_sent;
+  uint64_t msgs_sent;
+  /** Estimated rate (bytes/s) at which the client takes data */
+  double throughput;
+  /** Start of the current throughput estimation period, with @p
+   * bytes_sent and the kernel's send queue length at the time */
+  double rate_time;
+  uint64_t rate_bytes;
+  size_t rate_outq;
+  /** Estimated bytes waiting for the client, and time (s) to take them */
+  size_t backlog;
+  double lag;
   /** Linked list of devices to which we are subscribed */
   Device** dev_subs;
   size_t num_dev_subs;
@@ -122,8 +174,67 @@ typedef struct playertcp_conn
    * TCPRemoteDriver uses this flag to know when the connection has been
    * closed, and thus that it should stop publishing to its queue. */
   int* kill_flag;
+  /** Network thread that writes to this connection, or NULL if
+   * PlayerTCP::Write() does */
+  struct playertcp_netthread* netthread;
+  /** Index of this connection in the network thread's slots */
+  int netslot;
+  /** Is the global file watcher waiting for @p fd to become writable? */
+  int writewatch;
+  /** Wire encoding (PLAYER_ENCODING_*) of messages from the client */
+  int encoding;
+  /** Wire encoding of messages to the client.  It catches up with @p
+   * encoding once the acknowledgement of a change has been encoded. */
+  int write_encoding;
+  /** Compression (PLAYER_COMPRESSION_*) the client asked for, and the one
+   * applied to messages to it, which likewise catches up */
+  int compression;
+  int write_compression;
+  /** Smallest encoded body worth compressing */
+  size_t compress_threshold;
+#if HAVE_Z
+  /** Compression context, made when the client first asks for it */
+  z_stream* zstream;
+#endif
+  /** Scratch space for compressing */
+  char* zbuffer;
+  size_t zbuffersize;
 } playertcp_conn_t;
 
+/** Maximum number of epoll events handled per wakeup */
+#define PLAYERTCP_NETTHREAD_EVENTS 64
+/** epoll key of a network thread's own wakeup descriptor */
+#define PLAYERTCP_NETTHREAD_CONTROL (~(uint64_t)0)
+
+/** @brief A network thread's place for one connection.  The epoll key of
+ * a connection's descriptors is its slot number and the slot's generation,
+ * so that events still pending for a departed connection are ignored. */
+typedef struct playertcp_netslot
+{
+  /** The connection, or NULL if the slot is free */
+  playertcp_conn_t* conn;
+  /** Incremented each time the slot is taken or freed */
+  uint32_t gen;
+  /** Is the socket in the epoll set, waiting to become writable? */
+  int armed;
+} playertcp_netslot_t;
+
+/** @brief A thread that writes to a set of connections */
+typedef struct playertcp_netthread
+{
+  PlayerTCP* ptcp;
+  pthread_t thread;
+  /** Held while the thread is writing, and to change the slots */
+  pthread_mutex_t mutex;
+  int epfd;
+  /** eventfd used to tell the thread to quit */
+  int wakefd;
+  int quit;
+  playertcp_netslot_t* slots;
+  int num_slots;
+  int num_conns;
+} playertcp_netthread_t;
+
 void
 PlayerTCP::InitGlobals(void)
 {
@@ -147,8 +258,11 @@ PlayerTCP::PlayerTCP()
   this->thread = pthread_self();
   this->size_clients = 0;
   this->num_clients = 0;
-  this->clients = (playertcp_conn_t*)NULL;
+  this->clients = (playertcp_conn_t**)NULL;
   this->client_ufds = (struct pollfd*)NULL;
+  this->num_netthreads = 0;
+  this->netthreads = NULL;
+  this->max_lag = 0.0;
 
   pthread_mutex_init(&this->clients_mutex,NULL);
 
@@ -172,8 +286,12 @@ PlayerTCP::PlayerTCP()
 
 PlayerTCP::~PlayerTCP()
 {
+  this->StopNetworkThreads();
   for(int i=0;i<this->num_clients;i++)
+  {
     this->Close(i);
+    delete this->clients[i];
+  }
   free(this->clients);
   free(this->client_ufds);
   free(this->listeners);
@@ -268,9 +386,9 @@ PlayerTCP::AddClient(struct sockaddr_in* cliaddr,
   if(j == this->size_clients)
   {
     this->size_clients++;
-    this->clients = (playertcp_conn_t*)realloc(this->clients,
-                                               this->size_clients *
-                                               sizeof(playertcp_conn_t));
+    this->clients = (playertcp_conn_t**)realloc(this->clients,
+                                                this->size_clients *
+                                                sizeof(playertcp_conn_t*));
     assert(this->clients);
 
     this->client_ufds = (struct pollfd*)realloc(this->client_ufds,
@@ -279,42 +397,65 @@ PlayerTCP::AddClient(struct sockaddr_in* cliaddr,
     assert(this->client_ufds);
   }
 
-  memset(this->clients + j, 0, sizeof(playertcp_conn_t));
+  // Connections are allocated one by one, so that they stay put for a
+  // network thread while the list changes
+  this->clients[j] = new playertcp_conn_t();
   // Store the client's info
-  this->clients[j].valid = 1;
-  this->clients[j].del = 0;
-  this->clients[j].host = local_host;
-  this->clients[j].port = local_port;
-  this->clients[j].fd = newsock;
+  this->clients[j]->valid = 1;
+  this->clients[j]->del = 0;
+  this->clients[j]->host = local_host;
+  this->clients[j]->port = local_port;
+  this->clients[j]->fd = newsock;
   if(cliaddr)
-    this->clients[j].addr = *cliaddr;
-  this->clients[j].dev_subs = NULL;
-  this->clients[j].num_dev_subs = 0;
-  this->clients[j].kill_flag = kill_flag;
+    this->clients[j]->addr = *cliaddr;
+  this->clients[j]->dev_subs = NULL;
+  this->clients[j]->num_dev_subs = 0;
+  this->clients[j]->kill_flag = kill_flag;
+  this->clients[j]->encoding = PLAYER_ENCODING_XDR;
+  this->clients[j]->write_encoding = PLAYER_ENCODING_XDR;
+  this->clients[j]->compression = PLAYER_COMPRESSION_NONE;
+  this->clients[j]->write_compression = PLAYER_COMPRESSION_NONE;
+  this->clients[j]->compress_threshold = PLAYERTCP_COMPRESS_THRESHOLD;
+#if HAVE_Z
+  this->clients[j]->zstream = NULL;
+#endif
+  this->clients[j]->zbuffer = NULL;
+  this->clients[j]->zbuffersize = 0;
 
   // Set up for later use of poll
-  this->client_ufds[j].fd = this->clients[j].fd;
+  this->client_ufds[j].fd = this->clients[j]->fd;
   this->client_ufds[j].events = POLLIN;
 
   // set up for later use by global file watcher
   fileWatcher->AddFileWatch(this->client_ufds[j].fd);
 
   // Create an outgoing queue for this client
-  this->clients[j].queue = queue;
+  this->clients[j]->queue = queue;
 
   // Create a buffer to hold incoming messages
-  this->clients[j].readbuffersize = PLAYERTCP_READBUFFER_SIZE;
-  this->clients[j].readbuffer =
-          (char*)calloc(1,this->clients[j].readbuffersize);
-  assert(this->clients[j].readbuffer);
-  this->clients[j].readbufferlen = 0;
+  this->clients[j]->readbuffersize = PLAYERTCP_READBUFFER_SIZE;
+  this->clients[j]->readbuffer =
+          (char*)calloc(1,this->clients[j]->readbuffersize);
+  assert(this->clients[j]->readbuffer);
+  this->clients[j]->readbufferlen = 0;
 
   // Create a buffer to hold outgoing messages
-  this->clients[j].writebuffersize = PLAYERTCP_WRITEBUFFER_SIZE;
-  this->clients[j].writebuffer =
-          (char*)calloc(1,this->clients[j].writebuffersize);
-  assert(this->clients[j].writebuffer);
-  this->clients[j].writebufferlen = 0;
+  this->clients[j]->writebuffersize = PLAYERTCP_WRITEBUFFER_SIZE;
+  this->clients[j]->writebuffer =
+          (char*)calloc(1,this->clients[j]->writebuffersize);
+  assert(this->clients[j]->writebuffer);
+  this->clients[j]->writebufferlen = 0;
+  this->clients[j]->num_writechunks = 0;
+  this->clients[j]->writechunk = 0;
+  this->clients[j]->writepending = 0;
+  this->clients[j]->bytes_sent = 0;
+  this->clients[j]->msgs_sent = 0;
+  this->clients[j]->throughput = 0.0;
+  this->clients[j]->rate_time = 0.0;
+  this->clients[j]->rate_bytes = 0;
+  this->clients[j]->rate_outq = 0;
+  this->clients[j]->backlog = 0;
+  this->clients[j]->lag = 0.0;
 
   this->num_clients++;
 
@@ -323,10 +464,11 @@ PlayerTCP::AddClient(struct sockaddr_in* cliaddr,
     memset(data,0,sizeof(data));
     snprintf((char*)data, sizeof(data)-1, "%s%s",
              PLAYER_IDENT_STRING, playerversion);
+    playerxdr_native_byteorder(data + PLAYER_IDENT_BYTEORDER);
 #if defined (WIN32)
-    if(send(this->clients[j].fd, (const char*)data, PLAYER_IDENT_STRLEN, 0) < 0)
+    if(send(this->clients[j]->fd, (const char*)data, PLAYER_IDENT_STRLEN, 0) < 0)
 #else
-    if(send(this->clients[j].fd, (void*)data, PLAYER_IDENT_STRLEN, 0) < 0)
+    if(send(this->clients[j]->fd, (void*)data, PLAYER_IDENT_STRLEN, 0) < 0)
 #endif
     {
       PLAYER_ERROR("failed to send ident string");
@@ -334,15 +476,20 @@ PlayerTCP::AddClient(struct sockaddr_in* cliaddr,
   }
 
   PLAYER_MSG3(1, "accepted TCP client %d on port %d, fd %d",
-              j, this->clients[j].port, this->clients[j].fd);
+              j, this->clients[j]->port, this->clients[j]->fd);
+
+  this->AttachClient(this->clients[j]);
+  // Otherwise the main loop writes to it, and must wake up for its queue
+  if(!this->clients[j]->netthread)
+    fileWatcher->AddFileWatch(this->clients[j]->queue->GetNotifyFd());
 
-  assert (this->clients[j].queue != NULL);
+  assert (this->clients[j]->queue != NULL);
 
   if(!have_lock)
     Unlock();
 
-  assert (this->clients[j].queue != NULL);
-  return(this->clients[j].queue);
+  assert (this->clients[j]->queue != NULL);
+  return(this->clients[j]->queue);
 }
 
 int
@@ -451,33 +598,62 @@ PlayerTCP::Close(int cli)
   assert((cli >= 0) && (cli < this->num_clients));
 
   PLAYER_MSG2(1, "closing TCP connection to client %d on port %d",
-              cli, this->clients[cli].port);
+              cli, this->clients[cli]->port);
 
-  for(size_t i=0;i<this->clients[cli].num_dev_subs;i++)
+  if(this->clients[cli]->netthread)
+    this->DetachClient(this->clients[cli]);
+  else
+    fileWatcher->RemoveFileWatch(this->clients[cli]->queue->GetNotifyFd());
+  if(this->clients[cli]->writewatch)
+    fileWatcher->RemoveFileWatch(this->clients[cli]->fd, false, true, false);
+
+  for(size_t i=0;i<this->clients[cli]->num_dev_subs;i++)
   {
-    Device* dev = this->clients[cli].dev_subs[i];
+    Device* dev = this->clients[cli]->dev_subs[i];
     {
       if(dev)
-        dev->Unsubscribe(this->clients[cli].queue);
+        dev->Unsubscribe(this->clients[cli]->queue);
     }
   }
-  free(this->clients[cli].dev_subs);
-  fileWatcher->RemoveFileWatch(this->clients[cli].fd);
+  if(this->clients[cli]->queue->GetDiscardCount())
+    PLAYER_MSG3(2, "client on socket %d was sent %llu bytes; %u messages to it were discarded",
+                this->clients[cli]->fd,
+                (unsigned long long)this->clients[cli]->bytes_sent,
+                this->clients[cli]->queue->GetDiscardCount());
+  free(this->clients[cli]->dev_subs);
+  fileWatcher->RemoveFileWatch(this->clients[cli]->fd);
 #if defined (WIN32)
-  if (closesocket (this->clients[cli].fd) != 0)
+  if (closesocket (this->clients[cli]->fd) != 0)
     STRERROR (PLAYER_WARN1, "closesocket() failed: %s");
 #else
-  if(close(this->clients[cli].fd) < 0)
+  if(close(this->clients[cli]->fd) < 0)
     STRERROR (PLAYER_WARN1, "close() failed: %s");
 #endif
 
-  this->clients[cli].fd = -1;
-  this->clients[cli].valid = 0;
-  this->clients[cli].queue = QueuePointer();
-  free(this->clients[cli].readbuffer);
-  free(this->clients[cli].writebuffer);
-  if(this->clients[cli].kill_flag)
-    *(this->clients[cli].kill_flag) = 1;
+  this->clients[cli]->fd = -1;
+  this->clients[cli]->valid = 0;
+  this->clients[cli]->queue = QueuePointer();
+  free(this->clients[cli]->readbuffer);
+  free(this->clients[cli]->writebuffer);
+#if HAVE_Z
+  if(this->clients[cli]->zstream)
+  {
+    deflateEnd(this->clients[cli]->zstream);
+    delete this->clients[cli]->zstream;
+    this->clients[cli]->zstream = NULL;
+  }
+#endif
+  free(this->clients[cli]->zbuffer);
+  this->clients[cli]->zbuffer = NULL;
+  this->clients[cli]->zbuffersize = 0;
+  for(int i = this->clients[cli]->writechunk;
+      i < this->clients[cli]->num_writechunks; i++)
+    delete this->clients[cli]->writechunks[i].msg;
+  this->clients[cli]->num_writechunks = 0;
+  this->clients[cli]->writechunk = 0;
+  this->clients[cli]->writepending = 0;
+  if(this->clients[cli]->kill_flag)
+    *(this->clients[cli]->kill_flag) = 1;
 }
 
 int
@@ -526,7 +702,7 @@ PlayerTCP::Read(int timeout, bool have_lock)
         (this->client_ufds[i].revents & POLLNVAL)))
     {
       PLAYER_WARN1("other error on client %d", i);
-      this->clients[i].del = 1;
+      this->clients[i]->del = 1;
       num_available--;
     }
     else if(this->client_ufds[i].revents & POLLIN)
@@ -534,7 +710,7 @@ PlayerTCP::Read(int timeout, bool have_lock)
       if(this->ReadClient(i) < 0)
       {
         PLAYER_MSG1(2,"failed to read from client %d", i);
-        this->clients[i].del = 1;
+        this->clients[i]->del = 1;
       }
       num_available--;
     }
@@ -555,9 +731,9 @@ PlayerTCP::DeleteClients()
   // Delete those connections that generated errors in this iteration
   for(int i=0; i<this->num_clients; i++)
   {
-    if(this->clients[i].del)
+    if(this->clients[i]->del)
     {
-      this->clients[i].valid = 0;
+      this->clients[i]->valid = 0;
       this->Close(i);
       num_deleted++;
     }
@@ -567,33 +743,31 @@ PlayerTCP::DeleteClients()
   // Delete those connections that generated errors in this iteration
   for(int i=0; i<this->num_clients; i++)
   {
-    if(this->clients[i].valid && this->clients[i].del)
+    if(this->clients[i]->valid && this->clients[i]->del)
     {
       this->Close(i);
       num_deleted++;
     }
   }*/
 
-  this->num_clients -= num_deleted;
-
-  // Remove the resulting blank from both lists
-  for(int i=0,j=0; i<this->size_clients; i++)
+  // Remove the resulting blanks from both lists
+  int j=0;
+  for(int i=0; i<this->num_clients; i++)
   {
-    if(this->clients[j].del)
-    {
-      memmove(this->clients + j,
-              this->clients + j + 1,
-              (this->size_clients - j - 1) * sizeof(playertcp_conn_t));
-      memmove(this->client_ufds + j,
-              this->client_ufds + j + 1,
-              (this->size_clients - j - 1) * sizeof(struct pollfd));
-    }
+    if(this->clients[i]->del)
+      delete this->clients[i];
     else
+    {
+      this->clients[j] = this->clients[i];
+      this->client_ufds[j] = this->client_ufds[i];
       j++;
+    }
   }
+  this->num_clients -= num_deleted;
+  assert(this->num_clients == j);
   assert(this->num_clients <= this->size_clients);
   memset(this->clients + this->num_clients, 0,
-         (this->size_clients - this->num_clients) * sizeof(playertcp_conn_t));
+         (this->size_clients - this->num_clients) * sizeof(playertcp_conn_t*));
   memset(this->client_ufds + this->num_clients, 0,
          (this->size_clients - this->num_clients) * sizeof(struct pollfd));
 }
@@ -607,10 +781,10 @@ PlayerTCP::DeleteClient(QueuePointer &q, bool have_lock)
   int i;
   for(i=0;i<this->num_clients;i++)
   {
-    if(this->clients[i].queue == q)
+    if(this->clients[i]->queue == q)
     {
-      this->clients[i].del = 1;
-      this->clients[i].kill_flag = NULL;
+      this->clients[i]->del = 1;
+      this->clients[i]->kill_flag = NULL;
       break;
     }
   }
@@ -632,204 +806,546 @@ PlayerTCP::Listening(int port)
 int
 PlayerTCP::WriteClient(int cli)
 {
-  int numwritten;
-  playertcp_conn_t* client;
-  Message* msg;
+  assert((cli >= 0) && (cli < this->num_clients));
+  return(this->WriteConnection(this->clients[cli]));
+}
+
+// Add a run of bytes to the end of a connection's pending output, merging
+// it with the previous run if they are contiguous in the write buffer
+static void
+playertcp_add_chunk(playertcp_conn_t* client, Message* msg,
+                    const char* data, size_t off, size_t len)
+{
+  playertcp_chunk_t* chunk;
+
+  assert(client->num_writechunks < PLAYERTCP_WRITECHUNKS);
+  if(!msg && (client->num_writechunks > client->writechunk))
+  {
+    chunk = client->writechunks + client->num_writechunks - 1;
+    if(!chunk->msg && (chunk->off + chunk->len == off))
+    {
+      chunk->len += len;
+      client->writepending += len;
+      return;
+    }
+  }
+  chunk = client->writechunks + client->num_writechunks++;
+  chunk->msg = msg;
+  chunk->data = data;
+  chunk->off = off;
+  chunk->len = len;
+  client->writepending += len;
+}
+
+// Drop the runs that have been sent from the front of a connection's
+// pending output, and move the unsent part of the write buffer down to the
+// front of it
+static void
+playertcp_compact(playertcp_conn_t* client)
+{
+  playertcp_chunk_t* chunk;
+  size_t start = client->writebufferlen;
+
+  if(client->writechunk)
+  {
+    memmove(client->writechunks, client->writechunks + client->writechunk,
+            (client->num_writechunks - client->writechunk) *
+            sizeof(playertcp_chunk_t));
+    client->num_writechunks -= client->writechunk;
+    client->writechunk = 0;
+  }
+
+  // Runs in the buffer are in order, so the first one starts the unsent part
+  for(int i = 0; i < client->num_writechunks; i++)
+  {
+    if(!client->writechunks[i].msg)
+    {
+      start = client->writechunks[i].off;
+      break;
+    }
+  }
+  if(!start)
+    return;
+  memmove(client->writebuffer, client->writebuffer + start,
+          client->writebufferlen - start);
+  client->writebufferlen -= start;
+  for(int i = 0; i < client->num_writechunks; i++)
+  {
+    chunk = client->writechunks + i;
+    if(!chunk->msg)
+      chunk->off -= start;
+  }
+}
+
+// Make room for @p size more bytes at the end of a connection's write buffer
+static void
+playertcp_reserve(playertcp_conn_t* client, size_t size)
+{
+  if(client->writebufferlen + size > (size_t)(client->writebuffersize))
+  {
+    // A client that never quite catches up never lets the buffer start
+    // again at the front, so reclaim what has been sent instead of growing
+    // past it.  Only worth the copy if little is left to move, or if that
+    // makes enough room.
+    size_t sent = client->writebufferlen;
+    for(int i = client->writechunk; i < client->num_writechunks; i++)
+    {
+      if(!client->writechunks[i].msg)
+      {
+        sent = client->writechunks[i].off;
+        break;
+      }
+    }
+    if(sent && ((client->writebufferlen - sent <= sent) ||
+                (client->writebufferlen - sent + size <=
+                 (size_t)(client->writebuffersize))))
+      playertcp_compact(client);
+  }
+  if(client->writebufferlen + size > (size_t)(client->writebuffersize))
+  {
+    // Get at least twice as much space.  What is already there is still
+    // waiting to be sent, so it has to be kept.
+    client->writebuffersize = MAX((size_t)(client->writebuffersize * 2),
+                                  client->writebufferlen + size);
+    client->writebuffer = (char*)realloc(client->writebuffer,
+                                         client->writebuffersize);
+    assert(client->writebuffer);
+  }
+}
+
+#if HAVE_Z
+// Make a connection's compression buffer at least @p size bytes long
+static void
+playertcp_zreserve(playertcp_conn_t* client, size_t size)
+{
+  if(size > client->zbuffersize)
+  {
+    client->zbuffersize = MAX(client->zbuffersize * 2, size);
+    client->zbuffer = (char*)realloc(client->zbuffer, client->zbuffersize);
+    assert(client->zbuffer);
+  }
+}
+
+// Compress an encoded message body into the connection's compression
+// buffer, behind its uncompressed length.  Returns the length of the
+// result, or 0 if compressing failed or did not make the body smaller.
+static size_t
+playertcp_compress(playertcp_conn_t* client, const char* body, size_t len)
+{
+  z_stream* zs = client->zstream;
+  size_t bound = 4 + deflateBound(zs, len);
+
+  playertcp_zreserve(client, bound);
+  deflateReset(zs);
+  zs->next_in = (Bytef*)body;
+  zs->avail_in = len;
+  zs->next_out = (Bytef*)client->zbuffer + 4;
+  zs->avail_out = bound - 4;
+  if((deflate(zs, Z_FINISH) != Z_STREAM_END) || (4 + zs->total_out >= len))
+    return(0);
+  client->zbuffer[0] = (char)(len >> 24);
+  client->zbuffer[1] = (char)(len >> 16);
+  client->zbuffer[2] = (char)(len >> 8);
+  client->zbuffer[3] = (char)len;
+  return(4 + zs->total_out);
+}
+#endif
+
+// Encode a message onto the end of a connection's pending output.  The
+// message is deleted, unless its cached encoding is to be sent from where
+// it is, in which case it is deleted once sent.  Messages that cannot be
+// encoded are dropped.
+static void
+playertcp_encode(playertcp_conn_t* client, Message* msg)
+{
   player_pack_fn_t packfunc;
   player_msghdr_t hdr;
   void* payload;
   int encode_msglen;
+  int op;
+  char* start;
+  uint32_t sizeflag = 0;
 
 #if HAVE_Z
-  player_map_data_t* zipped_data=NULL;
+  player_map_data_t zipped_data;
 #endif
 
-  client = this->clients + cli;
-  for(;;)
+  op = PLAYERXDR_ENCODE;
+  if(client->write_encoding == PLAYER_ENCODING_NATIVE)
+    op |= PLAYERXDR_NATIVE;
+
+  // Note that we make a COPY of the header.  This is so that we can
+  // edit the size field before sending it out, without affecting other
+  // instances of the message on other queues.
+  hdr = *msg->GetHeader();
+  payload = msg->GetPayload();
+
+  // HACK: special handling for map data to compress it before sending
+  // them out over the network.
+  if((hdr.addr.interf == PLAYER_MAP_CODE) &&
+     (hdr.type == PLAYER_MSGTYPE_RESP_ACK) &&
+     (hdr.subtype == PLAYER_MAP_REQ_GET_DATA))
   {
-    // try to send any bytes leftover from last time.
-    if(client->writebufferlen)
+#if HAVE_Z
+    player_map_data_t* raw_data = (player_map_data_t*)payload;
+
+    // copy the metadata
+    zipped_data = *raw_data;
+    uLongf count = compressBound(raw_data->data_count);
+    playertcp_zreserve(client, count);
+    zipped_data.data = (int8_t*)client->zbuffer;
+
+    // compress the tile
+    int ret;
+    ret = compress((Bytef*)zipped_data.data,&count,
+                     (const Bytef*)raw_data->data, raw_data->data_count);
+    if((ret != Z_OK) && (ret != Z_STREAM_END))
     {
-      numwritten = send(client->fd,
-                         client->writebuffer,
-                         MIN(client->writebufferlen,
-                             PLAYERTCP_WRITEBUFFER_SIZE), 0);
+      PLAYER_ERROR("failed to compress map data");
+      delete msg;
+      return;
+    }
 
+    zipped_data.data_count = count;
 
-      if(numwritten < 0)
-      {
-        if(ErrNo == ERRNO_EAGAIN)
-        {
-          // buffers are full
-          return(0);
-        }
-        else
-        {
-#if defined (WIN32)
-          LPVOID buffer = NULL;
-          FormatMessage(FORMAT_MESSAGE_ALLOCATE_BUFFER | FORMAT_MESSAGE_FROM_SYSTEM, NULL,
-                        ErrNo, 0, reinterpret_cast<LPTSTR> (&buffer), 0, NULL);
-          PLAYER_MSG1(2, "send() failed: %s", reinterpret_cast<LPTSTR> (buffer));
-          LocalFree(buffer);
+    // swap the payload pointer to point at the zipped version
+    payload = (void*)&zipped_data;
 #else
-          PLAYER_MSG1(2,"send() failed: %s", strerror(ErrNo));
+    PLAYER_WARN("not compressing map data, because zlib was not found at compile time");
 #endif
-          return(-1);
-        }
-      }
-      else if(numwritten == 0)
-      {
-        PLAYER_MSG0(2,"wrote zero bytes");
-        return(-1);
-      }
+  }
+
+  // If another client has already encoded this message, send its
+  // encoding from where it is (not for the compressed map data, which is a
+  // private copy)
+  const char* encoded_payload = NULL;
+  size_t encoded_len = 0;
+  if (payload && (payload == msg->GetPayload()))
+    encoded_payload = msg->GetEncodedPayload(&encoded_len,
+                                             client->write_encoding);
+
+  // Make sure there's room in the buffer for the encoded messsage.
+  // 4 times the message (including dynamic data) is a safe upper bound
+  size_t maxsize = PLAYERXDR_MSGHDR_SIZE;
+  if(payload && !encoded_payload)
+    maxsize += 4 * msg->GetDataSize();
+  if(maxsize > PLAYERXDR_MAX_MESSAGE_SIZE)
+  {
+    PLAYER_WARN1("allocating maximum %d bytes to outgoing message",
+                 PLAYERXDR_MAX_MESSAGE_SIZE);
+    maxsize = PLAYERXDR_MAX_MESSAGE_SIZE;
+  }
+  playertcp_reserve(client, maxsize);
+  start = client->writebuffer + client->writebufferlen;
 
-      memmove(client->writebuffer, client->writebuffer + numwritten,
-              client->writebufferlen - numwritten);
-      client->writebufferlen -= numwritten;
+  if (encoded_payload)
+  {
+    encode_msglen = encoded_len;
+  }
+  else if (payload)
+  {
+    // Use the packing function the message looked up when it was
+    // created
+    packfunc = msg->GetFunctionRow() ? msg->GetFunctionRow()->packfunc : NULL;
+    if(!packfunc)
+    {
+      // TODO: Allow the user to register a callback to handle unsupported messages
+      PLAYER_WARN4("skipping message from %s:%u with unsupported type %s:%u",
+                       interf_to_str(hdr.addr.interf), hdr.addr.index, msgtype_to_str(hdr.type), hdr.subtype);
+      encode_msglen = -1;
     }
-    // try to pop a pending message
-    else if((msg = client->queue->Pop()))
+    // Encode the body first
+    else if((encode_msglen =
+             (*packfunc)(start + PLAYERXDR_MSGHDR_SIZE,
+                         maxsize - PLAYERXDR_MSGHDR_SIZE,
+                         payload, op)) < 0)
     {
-      // Note that we make a COPY of the header.  This is so that we can
-      // edit the size field before sending it out, without affecting other
-      // instances of the message on other queues.
-      hdr = *msg->GetHeader();
-      payload = msg->GetPayload();
-
-      // Make sure there's room in the buffer for the encoded messsage.
-      // 4 times the message (including dynamic data) is a safe upper bound
-      size_t maxsize = PLAYERXDR_MSGHDR_SIZE + (4 * msg->GetDataSize());
-      if(maxsize > (size_t)(client->writebuffersize))
-      {
-        // Get at least twice as much space
-        client->writebuffersize = MAX((size_t)(client->writebuffersize * 2),
-                                        maxsize);
-        // Did we hit the limit (or overflow and become negative)?
-        if((client->writebuffersize >= PLAYERXDR_MAX_MESSAGE_SIZE) ||
-           (client->writebuffersize < 0))
-        {
-          PLAYER_WARN1("allocating maximum %d bytes to outgoing message buffer",
-                         PLAYERXDR_MAX_MESSAGE_SIZE);
-          client->writebuffersize = PLAYERXDR_MAX_MESSAGE_SIZE;
-        }
-        client->writebuffer = (char*)realloc(client->writebuffer,
-                                               client->writebuffersize);
-        assert(client->writebuffer);
-        memset(client->writebuffer, 0, client->writebuffersize);
-      }
+      PLAYER_WARN4("encoding failed on message from %s:%u with type %s:%u",
+                   interf_to_str(hdr.addr.interf), hdr.addr.index, msgtype_to_str(hdr.type), hdr.subtype);
+    }
+    else if (payload == msg->GetPayload())
+      msg->CacheEncodedPayload(start + PLAYERXDR_MSGHDR_SIZE,
+                               encode_msglen, client->write_encoding);
+  }
+  else
+  {
+    encode_msglen = 0;
+  }
+  if(encode_msglen < 0)
+  {
+    delete msg;
+    return;
+  }
 
-      // HACK: special handling for map data to compress it before sending
-      // them out over the network.
-      if((hdr.addr.interf == PLAYER_MAP_CODE) &&
-         (hdr.type == PLAYER_MSGTYPE_RESP_ACK) &&
-         (hdr.subtype == PLAYER_MAP_REQ_GET_DATA))
-      {
 #if HAVE_Z
-        player_map_data_t* raw_data = (player_map_data_t*)payload;
-        zipped_data = (player_map_data_t*)calloc(1,sizeof(player_map_data_t));
-        assert(zipped_data);
-
-        // copy the metadata
-        *zipped_data = *raw_data;
-        uLongf count = compressBound(raw_data->data_count);
-        zipped_data->data = (int8_t*)malloc(count);
-
-        // compress the tile
-        int ret;
-        ret = compress((Bytef*)zipped_data->data,&count,
-                         (const Bytef*)raw_data->data, raw_data->data_count);
-        if((ret != Z_OK) && (ret != Z_STREAM_END))
-        {
-          PLAYER_ERROR("failed to compress map data");
-          free(zipped_data);
-          client->writebufferlen = 0;
-          delete msg;
-          return(0);
-        }
+  // Compress large bodies if the client asked for it (but not the map
+  // data, which already is)
+  if((client->write_compression == PLAYER_COMPRESSION_ZLIB) &&
+     (payload == msg->GetPayload()) && (encode_msglen > 0) &&
+     ((size_t)encode_msglen >= client->compress_threshold))
+  {
+    size_t zlen = playertcp_compress(client, encoded_payload ? encoded_payload :
+                                     start + PLAYERXDR_MSGHDR_SIZE,
+                                     encode_msglen);
+    if(zlen)
+    {
+      playertcp_reserve(client, PLAYERXDR_MSGHDR_SIZE + zlen);
+      start = client->writebuffer + client->writebufferlen;
+      memcpy(start + PLAYERXDR_MSGHDR_SIZE, client->zbuffer, zlen);
+      encode_msglen = zlen;
+      encoded_payload = NULL;
+      sizeflag = PLAYER_COMPRESSED_SIZE_FLAG;
+    }
+  }
+#endif
+
+  // Rewrite the size in the header with the length of the encoded
+  // body, then encode the header.
+  hdr.size = encode_msglen | sizeflag;
+  if(player_msghdr_pack(start, PLAYERXDR_MSGHDR_SIZE, &hdr, op) < 0)
+  {
+    PLAYER_ERROR("failed to encode msg header");
+    delete msg;
+    return;
+  }
+
+  // The acknowledgement of an encoding or compression change is the last
+  // message to go out under the old setting
+  if((hdr.addr.interf == PLAYER_PLAYER_CODE) &&
+     (hdr.type == PLAYER_MSGTYPE_RESP_ACK))
+  {
+    if(hdr.subtype == PLAYER_PLAYER_REQ_ENCODING)
+      client->write_encoding = client->encoding;
+    else if(hdr.subtype == PLAYER_PLAYER_REQ_COMPRESSION)
+      client->write_compression = client->compression;
+  }
 
-        zipped_data->data_count = count;
+  if(encoded_payload)
+  {
+    playertcp_add_chunk(client, NULL, NULL, client->writebufferlen,
+                        PLAYERXDR_MSGHDR_SIZE);
+    client->writebufferlen += PLAYERXDR_MSGHDR_SIZE;
+    // the message keeps the cached encoding alive until it has been sent
+    playertcp_add_chunk(client, msg, encoded_payload, 0, encoded_len);
+  }
+  else
+  {
+    playertcp_add_chunk(client, NULL, NULL, client->writebufferlen,
+                        PLAYERXDR_MSGHDR_SIZE + encode_msglen);
+    client->writebufferlen += PLAYERXDR_MSGHDR_SIZE + encode_msglen;
+    delete msg;
+  }
+  client->msgs_sent++;
+}
+
+// Send as much of a connection's pending output as the socket will take,
+// in one system call where possible.  Returns 0 if everything was sent or
+// the socket is full, -1 on error.
+static int
+playertcp_flush(playertcp_conn_t* client)
+{
+  playertcp_chunk_t* chunk;
+  int numwritten;
 
-        // swap the payload pointer to point at the zipped version
-        payload = (void*)zipped_data;
+  while(client->writepending)
+  {
+#if HAVE_SYS_UIO_H
+    struct iovec iov[PLAYERTCP_WRITECHUNKS];
+    int num_iov = 0;
+    for(int i = client->writechunk; i < client->num_writechunks; i++)
+    {
+      chunk = client->writechunks + i;
+      iov[num_iov].iov_base = (void*)((chunk->msg ? chunk->data :
+                                       client->writebuffer) + chunk->off);
+      iov[num_iov].iov_len = chunk->len;
+      num_iov++;
+    }
+    numwritten = writev(client->fd, iov, num_iov);
 #else
-        PLAYER_WARN("not compressing map data, because zlib was not found at compile time");
+    chunk = client->writechunks + client->writechunk;
+    numwritten = send(client->fd,
+                      (chunk->msg ? chunk->data : client->writebuffer) +
+                      chunk->off, chunk->len, 0);
 #endif
-      }
 
-      if (payload)
+    if(numwritten < 0)
+    {
+      if(ErrNo == ERRNO_EAGAIN)
       {
-        // Locate the appropriate packing function
-        if(!(packfunc = playerxdr_get_packfunc(hdr.addr.interf,
-                                               hdr.type, hdr.subtype)))
-        {
-          // TODO: Allow the user to register a callback to handle unsupported messages
-          PLAYER_WARN4("skipping message from %s:%u with unsupported type %s:%u",
-                           interf_to_str(hdr.addr.interf), hdr.addr.index, msgtype_to_str(hdr.type), hdr.subtype);
-        }
-        else
-        {
-          // Encode the body first
-          if((encode_msglen =
-              (*packfunc)(client->writebuffer + PLAYERXDR_MSGHDR_SIZE,
-                        maxsize - PLAYERXDR_MSGHDR_SIZE,
-                        payload, PLAYERXDR_ENCODE)) < 0)
-          {
-            PLAYER_WARN4("encoding failed on message from %s:%u with type %s:%u",
-                       interf_to_str(hdr.addr.interf), hdr.addr.index, msgtype_to_str(hdr.type), hdr.subtype);
-#if HAVE_Z
-            if(zipped_data)
-            {
-              free(zipped_data->data);
-              free(zipped_data);
-              zipped_data=NULL;
-            }
-#endif
-            client->writebufferlen = 0;
-            delete msg;
-            return(0);
-          }
-        }
+        // buffers are full
+        return(0);
       }
       else
       {
-        encode_msglen = 0;
-      }
-      // Rewrite the size in the header with the length of the encoded
-      // body, then encode the header.
-      hdr.size = encode_msglen;
-      if((encode_msglen = player_msghdr_pack(client->writebuffer,
-                   PLAYERXDR_MSGHDR_SIZE, &hdr,
-                   PLAYERXDR_ENCODE)) < 0)
-      {
-        PLAYER_ERROR("failed to encode msg header");
-#if HAVE_Z
-        if(zipped_data)
-        {
-          free(zipped_data->data);
-          free(zipped_data);
-          zipped_data=NULL;
-        }
+#if defined (WIN32)
+        LPVOID buffer = NULL;
+        FormatMessage(FORMAT_MESSAGE_ALLOCATE_BUFFER | FORMAT_MESSAGE_FROM_SYSTEM, NULL,
+                      ErrNo, 0, reinterpret_cast<LPTSTR> (&buffer), 0, NULL);
+        PLAYER_MSG1(2, "send() failed: %s", reinterpret_cast<LPTSTR> (buffer));
+        LocalFree(buffer);
+#else
+        PLAYER_MSG1(2,"send() failed: %s", strerror(ErrNo));
 #endif
-        client->writebufferlen = 0;
-        delete msg;
-        return(0);
+        return(-1);
       }
+    }
+    else if(numwritten == 0)
+    {
+      PLAYER_MSG0(2,"wrote zero bytes");
+      return(-1);
+    }
 
-      client->writebufferlen = PLAYERXDR_MSGHDR_SIZE + hdr.size;
-
-      delete msg;
-#if HAVE_Z
-      if(zipped_data)
+    // Step over what went out, letting go of messages that are done with
+    client->writepending -= numwritten;
+    client->bytes_sent += numwritten;
+    while(numwritten > 0)
+    {
+      chunk = client->writechunks + client->writechunk;
+      size_t sent = MIN(chunk->len, (size_t)numwritten);
+      chunk->off += sent;
+      chunk->len -= sent;
+      numwritten -= sent;
+      if(!chunk->len)
       {
-        free(zipped_data->data);
-        free(zipped_data);
-        zipped_data=NULL;
+        delete chunk->msg;
+        chunk->msg = NULL;
+        client->writechunk++;
       }
-#endif
     }
+  }
+
+  // Everything has gone, so start again at the front of the buffer
+  client->num_writechunks = 0;
+  client->writechunk = 0;
+  client->writebufferlen = 0;
+  return(0);
+}
+
+int
+PlayerTCP::WriteConnection(playertcp_conn_t* client)
+{
+  Message* msg;
+
+  for(;;)
+  {
+    // Encode whatever is queued, up to a buffer's worth, so that a burst
+    // of small messages goes out together
+    if(client->writechunk &&
+       (client->num_writechunks + 2 > PLAYERTCP_WRITECHUNKS))
+      playertcp_compact(client);
+    while((client->writepending < PLAYERTCP_WRITEBUFFER_SIZE) &&
+          (client->num_writechunks + 2 <= PLAYERTCP_WRITECHUNKS) &&
+          (msg = client->queue->Pop()))
+      playertcp_encode(client, msg);
+
+    if(!client->writepending)
+      break;
+    if(playertcp_flush(client) < 0)
+      return(-1);
+    // the socket is full; try again when it drains
+    if(client->writepending)
+      break;
+  }
+
+  this->UpdateFlow(client);
+  return(0);
+}
+
+void
+PlayerTCP::UpdateFlow(playertcp_conn_t* client)
+{
+  struct timeval tv;
+  double now;
+  size_t outq = 0;
+
+  gettimeofday(&tv, NULL);
+  now = tv.tv_sec + tv.tv_usec / 1e6;
+  if(now - client->rate_time < PLAYERTCP_RATE_INTERVAL)
+    return;
+
+#if HAVE_LINUX_SOCKIOS_H
+  int queued;
+  if((ioctl(client->fd, SIOCOUTQ, &queued) == 0) && (queued > 0))
+    outq = queued;
+#endif
+
+  if(client->rate_time > 0.0)
+  {
+    // What the client took is what went into the kernel, less what is
+    // still sitting there
+    double taken = (double)(client->bytes_sent - client->rate_bytes) +
+            (double)client->rate_outq - (double)outq;
+    double rate = MAX(taken, 0.0) / (now - client->rate_time);
+    // A client that had nothing waiting for it only shows how fast data
+    // was produced, which is no more than it could take
+    if(client->rate_outq || outq || client->writepending)
+      client->throughput = (client->throughput > 0.0) ?
+              0.5 * (client->throughput + rate) : rate;
     else
-      return(0);
+      client->throughput = MAX(client->throughput, rate);
   }
+  client->rate_time = now;
+  client->rate_bytes = client->bytes_sent;
+  client->rate_outq = outq;
+
+  // Queued messages are guessed to be of average size
+  client->backlog = client->writepending + outq;
+  if(client->msgs_sent)
+    client->backlog += client->queue->GetLength() *
+            (size_t)(client->bytes_sent / client->msgs_sent);
+  client->lag = (client->throughput > 0.0) ?
+          client->backlog / client->throughput : 0.0;
+
+  bool coalescing = client->queue->GetCoalesce();
+  if(!coalescing && (this->max_lag > 0.0) && (client->lag > this->max_lag))
+  {
+    PLAYER_MSG3(2, "client on socket %d is %.2f s behind at %.0f bytes/s; sending it only the latest data",
+                client->fd, client->lag, client->throughput);
+    client->queue->SetCoalesce(true);
+  }
+  else if(coalescing && ((this->max_lag <= 0.0) ||
+                         (client->lag < this->max_lag / 4)))
+  {
+    PLAYER_MSG1(2, "client on socket %d has caught up", client->fd);
+    client->queue->SetCoalesce(false);
+  }
+}
+
+void
+PlayerTCP::SetMaxLag(double seconds)
+{
+  this->max_lag = seconds;
+}
+
+int
+PlayerTCP::GetClientStats(int cli, playertcp_client_stats_t* stats)
+{
+  this->Lock();
+  if((cli < 0) || (cli >= this->num_clients) || !this->clients[cli]->valid)
+  {
+    this->Unlock();
+    return(-1);
+  }
+  playertcp_conn_t* client = this->clients[cli];
+  // A network thread updates these under its own lock, Write() under ours
+#if PLAYERTCP_NETTHREADS
+  playertcp_netthread_t* t = client->netthread;
+  if(t)
+    pthread_mutex_lock(&t->mutex);
+#endif
+  stats->bytes_sent = client->bytes_sent;
+  stats->throughput = client->throughput;
+  stats->backlog = client->backlog;
+  stats->lag = client->lag;
+  stats->writebuffersize = client->writebuffersize;
+#if PLAYERTCP_NETTHREADS
+  if(t)
+    pthread_mutex_unlock(&t->mutex);
+#endif
+  stats->discarded = client->queue->GetDiscardCount();
+  stats->coalescing = client->queue->GetCoalesce();
+  this->Unlock();
+  return(0);
 }
 
 int
@@ -847,10 +1363,28 @@ PlayerTCP::Write(bool have_lock)
 
   for(int i=0;i<this->num_clients;i++)
   {
+    playertcp_conn_t* client = this->clients[i];
+    // a network thread looks after this one
+    if(client->netthread || !client->valid)
+      continue;
+    // Reset the wakeup before popping, so that anything queued from here
+    // on wakes us again
+    client->queue->ClearNotifyFd();
     if(this->WriteClient(i) < 0)
     {
       PLAYER_WARN1("failed to write to client %d\n", i);
-      this->clients[i].del = 1;
+      client->del = 1;
+    }
+    // Wait for the socket to drain if anything is left over
+    else if(client->writepending && !client->writewatch)
+    {
+      if(fileWatcher->AddFileWatch(client->fd, false, true, false) == 0)
+        client->writewatch = 1;
+    }
+    else if(!client->writepending && client->writewatch)
+    {
+      fileWatcher->RemoveFileWatch(client->fd, false, true, false);
+      client->writewatch = 0;
     }
   }
 
@@ -866,7 +1400,7 @@ PlayerTCP::ReadClient(QueuePointer q)
 {
   for(int cli=0; cli < this->num_clients; cli++)
   {
-    if(this->clients[cli].queue == q)
+    if(this->clients[cli]->queue == q)
       return(ReadClient(cli));
   }
   return(-1);
@@ -881,7 +1415,7 @@ PlayerTCP::ReadClient(int cli)
 
   assert((cli >= 0) && (cli < this->num_clients));
 
-  client = this->clients + cli;
+  client = this->clients[cli];
 
   // Read until there's nothing left to read.
   for(;;)
@@ -963,10 +1497,11 @@ PlayerTCP::ParseBuffer(int cli)
   player_pack_fn_t packfunc=NULL;
   int msglen=0;
   int decode_msglen=0;
+  int op;
   Device* device=NULL;
 
   assert((cli >= 0) && (cli < this->num_clients));
-  client = this->clients + cli;
+  client = this->clients[cli];
 
   // Process one message in each iteration
   for(;;)
@@ -975,10 +1510,15 @@ PlayerTCP::ParseBuffer(int cli)
     if(client->readbufferlen < PLAYERXDR_MSGHDR_SIZE)
       return;
 
+    // The encoding can change from one message to the next
+    op = PLAYERXDR_DECODE;
+    if(client->encoding == PLAYER_ENCODING_NATIVE)
+      op |= PLAYERXDR_NATIVE;
+
     // Try to read the header
     if(player_msghdr_pack(client->readbuffer,
                           PLAYERXDR_MSGHDR_SIZE,
-                          &hdr, PLAYERXDR_DECODE) < 0)
+                          &hdr, op) < 0)
     {
       PLAYER_WARN("failed to unpack header on incoming message");
       return;
@@ -1031,7 +1571,7 @@ PlayerTCP::ParseBuffer(int cli)
             (*packfunc)(client->readbuffer + PLAYERXDR_MSGHDR_SIZE,
 			msglen - PLAYERXDR_MSGHDR_SIZE,
 			(void*)this->decode_readbuffer,
-			PLAYERXDR_DECODE);
+			op);
         }
         else // no packing function? this had better be an empty message
         {
@@ -1061,7 +1601,7 @@ PlayerTCP::ParseBuffer(int cli)
             // Non-obvious thing: as a result of HandlePlayerMessage(), the
             // list of clients can get realloc()ed, which can
             // invalidate our client pointer.  So we'll recompute it.
-            client = this->clients + cli;
+            client = this->clients[cli];
           }
           else
           {
@@ -1138,7 +1678,7 @@ PlayerTCP::HandlePlayerMessage(int cli, Message* msg)
   Message* resp;
 
   assert((cli >= 0) && (cli < this->num_clients));
-  client = this->clients + cli;
+  client = this->clients[cli];
 
   hdr = msg->GetHeader();
   payload = msg->GetPayload();
@@ -1204,7 +1744,7 @@ PlayerTCP::HandlePlayerMessage(int cli, Message* msg)
                 // Non-obvious thing: as a result of Subscribe(), the
                 // list of clients can get realloc()ed, which can
                 // invalidate our client pointer.  So we'll recompute it.
-                client = this->clients + cli;
+                client = this->clients[cli];
 
                 if(sub_result < 0)
                 {
@@ -1386,6 +1926,81 @@ PlayerTCP::HandlePlayerMessage(int cli, Message* msg)
           break;
         }
 
+        // Request change of wire encoding
+        case PLAYER_PLAYER_REQ_ENCODING:
+        {
+          player_device_encoding_req_t* req =
+                  reinterpret_cast<player_device_encoding_req_t*> (payload);
+          uint8_t byteorder[4];
+          playerxdr_native_byteorder(byteorder);
+          resphdr.type = PLAYER_MSGTYPE_RESP_NACK;
+          if(!req)
+            PLAYER_WARN("encoding request without a payload");
+          else if((req->encoding == PLAYER_ENCODING_XDR) ||
+                  ((req->encoding == PLAYER_ENCODING_NATIVE) &&
+                   !memcmp(req->byteorder, byteorder, sizeof(byteorder))))
+          {
+            // Messages from the client switch now; messages to it switch
+            // once the acknowledgement has been encoded
+            client->encoding = req->encoding;
+            resphdr.type = PLAYER_MSGTYPE_RESP_ACK;
+          }
+          else
+            PLAYER_WARN1("refusing wire encoding %u", req->encoding);
+          // Make up and push out the reply
+          resp = new Message(resphdr, NULL);
+          assert(resp);
+          client->queue->Push(*resp);
+          delete resp;
+          break;
+        }
+
+        case PLAYER_PLAYER_REQ_COMPRESSION:
+        {
+          player_device_compression_req_t* req =
+                  reinterpret_cast<player_device_compression_req_t*> (payload);
+          resphdr.type = PLAYER_MSGTYPE_RESP_NACK;
+          if(!req)
+            PLAYER_WARN("compression request without a payload");
+          else if(req->method == PLAYER_COMPRESSION_NONE)
+          {
+            client->compression = req->method;
+            resphdr.type = PLAYER_MSGTYPE_RESP_ACK;
+          }
+#if HAVE_Z
+          else if(req->method == PLAYER_COMPRESSION_ZLIB)
+          {
+            // The context is made once, here, before the acknowledgement
+            // lets whoever writes to the client use it
+            if(!client->zstream)
+            {
+              client->zstream = new z_stream();
+              if(deflateInit(client->zstream, Z_BEST_SPEED) != Z_OK)
+              {
+                PLAYER_ERROR("failed to set up compression");
+                delete client->zstream;
+                client->zstream = NULL;
+              }
+            }
+            if(client->zstream)
+            {
+              client->compression = req->method;
+              client->compress_threshold = req->threshold ?
+                      req->threshold : PLAYERTCP_COMPRESS_THRESHOLD;
+              resphdr.type = PLAYER_MSGTYPE_RESP_ACK;
+            }
+          }
+#endif
+          else
+            PLAYER_WARN1("refusing wire compression %u", req->method);
+          // Make up and push out the reply
+          resp = new Message(resphdr, NULL);
+          assert(resp);
+          client->queue->Push(*resp);
+          delete resp;
+          break;
+        }
+
         // Request data
         case PLAYER_PLAYER_REQ_DATA:
           // Make up and push the reply onto the front of the queue
@@ -1396,6 +2011,8 @@ PlayerTCP::HandlePlayerMessage(int cli, Message* msg)
           delete resp;
           // Remember that the user requested some
           client->queue->SetDataRequested(true,false);
+          // and wake whoever writes to this client
+          client->queue->DataAvailable();
           break;
 
 
@@ -1432,6 +2049,291 @@ PlayerTCP::HandlePlayerMessage(int cli, Message* msg)
 }
 
 
+int
+PlayerTCP::SetNetworkThreads(int num)
+{
+#if PLAYERTCP_NETTHREADS
+  if(this->num_netthreads)
+  {
+    PLAYER_ERROR("network threads have already been started");
+    return(-1);
+  }
+  if(num <= 0)
+    return(0);
+
+  this->netthreads = (playertcp_netthread_t*)calloc(num,
+                                                    sizeof(playertcp_netthread_t));
+  assert(this->netthreads);
+  for(int i=0;i<num;i++)
+  {
+    playertcp_netthread_t* t = this->netthreads + i;
+    t->ptcp = this;
+    pthread_mutex_init(&t->mutex,NULL);
+    if(((t->epfd = epoll_create(PLAYERTCP_NETTHREAD_EVENTS)) < 0) ||
+       ((t->wakefd = eventfd(0, EFD_NONBLOCK)) < 0))
+    {
+      STRERROR (PLAYER_ERROR1, "failed to create network thread descriptors: %s");
+      if(t->epfd >= 0)
+        close(t->epfd);
+      pthread_mutex_destroy(&t->mutex);
+      break;
+    }
+    struct epoll_event ev;
+    memset(&ev,0,sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.u64 = PLAYERTCP_NETTHREAD_CONTROL;
+    epoll_ctl(t->epfd, EPOLL_CTL_ADD, t->wakefd, &ev);
+    if(pthread_create(&t->thread, NULL, &PlayerTCP::NetworkThread, t) != 0)
+    {
+      PLAYER_ERROR("failed to start network thread");
+      close(t->epfd);
+      close(t->wakefd);
+      pthread_mutex_destroy(&t->mutex);
+      break;
+    }
+    this->num_netthreads++;
+  }
+  if(this->num_netthreads < num)
+  {
+    this->StopNetworkThreads();
+    return(-1);
+  }
+
+  // Hand over any connections we already have
+  this->Lock();
+  for(int i=0;i<this->num_clients;i++)
+  {
+    playertcp_conn_t* client = this->clients[i];
+    if(!client->valid)
+      continue;
+    this->AttachClient(client);
+    if(client->netthread)
+    {
+      fileWatcher->RemoveFileWatch(client->queue->GetNotifyFd());
+      if(client->writewatch)
+        fileWatcher->RemoveFileWatch(client->fd, false, true, false);
+      client->writewatch = 0;
+    }
+  }
+  this->Unlock();
+  return(0);
+#else
+  if(num > 0)
+  {
+    PLAYER_ERROR("network threads need epoll, which this platform lacks");
+    return(-1);
+  }
+  return(0);
+#endif
+}
+
+void
+PlayerTCP::StopNetworkThreads()
+{
+#if PLAYERTCP_NETTHREADS
+  if(!this->netthreads)
+    return;
+  // Take the connections back first
+  this->Lock();
+  for(int i=0;i<this->num_clients;i++)
+  {
+    if(!this->clients[i]->netthread)
+      continue;
+    this->DetachClient(this->clients[i]);
+    fileWatcher->AddFileWatch(this->clients[i]->queue->GetNotifyFd());
+  }
+  this->Unlock();
+
+  for(int i=0;i<this->num_netthreads;i++)
+  {
+    playertcp_netthread_t* t = this->netthreads + i;
+    pthread_mutex_lock(&t->mutex);
+    t->quit = 1;
+    pthread_mutex_unlock(&t->mutex);
+    eventfd_write(t->wakefd, 1);
+    pthread_join(t->thread, NULL);
+    close(t->epfd);
+    close(t->wakefd);
+    pthread_mutex_destroy(&t->mutex);
+    free(t->slots);
+  }
+  free(this->netthreads);
+  this->netthreads = NULL;
+  this->num_netthreads = 0;
+#endif
+}
+
+// Should be called with clients_mutex lock held
+void
+PlayerTCP::AttachClient(playertcp_conn_t* client)
+{
+#if PLAYERTCP_NETTHREADS
+  if(!this->num_netthreads || client->netthread)
+    return;
+
+  int notify_fd = client->queue->GetNotifyFd();
+  if(notify_fd < 0)
+    return;
+
+  // Give it to the least busy thread
+  playertcp_netthread_t* t = this->netthreads;
+  for(int i=1;i<this->num_netthreads;i++)
+  {
+    if(this->netthreads[i].num_conns < t->num_conns)
+      t = this->netthreads + i;
+  }
+
+  pthread_mutex_lock(&t->mutex);
+  int slot;
+  for(slot=0;slot<t->num_slots;slot++)
+  {
+    if(!t->slots[slot].conn)
+      break;
+  }
+  if(slot == t->num_slots)
+  {
+    t->num_slots = t->num_slots ? 2 * t->num_slots : 16;
+    t->slots = (playertcp_netslot_t*)realloc(t->slots,
+                                             t->num_slots *
+                                             sizeof(playertcp_netslot_t));
+    assert(t->slots);
+    memset(t->slots + slot, 0,
+           (t->num_slots - slot) * sizeof(playertcp_netslot_t));
+  }
+  t->slots[slot].conn = client;
+  t->slots[slot].gen++;
+  t->slots[slot].armed = 0;
+
+  struct epoll_event ev;
+  memset(&ev,0,sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.u64 = ((uint64_t)t->slots[slot].gen << 32) | (uint32_t)slot;
+  if(epoll_ctl(t->epfd, EPOLL_CTL_ADD, notify_fd, &ev) < 0)
+  {
+    STRERROR (PLAYER_ERROR1, "epoll_ctl() failed: %s");
+    t->slots[slot].conn = NULL;
+    t->slots[slot].gen++;
+    pthread_mutex_unlock(&t->mutex);
+    return;
+  }
+  client->netthread = t;
+  client->netslot = slot;
+  t->num_conns++;
+  pthread_mutex_unlock(&t->mutex);
+
+  // in case something was queued before we were watching
+  client->queue->DataAvailable();
+#endif
+}
+
+// Should be called with clients_mutex lock held.  Once this returns, the
+// network thread will not touch the connection again.
+void
+PlayerTCP::DetachClient(playertcp_conn_t* client)
+{
+#if PLAYERTCP_NETTHREADS
+  playertcp_netthread_t* t = client->netthread;
+  if(!t)
+    return;
+
+  pthread_mutex_lock(&t->mutex);
+  playertcp_netslot_t* slot = t->slots + client->netslot;
+  // These fail harmlessly if the thread already dropped the descriptors
+  struct epoll_event ev;
+  memset(&ev,0,sizeof(ev));
+  epoll_ctl(t->epfd, EPOLL_CTL_DEL, client->queue->GetNotifyFd(), &ev);
+  if(slot->armed)
+    epoll_ctl(t->epfd, EPOLL_CTL_DEL, client->fd, &ev);
+  slot->conn = NULL;
+  slot->gen++;
+  slot->armed = 0;
+  t->num_conns--;
+  pthread_mutex_unlock(&t->mutex);
+  client->netthread = NULL;
+#endif
+}
+
+void*
+PlayerTCP::NetworkThread(void* arg)
+{
+#if PLAYERTCP_NETTHREADS
+  playertcp_netthread_t* t = (playertcp_netthread_t*)arg;
+  struct epoll_event events[PLAYERTCP_NETTHREAD_EVENTS];
+  struct epoll_event ev;
+
+  for(;;)
+  {
+    int num_events = epoll_wait(t->epfd, events, PLAYERTCP_NETTHREAD_EVENTS, -1);
+    if(num_events < 0)
+    {
+      // Got interrupted by a signal; no problem
+      if(ErrNo == EINTR)
+        continue;
+      STRERROR (PLAYER_ERROR1, "epoll_wait() failed: %s");
+      break;
+    }
+
+    pthread_mutex_lock(&t->mutex);
+    if(t->quit)
+    {
+      pthread_mutex_unlock(&t->mutex);
+      break;
+    }
+    for(int i=0;i<num_events;i++)
+    {
+      if(events[i].data.u64 == PLAYERTCP_NETTHREAD_CONTROL)
+      {
+        eventfd_t value;
+        eventfd_read(t->wakefd, &value);
+        continue;
+      }
+      uint32_t index = (uint32_t)events[i].data.u64;
+      uint32_t gen = (uint32_t)(events[i].data.u64 >> 32);
+      if((index >= (uint32_t)t->num_slots) ||
+         (t->slots[index].gen != gen) || !t->slots[index].conn)
+        continue;
+      playertcp_netslot_t* slot = t->slots + index;
+      playertcp_conn_t* client = slot->conn;
+      if(client->del)
+        continue;
+
+      // Whether woken by the queue or the socket, send what we can
+      client->queue->ClearNotifyFd();
+      memset(&ev,0,sizeof(ev));
+      if(t->ptcp->WriteConnection(client) < 0)
+      {
+        PLAYER_WARN1("failed to write to client on port %d", client->port);
+        // Stop watching it; the main loop will close it
+        epoll_ctl(t->epfd, EPOLL_CTL_DEL, client->queue->GetNotifyFd(), &ev);
+        if(slot->armed)
+          epoll_ctl(t->epfd, EPOLL_CTL_DEL, client->fd, &ev);
+        slot->armed = 0;
+        client->del = 1;
+        // the main loop may be asleep
+        fileWatcher->Wake();
+        continue;
+      }
+
+      // Wait for the socket to drain if anything is left over
+      if(client->writepending && !slot->armed)
+      {
+        ev.events = EPOLLOUT;
+        ev.data.u64 = events[i].data.u64;
+        if(epoll_ctl(t->epfd, EPOLL_CTL_ADD, client->fd, &ev) == 0)
+          slot->armed = 1;
+      }
+      else if(!client->writepending && slot->armed)
+      {
+        epoll_ctl(t->epfd, EPOLL_CTL_DEL, client->fd, &ev);
+        slot->armed = 0;
+      }
+    }
+    pthread_mutex_unlock(&t->mutex);
+  }
+#endif
+  return(NULL);
+}
+
 void
 PlayerTCP::Lock()
 {
@@ -125,15 +125,50 @@ message.
     calloc() and realloc() read buffers in multiples of this size. */
 #define PLAYERTCP_READBUFFER_SIZE 65536
 
-/** We try to write() outgoing messages in chunks of this size.  We also
-    calloc() and realloc() write buffers in multiples of this size. */
+/** Outgoing messages are encoded ahead until about this many bytes are
+    waiting, then sent together.  It is also the initial size of a
+    client's write buffer, which grows as needed. */
 #define PLAYERTCP_WRITEBUFFER_SIZE 65536
 
+/** Maximum number of separate runs of encoded bytes waiting to be sent to
+    a client, and so handed to the kernel in one writev() */
+#define PLAYERTCP_WRITECHUNKS 64
+
+/** Default size (bytes) from which encoded message bodies are compressed
+    for clients that asked for compression (see PLAYER_PLAYER_REQ_COMPRESSION) */
+#define PLAYERTCP_COMPRESS_THRESHOLD 8192
+
+/** A client's throughput is estimated over periods of at least this many
+    seconds (see PlayerTCP::SetMaxLag()) */
+#define PLAYERTCP_RATE_INTERVAL 0.1
+
+/** @brief How a client connection is keeping up (see
+    PlayerTCP::GetClientStats()) */
+typedef struct playertcp_client_stats
+{
+  /** Bytes sent to the client so far */
+  uint64_t bytes_sent;
+  /** Estimated rate at which the client takes data (bytes/s) */
+  double throughput;
+  /** Estimated bytes waiting for the client: encoded, in the kernel's send
+      queue, or still queued as messages */
+  size_t backlog;
+  /** Estimated time for the client to take the backlog (s) */
+  double lag;
+  /** Current size of the client's write buffer (bytes) */
+  size_t writebuffersize;
+  /** Messages to the client discarded so far as replaced or overflowing */
+  unsigned int discarded;
+  /** Is the client's queue coalescing data to the latest of each kind? */
+  int coalescing;
+} playertcp_client_stats_t;
+
 // Forward declarations
 struct pollfd;
 
 struct playertcp_listener;
 struct playertcp_conn;
+struct playertcp_netthread;
 
 class PLAYERTCP_EXPORT PlayerTCP
 {
@@ -146,7 +181,7 @@ class PLAYERTCP_EXPORT PlayerTCP
     pthread_mutex_t clients_mutex;
     int size_clients;
     int num_clients;
-    playertcp_conn* clients;
+    playertcp_conn** clients;
     struct pollfd* client_ufds;
 
     /** Buffer in which to store decoded incoming messages */
@@ -154,6 +189,20 @@ class PLAYERTCP_EXPORT PlayerTCP
     /** Total size of @p decode_readbuffer */
     int decode_readbuffersize;
 
+    /** Network threads that write to clients (see SetNetworkThreads()) */
+    int num_netthreads;
+    playertcp_netthread* netthreads;
+
+    /** Lag beyond which clients' data is coalesced (see SetMaxLag()) */
+    double max_lag;
+
+    int WriteConnection(playertcp_conn* client);
+    void UpdateFlow(playertcp_conn* client);
+    void AttachClient(playertcp_conn* client);
+    void DetachClient(playertcp_conn* client);
+    void StopNetworkThreads();
+    static void* NetworkThread(void* arg);
+
   public:
     PlayerTCP();
     ~PlayerTCP();
@@ -165,6 +214,36 @@ class PLAYERTCP_EXPORT PlayerTCP
 
     pthread_t thread;
 
+    /** @brief Hand writing to clients over to a pool of threads.
+
+    Each connection, current and future, is pinned to one of @p num
+    threads, which waits on the connection's queue and socket with epoll,
+    then encodes and sends the queued messages.  Reading from clients and
+    accepting new ones stay with the caller's loop, as does updating
+    non-threaded drivers; Write() then only reaps dead connections.  This
+    stops a slow client or a large message from holding up the others.
+
+    Returns 0 on success, or -1 if the threads could not be started (or
+    this platform lacks epoll), in which case Write() carries on writing
+    as before. */
+    int SetNetworkThreads(int num);
+
+    /** @brief Coalesce the data of clients that fall behind.
+
+    The throughput of each client is estimated from how fast it drains
+    what is sent to it, and its lag from how much is waiting for it.  When
+    a client lags more than @p seconds behind, its queue is switched to
+    coalescing (see MessageQueue::SetCoalesce()), so that it gets only the
+    latest data of each kind; once it has caught up to within a quarter of
+    that, its queue goes back to normal.  0 (the default) turns this off. */
+    void SetMaxLag(double seconds);
+
+    /** @brief Get flow statistics for client @p cli.  Returns 0 on
+    success, -1 if there is no such client. */
+    int GetClientStats(int cli, playertcp_client_stats_t* stats);
+    /** @brief Number of client slots, for use with GetClientStats() */
+    int GetNumClients() {return num_clients;};
+
     int Listen(int* ports, int num_ports, int* new_ports=NULL);
     int Listen(int port);
     QueuePointer AddClient(struct sockaddr_in* cliaddr,
@@ -51,6 +51,9 @@
 #if HAVE_Z
   #include <zlib.h>
 #endif
+#if HAVE_UDP_SEGMENT
+  #include <netinet/udp.h>
+#endif
 
 #include <replace/replace.h>
 #include <libplayercore/playercore.h>
@@ -72,6 +75,27 @@ typedef struct playerudp_listener
   int port;
 } playerudp_listener_t;
 
+/** A datagram waiting to go out: a slice of the write buffer, which goes
+ * on the wire after its own header */
+typedef struct playerudp_frag
+{
+  /** Where the slice starts in the write buffer */
+  size_t off;
+  /** Length of the slice */
+  size_t len;
+  /** Is this the end of its message? */
+  int last;
+  /** The datagram header */
+  unsigned char hdr[PLAYER_UDP_HDR_SIZE];
+} playerudp_frag_t;
+
+/** How many messages a client has been sent from a device */
+typedef struct playerudp_seq
+{
+  player_devaddr_t addr;
+  uint32_t seq;
+} playerudp_seq_t;
+
 /** @brief A UDP Connection */
 typedef struct playerudp_conn
 {
@@ -101,9 +125,33 @@ typedef struct playerudp_conn
   char* writebuffer;
   /** Total size of @p writebuffer */
   int writebuffersize;
-  /** How much of @p writebuffer is currently in use (i.e., holding a
-    partial message) */
+  /** How much of @p writebuffer is currently in use (i.e., holding
+    messages waiting to go out) */
   int writebufferlen;
+  /** The datagrams that @p writebuffer is to go out in */
+  playerudp_frag_t* frags;
+  /** Total size of @p frags */
+  int size_frags;
+  /** How many of @p frags are in use */
+  int num_frags;
+  /** How many of @p frags have been sent */
+  int frag;
+  /** Number for the next message to the client */
+  uint32_t msgseq;
+  /** Message counts for each device the client has heard from */
+  playerudp_seq_t* seqs;
+  size_t num_seqs;
+  /** Let the kernel split messages into datagrams (UDP GSO)? */
+  int gso;
+  /** The message being reassembled after the complete ones in @p
+    readbuffer: its number, length (0 if none) and how much has come */
+  uint32_t read_msgseq;
+  size_t read_msglen;
+  size_t read_msggot;
+  /** Which of that message's datagrams have come, a bit for each, so
+    that a duplicate isn't counted twice */
+  unsigned char* read_frags;
+  size_t read_frags_size;
   /** Linked list of devices to which we are subscribed */
   Device** dev_subs;
   size_t num_dev_subs;
@@ -111,8 +159,267 @@ typedef struct playerudp_conn
    * TCPRemoteDriver uses this flag to know when the connection has been
    * closed, and thus that it should stop publishing to its queue. */
   int* kill_flag;
+  /** Wire encoding (PLAYER_ENCODING_*) of messages from the client */
+  int encoding;
+  /** Wire encoding of messages to the client.  It catches up with @p
+   * encoding once the acknowledgement of a change has been encoded. */
+  int write_encoding;
 } playerudp_conn_t;
 
+// Most datagrams the kernel is given to split a message into at once.
+// The total has to stay under the 64K limit on a UDP datagram.
+#define PLAYERUDP_GSO_SEGMENTS 40
+
+static void
+playerudp_put_uint32(unsigned char* buf, uint32_t val)
+{
+  val = htonl(val);
+  memcpy(buf, &val, sizeof(val));
+}
+
+static uint32_t
+playerudp_get_uint32(const char* buf)
+{
+  uint32_t val;
+  memcpy(&val, buf, sizeof(val));
+  return(ntohl(val));
+}
+
+// Count a message to a client from a device, returning its number among
+// those the client has been sent from that device
+static uint32_t
+playerudp_next_seq(playerudp_conn_t* client, const player_devaddr_t* addr)
+{
+  playerudp_seq_t* seq;
+
+  for(size_t i=0;i<client->num_seqs;i++)
+  {
+    seq = client->seqs + i;
+    if((seq->addr.host == addr->host) &&
+       (seq->addr.robot == addr->robot) &&
+       (seq->addr.interf == addr->interf) &&
+       (seq->addr.index == addr->index))
+      return(seq->seq++);
+  }
+  client->seqs = (playerudp_seq_t*)realloc(client->seqs,
+                                           (client->num_seqs + 1) *
+                                           sizeof(playerudp_seq_t));
+  assert(client->seqs);
+  seq = client->seqs + client->num_seqs++;
+  seq->addr = *addr;
+  seq->seq = 1;
+  return(0);
+}
+
+// Split the encoded message at @p off in a connection's write buffer
+// into datagrams
+static void
+playerudp_add_frags(playerudp_conn_t* client, size_t off, size_t len,
+                    uint32_t devseq)
+{
+  const size_t payload = PLAYER_UDP_DATAGRAM_SIZE - PLAYER_UDP_HDR_SIZE;
+  uint32_t msgseq = client->msgseq++;
+  playerudp_frag_t* frag;
+
+  for(size_t done=0; done<len; done+=frag->len)
+  {
+    if(client->num_frags == client->size_frags)
+    {
+      client->size_frags = MAX(client->size_frags * 2, PLAYERUDP_BATCH);
+      client->frags = (playerudp_frag_t*)realloc(client->frags,
+                                                 client->size_frags *
+                                                 sizeof(playerudp_frag_t));
+      assert(client->frags);
+    }
+    frag = client->frags + client->num_frags++;
+    frag->off = off + done;
+    frag->len = MIN(payload, len - done);
+    frag->last = (done + frag->len == len);
+    playerudp_put_uint32(frag->hdr, msgseq);
+    playerudp_put_uint32(frag->hdr + 4, devseq);
+    playerudp_put_uint32(frag->hdr + 8, done);
+    playerudp_put_uint32(frag->hdr + 12, len);
+  }
+}
+
+// Send the datagrams waiting on a connection, in as few system calls as
+// possible.  Returns 0 if they all went or the socket is full, -1 on
+// error.
+static int
+playerudp_flush(playerudp_conn_t* client)
+{
+  int numsent;
+
+  while(client->frag < client->num_frags)
+  {
+#if HAVE_SENDMMSG
+    struct mmsghdr msgs[PLAYERUDP_BATCH];
+    struct iovec iov[2 * PLAYERUDP_BATCH];
+    int msgfrags[PLAYERUDP_BATCH];
+    int num_msgs = 0;
+    int num_iov = 0;
+#if HAVE_UDP_SEGMENT
+    char control[PLAYERUDP_BATCH][CMSG_SPACE(sizeof(uint16_t))];
+#endif
+
+    memset(msgs, 0, sizeof(msgs));
+    for(int i=client->frag;
+        (i < client->num_frags) && (num_msgs < PLAYERUDP_BATCH) &&
+        (num_iov + 2 <= 2 * PLAYERUDP_BATCH);
+        num_msgs++)
+    {
+      struct msghdr* hdr = &msgs[num_msgs].msg_hdr;
+      int n = 0;
+      hdr->msg_name = &client->addr;
+      hdr->msg_namelen = sizeof(client->addr);
+      hdr->msg_iov = iov + num_iov;
+      // With GSO, a run of full datagrams from one message (and the
+      // message's last, which may be short) goes as one buffer that the
+      // kernel splits up
+      do
+      {
+        playerudp_frag_t* frag = client->frags + i + n;
+        iov[num_iov].iov_base = frag->hdr;
+        iov[num_iov++].iov_len = PLAYER_UDP_HDR_SIZE;
+        iov[num_iov].iov_base = client->writebuffer + frag->off;
+        iov[num_iov++].iov_len = frag->len;
+        n++;
+      } while(client->gso && !client->frags[i + n - 1].last &&
+              (n < PLAYERUDP_GSO_SEGMENTS) &&
+              (num_iov + 2 <= 2 * PLAYERUDP_BATCH));
+      hdr->msg_iovlen = 2 * n;
+#if HAVE_UDP_SEGMENT
+      if(n > 1)
+      {
+        struct cmsghdr* cmsg;
+        uint16_t segsize = PLAYER_UDP_DATAGRAM_SIZE;
+        hdr->msg_control = control[num_msgs];
+        hdr->msg_controllen = sizeof(control[num_msgs]);
+        cmsg = CMSG_FIRSTHDR(hdr);
+        cmsg->cmsg_level = IPPROTO_UDP;
+        cmsg->cmsg_type = UDP_SEGMENT;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(segsize));
+        memcpy(CMSG_DATA(cmsg), &segsize, sizeof(segsize));
+      }
+#endif
+      msgfrags[num_msgs] = n;
+      i += n;
+    }
+
+    numsent = sendmmsg(client->fd, msgs, num_msgs, 0);
+    if((numsent < 0) && client->gso && (ErrNo == EIO || ErrNo == EINVAL))
+    {
+      // The kernel can't do the splitting on this route; do it ourselves
+      PLAYER_MSG0(2, "UDP segmentation offload unavailable");
+      client->gso = 0;
+      continue;
+    }
+    for(int i=0;i<numsent;i++)
+      client->frag += msgfrags[i];
+#else
+    // One datagram at a time, put together in a scratch buffer
+    char dgram[PLAYER_UDP_DATAGRAM_SIZE];
+    playerudp_frag_t* frag = client->frags + client->frag;
+    memcpy(dgram, frag->hdr, PLAYER_UDP_HDR_SIZE);
+    memcpy(dgram + PLAYER_UDP_HDR_SIZE, client->writebuffer + frag->off,
+           frag->len);
+    numsent = sendto(client->fd, dgram, PLAYER_UDP_HDR_SIZE + frag->len, 0,
+                     (struct sockaddr*)&client->addr, sizeof(client->addr));
+    if(numsent > 0)
+      client->frag++;
+#endif
+
+    if(numsent < 0)
+    {
+      if(ErrNo == ERRNO_EAGAIN)
+      {
+        // buffers are full
+        return(0);
+      }
+#if defined (WIN32)
+      LPVOID buffer = NULL;
+      FormatMessage(FORMAT_MESSAGE_ALLOCATE_BUFFER | FORMAT_MESSAGE_FROM_SYSTEM, NULL,
+                    ErrNo, 0, reinterpret_cast<LPTSTR> (&buffer), 0, NULL);
+      PLAYER_MSG1(2, "sendto() failed: %s", reinterpret_cast<LPTSTR> (buffer));
+      LocalFree(buffer);
+#else
+      PLAYER_MSG1(2,"sendmmsg() failed: %s", strerror(ErrNo));
+#endif
+      return(-1);
+    }
+  }
+
+  // Everything has gone, so start again at the front of the buffer
+  client->num_frags = 0;
+  client->frag = 0;
+  client->writebufferlen = 0;
+  return(0);
+}
+
+// Fit a datagram into the message being reassembled after the complete
+// ones in a connection's read buffer.  Returns 1 if that completed the
+// message, 0 if there is more to come, -1 if the datagram was dropped.
+static int
+playerudp_reassemble(playerudp_conn_t* client, const char* data, size_t len)
+{
+  const size_t payload = PLAYER_UDP_DATAGRAM_SIZE - PLAYER_UDP_HDR_SIZE;
+  uint32_t msgseq;
+  size_t off, msglen, frag, nbytes;
+
+  if(len < PLAYER_UDP_HDR_SIZE)
+    return(-1);
+  msgseq = playerudp_get_uint32(data);
+  off = playerudp_get_uint32(data + 8);
+  msglen = playerudp_get_uint32(data + 12);
+  data += PLAYER_UDP_HDR_SIZE;
+  len -= PLAYER_UDP_HDR_SIZE;
+  // Every datagram of a message but the last carries a full payload
+  if((msglen > PLAYERXDR_MAX_MESSAGE_SIZE) || (off + len > msglen) ||
+     (off % payload) || ((len != payload) && (off + len != msglen)))
+    return(-1);
+
+  // A new message; anything left of the last one has been lost
+  if(!client->read_msglen || (client->read_msgseq != msgseq))
+  {
+    client->read_msgseq = msgseq;
+    client->read_msglen = msglen;
+    client->read_msggot = 0;
+    nbytes = (msglen / payload + 8) / 8;
+    if(nbytes > client->read_frags_size)
+    {
+      client->read_frags = (unsigned char*)realloc(client->read_frags, nbytes);
+      assert(client->read_frags);
+      client->read_frags_size = nbytes;
+    }
+    memset(client->read_frags, 0, nbytes);
+  }
+  else if(client->read_msglen != msglen)
+    return(-1);
+
+  // Only count each datagram once
+  frag = off / payload;
+  if(client->read_frags[frag / 8] & (1 << (frag % 8)))
+    return(0);
+  client->read_frags[frag / 8] |= 1 << (frag % 8);
+
+  // Might we need more room to assemble it?
+  if((size_t)(client->readbuffersize - client->readbufferlen) < msglen)
+  {
+    client->readbuffersize = MAX((size_t)(client->readbuffersize * 2),
+                                 client->readbufferlen + msglen);
+    client->readbuffer = (char*)realloc(client->readbuffer,
+                                        client->readbuffersize);
+    assert(client->readbuffer);
+  }
+
+  memcpy(client->readbuffer + client->readbufferlen + off, data, len);
+  client->read_msggot += len;
+  if(client->read_msggot < client->read_msglen)
+    return(0);
+  client->readbufferlen += client->read_msglen;
+  client->read_msglen = 0;
+  return(1);
+}
 
 PlayerUDP::PlayerUDP()
 {
@@ -144,6 +451,10 @@ PlayerUDP::PlayerUDP()
   assert(this->decode_readbuffer);
   this->decode_readbufferlen = 0;
 
+  // and one for a batch of datagrams as they come in
+  this->recvbuffer = (char*)malloc(PLAYERUDP_BATCH * PLAYER_UDP_DATAGRAM_SIZE);
+  assert(this->recvbuffer);
+
   if(hostname_to_packedaddr(&this->host,"localhost") < 0)
   {
     PLAYER_WARN("address lookup failed for localhost");
@@ -162,6 +473,7 @@ PlayerUDP::~PlayerUDP()
   free(this->listeners);
   free(this->listen_ufds);
   free(this->decode_readbuffer);
+  free(this->recvbuffer);
 
 #if defined (WIN32)
   // Clean up the Windows sockets API (this can safely be done as many times as we like)
@@ -241,10 +553,17 @@ PlayerUDP::AddClient(struct sockaddr_in* cliaddr,
   this->clients[j].dev_subs = NULL;
   this->clients[j].num_dev_subs = 0;
   this->clients[j].kill_flag = kill_flag;
+  this->clients[j].encoding = PLAYER_ENCODING_XDR;
+  this->clients[j].write_encoding = PLAYER_ENCODING_XDR;
+#if HAVE_UDP_SEGMENT
+  this->clients[j].gso = 1;
+#endif
 
   // Create an outgoing queue for this client
   this->clients[j].queue =
           QueuePointer(0,PLAYER_MSGQUEUE_DEFAULT_MAXLEN);
+  // wake the main loop when there is something to send
+  fileWatcher->AddFileWatch(this->clients[j].queue->GetNotifyFd());
 
   // Create a buffer to hold incoming messages
   this->clients[j].readbuffersize = PLAYERUDP_READBUFFER_SIZE;
@@ -267,6 +586,7 @@ PlayerUDP::AddClient(struct sockaddr_in* cliaddr,
     memset(data,0,sizeof(data));
     snprintf((char*)data, sizeof(data)-1, "%s%s",
              PLAYER_IDENT_STRING, playerversion);
+    playerxdr_native_byteorder(data + PLAYER_IDENT_BYTEORDER);
 #if defined (WIN32)
     if(sendto(this->clients[j].fd, reinterpret_cast<const char*> (data), PLAYER_IDENT_STRLEN, 0,
               (struct sockaddr*)&this->clients[j].addr, addrlen) < 0)
@@ -302,6 +622,7 @@ PlayerUDP::Close(int cli)
   }
   free(this->clients[cli].dev_subs);
   fileWatcher->RemoveFileWatch(this->clients[cli].fd);
+  fileWatcher->RemoveFileWatch(this->clients[cli].queue->GetNotifyFd());
 #if defined (WIN32)
   if (closesocket (this->clients[cli].fd) != 0)
     STRERROR (PLAYER_WARN1, "closesocket() failed: %s");
@@ -322,7 +643,10 @@ PlayerUDP::Close(int cli)
   while((msg = this->clients[cli].queue->Pop()))
     delete msg;
   free(this->clients[cli].readbuffer);
+  free(this->clients[cli].read_frags);
   free(this->clients[cli].writebuffer);
+  free(this->clients[cli].frags);
+  free(this->clients[cli].seqs);
   if(this->clients[cli].kill_flag)
     *(this->clients[cli].kill_flag) = 1;
 }
@@ -330,11 +654,9 @@ PlayerUDP::Close(int cli)
 int
 PlayerUDP::Read(int timeout)
 {
-  struct sockaddr_in fromaddr;
-  socklen_t fromlen = sizeof(fromaddr);
+  struct sockaddr_in fromaddr[PLAYERUDP_BATCH];
   int num_available;
-  playerudp_conn_t* client;
-  int cli;
+  int num_dgrams;
 
   // Poll for incoming messages
   if((num_available = poll(this->listen_ufds, num_listeners, timeout)) < 0)
@@ -355,15 +677,33 @@ PlayerUDP::Read(int timeout)
   {
     if(this->listen_ufds[i].revents & POLLIN)
     {
-      /* Read into the decode_readbuffer, which is big enough to hold a
-       * single UDP datagram */
-      if((this->decode_readbufferlen = recvfrom(this->listen_ufds[i].fd,
-                                                this->decode_readbuffer,
-                                                PLAYERUDP_READBUFFER_SIZE,
-                                                0,
-                                                (struct sockaddr*)&fromaddr,
-                                                &fromlen)) < 0)
+#if HAVE_RECVMMSG
+      // Take as many datagrams as are waiting, up to a batch, at once
+      struct mmsghdr msgs[PLAYERUDP_BATCH];
+      struct iovec iov[PLAYERUDP_BATCH];
+      memset(msgs, 0, sizeof(msgs));
+      for(int j=0;j<PLAYERUDP_BATCH;j++)
+      {
+        iov[j].iov_base = this->recvbuffer + j * PLAYER_UDP_DATAGRAM_SIZE;
+        iov[j].iov_len = PLAYER_UDP_DATAGRAM_SIZE;
+        msgs[j].msg_hdr.msg_iov = iov + j;
+        msgs[j].msg_hdr.msg_iovlen = 1;
+        msgs[j].msg_hdr.msg_name = fromaddr + j;
+        msgs[j].msg_hdr.msg_namelen = sizeof(fromaddr[j]);
+      }
+      num_dgrams = recvmmsg(this->listen_ufds[i].fd, msgs, PLAYERUDP_BATCH,
+                            MSG_DONTWAIT, NULL);
+#else
+      socklen_t fromlen = sizeof(fromaddr[0]);
+      int len = recvfrom(this->listen_ufds[i].fd, this->recvbuffer,
+                         PLAYER_UDP_DATAGRAM_SIZE, 0,
+                         (struct sockaddr*)fromaddr, &fromlen);
+      num_dgrams = (len < 0) ? -1 : 1;
+#endif
+      if(num_dgrams < 0)
       {
+        if(ErrNo != ERRNO_EAGAIN)
+        {
 #if defined (WIN32)
           LPVOID buffer = NULL;
           FormatMessage(FORMAT_MESSAGE_ALLOCATE_BUFFER | FORMAT_MESSAGE_FROM_SYSTEM, NULL,
@@ -373,98 +713,90 @@ PlayerUDP::Read(int timeout)
 #else
           PLAYER_ERROR2("recvfrom() failed on port %d: %s", this->listeners[i].port, strerror(ErrNo));
 #endif
+        }
       }
       else
       {
         pthread_mutex_lock(&this->clients_mutex);
-
-        // Do we know about this one already?
-        for(cli=0; cli<this->num_clients; cli++)
+        for(int j=0;j<num_dgrams;j++)
         {
-          client = this->clients + cli;
-          if((client->addr.sin_addr.s_addr == fromaddr.sin_addr.s_addr) &&
-             (client->addr.sin_port == fromaddr.sin_port))
+#if HAVE_RECVMMSG
+          if(msgs[j].msg_hdr.msg_flags & MSG_TRUNC)
           {
-            // Matched.
-
-            // An empty datagram signals a new client, even if he's
-            // using an old port
-            if(!this->decode_readbufferlen)
-            {
-              client->del = 1;
-              cli = this->num_clients;
-              break;
-            }
-
-            // Might we need more room to assemble the current partial message?
-            if((client->readbuffersize - client->readbufferlen) <
-               this->decode_readbufferlen)
-            {
-              // Get twice as much space.
-              client->readbuffersize *= 2;
-              // Did we hit the limit (or overflow and become negative)?
-              if((client->readbuffersize >= PLAYERXDR_MAX_MESSAGE_SIZE) ||
-                 (client->readbuffersize < 0))
-              {
-                PLAYER_WARN2("allocating maximum %d bytes to client %d's read buffer",
-                             PLAYERXDR_MAX_MESSAGE_SIZE, cli);
-                client->readbuffersize = PLAYERXDR_MAX_MESSAGE_SIZE;
-              }
-              client->readbuffer = (char*)realloc(client->readbuffer,
-                                                  client->readbuffersize);
-              assert(client->readbuffer);
-              memset(client->readbuffer + client->readbufferlen, 0,
-                     client->readbuffersize - client->readbufferlen);
-            }
-
-            // Having allocated more space, are we full?
-            if((client->readbuffersize - client->readbufferlen) <
-               this->decode_readbufferlen)
-            {
-              PLAYER_WARN2("client %d's buffer is full (%d bytes)",
-                           cli, client->readbufferlen);
-            }
-            else
-            {
-              // Copy the new datagram into the client's buffer
-              memcpy(client->readbuffer + client->readbufferlen,
-                     this->decode_readbuffer, this->decode_readbufferlen);
-              client->readbufferlen += this->decode_readbufferlen;
-
-              // Try to parse the data received so far
-              this->ParseBuffer(cli);
-            }
-
-            break;
+            PLAYER_WARN1("dropping oversized datagram on port %d",
+                         this->listeners[i].port);
+            continue;
           }
+          this->HandleDatagram(i, fromaddr + j,
+                               this->recvbuffer + j * PLAYER_UDP_DATAGRAM_SIZE,
+                               msgs[j].msg_len);
+#else
+          this->HandleDatagram(i, fromaddr, this->recvbuffer, len);
+#endif
         }
+        pthread_mutex_unlock(&this->clients_mutex);
+      }
+      num_available--;
+    }
+  }
 
-        this->DeleteClients();
+  return(0);
+}
 
-        if(cli >= this->num_clients)
-        {
-          // No match; must be a new client
-          this->AddClient(&fromaddr,
-                          this->host,
-                          this->listeners[i].port,
-                          this->listeners[i].fd,
-                          true, NULL);
-
-          if(this->decode_readbufferlen > 0)
-          {
-            PLAYER_WARN1("non-empty (%u bytes) initial message from UDP client",
-                         this->decode_readbufferlen);
-          }
-        }
+// Should be called with clients_mutex lock held
+void
+PlayerUDP::HandleDatagram(int listener, struct sockaddr_in* fromaddr,
+                          const char* data, int len)
+{
+  playerudp_conn_t* client;
+  int cli;
 
-        num_available--;
+  // Do we know about this one already?
+  for(cli=0; cli<this->num_clients; cli++)
+  {
+    client = this->clients + cli;
+    if((client->addr.sin_addr.s_addr == fromaddr->sin_addr.s_addr) &&
+       (client->addr.sin_port == fromaddr->sin_port))
+    {
+      // Matched.
 
-        pthread_mutex_unlock(&this->clients_mutex);
+      // An empty datagram signals a new client, even if he's
+      // using an old port
+      if(!len)
+      {
+        client->del = 1;
+        cli = this->num_clients;
+        break;
       }
+
+      // Add it to the message it's part of, and parse that if it's done
+      int ret = playerudp_reassemble(client, data, len);
+      if(ret < 0)
+        PLAYER_WARN2("dropping malformed datagram (%d bytes) from client %d",
+                     len, cli);
+      else if(ret > 0)
+        this->ParseBuffer(cli);
+      break;
     }
   }
 
-  return(0);
+  this->DeleteClients();
+
+  if(cli >= this->num_clients)
+  {
+    // No match; must be a new client
+    this->AddClient(fromaddr,
+                    this->host,
+                    this->listeners[listener].port,
+                    this->listeners[listener].fd,
+                    true, NULL);
+
+    if(len > 0)
+    {
+      PLAYER_WARN1("non-empty (%u bytes) initial message from UDP client",
+                   len);
+    }
+  }
 }
 
 // Should be called with clients_mutex lock held
@@ -543,205 +875,201 @@ PlayerUDP::Listening(int port)
   return(false);
 }
 
-int
-PlayerUDP::WriteClient(int cli)
+// Encode a message onto the end of a connection's write buffer, and
+// split it into datagrams.  The message is deleted; messages that cannot
+// be encoded are dropped.
+static void
+playerudp_encode(playerudp_conn_t* client, Message* msg)
 {
-  int numwritten;
-  playerudp_conn_t* client;
-  Message* msg;
   player_pack_fn_t packfunc;
   player_msghdr_t hdr;
   void* payload;
   int encode_msglen;
-  socklen_t addrlen = sizeof(struct sockaddr_in);
+  int op;
+  char* start;
 #if HAVE_Z
   player_map_data_t* zipped_data=NULL;
 #endif
 
-  client = this->clients + cli;
-  for(;;)
+  op = PLAYERXDR_ENCODE;
+  if(client->write_encoding == PLAYER_ENCODING_NATIVE)
+    op |= PLAYERXDR_NATIVE;
+
+  // Note that we make a COPY of the header.  This is so that we can
+  // edit the size field before sending it out, without affecting other
+  // instances of the message on other queues.
+  hdr = *msg->GetHeader();
+  payload = msg->GetPayload();
+
+  // HACK: special handling for map data to compress it before sending
+  // them out over the network.
+  if((hdr.addr.interf == PLAYER_MAP_CODE) &&
+     (hdr.type == PLAYER_MSGTYPE_RESP_ACK) &&
+     (hdr.subtype == PLAYER_MAP_REQ_GET_DATA))
   {
-    // try to send any bytes leftover from last time.
-    if(client->writebufferlen)
+#if HAVE_Z
+    player_map_data_t* raw_data = (player_map_data_t*)payload;
+    zipped_data = (player_map_data_t*)calloc(1,sizeof(player_map_data_t));
+    assert(zipped_data);
+
+    // copy the metadata
+    *zipped_data = *raw_data;
+    uLongf count = compressBound(raw_data->data_count);
+    zipped_data->data = (int8_t*)malloc(count);
+
+    // compress the tile
+    int ret;
+    ret = compress((Bytef*)zipped_data->data,&count,
+                     (const Bytef*)raw_data->data, raw_data->data_count);
+    if((ret != Z_OK) && (ret != Z_STREAM_END))
     {
-      numwritten = sendto(client->fd,
-                          client->writebuffer,
-                          MIN(client->writebufferlen,
-                              PLAYERUDP_WRITEBUFFER_SIZE), 0,
-                          (struct sockaddr*)&client->addr, addrlen);
+      PLAYER_ERROR("failed to compress map data");
+      free(zipped_data->data);
+      free(zipped_data);
+      delete msg;
+      return;
+    }
 
-      if(numwritten < 0)
-      {
-        if(ErrNo == ERRNO_EAGAIN)
-        {
-          // buffers are full
-          return(0);
-        }
-        else
-        {
-#if defined (WIN32)
-          LPVOID buffer = NULL;
-          FormatMessage(FORMAT_MESSAGE_ALLOCATE_BUFFER | FORMAT_MESSAGE_FROM_SYSTEM, NULL,
-                        ErrNo, 0, reinterpret_cast<LPTSTR> (&buffer), 0, NULL);
-          PLAYER_MSG1(2, "sendto() failed: %s", reinterpret_cast<LPTSTR> (buffer));
-          LocalFree(buffer);
+    zipped_data->data_count = count;
+
+    // swap the payload pointer to point at the zipped version
+    payload = (void*)zipped_data;
 #else
-          PLAYER_MSG1(2,"sendto() failed: %s", strerror(ErrNo));
+    PLAYER_WARN("not compressing map data, because zlib was not found at compile time");
 #endif
-          return(-1);
-        }
-      }
-      else if(numwritten == 0)
-      {
-        PLAYER_MSG0(2,"wrote zero bytes");
-        return(-1);
-      }
+  }
+
+  // If another client has already encoded this message, reuse its
+  // encoding (not for the compressed map data, which is a private copy)
+  const char* encoded_payload = NULL;
+  size_t encoded_len = 0;
+  if (payload && (payload == msg->GetPayload()))
+    encoded_payload = msg->GetEncodedPayload(&encoded_len,
+                                             client->write_encoding);
+
+  // Make sure there's room in the buffer for the encoded messsage.
+  // 4 times the message (including dynamic data) is a safe upper bound
+  size_t maxsize = PLAYERXDR_MSGHDR_SIZE;
+  if(encoded_payload)
+    maxsize += encoded_len;
+  else if(payload)
+    maxsize += 4 * msg->GetDataSize();
+  if(maxsize > PLAYERXDR_MAX_MESSAGE_SIZE)
+  {
+    PLAYER_WARN1("allocating maximum %d bytes to outgoing message",
+                 PLAYERXDR_MAX_MESSAGE_SIZE);
+    maxsize = PLAYERXDR_MAX_MESSAGE_SIZE;
+  }
+  if(client->writebufferlen + maxsize > (size_t)(client->writebuffersize))
+  {
+    // Get at least twice as much space.  What is already there is still
+    // waiting to be sent, so it has to be kept.
+    client->writebuffersize = MAX((size_t)(client->writebuffersize * 2),
+                                  client->writebufferlen + maxsize);
+    client->writebuffer = (char*)realloc(client->writebuffer,
+                                         client->writebuffersize);
+    assert(client->writebuffer);
+  }
+  start = client->writebuffer + client->writebufferlen;
 
-      memmove(client->writebuffer, client->writebuffer + numwritten,
-              client->writebufferlen - numwritten);
-      client->writebufferlen -= numwritten;
+  if (encoded_payload && (encoded_len <= maxsize - PLAYERXDR_MSGHDR_SIZE))
+  {
+    memcpy(start + PLAYERXDR_MSGHDR_SIZE, encoded_payload, encoded_len);
+    encode_msglen = encoded_len;
+  }
+  else if (payload)
+  {
+    // Use the packing function the message looked up when it was
+    // created
+    packfunc = msg->GetFunctionRow() ? msg->GetFunctionRow()->packfunc : NULL;
+    if(!packfunc)
+    {
+      // TODO: Allow the user to register a callback to handle unsupported messages
+      PLAYER_WARN4("skipping message from %s:%u with unsupported type %s:%u",
+                       interf_to_str(hdr.addr.interf), hdr.addr.index, msgtype_to_str(hdr.type), hdr.subtype);
+      encode_msglen = -1;
     }
-    // try to pop a pending message
-    else if((msg = client->queue->Pop()))
+    // Encode the body first
+    else if((encode_msglen =
+             (*packfunc)(start + PLAYERXDR_MSGHDR_SIZE,
+                         maxsize - PLAYERXDR_MSGHDR_SIZE,
+                         payload, op)) < 0)
     {
-      // Note that we make a COPY of the header.  This is so that we can
-      // edit the size field before sending it out, without affecting other
-      // instances of the message on other queues.
-      hdr = *msg->GetHeader();
-      payload = msg->GetPayload();
-
-      // Make sure there's room in the buffer for the encoded messsage.
-      // 4 times the message (including dynamic data) is a safe upper bound
-      size_t maxsize = PLAYERXDR_MSGHDR_SIZE + (4 * msg->GetDataSize());
-      if(maxsize > (size_t)(client->writebuffersize))
-      {
-        // Get at least twice as much space
-        client->writebuffersize = MAX((size_t)(client->writebuffersize * 2),
-                                        maxsize);
-        // Did we hit the limit (or overflow and become negative)?
-        if((client->writebuffersize >= PLAYERXDR_MAX_MESSAGE_SIZE) ||
-           (client->writebuffersize < 0))
-        {
-          PLAYER_WARN1("allocating maximum %d bytes to outgoing message buffer",
-                         PLAYERXDR_MAX_MESSAGE_SIZE);
-          client->writebuffersize = PLAYERXDR_MAX_MESSAGE_SIZE;
-        }
-        client->writebuffer = (char*)realloc(client->writebuffer,
-                                               client->writebuffersize);
-        assert(client->writebuffer);
-        memset(client->writebuffer, 0, client->writebuffersize);
-      }
-
-      // HACK: special handling for map data to compress it before sending
-      // them out over the network.
-      if((hdr.addr.interf == PLAYER_MAP_CODE) &&
-         (hdr.type == PLAYER_MSGTYPE_RESP_ACK) &&
-         (hdr.subtype == PLAYER_MAP_REQ_GET_DATA))
-      {
+      PLAYER_WARN4("encoding failed on message from %s:%u with type %s:%u",
+                   interf_to_str(hdr.addr.interf), hdr.addr.index, msgtype_to_str(hdr.type), hdr.subtype);
+    }
+    else if (payload == msg->GetPayload())
+      msg->CacheEncodedPayload(start + PLAYERXDR_MSGHDR_SIZE,
+                               encode_msglen, client->write_encoding);
+  }
+  else
+  {
+    encode_msglen = 0;
+  }
 #if HAVE_Z
-        player_map_data_t* raw_data = (player_map_data_t*)payload;
-        zipped_data = (player_map_data_t*)calloc(1,sizeof(player_map_data_t));
-        assert(zipped_data);
-
-        // copy the metadata
-        *zipped_data = *raw_data;
-        uLongf count = compressBound(raw_data->data_count);
-        zipped_data->data = (int8_t*)malloc(count);
-
-        // compress the tile
-        int ret;
-        ret = compress((Bytef*)zipped_data->data,&count,
-                         (const Bytef*)raw_data->data, raw_data->data_count);
-        if((ret != Z_OK) && (ret != Z_STREAM_END))
-        {
-          PLAYER_ERROR("failed to compress map data");
-          free(zipped_data);
-          client->writebufferlen = 0;
-          delete msg;
-          return(0);
-        }
+  if(zipped_data)
+  {
+    free(zipped_data->data);
+    free(zipped_data);
+    zipped_data=NULL;
+  }
+#endif
+  if(encode_msglen < 0)
+  {
+    delete msg;
+    return;
+  }
 
-        zipped_data->data_count = count;
+  // Rewrite the size in the header with the length of the encoded
+  // body, then encode the header.
+  hdr.size = encode_msglen;
+  if(player_msghdr_pack(start, PLAYERXDR_MSGHDR_SIZE, &hdr, op) < 0)
+  {
+    PLAYER_ERROR("failed to encode msg header");
+    delete msg;
+    return;
+  }
 
-        // swap the payload pointer to point at the zipped version
-        payload = (void*)zipped_data;
-#else
-        PLAYER_WARN("not compressing map data, because zlib was not found at compile time");
-#endif
-      }
+  // The acknowledgement of an encoding change is the last message to
+  // go out in the old encoding
+  if((hdr.addr.interf == PLAYER_PLAYER_CODE) &&
+     (hdr.type == PLAYER_MSGTYPE_RESP_ACK) &&
+     (hdr.subtype == PLAYER_PLAYER_REQ_ENCODING))
+    client->write_encoding = client->encoding;
+
+  playerudp_add_frags(client, client->writebufferlen,
+                      PLAYERXDR_MSGHDR_SIZE + hdr.size,
+                      playerudp_next_seq(client, &msg->GetHeader()->addr));
+  client->writebufferlen += PLAYERXDR_MSGHDR_SIZE + hdr.size;
+  delete msg;
+}
 
-      if (payload)
-      {
-        // Locate the appropriate packing function
-        if(!(packfunc = playerxdr_get_packfunc(hdr.addr.interf,
-                                               hdr.type, hdr.subtype)))
-        {
-          // TODO: Allow the user to register a callback to handle unsupported messages
-          PLAYER_WARN4("skipping message from %s:%u with unsupported type %s:%u",
-                           interf_to_str(hdr.addr.interf), hdr.addr.index, msgtype_to_str(hdr.type), hdr.subtype);
-        }
-        else
-        {
-          // Encode the body first
-          if((encode_msglen =
-              (*packfunc)(client->writebuffer + PLAYERXDR_MSGHDR_SIZE,
-                        maxsize - PLAYERXDR_MSGHDR_SIZE,
-                        payload, PLAYERXDR_ENCODE)) < 0)
-          {
-            PLAYER_WARN4("encoding failed on message from %s:%u with type %s:%u",
-                       interf_to_str(hdr.addr.interf), hdr.addr.index, msgtype_to_str(hdr.type), hdr.subtype);
-#if HAVE_Z
-            if(zipped_data)
-            {
-              free(zipped_data->data);
-              free(zipped_data);
-              zipped_data=NULL;
-            }
-#endif
-            client->writebufferlen = 0;
-            delete msg;
-            return(0);
-          }
-        }
-      }
-      else
-      {
-        encode_msglen = 0;
-      }
-      // Rewrite the size in the header with the length of the encoded
-      // body, then encode the header.
-      hdr.size = encode_msglen;
-      if((encode_msglen = player_msghdr_pack(client->writebuffer,
-                   PLAYERXDR_MSGHDR_SIZE, &hdr,
-                   PLAYERXDR_ENCODE)) < 0)
-      {
-        PLAYER_ERROR("failed to encode msg header");
-#if HAVE_Z
-        if(zipped_data)
-        {
-          free(zipped_data->data);
-          free(zipped_data);
-          zipped_data=NULL;
-        }
-#endif
-        client->writebufferlen = 0;
-        delete msg;
+int
+PlayerUDP::WriteClient(int cli)
+{
+  playerudp_conn_t* client;
+  Message* msg;
+
+  client = this->clients + cli;
+  for(;;)
+  {
+    // Finish sending what was left from last time first
+    if(client->num_frags)
+    {
+      if(playerudp_flush(client) < 0)
+        return(-1);
+      // the socket is full; try again when it drains
+      if(client->num_frags)
         return(0);
-      }
+    }
 
-      client->writebufferlen = PLAYERXDR_MSGHDR_SIZE + hdr.size;
+    // Encode whatever is queued, up to a buffer's worth, so that a burst
+    // of messages goes out in a few system calls
+    while((client->writebufferlen < PLAYERUDP_WRITEBUFFER_SIZE) &&
+          (msg = client->queue->Pop()))
+      playerudp_encode(client, msg);
 
-      delete msg;
-#if HAVE_Z
-      if(zipped_data)
-      {
-        free(zipped_data->data);
-        free(zipped_data);
-        zipped_data=NULL;
-      }
-#endif
-    }
-    else
+    if(!client->num_frags)
       return(0);
   }
 }
@@ -753,6 +1081,10 @@ PlayerUDP::Write()
 
   for(int i=0;i<this->num_clients;i++)
   {
+    // Reset the wakeup before popping, so that anything queued from here
+    // on wakes us again
+    if(this->clients[i].valid)
+      this->clients[i].queue->ClearNotifyFd();
     if(this->WriteClient(i) < 0)
     {
       PLAYER_WARN1("failed to write to client %d\n", i);
@@ -775,6 +1107,7 @@ PlayerUDP::ParseBuffer(int cli)
   player_pack_fn_t packfunc=NULL;
   int msglen=0;
   int decode_msglen=0;
+  int op;
   Device* device=NULL;
 
   assert((cli >= 0) && (cli < this->num_clients));
@@ -787,10 +1120,15 @@ PlayerUDP::ParseBuffer(int cli)
     if(client->readbufferlen < PLAYERXDR_MSGHDR_SIZE)
       return;
 
+    // The encoding can change from one message to the next
+    op = PLAYERXDR_DECODE;
+    if(client->encoding == PLAYER_ENCODING_NATIVE)
+      op |= PLAYERXDR_NATIVE;
+
     // Try to read the header
     if(player_msghdr_pack(client->readbuffer,
                           PLAYERXDR_MSGHDR_SIZE,
-                          &hdr, PLAYERXDR_DECODE) < 0)
+                          &hdr, op) < 0)
     {
       PLAYER_WARN("failed to unpack header on incoming message");
       return;
@@ -844,7 +1182,7 @@ PlayerUDP::ParseBuffer(int cli)
             (*packfunc)(client->readbuffer + PLAYERXDR_MSGHDR_SIZE,
 			msglen - PLAYERXDR_MSGHDR_SIZE,
 			(void*)this->decode_readbuffer,
-			PLAYERXDR_DECODE);
+			op);
         }
         else // no packing function? this had better be an empty message
         {
@@ -1200,6 +1538,35 @@ PlayerUDP::HandlePlayerMessage(int cli, Message* msg)
           break;
         }
 
+        // Request change of wire encoding
+        case PLAYER_PLAYER_REQ_ENCODING:
+        {
+          player_device_encoding_req_t* req =
+                  reinterpret_cast<player_device_encoding_req_t*> (payload);
+          uint8_t byteorder[4];
+          playerxdr_native_byteorder(byteorder);
+          resphdr.type = PLAYER_MSGTYPE_RESP_NACK;
+          if(!req)
+            PLAYER_WARN("encoding request without a payload");
+          else if((req->encoding == PLAYER_ENCODING_XDR) ||
+                  ((req->encoding == PLAYER_ENCODING_NATIVE) &&
+                   !memcmp(req->byteorder, byteorder, sizeof(byteorder))))
+          {
+            // Messages from the client switch now; messages to it switch
+            // once the acknowledgement has been encoded
+            client->encoding = req->encoding;
+            resphdr.type = PLAYER_MSGTYPE_RESP_ACK;
+          }
+          else
+            PLAYER_WARN1("refusing wire encoding %u", req->encoding);
+          // Make up and push out the reply
+          resp = new Message(resphdr, NULL);
+          assert(resp);
+          client->queue->Push(*resp);
+          delete resp;
+          break;
+        }
+
         // Request data
         case PLAYER_PLAYER_REQ_DATA:
           // Make up and push out the reply
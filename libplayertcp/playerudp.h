@@ -89,10 +89,14 @@ This library moves messages between Player message queues and UDP sockets.
     calloc() and realloc() read buffers in multiples of this size. */
 #define PLAYERUDP_READBUFFER_SIZE 65536
 
-/** We try to write() outgoing messages in chunks of this size.  We also
-    calloc() and realloc() write buffers in multiples of this size. */
+/** Outgoing messages are encoded into a client's write buffer until this
+    much is waiting, and then sent together.  We also calloc() write
+    buffers of this size. */
 #define PLAYERUDP_WRITEBUFFER_SIZE 65536
 
+/** Most datagrams sent or received in one system call */
+#define PLAYERUDP_BATCH 64
+
 // Forward declarations
 struct pollfd;
 
@@ -121,6 +125,12 @@ class PLAYERUDP_EXPORT PlayerUDP
     int decode_readbuffersize;
     /** Currently-used length of @p decode_readbuffersize */
     int decode_readbufferlen;
+    /** Room for a batch of incoming datagrams, PLAYER_UDP_DATAGRAM_SIZE
+     * bytes each */
+    char* recvbuffer;
+
+    void HandleDatagram(int listener, struct sockaddr_in* fromaddr,
+                        const char* data, int len);
 
   public:
     PlayerUDP();
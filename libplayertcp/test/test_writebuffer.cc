@@ -0,0 +1,118 @@
+/*
+ *  Player - One Hell of a Robot Server
+ *  Copyright (C) 2000
+ *     Brian Gerkey, Kasper Stoy, Richard Vaughan, & Andrew Howard
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+/*
+ * $Id$
+ *
+ * Checks that a client's write buffer stays bounded when the client
+ * reads at only half the rate at which data is published to it, and so
+ * never quite catches up.
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include <libplayercore/playercore.h>
+#include <libplayertcp/playertcp.h>
+
+#include "playertest.h"
+
+#define MSG_SIZE 4096
+#define MSGS_PER_ROUND 4
+#define ROUNDS 4000
+
+int
+main(int argc, char** argv)
+{
+  int fds[2];
+  int bufsize = 16384;
+  static char readbuf[MSGS_PER_ROUND * MSG_SIZE];
+  static uint8_t data[MSG_SIZE];
+
+  PlayerTCP::InitGlobals();
+
+  if(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0)
+  {
+    perror("socketpair");
+    return(1);
+  }
+  setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &bufsize, sizeof(bufsize));
+  setsockopt(fds[1], SOL_SOCKET, SO_RCVBUF, &bufsize, sizeof(bufsize));
+  fcntl(fds[0], F_SETFL, O_NONBLOCK);
+  fcntl(fds[1], F_SETFL, O_NONBLOCK);
+
+  PlayerTCP* ptcp = new PlayerTCP();
+  QueuePointer q = ptcp->AddClient(NULL, 0, 0, fds[0], false, NULL, false);
+
+  player_opaque_data_t opaque;
+  opaque.data_count = MSG_SIZE;
+  opaque.data = data;
+  player_msghdr_t hdr;
+  memset(&hdr, 0, sizeof(hdr));
+  hdr.addr.interf = PLAYER_OPAQUE_CODE;
+  hdr.type = PLAYER_MSGTYPE_DATA;
+  hdr.subtype = PLAYER_OPAQUE_DATA_STATE;
+
+  size_t maxsize = 0;
+  ssize_t total = 0;
+  bool ok = true;
+  for(int i = 0; i < ROUNDS && ok; i++)
+  {
+    for(int j = 0; j < MSGS_PER_ROUND; j++)
+    {
+      Message msg(hdr, &opaque);
+      q->Push(msg);
+    }
+    if(ptcp->WriteClient(0) < 0)
+      ok = false;
+
+    // Take half of what was published this round
+    ssize_t want = MSGS_PER_ROUND * MSG_SIZE / 2, got;
+    while(want > 0 && (got = read(fds[1], readbuf, want)) > 0)
+    {
+      want -= got;
+      total += got;
+    }
+
+    playertcp_client_stats_t stats;
+    if(ptcp->GetClientStats(0, &stats) < 0)
+      ok = false;
+    else if(stats.writebuffersize > maxsize)
+      maxsize = stats.writebuffersize;
+  }
+  printf("read %ld bytes; write buffer peaked at %lu bytes\n",
+         (long)total, (unsigned long)maxsize);
+
+  check(ok, "client written to throughout");
+  check(total >= (ssize_t)ROUNDS * MSGS_PER_ROUND * MSG_SIZE / 2 - MSG_SIZE,
+        "client read at half rate");
+  check(maxsize <= 4 * PLAYERTCP_WRITEBUFFER_SIZE,
+        "write buffer stays bounded");
+
+  delete ptcp;
+  player_globals_fini();
+  return(test_result());
+}
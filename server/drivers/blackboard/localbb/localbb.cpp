@@ -377,6 +377,9 @@ void localbb_Register(DriverTable* table)
 LocalBB::LocalBB(ConfigFile* cf, int section) :
 	Driver(cf, section, true, PLAYER_MSGQUEUE_DEFAULT_MAXLEN, PLAYER_BLACKBOARD_CODE)
 {
+	// all our work is done in response to messages
+	this->event_driven = true;
+
 	// No settings needed currently.
 }
 
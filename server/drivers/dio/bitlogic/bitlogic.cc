@@ -113,6 +113,9 @@ class Bitlogic : public Driver
 
 Bitlogic::Bitlogic(ConfigFile * cf, int section) : Driver(cf, section, true, PLAYER_MSGQUEUE_DEFAULT_MAXLEN)
 {
+  // all our work is done in response to messages
+  this->event_driven = true;
+
   const char * _init_bits;
   const char * fun;
   char key[7];
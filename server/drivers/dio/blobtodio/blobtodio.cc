@@ -86,10 +86,10 @@ driver
 #include <assert.h>
 #include <libplayercore/playercore.h>
 
-#if defined (WIN32)
-  #define snprintf _snprintf
-#endif
-
+#if defined (WIN32)
+  #define snprintf _snprintf
+#endif
+
 class BlobToDio : public Driver
 {
   public: BlobToDio(ConfigFile * cf, int section);
@@ -112,6 +112,9 @@ class BlobToDio : public Driver
 
 BlobToDio::BlobToDio(ConfigFile * cf, int section) : Driver(cf, section, true, PLAYER_MSGQUEUE_DEFAULT_MAXLEN)
 {
+  // all our work is done in response to messages
+  this->event_driven = true;
+
   int i, j;
   char entry[12];
 
@@ -180,6 +180,9 @@ private:
 
 Blobtracker::Blobtracker(ConfigFile * cf, int section) : Driver(cf, section, true, PLAYER_MSGQUEUE_DEFAULT_MAXLEN)
 {
+  // all our work is done in response to messages
+  this->event_driven = true;
+
   memset(&(this->r_blobfinder_addr), 0, sizeof(player_devaddr_t));
   memset(&(this->r_ptz_addr), 0, sizeof(player_devaddr_t));
   memset(&(this->p_dio_addr), 0, sizeof(player_devaddr_t));
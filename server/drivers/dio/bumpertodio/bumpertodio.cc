@@ -105,6 +105,9 @@ class BumperToDio : public Driver
 
 BumperToDio::BumperToDio(ConfigFile * cf, int section) : Driver(cf, section, true, PLAYER_MSGQUEUE_DEFAULT_MAXLEN)
 {
+  // all our work is done in response to messages
+  this->event_driven = true;
+
   memset(&(this->dio_provided_addr), 0, sizeof(player_devaddr_t));
   memset(&(this->bumper_required_addr), 0, sizeof(player_devaddr_t));
   memset(&(this->dio_required_addr), 0, sizeof(player_devaddr_t));
@@ -124,6 +124,9 @@ class DioLatch : public Driver
 //
 DioLatch::DioLatch(ConfigFile * cf, int section) : Driver(cf, section, true, PLAYER_MSGQUEUE_DEFAULT_MAXLEN)
 {
+  // all our work is done in response to messages
+  this->event_driven = true;
+
   const char * _pattern;
   int i;
   uint32_t u;
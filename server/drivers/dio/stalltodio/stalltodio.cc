@@ -94,6 +94,9 @@ class StallToDio : public Driver
 
 StallToDio::StallToDio(ConfigFile * cf, int section) : Driver(cf, section, true, PLAYER_MSGQUEUE_DEFAULT_MAXLEN)
 {
+  // all our work is done in response to messages
+  this->event_driven = true;
+
   memset(&(this->dio_provided_addr), 0, sizeof(player_devaddr_t));
   memset(&(this->position2d_required_addr), 0, sizeof(player_devaddr_t));
   memset(&(this->dio_required_addr), 0, sizeof(player_devaddr_t));
@@ -189,6 +189,9 @@ void laserbar_Register(DriverTable* table)
 LaserBar::LaserBar( ConfigFile* cf, int section)
   : Driver(cf, section, true, PLAYER_MSGQUEUE_DEFAULT_MAXLEN, PLAYER_FIDUCIAL_CODE)
 {
+  // all our work is done in response to messages
+  this->event_driven = true;
+
 
   // Must have an input laser
   if (cf->ReadDeviceAddr(&this->laser_addr, section, "requires",
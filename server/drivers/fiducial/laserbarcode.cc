@@ -200,6 +200,9 @@ void laserbarcode_Register(DriverTable* table)
 LaserBarcode::LaserBarcode( ConfigFile* cf, int section)
   : Driver(cf, section, true, PLAYER_MSGQUEUE_DEFAULT_MAXLEN, PLAYER_FIDUCIAL_CODE)
 {
+  // all our work is done in response to messages
+  this->event_driven = true;
+
   // Must have an input laser
   if (cf->ReadDeviceAddr(&this->laser_id, section, "requires",
                        PLAYER_LASER_CODE, -1, NULL) != 0)
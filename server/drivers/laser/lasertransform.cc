@@ -27,6 +27,9 @@
 LaserTransform::LaserTransform( ConfigFile* cf, int section)
   : Driver(cf, section, true, PLAYER_MSGQUEUE_DEFAULT_MAXLEN, PLAYER_LASER_CODE)
 {
+  // all our work is done in response to messages
+  this->event_driven = true;
+
   // Must have an input laser
   if (cf->ReadDeviceAddr(&this->laser_addr, section, "requires",
                          PLAYER_LASER_CODE, -1, NULL) != 0)
@@ -190,6 +190,9 @@ MapFile::MapFile(ConfigFile* cf, int section, const char* file,
                  double res, int neg, player_pose2d_t o)
   : Driver(cf, section, true, PLAYER_MSGQUEUE_DEFAULT_MAXLEN, PLAYER_MAP_CODE)
 {
+  // all our work is done in response to messages
+  this->event_driven = true;
+
   this->mapdata = NULL;
   this->size_x = this->size_y = 0;
   this->filename = file;
@@ -31,6 +31,9 @@
 MapTransform::MapTransform(ConfigFile* cf, int section)
   : Driver(cf, section, true, PLAYER_MSGQUEUE_DEFAULT_MAXLEN, PLAYER_MAP_CODE)
 {
+  // all our work is done in response to messages
+  this->event_driven = true;
+
   PLAYER_MSG0(9,"Initialising the MapTransform Driver");
   memset(&source_map,0,sizeof(source_map));
   memset(&new_map,0,sizeof(new_map));
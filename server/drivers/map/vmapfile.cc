@@ -160,6 +160,9 @@ vmapfile_Register(DriverTable* table)
 VMapFile::VMapFile(ConfigFile* cf, int section, const char* file)
   : Driver(cf, section, false, PLAYER_MSGQUEUE_DEFAULT_MAXLEN, PLAYER_MAP_CODE)
 {
+  // all our work is done in response to messages
+  this->event_driven = true;
+
   this->vmap = NULL;
   this->filename = file;
   scalex_ = cf->ReadTupleFloat(section, "scale", 0, 1.0);
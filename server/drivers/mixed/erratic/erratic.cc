@@ -217,6 +217,9 @@ extern "C" {
 Erratic::Erratic(ConfigFile* cf, int section)
   : Driver(cf,section,true,PLAYER_MSGQUEUE_DEFAULT_MAXLEN)
 {
+  // all our work is done in response to messages
+  this->event_driven = true;
+
   // zero ids, so that we'll know later which interfaces were requested
   memset(&this->position_id, 0, sizeof(player_devaddr_t));
   memset(&this->power_id, 0, sizeof(player_devaddr_t));
@@ -209,6 +209,9 @@ extern "C"
 mbasedriver::mbasedriver(ConfigFile* cf, int section)
   : Driver(cf,section,true,PLAYER_MSGQUEUE_DEFAULT_MAXLEN)
 {
+	// all our work is done in response to messages
+	this->event_driven = true;
+
 	memset(&this->position_id, 0, sizeof(player_devaddr_t));	
 	memset(&this->power_id, 0, sizeof(player_devaddr_t));
   	memset(&this->aio_id, 0, sizeof(player_devaddr_t));
@@ -169,6 +169,9 @@ LaserPTZCloud::LaserPTZCloud (ConfigFile* cf, int section)
     : Driver(cf, section, false, PLAYER_MSGQUEUE_DEFAULT_MAXLEN,
              PLAYER_POINTCLOUD3D_CODE)
 {
+    // all our work is done in response to messages
+    this->event_driven = true;
+
     // Must have an input laser
     if (cf->ReadDeviceAddr (&this->laser_addr, section, "requires",
         PLAYER_LASER_CODE, -1, NULL) != 0)
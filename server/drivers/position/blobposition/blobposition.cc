@@ -167,6 +167,9 @@ class Blobposition: public Driver
 Blobposition::Blobposition(ConfigFile * cf, int section)
     : Driver(cf, section, true, PLAYER_MSGQUEUE_DEFAULT_MAXLEN)
 {
+  // all our work is done in response to messages
+  this->event_driven = true;
+
   const char * hexbuf;
   int i;
 
@@ -362,6 +362,9 @@ int BumperSafe::ShutdownBumper() {
 BumperSafe::BumperSafe( ConfigFile* cf, int section)
   : Driver(cf, section, true, PLAYER_MSGQUEUE_DEFAULT_MAXLEN, PLAYER_POSITION2D_CODE)
 {
+  // all our work is done in response to messages
+  this->event_driven = true;
+
   Blocked = false;
 
   this->position = NULL;
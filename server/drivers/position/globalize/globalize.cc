@@ -102,6 +102,9 @@ class Globalize : public Driver
 
 Globalize::Globalize(ConfigFile* cf, int section) : Driver(cf, section, true, PLAYER_MSGQUEUE_DEFAULT_MAXLEN)
 {
+  // all our work is done in response to messages
+  this->event_driven = true;
+
   int i;
 
   this->r_local_pos_dev = NULL;
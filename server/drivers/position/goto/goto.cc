@@ -218,6 +218,9 @@ double Goto::angle_diff(double a, double b)
 
 Goto::Goto(ConfigFile* cf, int section) : Driver(cf, section, true, PLAYER_MSGQUEUE_DEFAULT_MAXLEN)
 {
+  // all our work is done in response to messages
+  this->event_driven = true;
+
   int i;
 
   srand(time(NULL));
@@ -508,6 +508,9 @@ int LaserSafe::ShutdownLaser () {
 LaserSafe::LaserSafe (ConfigFile* cf, int section)
   : Driver (cf, section, true, PLAYER_MSGQUEUE_DEFAULT_MAXLEN, PLAYER_POSITION2D_CODE)
 {
+  // all our work is done in response to messages
+  this->event_driven = true;
+
   Blocked = false;
   gotPoseInfo = false;
   needPoseInfo = false;
@@ -38,6 +38,9 @@
 FromRanger::FromRanger (ConfigFile* cf, int section)
 	: Driver (cf, section, false, PLAYER_MSGQUEUE_DEFAULT_MAXLEN, PLAYER_LASER_CODE)
 {
+	// all our work is done in response to messages
+	this->event_driven = true;
+
 	inputDevice = NULL;
 }
 
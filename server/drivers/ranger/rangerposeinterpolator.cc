@@ -188,6 +188,9 @@ RangerPoseInterp::RangerPoseInterp(ConfigFile* cf, int section)
     : Driver(cf, section, true, PLAYER_MSGQUEUE_DEFAULT_MAXLEN,
              PLAYER_RANGER_CODE)
 {
+  // all our work is done in response to messages
+  this->event_driven = true;
+
   // Must have an input ranger
   if (cf->ReadDeviceAddr(&this->ranger_addr, section, "requires",
                          PLAYER_RANGER_CODE, -1, NULL) != 0)
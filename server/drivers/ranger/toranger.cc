@@ -38,6 +38,9 @@
 ToRanger::ToRanger (ConfigFile* cf, int section)
 	: Driver (cf, section, false, PLAYER_MSGQUEUE_DEFAULT_MAXLEN, PLAYER_RANGER_CODE)
 {
+	// all our work is done in response to messages
+	this->event_driven = true;
+
 	memset (&deviceGeom, 0, sizeof (deviceGeom));
 	deviceGeom.element_poses = NULL;
 	deviceGeom.element_sizes = NULL;
@@ -0,0 +1,168 @@
+/*
+ *  Player - One Hell of a Robot Server
+ *  Copyright (C) 2004
+ *     Andrew Howard
+ *
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+/*
+ * Desc: Binary log file container, shared by writelog and readlog
+ */
+
+#include <string.h>
+
+#include "binlog.h"
+
+
+////////////////////////////////////////////////////////////////////////////
+// Big-endian integers and doubles
+static void PutUint32(char *dst, uint32_t value)
+{
+  dst[0] = (char) (value >> 24);
+  dst[1] = (char) (value >> 16);
+  dst[2] = (char) (value >> 8);
+  dst[3] = (char) value;
+}
+
+static uint32_t GetUint32(const char *src)
+{
+  const unsigned char *s = (const unsigned char*) src;
+  return ((uint32_t) s[0] << 24) | ((uint32_t) s[1] << 16) |
+         ((uint32_t) s[2] << 8) | (uint32_t) s[3];
+}
+
+static void PutUint64(char *dst, uint64_t value)
+{
+  PutUint32(dst, (uint32_t) (value >> 32));
+  PutUint32(dst + 4, (uint32_t) value);
+}
+
+static uint64_t GetUint64(const char *src)
+{
+  return ((uint64_t) GetUint32(src) << 32) | GetUint32(src + 4);
+}
+
+static void PutDouble(char *dst, double value)
+{
+  uint64_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  PutUint64(dst, bits);
+}
+
+static double GetDouble(const char *src)
+{
+  uint64_t bits = GetUint64(src);
+  double value;
+  memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Write the file header
+void BinLogPackHeader(char *dst)
+{
+  memcpy(dst, BINLOG_MAGIC, 8);
+  PutUint32(dst + 8, BINLOG_VERSION);
+  PutUint32(dst + 12, 0);
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Read the file header
+int BinLogUnpackHeader(uint32_t *version, const char *src)
+{
+  if (memcmp(src, BINLOG_MAGIC, 8) != 0)
+    return -1;
+  *version = GetUint32(src + 8);
+  return 0;
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Write a chunk header
+void BinLogPackChunkHeader(char *dst, const BinLogChunk *chunk)
+{
+  memcpy(dst, BINLOG_CHUNK_MAGIC, 4);
+  PutUint32(dst + 4, chunk->count);
+  PutUint32(dst + 8, chunk->length);
+  PutUint32(dst + 12, 0);
+  PutDouble(dst + 16, chunk->start_time);
+  PutDouble(dst + 24, chunk->end_time);
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Read a chunk header
+int BinLogUnpackChunkHeader(BinLogChunk *chunk, const char *src)
+{
+  if (memcmp(src, BINLOG_CHUNK_MAGIC, 4) != 0)
+    return -1;
+  chunk->count = GetUint32(src + 4);
+  chunk->length = GetUint32(src + 8);
+  chunk->start_time = GetDouble(src + 16);
+  chunk->end_time = GetDouble(src + 24);
+  return 0;
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Write an index entry
+void BinLogPackIndexEntry(char *dst, const BinLogChunk *chunk)
+{
+  PutUint64(dst, chunk->offset);
+  PutUint32(dst + 8, chunk->count);
+  PutUint32(dst + 12, chunk->length);
+  PutDouble(dst + 16, chunk->start_time);
+  PutDouble(dst + 24, chunk->end_time);
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Read an index entry
+void BinLogUnpackIndexEntry(BinLogChunk *chunk, const char *src)
+{
+  chunk->offset = GetUint64(src);
+  chunk->count = GetUint32(src + 8);
+  chunk->length = GetUint32(src + 12);
+  chunk->start_time = GetDouble(src + 16);
+  chunk->end_time = GetDouble(src + 24);
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Write the trailer
+void BinLogPackTrailer(char *dst, uint32_t count, uint64_t index_offset)
+{
+  memcpy(dst, BINLOG_INDEX_MAGIC, 8);
+  PutUint32(dst + 8, count);
+  PutUint32(dst + 12, 0);
+  PutUint64(dst + 16, index_offset);
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Read the trailer
+int BinLogUnpackTrailer(uint32_t *count, uint64_t *index_offset,
+                        const char *src)
+{
+  if (memcmp(src, BINLOG_INDEX_MAGIC, 8) != 0)
+    return -1;
+  *count = GetUint32(src + 8);
+  *index_offset = GetUint64(src + 16);
+  return 0;
+}
@@ -0,0 +1,106 @@
+/*
+ *  Player - One Hell of a Robot Server
+ *  Copyright (C) 2004
+ *     Andrew Howard
+ *
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+/*
+ * Desc: Binary log file container, shared by writelog and readlog
+ *
+ * A binary log starts with a header holding BINLOG_MAGIC and the format
+ * version.  Messages follow in chunks; each chunk has a header giving the
+ * number of messages, the length of the message data and the first and
+ * last timestamps in it.  Each message is stored as it would go over the
+ * wire: an XDR-encoded player_msghdr_t followed by the XDR-encoded
+ * payload.  When the log is closed, an index of all the chunks is written
+ * after the last one, followed by a fixed-size trailer pointing back at
+ * the index.  A log whose writer died has no index, but can still be read
+ * chunk by chunk.  All integers and doubles are big-endian.
+ */
+
+#ifndef BINLOG_H_
+#define BINLOG_H_
+
+#if !defined (WIN32) || defined (__MINGW32__)
+  #include <stdint.h>
+#endif
+#include <stddef.h>
+
+/// File header: magic, version, reserved
+#define BINLOG_MAGIC "PLAYERBL"
+#define BINLOG_VERSION 1
+#define BINLOG_HEADER_SIZE 16
+
+/// Chunk header: magic, count, length, reserved, start and end times
+#define BINLOG_CHUNK_MAGIC "CHNK"
+#define BINLOG_CHUNK_HEADER_SIZE 32
+
+/// Index entry: offset, count, length, start and end times
+#define BINLOG_INDEX_ENTRY_SIZE 32
+
+/// Trailer: magic, index entry count, reserved, index offset
+#define BINLOG_INDEX_MAGIC "PLAYERIX"
+#define BINLOG_TRAILER_SIZE 24
+
+/// A chunk is written out once it holds this many bytes of messages...
+#define BINLOG_CHUNK_SIZE (1024 * 1024)
+/// ...or spans this many seconds of log time
+#define BINLOG_CHUNK_PERIOD 1.0
+/// So no chunk is longer than this (a full chunk plus the message that
+/// overfilled it)
+#define BINLOG_MAX_CHUNK_LENGTH (BINLOG_CHUNK_SIZE + PLAYERXDR_MAX_MESSAGE_SIZE)
+
+/// Where a chunk is and what it holds
+struct BinLogChunk
+{
+  /// File offset of the chunk header
+  public: uint64_t offset;
+  /// Number of messages
+  public: uint32_t count;
+  /// Length of the message data, not counting the chunk header
+  public: uint32_t length;
+  /// Timestamps of the first and last messages
+  public: double start_time, end_time;
+};
+
+/// Write the file header into a buffer of BINLOG_HEADER_SIZE bytes
+void BinLogPackHeader(char *dst);
+
+/// Read the file header; returns -1 if this is not a binary log
+int BinLogUnpackHeader(uint32_t *version, const char *src);
+
+/// Write a chunk header into a buffer of BINLOG_CHUNK_HEADER_SIZE bytes
+void BinLogPackChunkHeader(char *dst, const BinLogChunk *chunk);
+
+/// Read a chunk header; returns -1 if there isn't one here
+int BinLogUnpackChunkHeader(BinLogChunk *chunk, const char *src);
+
+/// Write an index entry into a buffer of BINLOG_INDEX_ENTRY_SIZE bytes
+void BinLogPackIndexEntry(char *dst, const BinLogChunk *chunk);
+
+/// Read an index entry
+void BinLogUnpackIndexEntry(BinLogChunk *chunk, const char *src);
+
+/// Write a trailer into a buffer of BINLOG_TRAILER_SIZE bytes
+void BinLogPackTrailer(char *dst, uint32_t count, uint64_t index_offset);
+
+/// Read a trailer; returns -1 if there isn't one here
+int BinLogUnpackTrailer(uint32_t *count, uint64_t *index_offset,
+                        const char *src);
+
+#endif
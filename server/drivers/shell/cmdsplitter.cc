@@ -110,6 +110,9 @@ class CmdSplitter : public Driver
 
 CmdSplitter::CmdSplitter(ConfigFile * cf, int section) : Driver(cf, section, true, PLAYER_MSGQUEUE_DEFAULT_MAXLEN)
 {
+  // all our work is done in response to messages
+  this->event_driven = true;
+
   char key[7];
   int i;
 
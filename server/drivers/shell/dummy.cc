@@ -212,37 +212,38 @@ void Dummy::Main(void)
         {
             case PLAYER_CAMERA_CODE:
             {
-                player_camera_data_t data;
+                // Build the frame on the heap and hand it over to
+                // Publish (copy = false), so that the image is shared by
+                // every subscriber rather than cloned
+                player_camera_data_t* data =
+                  (player_camera_data_t*)calloc(1, sizeof(player_camera_data_t));
+                assert(data);
                 int w = 320;
                 int h = 240;
 
-                data.width = w;
-                data.height = h;
-                data.bpp = 24;
-                data.format = PLAYER_CAMERA_FORMAT_RGB888;
-                data.compression = PLAYER_CAMERA_COMPRESS_RAW;
-                data.image_count = w * h * 3;
-                
-                data.image = new uint8_t[data.image_count];
-                
-                
-                
+                data->width = w;
+                data->height = h;
+                data->bpp = 24;
+                data->format = PLAYER_CAMERA_FORMAT_RGB888;
+                data->compression = PLAYER_CAMERA_COMPRESS_RAW;
+                data->image_count = w * h * 3;
+
+                data->image = (uint8_t*)malloc(data->image_count);
+                assert(data->image);
+
                 for (int j = 0; j < h; j++)
                 {
                     for (int i = 0; i < w; i++)
                     {
-                        data.image[(i + j * w) * 3 + 0] = loopcount;//((i + j) % 2) * 255;
-                        data.image[(i + j * w) * 3 + 1] = loopcount;//((i + j) % 2) * 255;
-                        data.image[(i + j * w) * 3 + 2] = loopcount;//((i + j) % 2) * 255;
+                        data->image[(i + j * w) * 3 + 0] = loopcount;//((i + j) % 2) * 255;
+                        data->image[(i + j * w) * 3 + 1] = loopcount;//((i + j) % 2) * 255;
+                        data->image[(i + j * w) * 3 + 2] = loopcount;//((i + j) % 2) * 255;
                     }
                 }
 
-                int data_len = sizeof(data);// - sizeof(data.image) + w * h * 3;
-
                 Publish (device_addr, PLAYER_MSGTYPE_DATA,
-                         PLAYER_CAMERA_DATA_STATE, (void*)&data, data_len,
-                         NULL);
-                delete[] data.image;
+                         PLAYER_CAMERA_DATA_STATE, (void*)data, 0,
+                         NULL, false);
                 loopcount++;
                 if (loopcount > 255)
                   loopcount = 0;
@@ -884,6 +884,9 @@ void Guile::scm_player_init()
 Guile::Guile(ConfigFile * cf, int section)
   : Driver(cf, section, true, PLAYER_MSGQUEUE_DEFAULT_MAXLEN)
 {
+  // all our work is done in response to messages
+  this->event_driven = true;
+
   int i, j, n, rnum;
   const char * key;
   const char * pkeys[MAX_ADDR];
@@ -134,6 +134,9 @@ class Inhibitor : public Driver
 
 Inhibitor::Inhibitor(ConfigFile * cf, int section) : Driver(cf, section, true, PLAYER_MSGQUEUE_DEFAULT_MAXLEN)
 {
+  // all our work is done in response to messages
+  this->event_driven = true;
+
   const char * _bitmask;
   size_t count;
   int i;
@@ -549,6 +549,9 @@ void postlog_Register(DriverTable *table)
 Postlog::Postlog(ConfigFile * cf, int section)
   : Driver(cf, section, true, PLAYER_MSGQUEUE_DEFAULT_MAXLEN)
 {
+  // all our work is done in response to messages
+  this->event_driven = true;
+
   int i, n, rnum;
   const char * table;
 
@@ -36,8 +36,10 @@ The readlog driver can be used to replay data stored in a log file.
 This is particularly useful for debugging client programs, since users
 may run their clients against the same data set over and over again.
 Suitable log files can be generated using the @ref driver_writelog driver.
-The format for the log file can be found in the
-@ref tutorial_datalog "data logging tutorial".
+The driver reads both the ascii and the binary log formats, telling them
+apart by the first bytes of the file; the formats are described in the
+@ref tutorial_datalog "data logging tutorial".  Binary logs are much
+faster to read, and can replay data from any interface.
 
 See below for an example configuration file; note that the device
 id's specified in the provides field must match those stored in the
@@ -91,6 +93,7 @@ The driver also provides an interface for controlling the playback:
 - PLAYER_LOG_SET_READ_STATE_REQ
 - PLAYER_LOG_GET_STATE_REQ
 - PLAYER_LOG_SET_READ_REWIND_REQ
+- PLAYER_LOG_REQ_SET_READ_SEEK
 
 @par Configuration file options
 
@@ -100,6 +103,16 @@ The driver also provides an interface for controlling the playback:
 - speed (float)
   - Default: 1.0
   - Playback speed; 1.0 is real-time
+- unthrottled (integer)
+  - Default: 0
+  - Ignore speed, and play back as fast as the subscribers take the data:
+    each message is held back until every queue subscribed to the
+    driver's devices has been emptied.  As no message is ever replaced in,
+    or dropped from, a full queue, a pipeline of drivers fed this way sees
+    the same data on every run.
+    Note that a client in PULL mode (the libplayerc default) only empties
+    its queue when it asks for data, so it gets one message per read;
+    switch clients to PUSH mode to replay at full speed.
 - autoplay (integer)
   - Default: 1
   - Begin playing back log data when first client subscribes
@@ -109,6 +122,27 @@ The driver also provides an interface for controlling the playback:
   - Default: 0
   - Automatically rewind and play the log file again when the end is
     reached (as opposed to not producing any more data).
+- readahead (integer)
+  - Default: 8
+  - For compressed (.gz) logs: the number of 1 MB blocks that a separate
+    thread inflates ahead of playback.  0 inflates the log in the driver
+    thread, as it is read.
+
+@par Seeking
+
+A client can jump to any time in the log with a
+PLAYER_LOG_REQ_SET_READ_SEEK request.  Binary logs are seeked through
+their chunk index.  For ascii logs, and binary logs that have lost
+their index, the driver reads through the file once, on the first seek,
+and notes where each second of the log starts; later seeks go straight
+there.
+
+@par Time
+
+While the driver runs, the server clock follows the log: it reads the
+timestamp of the message last played back, whatever the speed.  Drivers
+downstream that use the server clock (and not the wall clock) therefore
+behave the same at any speed, and in unthrottled mode.
 
 @par Example
 
@@ -133,11 +167,12 @@ driver
 
 #include <libplayercore/playercore.h>
 #include <libplayerinterface/functiontable.h>
-//#include <libplayerinterface/playerxdr.h>
+#include <libplayerinterface/playerxdr.h>
 
 #include <assert.h>
 #include <ctype.h>
 #include <errno.h>
+#include <pthread.h>
 #include <sys/types.h>
 #if !defined (WIN32) || defined (__MINGW32__)
   #include <sys/time.h>
@@ -150,15 +185,36 @@ driver
 
 #if HAVE_Z
   #include <zlib.h>
+  // Use 64-bit offsets in compressed logs where zlib has them
+  #if defined (Z_LARGE64)
+    #define READLOG_GZSEEK(file, offset) \
+      gzseek64(file, (z_off64_t) (offset), SEEK_SET)
+    #define READLOG_GZTELL(file) ((uint64_t) gztell64(file))
+  #else
+    #define READLOG_GZSEEK(file, offset) \
+      gzseek(file, (z_off_t) (offset), SEEK_SET)
+    #define READLOG_GZTELL(file) ((uint64_t) gztell(file))
+  #endif
 #endif
 
+#include "binlog.h"
 #include "encode.h"
 #include "readlog_time.h"
 
 #if defined (WIN32)
   #define strdup _strdup
+  #define fseeko _fseeki64
 #endif
 
+// Spacing of the index built for logs that don't come with one [s]
+#define READLOG_INDEX_PERIOD 1.0
+
+// How often to check on the subscribers in unthrottled mode [s]
+#define READLOG_DRAIN_PERIOD 0.0002
+
+// Size of the blocks a compressed log is inflated in
+#define READLOG_BLOCK_SIZE (1024 * 1024)
+
 
 #if 0
 // we use this pointer to reset timestamps in the client objects when the
@@ -233,6 +289,58 @@ class ReadLog: public ThreadedDriver
                                 player_msghdr_t * hdr,
                                 void * data);
 
+  // Read some bytes from the file
+  private: size_t ReadBytes(void *buf, size_t len);
+
+  // Move to an offset in the file
+  private: int Seek(uint64_t offset);
+
+  // Read the next line from an ascii log
+  private: int ReadLine();
+
+#if HAVE_Z
+  // Start and stop inflating a compressed log ahead of playback
+  private: void StartReader();
+  private: void StopReader();
+
+  // Make sure there is an inflated block to read from; returns false at
+  // the end of the file
+  private: bool NextBlock();
+
+  // Done with the current inflated block
+  private: void ReleaseBlock();
+
+  // Reader thread
+  private: static void* ReaderThread(void *arg);
+  private: void ReaderMain();
+#endif
+
+  // Index a log that didn't come with one
+  private: int BuildIndex();
+
+  // Move to the first message at or after a time in the log; returns the
+  // log time moved to
+  private: int SeekTime(double time, bool relative, double *target);
+
+  // Wait until the subscribers have taken everything we've published
+  private: void WaitForSubscribers();
+
+  // Work out whether the file is a binary log, and if so load its index
+  private: int OpenBinary();
+
+  // Read the next message from a binary log
+  private: int ReadRecord();
+
+  // Decode and publish the current message from a binary log
+  private: int PublishRecord(player_devaddr_t id, double time);
+
+  // Cache a configuration reply from a binary log
+  private: int CacheReply(player_devaddr_t id, unsigned short subtype,
+                          void *data);
+
+  // Free the metadata cached for a device
+  private: void FreeMetadata(int j);
+
   // Parse the header info
   private: int ParseHeader(int linenum, int token_count, char **tokens,
                            player_devaddr_t *id, double *dtime,
@@ -379,6 +487,9 @@ class ReadLog: public ThreadedDriver
   private: player_devaddr_t provide_ids[1024];
   // spots to cache metadata for a device (e.g., sonar geometry)
   private: void* provide_metadata[1024];
+  // Subtype of a reply cached by CacheReply() (a deep copy), or 0 if the
+  // metadata is a plain allocation
+  private: unsigned short provide_reply_subtype[1024];
 
   // The log interface (at most one of these)
   private: player_devaddr_t log_id;
@@ -388,6 +499,22 @@ class ReadLog: public ThreadedDriver
   private: FILE *file;
 #if HAVE_Z
   private: gzFile gzfile;
+
+  // Compressed logs: a ring of blocks inflated by the reader thread.
+  // The reader fills the block_count blocks from block_head on; once
+  // block_held is set, the driver thread is reading the one at block_head.
+  private: int readahead;
+  private: char **blocks;
+  private: size_t *block_len;
+  private: int block_head, block_count;
+  private: size_t block_pos;
+  private: bool block_held;
+  // Offset in the inflated log that the driver thread has read up to
+  private: uint64_t reader_offset;
+  private: bool reader_running, reader_quit, reader_eof;
+  private: pthread_t reader_thread;
+  private: pthread_mutex_t reader_mutex;
+  private: pthread_cond_t reader_cond;
 #endif
 
   // localize particles
@@ -400,18 +527,45 @@ class ReadLog: public ThreadedDriver
   private: size_t line_size;
   private: char *line;
 
+  // Is this a binary log?
+  private: bool binary;
+
+  // Binary log: the chunk being read, the current message in it, and
+  // where to decode messages to
+  private: char *chunk_buffer;
+  private: size_t chunk_buffer_size, chunk_len, chunk_pos;
+  private: player_msghdr_t record_hdr;
+  private: char *record_data;
+  private: char *decode_buffer;
+
+  // Where to find each part of the log: the chunk index of a binary
+  // log, or the offsets of lines about a second apart in an ascii one
+  private: BinLogChunk *index;
+  private: uint32_t index_count;
+
   // File format
   private: char *format;
 
   // Playback speed (1 = real time, 2 = twice real time)
   private: double speed;
 
+  // Play back as fast as the subscribers take the data?
+  private: bool unthrottled;
+
+  // The devices we publish on, for checking on their subscribers
+  private: Device *provide_devices[1024];
+
   // Playback enabled?
   public: bool enable;
 
   // Has a client requested that we rewind?
   public: bool rewind_requested;
 
+  // Has a client requested that we seek, and to where?
+  public: bool seek_requested;
+  public: double seek_time;
+  public: bool seek_relative;
+
   // Should we auto-rewind?  This is set in the log devie in the .cfg
   // file, and defaults to false
   public: bool autorewind;
@@ -424,6 +578,16 @@ class ReadLog: public ThreadedDriver
 };
 
 
+////////////////////////////////////////////////////////////////////////////
+// Set the server clock
+static void SetReadLogTime(double time)
+{
+  ::ReadLogTime_timeDouble = time;
+  ::ReadLogTime_time.tv_sec = (time_t) floor(time);
+  ::ReadLogTime_time.tv_usec = (suseconds_t) ((time - floor(time)) * 1e6);
+}
+
+
 ////////////////////////////////////////////////////////////////////////////
 // Create a driver for reading log files
 Driver* ReadReadLog_Init(ConfigFile* cf, int section)
@@ -457,10 +621,12 @@ ReadLog::ReadLog(ConfigFile* cf, int section)
     return;
   }
   this->speed = cf->ReadFloat(section, "speed", 1.0);
+  this->unthrottled = cf->ReadInt(section, "unthrottled", 0) != 0;
 
   this->provide_count = 0;
   memset(&this->log_id, 0, sizeof(this->log_id));
   memset(this->provide_metadata,0,sizeof(this->provide_metadata));
+  memset(this->provide_reply_subtype,0,sizeof(this->provide_reply_subtype));
 
   particles_set = false;
 
@@ -524,8 +690,18 @@ ReadLog::ReadLog(ConfigFile* cf, int section)
   // Initialize other stuff
   this->format = strdup("unknown");
   this->file = NULL;
+  this->binary = false;
+  this->chunk_buffer = NULL;
+  this->chunk_buffer_size = 0;
+  this->decode_buffer = NULL;
+  this->index = NULL;
+  this->index_count = 0;
 #if HAVE_Z
   this->gzfile = NULL;
+  this->readahead = cf->ReadInt(section, "readahead", 8);
+  this->blocks = NULL;
+  this->block_len = NULL;
+  this->reader_running = false;
 #endif
 
   // Set up the global time object.  We're just shoving our own in over the
@@ -544,13 +720,7 @@ ReadLog::~ReadLog()
 {
   // Free allocated metadata slots
   for(int i=0;i<this->provide_count;i++)
-  {
-    if(this->provide_metadata[i])
-    {
-      free(this->provide_metadata[i]);
-      this->provide_metadata[i] = NULL;
-    }
-  }
+    this->FreeMetadata(i);
 
   return;
 }
@@ -561,9 +731,11 @@ ReadLog::~ReadLog()
 int ReadLog::MainSetup()
 {
   // Reset the time
-  ReadLogTime_time.tv_sec = 0;
-  ReadLogTime_time.tv_usec = 0;
-  ReadLogTime_timeDouble = 0.0;
+  ::SetReadLogTime(0.0);
+
+  for (int i = 0; i < this->provide_count; i++)
+    this->provide_devices[i] = deviceTable->GetDevice(this->provide_ids[i],
+                                                      false);
 
   // Open the file (possibly compressed)
   if (strlen(this->filename) >= 3 &&
@@ -574,17 +746,26 @@ int ReadLog::MainSetup()
 #endif
   {
 #if HAVE_Z
-    this->gzfile = gzopen(this->filename, "r");
+    this->gzfile = gzopen(this->filename, "rb");
+#if ZLIB_VERNUM >= 0x1240
+    if (this->gzfile)
+      gzbuffer(this->gzfile, READLOG_BLOCK_SIZE);
+#endif
 #else
     PLAYER_ERROR("no support for reading compressed log files");
     return -1;
 #endif
   }
   else
-    this->file = fopen(this->filename, "r");
+    // binary mode, in case this is a binary log; the ascii parser takes
+    // any stray carriage returns as whitespace
+    this->file = fopen(this->filename, "rb");
 
-  /** @todo Fix support for reading gzipped files */
+#if HAVE_Z
+  if ((this->file == NULL) && (this->gzfile == NULL))
+#else
   if (this->file == NULL)
+#endif
   {
     PLAYER_ERROR2("unable to open [%s]: %s\n", this->filename, strerror(errno));
     return -1;
@@ -592,12 +773,43 @@ int ReadLog::MainSetup()
 
   // Rewind not requested by default
   this->rewind_requested = false;
+  this->seek_requested = false;
 
   // Make some space for parsing data from the file.  This size is not
   // an exact upper bound; it's just my best guess.
   this->line_size = PLAYER_MAX_MESSAGE_SIZE;
   this->line = (char*) malloc(this->line_size);
   assert(this->line);
+  this->decode_buffer = (char*) malloc(PLAYER_MAX_MESSAGE_SIZE);
+  assert(this->decode_buffer);
+
+  // Binary logs have a header of their own; anything else is ascii
+  if (this->OpenBinary() != 0)
+  {
+    PLAYER_ERROR1("unable to read [%s]", this->filename);
+    this->MainQuit();
+    return -1;
+  }
+
+#if HAVE_Z
+  // Inflate compressed logs in a thread of their own
+  if (this->gzfile && (this->readahead > 0))
+  {
+    this->blocks = (char**) calloc(this->readahead, sizeof(this->blocks[0]));
+    assert(this->blocks);
+    this->block_len = (size_t*) calloc(this->readahead,
+                                       sizeof(this->block_len[0]));
+    assert(this->block_len);
+    for (int i = 0; i < this->readahead; i++)
+    {
+      this->blocks[i] = (char*) malloc(READLOG_BLOCK_SIZE);
+      assert(this->blocks[i]);
+    }
+    pthread_mutex_init(&this->reader_mutex, NULL);
+    pthread_cond_init(&this->reader_cond, NULL);
+    this->StartReader();
+  }
+#endif
 
   return 0;
 }
@@ -609,9 +821,30 @@ void ReadLog::MainQuit()
 {
   // Free allocated mem
   free(this->line);
+  this->line = NULL;
+  free(this->decode_buffer);
+  this->decode_buffer = NULL;
+  free(this->chunk_buffer);
+  this->chunk_buffer = NULL;
+  this->chunk_buffer_size = 0;
+  free(this->index);
+  this->index = NULL;
+  this->index_count = 0;
 
   // Close the file
 #if HAVE_Z
+  if (this->blocks)
+  {
+    this->StopReader();
+    pthread_mutex_destroy(&this->reader_mutex);
+    pthread_cond_destroy(&this->reader_cond);
+    for (int i = 0; i < this->readahead; i++)
+      free(this->blocks[i]);
+    free(this->blocks);
+    this->blocks = NULL;
+    free(this->block_len);
+    this->block_len = NULL;
+  }
   if (this->gzfile)
   {
     gzclose(this->gzfile);
@@ -639,6 +872,7 @@ void ReadLog::Main()
   struct timeval tv;
   double last_wall_time, curr_wall_time;
   double curr_log_time, last_log_time;
+  double seek_target, wait;
   unsigned short type, subtype;
   bool reading_configs;
 
@@ -646,6 +880,7 @@ void ReadLog::Main()
 
   last_wall_time = -1.0;
   last_log_time = -1.0;
+  seek_target = -1.0;
 
   // First thing, we'll read all the configs from the front of the file
   reading_configs = true;
@@ -669,30 +904,32 @@ void ReadLog::Main()
     // If a client has requested that we rewind, then do so
     if(!reading_configs && this->rewind_requested)
     {
-      // back up to the beginning of the file
-#if HAVE_Z
-      if (this->gzfile)
-        ret = gzseek(this->gzfile,0,SEEK_SET);
-      else
-        ret = fseek(this->file,0,SEEK_SET);
-#else
-      ret = fseek(this->file,0,SEEK_SET);
-#endif
+      // back up to the beginning of the file (or of the chunks, in a
+      // binary log)
+      this->chunk_len = 0;
+      this->chunk_pos = 0;
+      ret = this->Seek(this->binary ? BINLOG_HEADER_SIZE : 0);
 
       if(ret < 0)
       {
         // oh well, warn the user and keep going
-        PLAYER_WARN1("while rewinding logfile, gzseek()/fseek() failed: %s",
+        PLAYER_WARN1("while rewinding logfile, gzseek()/fseeko() failed: %s",
                      strerror(errno));
       }
       else
       {
         linenum = 0;
 
+        // a message held over from the config block is no longer next
+        use_stored_tokens = false;
+        reading_configs = false;
+
+        // drop any seek still skipping ahead (e.g., one past the end),
+        // or it would skip the whole file again
+        seek_target = -1.0;
+
         // reset the time
-        ReadLogTime_time.tv_sec = 0;
-        ReadLogTime_time.tv_usec = 0;
-        ReadLogTime_timeDouble = 0.0;
+        ::SetReadLogTime(0.0);
 
 #if 0
         // reset time-of-last-write in all clients
@@ -712,18 +949,40 @@ void ReadLog::Main()
       }
     }
 
+    // If a client has requested that we seek, then do so
+    if(!reading_configs && this->seek_requested)
+    {
+      this->seek_requested = false;
+
+      // Even a failed seek may have moved the file (and indexing an ascii
+      // log reads over the line buffer), so a message held over from the
+      // config block is gone
+      use_stored_tokens = false;
+      reading_configs = false;
+
+      if(this->SeekTime(this->seek_time, this->seek_relative,
+                        &seek_target) < 0)
+        PLAYER_WARN1("unable to seek in logfile %s", this->filename);
+      else
+      {
+        linenum = 0;
+
+        // start timing playback afresh from the new position
+        last_wall_time = -1.0;
+        last_log_time = -1.0;
+
+        PLAYER_MSG1(2, "logfile seeked to %.3f", seek_target);
+      }
+      continue;
+    }
+
     if(!use_stored_tokens)
     {
-      // Read a line from the file; note that gzgets is really slow
-      // compared to fgets (on uncompressed files), so use the latter.
-#if HAVE_Z
-      if (this->gzfile)
-        ret = (gzgets(this->gzfile, this->line, this->line_size) == NULL);
+      // Read a message from a binary log, or a line from an ascii one
+      if (this->binary)
+        ret = this->ReadRecord();
       else
-        ret = (fgets(this->line, this->line_size, (FILE*) this->file) == NULL);
-#else
-      ret = (fgets(this->line, this->line_size, (FILE*) this->file) == NULL);
-#endif
+        ret = this->ReadLine();
 
       if (ret != 0)
       {
@@ -736,7 +995,8 @@ void ReadLog::Main()
         if(!this->autorewind && !this->rewind_requested)
           this->enable=false;
 
-        while(!this->autorewind && !this->rewind_requested)
+        while(!this->autorewind && !this->rewind_requested &&
+              !this->seek_requested)
         {
           usleep(100000);
           pthread_testcancel();
@@ -744,58 +1004,61 @@ void ReadLog::Main()
           // Process requests
           this->ProcessMessages();
 
-          ReadLogTime_timeDouble += 0.1;
-          ReadLogTime_time.tv_sec = (time_t)floor(ReadLogTime_timeDouble);
-          ReadLogTime_time.tv_sec = (time_t)fmod(ReadLogTime_timeDouble,1.0);
+          ::SetReadLogTime(ReadLogTime_timeDouble + 0.1);
         }
 
-        // request a rewind and start again
-        this->rewind_requested = true;
+        // request a rewind and start again, unless we're to go elsewhere
+        if(!this->seek_requested)
+          this->rewind_requested = true;
         continue;
       }
 
-      // Possible buffer overflow, so bail
-      assert(strlen(this->line) < this->line_size);
-
       linenum += 1;
 
-      //printf("line %d\n", linenum);
-      //continue;
-
-      // Tokenize the line using whitespace separators
-      token_count = 0;
-      len = strlen(line);
-      for (i = 0; i < len; i++)
+      // Binary messages need no tokenizing
+      if (!this->binary)
       {
-        if (isspace(line[i]))
-          line[i] = 0;
-        else if (i == 0)
-        {
-          assert(token_count < (int) (sizeof(tokens) / sizeof(tokens[i])));
-          tokens[token_count++] = line + i;
-        }
-        else if (line[i - 1] == 0)
+        // Possible buffer overflow, so bail
+        assert(strlen(this->line) < this->line_size);
+
+        //printf("line %d\n", linenum);
+        //continue;
+
+        // Tokenize the line using whitespace separators
+        token_count = 0;
+        len = strlen(line);
+        for (i = 0; i < len; i++)
         {
-          assert(token_count < (int) (sizeof(tokens) / sizeof(tokens[i])));
-          tokens[token_count++] = line + i;
+          if (isspace(line[i]))
+            line[i] = 0;
+          else if (i == 0)
+          {
+            assert(token_count < (int) (sizeof(tokens) / sizeof(tokens[i])));
+            tokens[token_count++] = line + i;
+          }
+          else if (line[i - 1] == 0)
+          {
+            assert(token_count < (int) (sizeof(tokens) / sizeof(tokens[i])));
+            tokens[token_count++] = line + i;
+          }
         }
-      }
 
-      if (token_count >= 1)
-      {
-        // Discard comments
-        if (strcmp(tokens[0], "#") == 0)
-          continue;
-
-        // Parse meta-data
-        if (strcmp(tokens[0], "##") == 0)
+        if (token_count >= 1)
         {
-          if (token_count == 4)
+          // Discard comments
+          if (strcmp(tokens[0], "#") == 0)
+            continue;
+
+          // Parse meta-data
+          if (strcmp(tokens[0], "##") == 0)
           {
-            free(this->format);
-            this->format = strdup(tokens[3]);
+            if (token_count == 4)
+            {
+              free(this->format);
+              this->format = strdup(tokens[3]);
+            }
+            continue;
           }
-          continue;
         }
       }
     }
@@ -803,10 +1066,25 @@ void ReadLog::Main()
       use_stored_tokens = false;
 
     // Parse out the header info
-    if (this->ParseHeader(linenum, token_count, tokens,
-                          &header_id, &curr_log_time, &type, &subtype) != 0)
+    if (this->binary)
+    {
+      header_id = this->record_hdr.addr;
+      curr_log_time = this->record_hdr.timestamp;
+      type = this->record_hdr.type;
+      subtype = this->record_hdr.subtype;
+    }
+    else if (this->ParseHeader(linenum, token_count, tokens,
+                               &header_id, &curr_log_time, &type, &subtype) != 0)
       continue;
 
+    // After a seek, pass over what comes before the time sought
+    if(seek_target >= 0)
+    {
+      if(curr_log_time < seek_target)
+        continue;
+      seek_target = -1.0;
+    }
+
     if(reading_configs)
     {
       if(type != PLAYER_MSGTYPE_RESP_ACK)
@@ -820,26 +1098,27 @@ void ReadLog::Main()
       }
     }
 
-    // Set the global timestamp
-    ::ReadLogTime_timeDouble = curr_log_time;
-    ::ReadLogTime_time.tv_sec = (time_t)floor(curr_log_time);
-    ::ReadLogTime_time.tv_usec = (time_t)fmod(curr_log_time,1.0);
-
     gettimeofday(&tv,NULL);
     curr_wall_time = tv.tv_sec + tv.tv_usec/1e6;
-    if(!reading_configs)
+    if(!reading_configs && this->unthrottled)
+    {
+      // Hold on until the subscribers are ready for more
+      this->WaitForSubscribers();
+    }
+    else if(!reading_configs)
     {
       // Have we published at least one message from this log?
       if(last_wall_time >= 0)
       {
-        // Wait until it's time to publish this message
-        while((curr_wall_time - last_wall_time) <
-              ((curr_log_time - last_log_time) / this->speed))
+        // Wait until it's time to publish this message, dealing with
+        // requests in the meantime
+        while((wait = last_wall_time - curr_wall_time +
+               (curr_log_time - last_log_time) / this->speed) > 0)
         {
+          if(this->Wait(wait))
+            this->ProcessMessages();
           gettimeofday(&tv,NULL);
           curr_wall_time = tv.tv_sec + tv.tv_usec/1e6;
-          this->ProcessMessages();
-          usleep(1000);
         }
       }
 
@@ -847,6 +1126,10 @@ void ReadLog::Main()
       last_log_time = curr_log_time;
     }
 
+    // Set the global timestamp, now that the message is going out, so
+    // that the server clock never runs ahead of the data
+    ::SetReadLogTime(curr_log_time);
+
     // Look for a matching read interface; data will be output on
     // the corresponding provides interface.
     for (i = 0; i < this->provide_count; i++)
@@ -854,8 +1137,11 @@ void ReadLog::Main()
       provide_id = this->provide_ids[i];
       if(Device::MatchDeviceAddress(header_id, provide_id))
       {
-        this->ParseData(provide_id, type, subtype,
-                        linenum, token_count, tokens, curr_log_time);
+        if (this->binary)
+          this->PublishRecord(provide_id, curr_log_time);
+        else
+          this->ParseData(provide_id, type, subtype,
+                          linenum, token_count, tokens, curr_log_time);
         break;
       }
     }
@@ -923,6 +1209,23 @@ int ReadLog::ProcessLogConfig(QueuePointer & resp_queue,
                     (void*)&greq, sizeof(greq), NULL);
       return(0);
 
+    case PLAYER_LOG_REQ_SET_READ_SEEK:
+      if(hdr->size != sizeof(player_log_set_read_seek_t))
+      {
+        PLAYER_WARN2("request wrong size (%d != %d)",
+                     hdr->size, sizeof(player_log_set_read_seek_t));
+        return(-1);
+      }
+      // the seek is done by the main loop, between messages
+      this->seek_time = ((player_log_set_read_seek_t*)data)->time;
+      this->seek_relative = ((player_log_set_read_seek_t*)data)->relative != 0;
+      this->seek_requested = true;
+
+      this->Publish(this->log_id, resp_queue,
+                    PLAYER_MSGTYPE_RESP_ACK,
+                    PLAYER_LOG_REQ_SET_READ_SEEK);
+      return(0);
+
     case PLAYER_LOG_REQ_SET_READ_REWIND:
       // set the appropriate flag in the manager
       this->rewind_requested = true;
@@ -1338,6 +1641,665 @@ ReadLog::ProcessMessage(QueuePointer & resp_queue,
 #define RAD_DEG(x) ((x) * 180.0 / M_PI)
 
 
+////////////////////////////////////////////////////////////////////////////
+// Read some bytes from the file
+size_t ReadLog::ReadBytes(void *buf, size_t len)
+{
+#if HAVE_Z
+  if (this->reader_running)
+  {
+    size_t count = 0, n;
+
+    while ((count < len) && this->NextBlock())
+    {
+      n = this->block_len[this->block_head] - this->block_pos;
+      if (n > len - count)
+        n = len - count;
+      memcpy((char*) buf + count,
+             this->blocks[this->block_head] + this->block_pos, n);
+      this->block_pos += n;
+      count += n;
+    }
+    this->reader_offset += count;
+    return count;
+  }
+  if (this->gzfile)
+  {
+    int ret = gzread(this->gzfile, buf, len);
+    return ret < 0 ? 0 : ret;
+  }
+#endif
+  return fread(buf, 1, len, this->file);
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Move to an offset in the file
+int ReadLog::Seek(uint64_t offset)
+{
+#if HAVE_Z
+  if (this->reader_running && (offset >= this->reader_offset))
+  {
+    // skip forward through what has been inflated already
+    size_t n;
+    while ((this->reader_offset < offset) && this->NextBlock())
+    {
+      n = this->block_len[this->block_head] - this->block_pos;
+      if (n > offset - this->reader_offset)
+        n = offset - this->reader_offset;
+      this->block_pos += n;
+      this->reader_offset += n;
+    }
+    return (this->reader_offset == offset) ? 0 : -1;
+  }
+  if (this->reader_running)
+  {
+    // the reader thread has the file while it runs
+    int ret;
+    this->StopReader();
+    ret = READLOG_GZSEEK(this->gzfile, offset) < 0 ? -1 : 0;
+    this->StartReader();
+    return ret;
+  }
+  if (this->gzfile)
+    return READLOG_GZSEEK(this->gzfile, offset) < 0 ? -1 : 0;
+#endif
+  return fseeko(this->file, offset, SEEK_SET);
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Read the next line from an ascii log; note that gzgets is really slow
+// compared to fgets (on uncompressed files), so use the latter.
+int ReadLog::ReadLine()
+{
+#if HAVE_Z
+  if (this->reader_running)
+  {
+    size_t len = 0, n;
+    const char *start, *end;
+
+    // Copy up to and including the newline, which may be in a later block
+    while ((len < this->line_size - 1) && this->NextBlock())
+    {
+      start = this->blocks[this->block_head] + this->block_pos;
+      n = this->block_len[this->block_head] - this->block_pos;
+      if (n > this->line_size - 1 - len)
+        n = this->line_size - 1 - len;
+      end = (const char*) memchr(start, '\n', n);
+      if (end)
+        n = end - start + 1;
+      memcpy(this->line + len, start, n);
+      this->block_pos += n;
+      len += n;
+      if (end)
+        break;
+    }
+    this->line[len] = 0;
+    this->reader_offset += len;
+    return (len == 0);
+  }
+  if (this->gzfile)
+    return (gzgets(this->gzfile, this->line, this->line_size) == NULL);
+#endif
+  return (fgets(this->line, this->line_size, this->file) == NULL);
+}
+
+
+#if HAVE_Z
+////////////////////////////////////////////////////////////////////////////
+// Start inflating the compressed log from where it is now
+void ReadLog::StartReader()
+{
+  this->block_head = 0;
+  this->block_count = 0;
+  this->block_pos = 0;
+  this->block_held = false;
+  this->reader_offset = READLOG_GZTELL(this->gzfile);
+  this->reader_quit = false;
+  this->reader_eof = false;
+  if (pthread_create(&this->reader_thread, NULL,
+                     &ReadLog::ReaderThread, this) != 0)
+  {
+    PLAYER_WARN1("unable to start reading [%s] ahead", this->filename);
+    return;
+  }
+  this->reader_running = true;
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Stop inflating, throwing away whatever has been inflated but not read
+void ReadLog::StopReader()
+{
+  if (!this->reader_running)
+    return;
+  pthread_mutex_lock(&this->reader_mutex);
+  this->reader_quit = true;
+  pthread_cond_broadcast(&this->reader_cond);
+  pthread_mutex_unlock(&this->reader_mutex);
+  pthread_join(this->reader_thread, NULL);
+  this->reader_running = false;
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Make sure the block at block_head has something left in it, waiting for
+// the reader if need be
+bool ReadLog::NextBlock()
+{
+  if (this->block_held)
+  {
+    if (this->block_pos < this->block_len[this->block_head])
+      return true;
+    this->ReleaseBlock();
+  }
+
+  pthread_mutex_lock(&this->reader_mutex);
+  while ((this->block_count == 0) && !this->reader_eof)
+    pthread_cond_wait(&this->reader_cond, &this->reader_mutex);
+  this->block_held = (this->block_count > 0);
+  pthread_mutex_unlock(&this->reader_mutex);
+  return this->block_held;
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Hand the block at block_head back to the reader
+void ReadLog::ReleaseBlock()
+{
+  pthread_mutex_lock(&this->reader_mutex);
+  this->block_head = (this->block_head + 1) % this->readahead;
+  this->block_count--;
+  this->block_pos = 0;
+  this->block_held = false;
+  pthread_cond_broadcast(&this->reader_cond);
+  pthread_mutex_unlock(&this->reader_mutex);
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Reader thread: inflate blocks until they are all full, then wait for the
+// driver thread to use one up
+void* ReadLog::ReaderThread(void *arg)
+{
+  ((ReadLog*) arg)->ReaderMain();
+  return NULL;
+}
+
+void ReadLog::ReaderMain()
+{
+  int slot, len;
+
+  pthread_mutex_lock(&this->reader_mutex);
+  while (true)
+  {
+    while ((this->block_count == this->readahead) && !this->reader_quit)
+      pthread_cond_wait(&this->reader_cond, &this->reader_mutex);
+    if (this->reader_quit)
+      break;
+
+    // The free blocks are ours until block_count says otherwise
+    slot = (this->block_head + this->block_count) % this->readahead;
+    pthread_mutex_unlock(&this->reader_mutex);
+
+    len = gzread(this->gzfile, this->blocks[slot], READLOG_BLOCK_SIZE);
+
+    pthread_mutex_lock(&this->reader_mutex);
+    if (len <= 0)
+    {
+      if (len < 0)
+        PLAYER_ERROR1("unable to inflate [%s]", this->filename);
+      this->reader_eof = true;
+      pthread_cond_broadcast(&this->reader_cond);
+      break;
+    }
+    this->block_len[slot] = len;
+    this->block_count++;
+    pthread_cond_broadcast(&this->reader_cond);
+  }
+  pthread_mutex_unlock(&this->reader_mutex);
+}
+#endif
+
+
+////////////////////////////////////////////////////////////////////////////
+// Index a log that didn't come with one: walk the chunk headers of a
+// binary log, or read through an ascii log noting the offset of the first
+// line in each READLOG_INDEX_PERIOD seconds of it.  Leaves the file
+// position anywhere.
+int ReadLog::BuildIndex()
+{
+  char header[BINLOG_CHUNK_HEADER_SIZE];
+  BinLogChunk entry;
+  uint32_t size;
+  uint64_t offset;
+  char *end;
+
+  free(this->index);
+  this->index = NULL;
+  this->index_count = 0;
+  size = 0;
+  memset(&entry, 0, sizeof(entry));
+
+  offset = this->binary ? BINLOG_HEADER_SIZE : 0;
+  if (this->Seek(offset) != 0)
+    return -1;
+
+  while (true)
+  {
+    if (this->binary)
+    {
+      if ((this->ReadBytes(header, sizeof(header)) != sizeof(header)) ||
+          (::BinLogUnpackChunkHeader(&entry, header) != 0))
+        break;
+      entry.offset = offset;
+      offset += sizeof(header) + entry.length;
+      if (this->Seek(offset) != 0)
+        break;
+    }
+    else
+    {
+      if (this->ReadLine() != 0)
+        break;
+      entry.offset = offset;
+      offset += strlen(this->line);
+
+      // Only lines starting with a timestamp are messages
+      entry.start_time = strtod(this->line, &end);
+      if ((end == this->line) || (this->line[0] == '#'))
+        continue;
+      if ((this->index_count > 0) &&
+          (entry.start_time <
+           this->index[this->index_count - 1].start_time + READLOG_INDEX_PERIOD))
+        continue;
+      entry.end_time = entry.start_time;
+    }
+
+    if (this->index_count == size)
+    {
+      size = size ? 2 * size : 1024;
+      this->index = (BinLogChunk*) realloc(this->index,
+                                           size * sizeof(this->index[0]));
+      assert(this->index);
+    }
+    this->index[this->index_count++] = entry;
+  }
+
+  PLAYER_MSG2(1, "indexed [%s] at %u places", this->filename,
+              this->index_count);
+  return 0;
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Move to the place in the log to read on from to get to a time in it.
+// Messages before the time still have to be passed over by the caller.
+int ReadLog::SeekTime(double time, bool relative, double *target)
+{
+  uint32_t i;
+
+  if ((this->index_count == 0) && (this->BuildIndex() != 0))
+    return -1;
+
+  this->chunk_len = 0;
+  this->chunk_pos = 0;
+  if (this->index_count == 0)
+  {
+    // nothing to seek to
+    *target = time;
+    return this->Seek(this->binary ? BINLOG_HEADER_SIZE : 0);
+  }
+
+  *target = relative ? this->index[0].start_time + time : time;
+
+  // Find the last place that starts no later than the time sought
+  for (i = 1; i < this->index_count; i++)
+    if (this->index[i].start_time > *target)
+      break;
+  return this->Seek(this->index[i - 1].offset);
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Wait until every queue subscribed to our devices is empty, so that the
+// next message can't replace, or crowd out, one that hasn't been taken
+// yet.  Queues don't say when they have been emptied, so we look every
+// READLOG_DRAIN_PERIOD, dealing with requests in the meantime.
+void ReadLog::WaitForSubscribers()
+{
+  Device *dev;
+  bool drained;
+  int i;
+  size_t j;
+
+  while (true)
+  {
+    drained = true;
+
+    // the queue lists are guarded by our lock, as in Publish()
+    this->Lock();
+    for (i = 0; drained && (i < this->provide_count); i++)
+    {
+      if (!(dev = this->provide_devices[i]))
+        continue;
+      for (j = 0; j < dev->len_queues; j++)
+      {
+        if ((dev->queues[j] != NULL) && !dev->queues[j]->Empty())
+        {
+          drained = false;
+          break;
+        }
+      }
+    }
+    this->Unlock();
+
+    if (drained)
+      return;
+    if (this->Wait(READLOG_DRAIN_PERIOD))
+      this->ProcessMessages();
+  }
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Work out whether the file is a binary log, and if so load the chunk
+// index from the end of it.  Leaves the file at the first message.
+int ReadLog::OpenBinary()
+{
+  char header[BINLOG_HEADER_SIZE];
+  char trailer[BINLOG_TRAILER_SIZE];
+  char entry[BINLOG_INDEX_ENTRY_SIZE];
+  uint32_t version, count;
+  uint64_t index_offset;
+  off_t index_end;
+  uint32_t i;
+
+  this->binary = false;
+  this->chunk_len = 0;
+  this->chunk_pos = 0;
+
+  if ((this->ReadBytes(header, sizeof(header)) != sizeof(header)) ||
+      (::BinLogUnpackHeader(&version, header) != 0))
+    return this->Seek(0);
+
+  if (version != BINLOG_VERSION)
+  {
+    PLAYER_ERROR2("unsupported binary log version %u in [%s]",
+                  version, this->filename);
+    return -1;
+  }
+  this->binary = true;
+
+  // The index can only be had by seeking to the end, which a compressed
+  // file won't do cheaply; without it the log is still read front to back
+  if (this->file &&
+      (fseeko(this->file, -BINLOG_TRAILER_SIZE, SEEK_END) == 0) &&
+      ((index_end = ftello(this->file)) >= 0) &&
+      (fread(trailer, sizeof(trailer), 1, this->file) == 1) &&
+      (::BinLogUnpackTrailer(&count, &index_offset, trailer) == 0) &&
+      (fseeko(this->file, index_offset, SEEK_SET) == 0))
+  {
+    // The entries have to fit between where the index starts and the
+    // trailer
+    if ((index_offset > (uint64_t) index_end) ||
+        (count > ((uint64_t) index_end - index_offset) / BINLOG_INDEX_ENTRY_SIZE))
+    {
+      PLAYER_WARN1("binary log [%s] has a damaged index", this->filename);
+      return this->Seek(BINLOG_HEADER_SIZE);
+    }
+    this->index = (BinLogChunk*) calloc(count + 1, sizeof(this->index[0]));
+    assert(this->index);
+    for (i = 0; i < count; i++)
+    {
+      if (fread(entry, sizeof(entry), 1, this->file) != 1)
+        break;
+      ::BinLogUnpackIndexEntry(this->index + i, entry);
+    }
+    if (i < count)
+      PLAYER_WARN1("binary log [%s] has a damaged index", this->filename);
+    else
+    {
+      this->index_count = count;
+      if (count > 0)
+        PLAYER_MSG3(1, "binary log [%s] has %u chunks covering %.3f s",
+                    this->filename, count,
+                    this->index[count - 1].end_time - this->index[0].start_time);
+    }
+  }
+  else if (this->file)
+    PLAYER_WARN1("binary log [%s] has no index; was it closed properly?",
+                 this->filename);
+
+  return this->Seek(BINLOG_HEADER_SIZE);
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Read the next message from a binary log, reading in the next chunk
+// when this one is used up.  Returns -1 at the end of the messages.
+int ReadLog::ReadRecord()
+{
+  char header[BINLOG_CHUNK_HEADER_SIZE];
+  BinLogChunk chunk;
+  char *start;
+
+  while (true)
+  {
+    if (this->chunk_pos >= this->chunk_len)
+    {
+      this->chunk_len = 0;
+      this->chunk_pos = 0;
+
+      // The index, if any, follows the last chunk
+      if ((this->ReadBytes(header, sizeof(header)) != sizeof(header)) ||
+          (::BinLogUnpackChunkHeader(&chunk, header) != 0))
+        return -1;
+
+      if (chunk.length > BINLOG_MAX_CHUNK_LENGTH)
+      {
+        PLAYER_WARN1("corrupt chunk in %s", this->filename);
+        return -1;
+      }
+      if (chunk.length > this->chunk_buffer_size)
+      {
+        this->chunk_buffer_size = chunk.length;
+        this->chunk_buffer = (char*) realloc(this->chunk_buffer,
+                                             this->chunk_buffer_size);
+        assert(this->chunk_buffer);
+      }
+      if (this->ReadBytes(this->chunk_buffer, chunk.length) != chunk.length)
+      {
+        PLAYER_WARN1("truncated chunk at the end of %s", this->filename);
+        return -1;
+      }
+      this->chunk_len = chunk.length;
+    }
+
+    start = this->chunk_buffer + this->chunk_pos;
+    if ((this->chunk_len - this->chunk_pos < PLAYERXDR_MSGHDR_SIZE) ||
+        (player_msghdr_pack(start, PLAYERXDR_MSGHDR_SIZE,
+                            &this->record_hdr, PLAYERXDR_DECODE) < 0) ||
+        (this->chunk_len - this->chunk_pos - PLAYERXDR_MSGHDR_SIZE <
+         this->record_hdr.size))
+    {
+      // skip the rest of the chunk
+      PLAYER_WARN1("corrupt chunk in %s", this->filename);
+      this->chunk_pos = this->chunk_len;
+      continue;
+    }
+
+    this->record_data = start + PLAYERXDR_MSGHDR_SIZE;
+    this->chunk_pos += PLAYERXDR_MSGHDR_SIZE + this->record_hdr.size;
+    return 0;
+  }
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Decode the current message from a binary log and publish it, or cache
+// it if it is a configuration reply
+int ReadLog::PublishRecord(player_devaddr_t id, double time)
+{
+  player_msghdr_t *hdr = &this->record_hdr;
+  player_pack_fn_t packfunc;
+  void *data;
+  int len, ret;
+
+  len = 0;
+  if (hdr->size > 0)
+  {
+    if (!(packfunc = playerxdr_get_packfunc(id.interf, hdr->type,
+                                            hdr->subtype)))
+    {
+      PLAYER_WARN4("skipping message from %s:%u with unsupported type %s:%u",
+                   interf_to_str(id.interf), id.index,
+                   msgtype_to_str(hdr->type), hdr->subtype);
+      return -1;
+    }
+    if ((len = (*packfunc)(this->record_data, hdr->size,
+                           this->decode_buffer, PLAYERXDR_DECODE)) < 0)
+    {
+      PLAYER_WARN4("decoding failed on message from %s:%u with type %s:%u",
+                   interf_to_str(id.interf), id.index,
+                   msgtype_to_str(hdr->type), hdr->subtype);
+      return -1;
+    }
+  }
+  data = len > 0 ? this->decode_buffer : NULL;
+
+  if (hdr->type == PLAYER_MSGTYPE_RESP_ACK)
+    ret = this->CacheReply(id, hdr->subtype, data);
+  else
+  {
+    this->Publish(id, hdr->type, hdr->subtype, data, len, &time);
+    ret = 0;
+  }
+
+  // The decoded message's dynamic data is ours to free; Publish has
+  // taken a copy of its own
+  if (len > 0)
+    playerxdr_cleanup_message(this->decode_buffer, id.interf,
+                              hdr->type, hdr->subtype);
+  return ret;
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Cache a configuration reply from a binary log, where the Process*Config
+// functions will find it
+int ReadLog::CacheReply(player_devaddr_t id, unsigned short subtype,
+                        void *data)
+{
+  void *reply;
+  int j;
+
+  if (!data)
+    return 0;
+
+  // Localize particles are kept apart from the rest
+  if ((id.interf == PLAYER_LOCALIZE_CODE) &&
+      (subtype == PLAYER_LOCALIZE_REQ_GET_PARTICLES))
+  {
+    if (this->particles_set)
+      playerxdr_cleanup_message(&this->particles, id.interf,
+                                PLAYER_MSGTYPE_RESP_ACK, subtype);
+    playerxdr_deepcopy_message(data, &this->particles, id.interf,
+                               PLAYER_MSGTYPE_RESP_ACK, subtype);
+    this->particles_set = true;
+    return 0;
+  }
+
+  // Find the right place to put it
+  for (j = 0; j < this->provide_count; j++)
+  {
+    if (Device::MatchDeviceAddress(this->provide_ids[j], id))
+      break;
+  }
+  assert(j < this->provide_count);
+
+  if (!(reply = playerxdr_clone_message(data, id.interf,
+                                        PLAYER_MSGTYPE_RESP_ACK, subtype)))
+    return -1;
+
+  // Rangers keep their geometry and configuration side by side
+  if (id.interf == PLAYER_RANGER_CODE)
+  {
+    ranger_meta_t* meta = (ranger_meta_t*) this->provide_metadata[j];
+    if (!meta)
+    {
+      meta = (ranger_meta_t*) calloc(1, sizeof(ranger_meta_t));
+      assert(meta);
+      this->provide_metadata[j] = (void*) meta;
+    }
+    if (subtype == PLAYER_RANGER_REQ_GET_GEOM)
+    {
+      if (meta->geom)
+        playerxdr_free_message(meta->geom, id.interf,
+                               PLAYER_MSGTYPE_RESP_ACK, subtype);
+      meta->geom = (player_ranger_geom_t*) reply;
+    }
+    else if (subtype == PLAYER_RANGER_REQ_GET_CONFIG)
+    {
+      if (meta->config)
+        playerxdr_free_message(meta->config, id.interf,
+                               PLAYER_MSGTYPE_RESP_ACK, subtype);
+      meta->config = (player_ranger_config_t*) reply;
+    }
+    else
+    {
+      playerxdr_free_message(reply, id.interf, PLAYER_MSGTYPE_RESP_ACK,
+                             subtype);
+      return -1;
+    }
+    this->provide_reply_subtype[j] = subtype;
+    return 0;
+  }
+
+  this->FreeMetadata(j);
+  this->provide_metadata[j] = reply;
+  this->provide_reply_subtype[j] = subtype;
+  return 0;
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Free the metadata cached for a device.  Replies cached from a binary
+// log are deep copies, and a ranger's geometry and configuration are
+// each one of those.
+void ReadLog::FreeMetadata(int j)
+{
+  ranger_meta_t *meta;
+
+  if (!this->provide_metadata[j])
+    return;
+
+  if (!this->provide_reply_subtype[j])
+    free(this->provide_metadata[j]);
+  else if (this->provide_ids[j].interf == PLAYER_RANGER_CODE)
+  {
+    meta = (ranger_meta_t*) this->provide_metadata[j];
+    if (meta->geom)
+      playerxdr_free_message(meta->geom, PLAYER_RANGER_CODE,
+                             PLAYER_MSGTYPE_RESP_ACK,
+                             PLAYER_RANGER_REQ_GET_GEOM);
+    if (meta->config)
+      playerxdr_free_message(meta->config, PLAYER_RANGER_CODE,
+                             PLAYER_MSGTYPE_RESP_ACK,
+                             PLAYER_RANGER_REQ_GET_CONFIG);
+    free(meta);
+  }
+  else
+    playerxdr_free_message(this->provide_metadata[j],
+                           this->provide_ids[j].interf,
+                           PLAYER_MSGTYPE_RESP_ACK,
+                           this->provide_reply_subtype[j]);
+
+  this->provide_metadata[j] = NULL;
+  this->provide_reply_subtype[j] = 0;
+}
+
+
 ////////////////////////////////////////////////////////////////////////////
 // Parse the header info
 int
@@ -77,7 +77,11 @@ class Relay:public Driver
 {
   public:
 	Relay(ConfigFile* cf, int section)
-		: Driver(cf, section, false, PLAYER_MSGQUEUE_DEFAULT_MAXLEN,PLAYER_OPAQUE_CODE) {};
+		: Driver(cf, section, false, PLAYER_MSGQUEUE_DEFAULT_MAXLEN,PLAYER_OPAQUE_CODE)
+	{
+		// all our work is done in response to messages
+		this->event_driven = true;
+	};
   	~Relay() {};
 
 	int Setup() {return 0;};
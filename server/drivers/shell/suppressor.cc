@@ -111,6 +111,9 @@ class Suppressor : public Driver
 
 Suppressor::Suppressor(ConfigFile * cf, int section) : Driver(cf, section, true, PLAYER_MSGQUEUE_DEFAULT_MAXLEN)
 {
+  // all our work is done in response to messages
+  this->event_driven = true;
+
   int i;
 
   memset(&(this->master_provided_addr), 0, sizeof(player_devaddr_t));
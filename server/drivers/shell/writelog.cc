@@ -32,8 +32,9 @@
  * @brief Logging data
 
 The writelog driver will write data from another device to a log file.
-Each data message is written to a separate line.  The format for the
-file is given in the
+By default each data message is written to a separate line of text;
+the driver can instead write a much smaller and faster binary log (see
+the @p format option).  Both formats are described in the
 @ref tutorial_datalog "data logging tutorial".
 
 The @ref driver_readlog driver can be used to replay the data
@@ -67,7 +68,8 @@ that logging start when Player starts.
 
 The writelog driver takes as input a list of devices to log data from.
 The driver with the <b>highest data rate</b> should be placed first in the list.
-The writelog driver can will log data from the following interfaces:
+The writelog driver can will log data from the following interfaces
+(binary logs can hold data from any interface):
 
 - @ref interface_laser
 - @ref interface_ranger
@@ -124,6 +126,25 @@ The writelog driver can will log data from the following interfaces:
 - autorecord (integer)
   - Default: 0
   - Default log state; set to 1 for continous logging.
+- format (string)
+  - Default: "ascii"
+  - "ascii" writes one line of text per message.  "binary" writes the
+    XDR-encoded messages in chunks, with an index by time at the end of
+    the file.  The @ref driver_readlog driver tells them apart itself.
+- buffer_size (integer)
+  - Default: 8388608
+  - Size in bytes of each of the two buffers that log output is collected
+    in.  Messages are formatted into one while a separate thread writes
+    the other to disk, so a slow disk doesn't hold up the driver.  At
+    least 65536; smaller values are raised to that.  This
+    size is exceeded for a message larger than it (e.g., a big camera
+    image in an ascii log): both buffers grow to hold the message, and
+    shrink back once it has been written.  If the disk falls so far
+    behind that both are full, messages are dropped (and counted).
+- flush_interval (float)
+  - Default: 1.0
+  - Longest time, in seconds, that log output waits in a buffer before
+    being written to disk.
 - camera_log_images (integer)
   - Default: 1
   - Save image data to the log file. If this is turned off, a log line is still
@@ -133,6 +154,15 @@ The writelog driver can will log data from the following interfaces:
   - Save image data to external files within the log directory.
     The image files are named "(basename)(timestamp)_camera_II_NNNNNNN.pnm",
     where II is the device index and NNNNNNN is the frame number.
+@par Properties
+
+- write_rate (float, read only)
+  - Bytes per second written to the log file, averaged over the last
+    flush interval or so.
+- dropped_messages (integer, read only)
+  - Number of messages that have been dropped because the disk could not
+    keep up.
+
 @par Example
 
 @verbatim
@@ -159,6 +189,9 @@ driver
 #include <assert.h>
 #include <ctype.h>
 #include <errno.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <stdlib.h>
@@ -166,11 +199,15 @@ driver
 #if defined (WIN32)
   #include <direct.h> // For _mkdir()
 #else
+  #include <sys/time.h>
   #include <unistd.h>
 #endif
 
 #include <libplayercore/playercore.h>
+#include <libplayerinterface/functiontable.h>
+#include <libplayerinterface/playerxdr.h>
 
+#include "binlog.h"
 #include "encode.h"
 
 #if defined (WIN32)
@@ -219,6 +256,43 @@ class WriteLog: public ThreadedDriver
   // Flush and close this->file
   private: void CloseFile();
 
+  // Start collecting a message in the front buffer
+  private: void BeginMessage();
+
+  // Finish collecting a message, which holds count log messages; returns
+  // -1 if it had to be dropped
+  private: int EndMessage(int count);
+
+  // Format text onto the message being collected
+  private: void Printf(const char *fmt, ...);
+
+  // Copy bytes onto the message being collected
+  private: void Append(const void *data, size_t len);
+
+  // Make room for more of the message being collected
+  private: bool MakeRoom(size_t len);
+
+  // Grow the buffers to hold a message of the given size
+  private: bool GrowBuffers(size_t size);
+
+  // Shrink the buffers back to their configured size, if they grew and
+  // what they hold fits again
+  private: void ShrinkBuffers();
+
+  // Hand the completed messages in the front buffer to the writer thread
+  private: bool HandOff(bool wait);
+
+  // Hand everything over and wait until it is on disk
+  private: void Flush();
+
+  // Writer thread
+  private: static void* WriterThread(void *arg);
+  private: void WriterMain();
+
+  // Hand over output that has waited long enough, and update the
+  // statistics
+  private: void Service();
+
   // Write localize particles to file
   private: void WriteLocalizeParticles();
 
@@ -226,6 +300,16 @@ class WriteLog: public ThreadedDriver
   private: void Write(WriteLogDevice *device,
                       player_msghdr_t* hdr, void *data);
 
+  // Add a message to the current chunk of a binary log
+  private: int WriteBinary(WriteLogDevice *device,
+                           player_msghdr_t* hdr, void *data);
+
+  // Write the current chunk of a binary log to file
+  private: int WriteChunk();
+
+  // Write the chunk index and trailer at the end of a binary log
+  private: int WriteIndex();
+
   // Write laser data to file
   private: int WriteLaser(player_msghdr_t* hdr, void *data);
 
@@ -285,6 +369,10 @@ class WriteLog: public ThreadedDriver
   // Write camera data to file
   private: int WriteCamera(WriteLogDevice *device, player_msghdr_t* hdr, void *data);
 
+  // Save a camera frame to its own image file
+  private: int SaveCameraImage(WriteLogDevice *device,
+                               player_camera_data_t *camera_data);
+
   // Write fiducial data to file
   private: int WriteFiducial(player_msghdr_t* hdr, void *data);
 
@@ -311,6 +399,51 @@ class WriteLog: public ThreadedDriver
   private: char filename[1024];
   private: FILE *file;
 
+  // Write a binary log rather than an ascii one?
+  private: bool binary;
+
+  // Output is collected in the front buffer while the writer thread
+  // writes out the back one.  The back buffer and its length belong to
+  // the writer thread while the length is non-zero.
+  private: char *buffers[2];
+  private: size_t buffer_size;
+  // Size the buffers were configured with, and go back to after growing
+  private: size_t base_buffer_size;
+  // Have we warned that a message was larger than that?
+  private: bool grow_warned;
+  private: char *front, *back;
+  private: size_t front_len, back_len;
+  // Where the message being collected starts, and whether it has
+  // already been dropped for lack of room
+  private: size_t message_start;
+  private: bool message_dropped;
+  // Wait for room rather than dropping messages?
+  private: bool blocking;
+  private: double flush_interval;
+  private: double last_handoff;
+
+  private: pthread_t writer_thread;
+  private: pthread_mutex_t writer_mutex;
+  private: pthread_cond_t writer_cond;
+  private: bool writer_running, writer_quit;
+  // Bytes written so far, and at the last stats update
+  private: uint64_t bytes_written, stats_bytes;
+  private: double stats_time;
+  private: int stats_dropped;
+
+  // Statistics for clients
+  private: DoubleProperty write_rate;
+  private: IntProperty dropped_messages;
+
+  // Binary log: messages not yet written out, the chunk they make up,
+  // where in the file it will go, and where the chunks already written are
+  private: char *chunk_buffer;
+  private: size_t chunk_buffer_size;
+  private: BinLogChunk chunk;
+  private: uint64_t offset;
+  private: BinLogChunk *index;
+  private: int index_count, index_size;
+
   // Subscribed device list
   private: int device_count;
   private: WriteLogDevice devices[1024];
@@ -337,6 +470,16 @@ class WriteLog: public ThreadedDriver
 extern int global_playerport;
 
 
+////////////////////////////////////////////////////////////////////////////
+// Wall clock time; GlobalTime may be log time when replaying
+static double WallTime()
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+
 ////////////////////////////////////////////////////////////////////////////
 // Create a driver for reading log files
 Driver* WriteLog_Init(ConfigFile* cf, int section)
@@ -357,7 +500,9 @@ void writelog_Register(DriverTable* table)
 ////////////////////////////////////////////////////////////////////////////
 // Constructor
 WriteLog::WriteLog(ConfigFile* cf, int section)
-    : ThreadedDriver(cf, section, true, PLAYER_MSGQUEUE_DEFAULT_MAXLEN, PLAYER_LOG_CODE)
+    : ThreadedDriver(cf, section, true, PLAYER_MSGQUEUE_DEFAULT_MAXLEN, PLAYER_LOG_CODE),
+      write_rate("write_rate", 0.0, true, this, cf, section),
+      dropped_messages("dropped_messages", 0, true, this, cf, section)
 {
   int i;
   player_devaddr_t addr;
@@ -372,6 +517,13 @@ WriteLog::WriteLog(ConfigFile* cf, int section)
   char complete_filename[1024];
 
   this->file = NULL;
+  this->chunk_buffer = NULL;
+  this->chunk_buffer_size = 0;
+  this->index = NULL;
+  this->index_count = 0;
+  this->index_size = 0;
+  this->buffers[0] = this->buffers[1] = NULL;
+  this->writer_running = false;
 
   // Construct timestamp from date and time.  Note that we use
   // the system time, *not* the Player time.  I think that this is the
@@ -415,6 +567,34 @@ WriteLog::WriteLog(ConfigFile* cf, int section)
   else
     this->enable_default = false;
 
+  // Log file format
+  const char *format = cf->ReadString(section, "format", "ascii");
+  if (strcmp(format, "binary") == 0)
+    this->binary = true;
+  else if (strcmp(format, "ascii") == 0)
+    this->binary = false;
+  else
+  {
+    PLAYER_ERROR1("unknown log format [%s]", format);
+    this->SetError(-1);
+    return;
+  }
+
+  // Output buffering.  The buffers have to hold a good few messages, and
+  // GrowBuffers() doubles them, so they can't be empty.
+  int buffer_size = cf->ReadInt(section, "buffer_size", 8 * 1024 * 1024);
+  if (buffer_size < 64 * 1024)
+  {
+    PLAYER_WARN1("buffer_size %d is too small; using 65536", buffer_size);
+    buffer_size = 64 * 1024;
+  }
+  this->buffer_size = buffer_size;
+  this->base_buffer_size = this->buffer_size;
+  this->grow_warned = false;
+  this->flush_interval = cf->ReadFloat(section, "flush_interval", 1.0);
+  if (this->flush_interval <= 0)
+    this->flush_interval = 1.0;
+
   this->device_count = 0;
 
   //write particles in case the localize interface is provided
@@ -453,6 +633,8 @@ WriteLog::WriteLog(ConfigFile* cf, int section)
 // Destructor
 WriteLog::~WriteLog()
 {
+  free(this->chunk_buffer);
+  free(this->index);
   return;
 }
 
@@ -488,6 +670,36 @@ int WriteLog::MainSetup()
   // Enable/disable logging, according to default set in config file
   this->enable = this->enable_default;
 
+  // Set up the output buffers and start the thread that writes them out
+  for (i = 0; i < 2; i++)
+  {
+    this->buffers[i] = (char*) malloc(this->buffer_size);
+    assert(this->buffers[i]);
+  }
+  this->front = this->buffers[0];
+  this->back = this->buffers[1];
+  this->front_len = this->back_len = 0;
+  this->message_start = 0;
+  this->message_dropped = false;
+  this->blocking = false;
+  this->last_handoff = WallTime();
+  this->bytes_written = this->stats_bytes = 0;
+  this->stats_time = this->last_handoff;
+  this->stats_dropped = 0;
+  this->write_rate.SetValue(0.0);
+  this->dropped_messages.SetValue(0);
+
+  pthread_mutex_init(&this->writer_mutex, NULL);
+  pthread_cond_init(&this->writer_cond, NULL);
+  this->writer_quit = false;
+  if (pthread_create(&this->writer_thread, NULL,
+                     &WriteLog::WriterThread, this) != 0)
+  {
+    PLAYER_ERROR("unable to start log writer thread");
+    return -1;
+  }
+  this->writer_running = true;
+
   return 0;
 }
 
@@ -502,6 +714,24 @@ void WriteLog::MainQuit()
   // Close the file
   this->CloseFile();
 
+  // Stop the writer thread
+  if (this->writer_running)
+  {
+    pthread_mutex_lock(&this->writer_mutex);
+    this->writer_quit = true;
+    pthread_cond_broadcast(&this->writer_cond);
+    pthread_mutex_unlock(&this->writer_mutex);
+    pthread_join(this->writer_thread, NULL);
+    this->writer_running = false;
+    pthread_cond_destroy(&this->writer_cond);
+    pthread_mutex_destroy(&this->writer_mutex);
+  }
+  for (i = 0; i < 2; i++)
+  {
+    free(this->buffers[i]);
+    this->buffers[i] = NULL;
+  }
+
   // Unsubscribe to the underlying devices
   for (i = 0; i < this->device_count; i++)
   {
@@ -524,26 +754,46 @@ WriteLog::OpenFile()
 #endif
 
   // Open the file
-  this->file = fopen(this->filename, "w+");
+  this->file = fopen(this->filename, this->binary ? "wb+" : "w+");
   if(this->file == NULL)
   {
     PLAYER_ERROR2("unable to open [%s]: %s\n", this->filename, strerror(errno));
     return(-1);
   }
 
-  // Write the file header
-  fprintf(this->file, "## Player version %s \n", PLAYER_VERSION);
-  fprintf(this->file, "## File version %s \n", "0.3.0");
+  // The header and geometries are worth waiting for room for
+  this->blocking = true;
 
-  fprintf(this->file, "## Format: \n");
-  fprintf(this->file, "## - Messages are newline-separated\n");
-  fprintf(this->file, "## - Common header to each message is:\n");
-  fprintf(this->file, "##   time     host   robot  interface index  type   subtype\n");
-  fprintf(this->file, "##   (double) (uint) (uint) (string)  (uint) (uint) (uint)\n");
-  fprintf(this->file, "## - Following the common header is the message payload \n");
+  // Write the file header
+  this->BeginMessage();
+  if (this->binary)
+  {
+    char header[BINLOG_HEADER_SIZE];
+
+    ::BinLogPackHeader(header);
+    this->Append(header, sizeof(header));
+    this->offset = sizeof(header);
+    this->chunk.count = 0;
+    this->chunk.length = 0;
+    this->index_count = 0;
+  }
+  else
+  {
+    this->Printf("## Player version %s \n", PLAYER_VERSION);
+    this->Printf("## File version %s \n", "0.3.0");
+
+    this->Printf("## Format: \n");
+    this->Printf("## - Messages are newline-separated\n");
+    this->Printf("## - Common header to each message is:\n");
+    this->Printf("##   time     host   robot  interface index  type   subtype\n");
+    this->Printf("##   (double) (uint) (uint) (string)  (uint) (uint) (uint)\n");
+    this->Printf("## - Following the common header is the message payload \n");
+  }
+  this->EndMessage(0);
 
   this->WriteGeometries();
 
+  this->blocking = false;
   return(0);
 }
 
@@ -720,12 +970,316 @@ WriteLog::CloseFile()
 {
   if(this->file)
   {
-    fflush(this->file);
+    // Everything that's left has to go out
+    this->blocking = true;
+    if (this->binary)
+    {
+      if (this->WriteChunk() < 0 || this->WriteIndex() < 0)
+        PLAYER_ERROR1("unable to finish [%s]", this->filename);
+    }
+    this->Flush();
+    this->blocking = false;
+
     fclose(this->file);
     this->file = NULL;
   }
 }
 
+
+////////////////////////////////////////////////////////////////////////////
+// Start collecting a message in the front buffer
+void WriteLog::BeginMessage()
+{
+  this->message_start = this->front_len;
+  this->message_dropped = false;
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Finish collecting a message
+int WriteLog::EndMessage(int count)
+{
+  if (this->message_dropped)
+  {
+    this->front_len = this->message_start;
+    this->message_dropped = false;
+    this->dropped_messages.SetValue(this->dropped_messages.GetValue() + count);
+    return -1;
+  }
+  this->message_start = this->front_len;
+
+  // Start writing once there is a good amount to write
+  if (this->front_len >= this->buffer_size / 2)
+    this->HandOff(false);
+  this->ShrinkBuffers();
+  return 0;
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Format text onto the message being collected
+void WriteLog::Printf(const char *fmt, ...)
+{
+  va_list ap;
+  int len;
+
+  if (this->message_dropped)
+    return;
+
+  va_start(ap, fmt);
+  len = vsnprintf(this->front + this->front_len,
+                  this->buffer_size - this->front_len, fmt, ap);
+  va_end(ap);
+  if (len < 0)
+  {
+    this->message_dropped = true;
+    return;
+  }
+
+  // If it didn't fit, make room and format it again
+  if ((size_t) len >= this->buffer_size - this->front_len)
+  {
+    if (!this->MakeRoom(len + 1))
+      return;
+    va_start(ap, fmt);
+    vsnprintf(this->front + this->front_len, len + 1, fmt, ap);
+    va_end(ap);
+  }
+  this->front_len += len;
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Copy bytes onto the message being collected
+void WriteLog::Append(const void *data, size_t len)
+{
+  if (!this->MakeRoom(len))
+    return;
+  memcpy(this->front + this->front_len, data, len);
+  this->front_len += len;
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Make room for more of the message being collected, by handing what is
+// already complete to the writer thread.  If the writer is still busy
+// with the other buffer, the message is dropped, unless we are blocking.
+// A message too big for an empty buffer is never dropped; the buffers
+// grow to fit it instead.
+bool WriteLog::MakeRoom(size_t len)
+{
+  if (this->message_dropped)
+    return false;
+  if (this->front_len + len <= this->buffer_size)
+    return true;
+  if (this->front_len - this->message_start + len > this->buffer_size)
+    return this->GrowBuffers(this->front_len - this->message_start + len);
+  if (this->HandOff(this->blocking) &&
+      (this->front_len + len <= this->buffer_size))
+    return true;
+  this->message_dropped = true;
+  return false;
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Grow both buffers so that one holds at least size bytes, after handing
+// over the completed messages and waiting for the writer to finish them
+bool WriteLog::GrowBuffers(size_t size)
+{
+  size_t new_size;
+  char *front, *back;
+
+  this->Flush();
+
+  for (new_size = 2 * this->buffer_size; new_size < size; new_size *= 2);
+  pthread_mutex_lock(&this->writer_mutex);
+  front = (char*) realloc(this->front, new_size);
+  if (front)
+    this->front = front;
+  back = front ? (char*) realloc(this->back, new_size) : NULL;
+  if (back)
+    this->back = back;
+  this->buffers[0] = this->front;
+  this->buffers[1] = this->back;
+  if (back)
+    this->buffer_size = new_size;
+  pthread_mutex_unlock(&this->writer_mutex);
+
+  if (!back)
+  {
+    PLAYER_ERROR1("unable to grow log buffers to %lu bytes",
+                  (unsigned long) new_size);
+    this->message_dropped = true;
+    return false;
+  }
+  if (!this->grow_warned)
+  {
+    PLAYER_WARN2("a message for [%s] is larger than buffer_size; log buffers grown to %lu bytes until it is written",
+                 this->filename, (unsigned long) new_size);
+    this->grow_warned = true;
+  }
+  else
+    PLAYER_MSG1(2, "grew log buffers to %lu bytes", (unsigned long) new_size);
+  return true;
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Shrink both buffers back to their configured size once the writer is
+// done with the back one and the front one holds no more than that.
+// Called between messages.
+void WriteLog::ShrinkBuffers()
+{
+  char *front, *back;
+
+  if ((this->buffer_size == this->base_buffer_size) ||
+      (this->front_len > this->base_buffer_size))
+    return;
+
+  pthread_mutex_lock(&this->writer_mutex);
+  if (this->back_len)
+  {
+    pthread_mutex_unlock(&this->writer_mutex);
+    return;
+  }
+  // Shrinking can only fail by leaving a buffer where it is
+  if ((front = (char*) realloc(this->front, this->base_buffer_size)))
+    this->front = front;
+  if ((back = (char*) realloc(this->back, this->base_buffer_size)))
+    this->back = back;
+  this->buffers[0] = this->front;
+  this->buffers[1] = this->back;
+  this->buffer_size = this->base_buffer_size;
+  pthread_mutex_unlock(&this->writer_mutex);
+
+  PLAYER_MSG1(2, "shrank log buffers back to %lu bytes",
+              (unsigned long) this->buffer_size);
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Hand the completed messages in the front buffer to the writer thread,
+// carrying the part of the current message collected so far over to the
+// other buffer.  Returns false if the writer is busy and we aren't to
+// wait for it.
+bool WriteLog::HandOff(bool wait)
+{
+  char *buffer;
+  size_t partial;
+
+  pthread_mutex_lock(&this->writer_mutex);
+  if (this->back_len && !wait)
+  {
+    pthread_mutex_unlock(&this->writer_mutex);
+    return false;
+  }
+  while (this->back_len)
+    pthread_cond_wait(&this->writer_cond, &this->writer_mutex);
+
+  if (this->message_start > 0)
+  {
+    partial = this->front_len - this->message_start;
+    buffer = this->back;
+    memcpy(buffer, this->front + this->message_start, partial);
+    this->back = this->front;
+    this->back_len = this->message_start;
+    this->front = buffer;
+    this->front_len = partial;
+    this->message_start = 0;
+    pthread_cond_broadcast(&this->writer_cond);
+  }
+  pthread_mutex_unlock(&this->writer_mutex);
+
+  this->last_handoff = WallTime();
+  return true;
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Hand everything over and wait until it has been written
+void WriteLog::Flush()
+{
+  this->HandOff(true);
+  pthread_mutex_lock(&this->writer_mutex);
+  while (this->back_len)
+    pthread_cond_wait(&this->writer_cond, &this->writer_mutex);
+  pthread_mutex_unlock(&this->writer_mutex);
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Writer thread: write out the back buffer whenever it is handed over
+void* WriteLog::WriterThread(void *arg)
+{
+  ((WriteLog*) arg)->WriterMain();
+  return NULL;
+}
+
+void WriteLog::WriterMain()
+{
+  FILE *file;
+  char *buffer;
+  size_t len, written;
+
+  pthread_mutex_lock(&this->writer_mutex);
+  while (true)
+  {
+    while (!this->back_len && !this->writer_quit)
+      pthread_cond_wait(&this->writer_cond, &this->writer_mutex);
+    if (!this->back_len)
+      break;
+
+    // The back buffer is ours until back_len goes back to zero
+    file = this->file;
+    buffer = this->back;
+    len = this->back_len;
+    pthread_mutex_unlock(&this->writer_mutex);
+
+    written = fwrite(buffer, 1, len, file);
+    if ((written < len) || (fflush(file) != 0))
+      PLAYER_ERROR2("unable to write [%s]: %s", this->filename, strerror(errno));
+
+    pthread_mutex_lock(&this->writer_mutex);
+    this->bytes_written += written;
+    this->back_len = 0;
+    pthread_cond_broadcast(&this->writer_cond);
+  }
+  pthread_mutex_unlock(&this->writer_mutex);
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Hand over output that has waited long enough, and update the statistics
+void WriteLog::Service()
+{
+  double now = WallTime();
+  uint64_t bytes;
+  int dropped;
+
+  if (this->front_len && (now - this->last_handoff >= this->flush_interval))
+    this->HandOff(false);
+  this->ShrinkBuffers();
+
+  if (now - this->stats_time >= this->flush_interval)
+  {
+    pthread_mutex_lock(&this->writer_mutex);
+    bytes = this->bytes_written;
+    pthread_mutex_unlock(&this->writer_mutex);
+
+    this->write_rate.SetValue((bytes - this->stats_bytes) /
+                              (now - this->stats_time));
+    dropped = this->dropped_messages.GetValue();
+    if (dropped > this->stats_dropped)
+      PLAYER_WARN2("dropped %d messages for [%s]; the disk is not keeping up",
+                   dropped - this->stats_dropped, this->filename);
+
+    this->stats_bytes = bytes;
+    this->stats_time = now;
+    this->stats_dropped = dropped;
+  }
+}
+
 int
 WriteLog::ProcessMessage(QueuePointer & resp_queue,
                          player_msghdr * hdr,
@@ -843,8 +1397,8 @@ WriteLog::Main(void)
   {
     pthread_testcancel();
 
-    // Wait on my queue
-    this->Wait();
+    // Wait on my queue, but not for so long that output sits around
+    this->Wait(this->flush_interval / 2);
 
 
     if (write_particles_now){
@@ -854,6 +1408,8 @@ WriteLog::Main(void)
 
     // Process all new messages (calls ProcessMessage on each)
     this->ProcessMessages();
+
+    this->Service();
   }
 }
 
@@ -872,15 +1428,25 @@ void WriteLog::Write(WriteLogDevice *device,
   ::lookup_interface_code(device->addr.interf, &iface);
   //gethostname(host, sizeof(host));
 
+  // Binary logs take any message the function table can encode
+  if (this->binary)
+  {
+    if (this->WriteBinary(device, hdr, data) < 0)
+      PLAYER_WARN2("not logging message to interface \"%s\" with subtype %d",
+                   ::lookup_interface_name(0, iface.interf), hdr->subtype);
+    return;
+  }
+
   // Write header info
-  fprintf(this->file, "%014.3f %u %u %s %02u %03u %03u ",
-          hdr->timestamp,
-          device->addr.host,
-          device->addr.robot,
-          iface.name,
-          device->addr.index,
-          hdr->type,
-          hdr->subtype);
+  this->BeginMessage();
+  this->Printf("%014.3f %u %u %s %02u %03u %03u ",
+               hdr->timestamp,
+               device->addr.host,
+               device->addr.robot,
+               iface.name,
+               device->addr.index,
+               hdr->type,
+               hdr->subtype);
 
 
   int retval;
@@ -978,16 +1544,167 @@ void WriteLog::Write(WriteLogDevice *device,
     PLAYER_WARN2("not logging message to interface \"%s\" with subtype %d",
                  ::lookup_interface_name(0, iface.interf), hdr->subtype);
 
-  fprintf(this->file, "\n");
+  this->Printf("\n");
 
-  // Flush the data (some drivers produce a lot of data; we dont want
-  // it to back up and slow us down later).
-  fflush(this->file);
+  // The writer thread takes it from here
+  this->EndMessage(1);
 
   return;
 }
 
 
+////////////////////////////////////////////////////////////////////////////
+// Add a message to the current chunk of a binary log.  The message is
+// encoded just as it would go over the wire.
+int WriteLog::WriteBinary(WriteLogDevice *device,
+                          player_msghdr_t* hdr,
+                          void *data)
+{
+  player_pack_fn_t packfunc;
+  player_msghdr_t rechdr;
+  player_camera_data_t camera_data;
+  size_t maxsize;
+  char *start;
+  int len;
+
+  // Camera frames can be saved to files of their own, and left out of
+  // the log
+  if ((device->addr.interf == PLAYER_CAMERA_CODE) && data &&
+      (hdr->type == PLAYER_MSGTYPE_DATA) &&
+      (hdr->subtype == PLAYER_CAMERA_DATA_STATE))
+  {
+    if (this->cameraSaveImages)
+      this->SaveCameraImage(device, (player_camera_data_t*) data);
+    if (!this->cameraLogImages)
+    {
+      camera_data = *(player_camera_data_t*) data;
+      camera_data.image_count = 0;
+      camera_data.image = NULL;
+      data = &camera_data;
+    }
+  }
+
+  packfunc = NULL;
+  if (data && !(packfunc = playerxdr_get_packfunc(device->addr.interf,
+                                                  hdr->type, hdr->subtype)))
+    return -1;
+
+  // 4 times the message is a safe upper bound on its encoding
+  maxsize = PLAYERXDR_MSGHDR_SIZE;
+  if (data)
+    maxsize += 4 * hdr->size;
+  if (maxsize > PLAYERXDR_MAX_MESSAGE_SIZE)
+    maxsize = PLAYERXDR_MAX_MESSAGE_SIZE;
+
+  // Write out the chunk so far if this message might not fit in it
+  if (this->chunk.length + maxsize > this->chunk_buffer_size)
+  {
+    if (this->WriteChunk() < 0)
+      return -1;
+    if (maxsize > this->chunk_buffer_size)
+    {
+      this->chunk_buffer_size = MAX(maxsize, (size_t) BINLOG_CHUNK_SIZE);
+      this->chunk_buffer = (char*) realloc(this->chunk_buffer,
+                                           this->chunk_buffer_size);
+      assert(this->chunk_buffer);
+    }
+  }
+  start = this->chunk_buffer + this->chunk.length;
+
+  // Encode the body, then the header with the length of the body
+  len = 0;
+  if (packfunc &&
+      (len = (*packfunc)(start + PLAYERXDR_MSGHDR_SIZE,
+                         maxsize - PLAYERXDR_MSGHDR_SIZE,
+                         data, PLAYERXDR_ENCODE)) < 0)
+    return -1;
+  rechdr = *hdr;
+  rechdr.addr = device->addr;
+  rechdr.size = len;
+  if (player_msghdr_pack(start, PLAYERXDR_MSGHDR_SIZE,
+                         &rechdr, PLAYERXDR_ENCODE) < 0)
+    return -1;
+
+  if (this->chunk.count == 0)
+  {
+    this->chunk.start_time = hdr->timestamp;
+    this->chunk.end_time = hdr->timestamp;
+  }
+  else
+  {
+    this->chunk.start_time = MIN(this->chunk.start_time, hdr->timestamp);
+    this->chunk.end_time = MAX(this->chunk.end_time, hdr->timestamp);
+  }
+  this->chunk.count++;
+  this->chunk.length += PLAYERXDR_MSGHDR_SIZE + len;
+
+  // Write the chunk out once it is big enough, or covers enough time that
+  // a crash would lose a noticeable stretch of the log
+  if ((this->chunk.length >= BINLOG_CHUNK_SIZE) ||
+      (this->chunk.end_time - this->chunk.start_time >= BINLOG_CHUNK_PERIOD))
+    return this->WriteChunk();
+  return 0;
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Write the current chunk of a binary log to file, and add it to the index
+int WriteLog::WriteChunk()
+{
+  char header[BINLOG_CHUNK_HEADER_SIZE];
+
+  if (this->chunk.count == 0)
+    return 0;
+
+  ::BinLogPackChunkHeader(header, &this->chunk);
+  this->BeginMessage();
+  this->Append(header, sizeof(header));
+  this->Append(this->chunk_buffer, this->chunk.length);
+  if (this->EndMessage(this->chunk.count) < 0)
+  {
+    // Dropped; the index only lists what is in the file
+    this->chunk.count = 0;
+    this->chunk.length = 0;
+    return 0;
+  }
+
+  if (this->index_count == this->index_size)
+  {
+    this->index_size = this->index_size ? 2 * this->index_size : 256;
+    this->index = (BinLogChunk*) realloc(this->index,
+                                         this->index_size * sizeof(this->index[0]));
+    assert(this->index);
+  }
+  this->chunk.offset = this->offset;
+  this->index[this->index_count++] = this->chunk;
+  this->offset += sizeof(header) + this->chunk.length;
+
+  this->chunk.count = 0;
+  this->chunk.length = 0;
+  return 0;
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Write the chunk index and the trailer that points to it at the end of a
+// binary log
+int WriteLog::WriteIndex()
+{
+  char entry[BINLOG_INDEX_ENTRY_SIZE];
+  char trailer[BINLOG_TRAILER_SIZE];
+
+  this->BeginMessage();
+  for (int i = 0; i < this->index_count; i++)
+  {
+    ::BinLogPackIndexEntry(entry, this->index + i);
+    this->Append(entry, sizeof(entry));
+  }
+  ::BinLogPackTrailer(trailer, this->index_count, this->offset);
+  this->Append(trailer, sizeof(trailer));
+  return this->EndMessage(0);
+}
+
+
 void
 WriteLog::WriteLocalizeParticles()
 
@@ -1072,17 +1789,17 @@ WriteLog::WriteLaser(player_msghdr_t* hdr, void *data)
           // Note that, in this format, we need a lot of precision in the
           // resolution field.
 
-          fprintf(this->file, "%04d %+07.4f %+07.4f %+.8f %+07.4f %04d ",
-                  scan->id, scan->min_angle, scan->max_angle,
-                  scan->resolution, scan->max_range, scan->ranges_count);
+          this->Printf("%04d %+07.4f %+07.4f %+.8f %+07.4f %04d ",
+                       scan->id, scan->min_angle, scan->max_angle,
+                       scan->resolution, scan->max_range, scan->ranges_count);
 
           for (i = 0; i < scan->ranges_count; i++)
           {
-            fprintf(this->file, "%.3f ", scan->ranges[i]);
+            this->Printf("%.3f ", scan->ranges[i]);
             if(i < scan->intensity_count)
-              fprintf(this->file, "%2d ", scan->intensity[i]);
+              this->Printf("%2d ", scan->intensity[i]);
             else
-              fprintf(this->file, "%2d ", 0);
+              this->Printf("%2d ", 0);
           }
           return(0);
 
@@ -1091,36 +1808,36 @@ WriteLog::WriteLaser(player_msghdr_t* hdr, void *data)
           // Note that, in this format, we need a lot of precision in the
           // resolution field.
 
-          fprintf(this->file, "%04d %+07.3f %+07.3f %+07.3f %+07.4f %+07.4f %+.8f %+07.4f %04d ",
-                  scanpose->scan.id,
-                  scanpose->pose.px, scanpose->pose.py, scanpose->pose.pa,
-                  scanpose->scan.min_angle, scanpose->scan.max_angle,
-                  scanpose->scan.resolution, scanpose->scan.max_range,
-                  scanpose->scan.ranges_count);
+          this->Printf("%04d %+07.3f %+07.3f %+07.3f %+07.4f %+07.4f %+.8f %+07.4f %04d ",
+                       scanpose->scan.id,
+                       scanpose->pose.px, scanpose->pose.py, scanpose->pose.pa,
+                       scanpose->scan.min_angle, scanpose->scan.max_angle,
+                       scanpose->scan.resolution, scanpose->scan.max_range,
+                       scanpose->scan.ranges_count);
 
           for (i = 0; i < scanpose->scan.ranges_count; i++)
           {
-            fprintf(this->file, "%.3f ", scanpose->scan.ranges[i]);
+            this->Printf("%.3f ", scanpose->scan.ranges[i]);
             if(i < scanpose->scan.intensity_count)
-              fprintf(this->file, "%2d ", scanpose->scan.intensity[i]);
+              this->Printf("%2d ", scanpose->scan.intensity[i]);
             else
-              fprintf(this->file, "%2d ", 0);
+              this->Printf("%2d ", 0);
           }
           return(0);
 
         case PLAYER_LASER_DATA_SCANANGLE:
 	  scanangle = (player_laser_data_scanangle_t*)data;
-	  fprintf(this->file, "%04d %+07.4f %04d ",
+	  this->Printf("%04d %+07.4f %04d ",
 		  scanangle->id, scanangle->max_range, scanangle->ranges_count);
 	  
 	  for (i = 0; i < scanangle->ranges_count; i++)
 	    {
-	      fprintf(this->file, "%.3f ", scanangle->ranges[i]);
-	      fprintf(this->file, "%.3f ", scanangle->angles[i]);
+	      this->Printf("%.3f ", scanangle->ranges[i]);
+	      this->Printf("%.3f ", scanangle->angles[i]);
 	      if(i < scanangle->intensity_count)
-		fprintf(this->file, "%2d ", scanangle->intensity[i]);
+		this->Printf("%2d ", scanangle->intensity[i]);
 	      else
-		fprintf(this->file, "%2d ", 0);
+		this->Printf("%2d ", 0);
 	    }
 	  return(0);
 	  
@@ -1132,12 +1849,12 @@ WriteLog::WriteLaser(player_msghdr_t* hdr, void *data)
       {
         case PLAYER_LASER_REQ_GET_GEOM:
           geom = (player_laser_geom_t*)data;
-          fprintf(this->file, "%+7.3f %+7.3f %7.3f %7.3f %7.3f",
-                  geom->pose.px,
-                  geom->pose.py,
-                  geom->pose.pyaw,
-                  geom->size.sl,
-                  geom->size.sw);
+          this->Printf("%+7.3f %+7.3f %7.3f %7.3f %7.3f",
+                       geom->pose.px,
+                       geom->pose.py,
+                       geom->pose.pyaw,
+                       geom->size.sl,
+                       geom->size.sw);
           return(0);
         default:
           return(-1);
@@ -1295,11 +2012,11 @@ WriteLog::WriteRanger(player_msghdr_t* hdr, void *data)
           // Note that, in this format, we need a lot of precision in the
           // resolution field.
 
-          fprintf(this->file, "%04d ", rscan->ranges_count);
+          this->Printf("%04d ", rscan->ranges_count);
 
           for (i = 0; i < rscan->ranges_count; i++)
 	    {
-	      fprintf(this->file, "%.3f ", rscan->ranges[i]);
+	      this->Printf("%.3f ", rscan->ranges[i]);
 	    }
           return(0);
 
@@ -1308,43 +2025,43 @@ WriteLog::WriteRanger(player_msghdr_t* hdr, void *data)
           // Note that, in this format, we need a lot of precision in the
           // resolution field.
 
-          fprintf(this->file, "%04d ", rscanpose->data.ranges_count);
+          this->Printf("%04d ", rscanpose->data.ranges_count);
 
           for (i = 0; i < rscanpose->data.ranges_count; i++)
 	    {
-	      fprintf(this->file, "%.3f ", rscanpose->data.ranges[i]);
+	      this->Printf("%.3f ", rscanpose->data.ranges[i]);
 	    }
 
-          fprintf(this->file, "%d ", rscanpose->have_geom);
+          this->Printf("%d ", rscanpose->have_geom);
 
 	  if (rscanpose->have_geom) 
 	    {
-	      fprintf(this->file, "%+07.3f %+07.3f %+07.3f %+07.3f %+07.3f %+07.3f %+07.3f %+07.3f %+07.3f ",
+	      this->Printf("%+07.3f %+07.3f %+07.3f %+07.3f %+07.3f %+07.3f %+07.3f %+07.3f %+07.3f ",
 		      rscanpose->geom.pose.px, rscanpose->geom.pose.py, rscanpose->geom.pose.pz,
 		      rscanpose->geom.pose.proll, rscanpose->geom.pose.ppitch, rscanpose->geom.pose.pyaw,
 		      rscanpose->geom.size.sw, rscanpose->geom.size.sl, rscanpose->geom.size.sh);
 	      
-	      fprintf(this->file, "%04d ", rscanpose->geom.element_poses_count);
+	      this->Printf("%04d ", rscanpose->geom.element_poses_count);
 	  
 	      for (i = 0; i < rscanpose->geom.element_poses_count; i++)
 		{
-		  fprintf(this->file, "%+07.3f %+07.3f %+07.3f %+07.3f %+07.3f %+07.3f ",
+		  this->Printf("%+07.3f %+07.3f %+07.3f %+07.3f %+07.3f %+07.3f ",
 			  rscanpose->geom.element_poses[i].px, rscanpose->geom.element_poses[i].py, rscanpose->geom.element_poses[i].pz,
 			  rscanpose->geom.element_poses[i].proll, rscanpose->geom.element_poses[i].ppitch, rscanpose->geom.element_poses[i].pyaw);
 		}
 
-	      fprintf(this->file, "%04d ", rscanpose->geom.element_sizes_count);
+	      this->Printf("%04d ", rscanpose->geom.element_sizes_count);
 	  
 	      for (i = 0; i < rscanpose->geom.element_sizes_count; i++)
 		{
-		  fprintf(this->file, "%+07.3f %+07.3f %+07.3f ",
+		  this->Printf("%+07.3f %+07.3f %+07.3f ",
 			  rscanpose->geom.element_sizes[i].sw, rscanpose->geom.element_sizes[i].sl, rscanpose->geom.element_sizes[i].sh);
 		}
 	    }
 	  
 	  if (rscanpose->have_config) 
 	    {
-	      fprintf(this->file, "%.4f %.4f %.4f %.4f %.4f %.4f %.4f ",
+	      this->Printf("%.4f %.4f %.4f %.4f %.4f %.4f %.4f ",
 		      rscanpose->config.min_angle, rscanpose->config.max_angle,
 		      rscanpose->config.angular_res, rscanpose->config.min_range,
 		      rscanpose->config.max_range, rscanpose->config.range_res,
@@ -1359,11 +2076,11 @@ WriteLog::WriteRanger(player_msghdr_t* hdr, void *data)
           // Note that, in this format, we need a lot of precision in the
           // resolution field.
 
-          fprintf(this->file, "%04d ", iscan->intensities_count);
+          this->Printf("%04d ", iscan->intensities_count);
 
           for (i = 0; i < iscan->intensities_count; i++)
 	    {
-	      fprintf(this->file, "%.3f ", iscan->intensities[i]);
+	      this->Printf("%.3f ", iscan->intensities[i]);
 	    }
           return(0);
 
@@ -1373,43 +2090,43 @@ WriteLog::WriteRanger(player_msghdr_t* hdr, void *data)
           // Note that, in this format, we need a lot of precision in the
           // resolution field.
 
-          fprintf(this->file, "%04d ", iscanpose->data.intensities_count);
+          this->Printf("%04d ", iscanpose->data.intensities_count);
 
           for (i = 0; i < iscanpose->data.intensities_count; i++)
 	    {
-	      fprintf(this->file, "%.3f ", iscanpose->data.intensities[i]);
+	      this->Printf("%.3f ", iscanpose->data.intensities[i]);
 	    }
 
-          fprintf(this->file, "%d ", iscanpose->have_geom);
+          this->Printf("%d ", iscanpose->have_geom);
 
 	  if (iscanpose->have_geom) 
 	    {
-	      fprintf(this->file, "%+07.3f %+07.3f %+07.3f %+07.3f %+07.3f %+07.3f %+07.3f %+07.3f %+07.3f ",
+	      this->Printf("%+07.3f %+07.3f %+07.3f %+07.3f %+07.3f %+07.3f %+07.3f %+07.3f %+07.3f ",
 		      iscanpose->geom.pose.px, iscanpose->geom.pose.py, iscanpose->geom.pose.pz,
 		      iscanpose->geom.pose.proll, iscanpose->geom.pose.ppitch, iscanpose->geom.pose.pyaw,
 		      iscanpose->geom.size.sw, iscanpose->geom.size.sl, iscanpose->geom.size.sh);
 	      
-	      fprintf(this->file, "%04d ", iscanpose->geom.element_poses_count);
+	      this->Printf("%04d ", iscanpose->geom.element_poses_count);
 	  
 	      for (i = 0; i < iscanpose->geom.element_poses_count; i++)
 		{
-		  fprintf(this->file, "%+07.3f %+07.3f %+07.3f %+07.3f %+07.3f %+07.3f ",
+		  this->Printf("%+07.3f %+07.3f %+07.3f %+07.3f %+07.3f %+07.3f ",
 			  iscanpose->geom.element_poses[i].px, iscanpose->geom.element_poses[i].py, iscanpose->geom.element_poses[i].pz,
 			  iscanpose->geom.element_poses[i].proll, iscanpose->geom.element_poses[i].ppitch, iscanpose->geom.element_poses[i].pyaw);
 		}
 
-	      fprintf(this->file, "%04d ", iscanpose->geom.element_sizes_count);
+	      this->Printf("%04d ", iscanpose->geom.element_sizes_count);
 	  
 	      for (i = 0; i < iscanpose->geom.element_sizes_count; i++)
 		{
-		  fprintf(this->file, "%+07.3f %+07.3f %+07.3f ",
+		  this->Printf("%+07.3f %+07.3f %+07.3f ",
 			  iscanpose->geom.element_sizes[i].sw, iscanpose->geom.element_sizes[i].sl, iscanpose->geom.element_sizes[i].sh);
 		}
 	    }
 
 	  if (iscanpose->have_config) 
 	    {
-	      fprintf(this->file, "%.4f %.4f %.4f %.4f %.4f %.4f %.4f ",
+	      this->Printf("%.4f %.4f %.4f %.4f %.4f %.4f %.4f ",
 		      iscanpose->config.min_angle, iscanpose->config.max_angle,
 		      iscanpose->config.angular_res, iscanpose->config.min_range,
 		      iscanpose->config.max_range, iscanpose->config.range_res,
@@ -1426,31 +2143,31 @@ WriteLog::WriteRanger(player_msghdr_t* hdr, void *data)
       {
         case PLAYER_RANGER_REQ_GET_GEOM:
           geom = (player_ranger_geom_t*)data;
-          fprintf(this->file, "%+07.3f %+07.3f %+07.3f %+07.3f %+07.3f %+07.3f %+07.3f %+07.3f %+07.3f ",
-                  geom->pose.px,
-                  geom->pose.py,
-                  geom->pose.pz,
-                  geom->pose.proll,
-                  geom->pose.ppitch,
-                  geom->pose.pyaw,
-                  geom->size.sw,
+          this->Printf("%+07.3f %+07.3f %+07.3f %+07.3f %+07.3f %+07.3f %+07.3f %+07.3f %+07.3f ",
+                       geom->pose.px,
+                       geom->pose.py,
+                       geom->pose.pz,
+                       geom->pose.proll,
+                       geom->pose.ppitch,
+                       geom->pose.pyaw,
+                       geom->size.sw,
 		  geom->size.sl,
-                  geom->size.sh);
+                       geom->size.sh);
 
-	  fprintf(this->file, "%04d ", geom->element_poses_count);
+	  this->Printf("%04d ", geom->element_poses_count);
 	  
 	  for (i = 0; i < geom->element_poses_count; i++)
 	    {
-	      fprintf(this->file, "%+07.3f %+07.3f %+07.3f %+07.3f %+07.3f %+07.3f ",
+	      this->Printf("%+07.3f %+07.3f %+07.3f %+07.3f %+07.3f %+07.3f ",
 		      geom->element_poses[i].px, geom->element_poses[i].py, geom->element_poses[i].pz,
 		      geom->element_poses[i].proll, geom->element_poses[i].ppitch, geom->element_poses[i].pyaw);
 	    }
 	  
-	  fprintf(this->file, "%04d ", geom->element_sizes_count);
+	  this->Printf("%04d ", geom->element_sizes_count);
 	  
 	  for (i = 0; i < geom->element_sizes_count; i++)
 	    {
-	      fprintf(this->file, "%+07.3f %+07.3f %+07.3f ",
+	      this->Printf("%+07.3f %+07.3f %+07.3f ",
 		      geom->element_sizes[i].sw, geom->element_sizes[i].sl, geom->element_sizes[i].sh);
 	    }
 	  
@@ -1459,7 +2176,7 @@ WriteLog::WriteRanger(player_msghdr_t* hdr, void *data)
         case PLAYER_RANGER_REQ_GET_CONFIG:
           config = (player_ranger_config_t*)data;
 
-	  fprintf(this->file, "%lf %lf %lf %lf %lf %lf %lf ",
+	  this->Printf("%lf %lf %lf %lf %lf %lf %lf ",
 		  config->min_angle, config->max_angle,
 		  config->angular_res, config->min_range,
 		  config->max_range, config->range_res,
@@ -1532,13 +2249,13 @@ WriteLog::WriteLocalize(player_msghdr_t* hdr, void *data)
           // resolution field.
 
 
-          fprintf(this->file, "%10d %+07.3f %2d ",
-                  hypoths->pending_count, hypoths->pending_time,
-                  hypoths->hypoths_count);
+          this->Printf("%10d %+07.3f %2d ",
+                       hypoths->pending_count, hypoths->pending_time,
+                       hypoths->hypoths_count);
 
           for (i = 0; i < hypoths->hypoths_count; i++)
-            fprintf(this->file, "%+7.3f %+7.3f %7.3f %7.3f %7.3f %7.3f %7.3f %7.3f %7.3f %7.3f ",
-                    hypoths->hypoths[i].mean.px,
+            this->Printf("%+7.3f %+7.3f %7.3f %7.3f %7.3f %7.3f %7.3f %7.3f %7.3f %7.3f ",
+                         hypoths->hypoths[i].mean.px,
 										hypoths->hypoths[i].mean.py,
 										hypoths->hypoths[i].mean.pa,
 										hypoths->hypoths[i].cov[0],
@@ -1561,15 +2278,15 @@ WriteLog::WriteLocalize(player_msghdr_t* hdr, void *data)
       {
         case PLAYER_LOCALIZE_REQ_GET_PARTICLES:
           particles = (player_localize_get_particles_t*)data;
-          fprintf(this->file, "%+7.3f %+7.3f %7.3f %7.3f %10d ",
-                  particles->mean.px,
-                  particles->mean.py,
-                  particles->mean.pa,
+          this->Printf("%+7.3f %+7.3f %7.3f %7.3f %10d ",
+                       particles->mean.px,
+                       particles->mean.py,
+                       particles->mean.pa,
 		  particles->variance,
 		  particles->particles_count);
 
           for (i = 0; i < particles->particles_count; i++)
-	    fprintf(this->file, "%+7.3f %+7.3f %7.3f %7.3f ",
+	    this->Printf("%+7.3f %+7.3f %7.3f %7.3f ",
                     particles->particles[i].pose.px,
 		    particles->particles[i].pose.py,
 		    particles->particles[i].pose.pa,
@@ -1619,15 +2336,15 @@ WriteLog::WritePosition(player_msghdr_t* hdr, void *data)
           {
             player_position2d_data_t* pdata =
                     (player_position2d_data_t*)data;
-            fprintf(this->file,
-                    "%+07.3f %+07.3f %+04.3f %+07.3f %+07.3f %+07.3f %d",
-                    pdata->pos.px,
-                    pdata->pos.py,
-                    pdata->pos.pa,
-                    pdata->vel.px,
-                    pdata->vel.py,
-                    pdata->vel.pa,
-                    pdata->stall);
+            this->Printf(
+                         "%+07.3f %+07.3f %+04.3f %+07.3f %+07.3f %+07.3f %d",
+                         pdata->pos.px,
+                         pdata->pos.py,
+                         pdata->pos.pa,
+                         pdata->vel.px,
+                         pdata->vel.py,
+                         pdata->vel.pa,
+                         pdata->stall);
             return(0);
           }
         default:
@@ -1642,13 +2359,13 @@ WriteLog::WritePosition(player_msghdr_t* hdr, void *data)
           {
             player_position2d_geom_t* gdata =
                     (player_position2d_geom_t*)data;
-            fprintf(this->file,
-                    "%+07.3f %+07.3f %+04.3f %+07.3f %+07.3f",
-                    gdata->pose.px,
-                    gdata->pose.py,
-                    gdata->pose.pyaw,
-                    gdata->size.sl,
-                    gdata->size.sw);
+            this->Printf(
+                         "%+07.3f %+07.3f %+04.3f %+07.3f %+07.3f",
+                         gdata->pose.px,
+                         gdata->pose.py,
+                         gdata->pose.pyaw,
+                         gdata->size.sl,
+                         gdata->size.sw);
 
             return(0);
           }
@@ -1688,13 +2405,13 @@ WriteLog::WritePTZ (player_msghdr_t* hdr, void *data)
           {
             player_ptz_data_t* pdata =
                     (player_ptz_data_t*)data;
-            fprintf(this->file,
-                    "%+07.3f %+07.3f %+04.3f %+07.3f %+07.3f",
-                    pdata->pan,
-                    pdata->tilt,
-                    pdata->zoom,
-                    pdata->panspeed,
-                    pdata->tiltspeed);
+            this->Printf(
+                         "%+07.3f %+07.3f %+04.3f %+07.3f %+07.3f",
+                         pdata->pan,
+                         pdata->tilt,
+                         pdata->zoom,
+                         pdata->panspeed,
+                         pdata->tiltspeed);
             return(0);
           }
         default:
@@ -1736,11 +2453,11 @@ WriteLog::WriteOpaque (player_msghdr_t* hdr, void *data)
           {
             player_opaque_data_t* odata =
                     (player_opaque_data_t*)data;
-            fprintf(this->file, "%04d ", odata->data_count);
+            this->Printf("%04d ", odata->data_count);
 
             for (unsigned int i = 0; i < odata->data_count; i++)
             {
-               fprintf(this->file, "%03d ", odata->data[i]);
+               this->Printf("%03d ", odata->data[i]);
             }
 
             return(0);
@@ -1757,11 +2474,11 @@ WriteLog::WriteOpaque (player_msghdr_t* hdr, void *data)
           {
             player_opaque_data_t* odata =
                     (player_opaque_data_t*)data;
-            fprintf(this->file, "%04d ", odata->data_count);
+            this->Printf("%04d ", odata->data_count);
 
             for (unsigned int i = 0; i < odata->data_count; i++)
             {
-               fprintf(this->file, "%03d ", odata->data[i]);
+               this->Printf("%03d ", odata->data[i]);
             }
 
             return(0);
@@ -1818,21 +2535,21 @@ WriteLog::WriteSonar(player_msghdr_t* hdr, void *data)
           // Format:
           //   pose_count x0 y0 a0 x1 y1 a1 ...
           geom = (player_sonar_geom_t*)data;
-          fprintf(this->file, "%u ", geom->poses_count);
+          this->Printf("%u ", geom->poses_count);
           for(i=0;i<geom->poses_count;i++)
-            fprintf(this->file, "%+07.3f %+07.3f %+07.4f ",
-                    geom->poses[i].px,
-                    geom->poses[i].py,
-                    geom->poses[i].pyaw);
+            this->Printf("%+07.3f %+07.3f %+07.4f ",
+                         geom->poses[i].px,
+                         geom->poses[i].py,
+                         geom->poses[i].pyaw);
           return(0);
 
         case PLAYER_SONAR_DATA_RANGES:
           // Format:
           //   range_count r0 r1 ...
           range_data = (player_sonar_data_t*)data;
-          fprintf(this->file, "%u ", range_data->ranges_count);
+          this->Printf("%u ", range_data->ranges_count);
           for(i=0;i<range_data->ranges_count;i++)
-            fprintf(this->file, "%.3f ", range_data->ranges[i]);
+            this->Printf("%.3f ", range_data->ranges[i]);
 
           return(0);
         default:
@@ -1846,12 +2563,12 @@ WriteLog::WriteSonar(player_msghdr_t* hdr, void *data)
           // Format:
           //   pose_count x0 y0 a0 x1 y1 a1 ...
           geom = (player_sonar_geom_t*)data;
-          fprintf(this->file, "%u ", geom->poses_count);
+          this->Printf("%u ", geom->poses_count);
           for(i=0;i<geom->poses_count;i++)
-            fprintf(this->file, "%+07.3f %+07.3f %+07.4f ",
-                    geom->poses[i].px,
-                    geom->poses[i].py,
-                    geom->poses[i].pyaw);
+            this->Printf("%+07.3f %+07.3f %+07.4f ",
+                         geom->poses[i].px,
+                         geom->poses[i].py,
+                         geom->poses[i].pyaw);
 
           return(0);
         default:
@@ -1896,7 +2613,7 @@ WriteLog::WriteWiFi(player_msghdr_t* hdr, void *data)
       {
 	case PLAYER_WIFI_DATA_STATE:
 	  wdata = (player_wifi_data_t*)data;
-          fprintf(this->file, "%04d ", wdata->links_count);
+          this->Printf("%04d ", wdata->links_count);
 
           for (i = 0; i < wdata->links_count; i++)
           {
@@ -1912,14 +2629,14 @@ WriteLog::WriteWiFi(player_msghdr_t* hdr, void *data)
 	    memcpy(ip, wdata->links[i].ip, wdata->links[i].ip_count);
             memcpy(essid, wdata->links[i].essid, wdata->links[i].essid_count);
 
-            fprintf(this->file, "'%s' '%s' '%s' %d %d %d %d %d %d ",
-                    mac, ip, essid,
-                    wdata->links[i].mode,
-                    wdata->links[i].freq,
-                    wdata->links[i].encrypt,
-                    wdata->links[i].qual,
-                    wdata->links[i].level,
-                    wdata->links[i].noise);
+            this->Printf("'%s' '%s' '%s' %d %d %d %d %d %d ",
+                         mac, ip, essid,
+                         wdata->links[i].mode,
+                         wdata->links[i].freq,
+                         wdata->links[i].encrypt,
+                         wdata->links[i].qual,
+                         wdata->links[i].level,
+                         wdata->links[i].noise);
           }
           return(0);
 
@@ -1967,20 +2684,20 @@ WriteLog::WriteWSN(player_msghdr_t* hdr, void *data)
             {
                 case PLAYER_WSN_DATA_STATE:
                     wdata = (player_wsn_data_t*)data;
-                    fprintf(this->file,"%d %d %d %f %f %f %f %f %f %f %f %f %f",
-                            wdata->node_type,
-                            wdata->node_id,
-                            wdata->node_parent_id,
-                            wdata->data_packet.light,
-                            wdata->data_packet.mic,
-                            wdata->data_packet.accel_x,
-                            wdata->data_packet.accel_y,
-                            wdata->data_packet.accel_z,
-                            wdata->data_packet.magn_x,
-                            wdata->data_packet.magn_y,
-                            wdata->data_packet.magn_z,
-                            wdata->data_packet.temperature,
-                            wdata->data_packet.battery);
+                    this->Printf("%d %d %d %f %f %f %f %f %f %f %f %f %f",
+                                 wdata->node_type,
+                                 wdata->node_id,
+                                 wdata->node_parent_id,
+                                 wdata->data_packet.light,
+                                 wdata->data_packet.mic,
+                                 wdata->data_packet.accel_x,
+                                 wdata->data_packet.accel_y,
+                                 wdata->data_packet.accel_z,
+                                 wdata->data_packet.magn_x,
+                                 wdata->data_packet.magn_y,
+                                 wdata->data_packet.magn_z,
+                                 wdata->data_packet.temperature,
+                                 wdata->data_packet.battery);
                     return(0);
 
                 default:
@@ -2037,9 +2754,9 @@ WriteLog::WriteCoopObject(player_msghdr_t* hdr, void *data)
 		{
                     player_coopobject_header_t *wdata = (player_coopobject_header_t*)data;
 
-                    fprintf(this->file,"%d %d %d ",
-                            wdata->id,
-                            wdata->parent_id,
+                    this->Printf("%d %d %d ",
+                                 wdata->id,
+                                 wdata->parent_id,
 			    wdata->origin);
 
                     return(0);
@@ -2049,32 +2766,32 @@ WriteLog::WriteCoopObject(player_msghdr_t* hdr, void *data)
 		{
                     player_coopobject_rssi_t *wdata = (player_coopobject_rssi_t*)data;
 
-                    fprintf(this->file,"%d %d %d %d %d %d %d %d %f %f %f ",
-                            wdata->header.id,
-                            wdata->header.parent_id,
+                    this->Printf("%d %d %d %d %d %d %d %d %f %f %f ",
+                                 wdata->header.id,
+                                 wdata->header.parent_id,
 			    wdata->header.origin,
-                            wdata->sender_id,
-                            wdata->rssi,
-                            wdata->stamp,
-                            wdata->nodeTimeHigh,
-                            wdata->nodeTimeLow,
-                            wdata->x,
+                                 wdata->sender_id,
+                                 wdata->rssi,
+                                 wdata->stamp,
+                                 wdata->nodeTimeHigh,
+                                 wdata->nodeTimeLow,
+                                 wdata->x,
 			    wdata->y,
-                            wdata->z);
+                                 wdata->z);
                     return(0);
 		    break;
 		}
                 case PLAYER_COOPOBJECT_DATA_SENSOR:
 		{
                     player_coopobject_data_sensor_t *wdata = (player_coopobject_data_sensor_t*)data;
-                    fprintf(this->file,"%d %d %d ",
-                            wdata->header.id,
-                            wdata->header.parent_id,
+                    this->Printf("%d %d %d ",
+                                 wdata->header.id,
+                                 wdata->header.parent_id,
 			    wdata->header.origin);
 
-		    fprintf (this->file, "%d ", wdata->data_count);
+		    this->Printf ("%d ", wdata->data_count);
 		    for (i = 0; i < wdata->data_count; i++)
-			fprintf (this->file,"%d %d ", wdata->data[i].type, wdata->data[i].value);
+			this->Printf ("%d %d ", wdata->data[i].type, wdata->data[i].value);
 
                     return(0);
 		    break;
@@ -2082,14 +2799,14 @@ WriteLog::WriteCoopObject(player_msghdr_t* hdr, void *data)
                 case PLAYER_COOPOBJECT_DATA_ALARM:
 		{
                     player_coopobject_data_sensor_t *wdata = (player_coopobject_data_sensor_t*)data;
-                    fprintf(this->file,"%d %d %d ",
-                            wdata->header.id,
-                            wdata->header.parent_id,
+                    this->Printf("%d %d %d ",
+                                 wdata->header.id,
+                                 wdata->header.parent_id,
 			    wdata->header.origin);
 
-		    fprintf (this->file, "%d ", wdata->data_count);
+		    this->Printf ("%d ", wdata->data_count);
 		    for (i = 0; i < wdata->data_count; i++)
-			fprintf (this->file,"%d %d ", wdata->data[i].type, wdata->data[i].value);
+			this->Printf ("%d %d ", wdata->data[i].type, wdata->data[i].value);
 
                     return(0);
 		    break;
@@ -2097,14 +2814,14 @@ WriteLog::WriteCoopObject(player_msghdr_t* hdr, void *data)
                 case PLAYER_COOPOBJECT_DATA_USERDEFINED:
 		{
                     player_coopobject_data_userdefined_t *wdata = (player_coopobject_data_userdefined_t*)data;
-                    fprintf(this->file,"%d %d %d ",
-                            wdata->header.id,
-                            wdata->header.parent_id,
+                    this->Printf("%d %d %d ",
+                                 wdata->header.id,
+                                 wdata->header.parent_id,
 			    wdata->header.origin);
 
-		    fprintf (this->file, "%d %d ", wdata->type, wdata->data_count);
+		    this->Printf ("%d %d ", wdata->type, wdata->data_count);
 		    for (i = 0; i < wdata->data_count; i++)
-			fprintf (this->file,"%d ", wdata->data[i]);
+			this->Printf ("%d ", wdata->data[i]);
 
 		    return(0);
 		    break;
@@ -2112,14 +2829,14 @@ WriteLog::WriteCoopObject(player_msghdr_t* hdr, void *data)
                 case PLAYER_COOPOBJECT_DATA_REQUEST:
 		{
                     player_coopobject_req_t *wdata = (player_coopobject_req_t*)data;
-                    fprintf(this->file,"%d %d %d %d ",
-                            wdata->header.id,
-                            wdata->header.parent_id,
+                    this->Printf("%d %d %d %d ",
+                                 wdata->header.id,
+                                 wdata->header.parent_id,
 			    wdata->header.origin);
 
-		    fprintf (this->file, "%d %d ", wdata->request, wdata->parameters_count);
+		    this->Printf ("%d %d ", wdata->request, wdata->parameters_count);
 		    for (i = 0; i < wdata->parameters_count; i++)
-			fprintf (this->file,"%d ", wdata->parameters[i]);
+			this->Printf ("%d ", wdata->parameters[i]);
 
                     return(0);
 		    break;
@@ -2127,14 +2844,14 @@ WriteLog::WriteCoopObject(player_msghdr_t* hdr, void *data)
 		case PLAYER_COOPOBJECT_DATA_COMMAND:
 		{
                     player_coopobject_cmd_t *wdata = (player_coopobject_cmd_t*)data;
-                    fprintf(this->file,"%d %d %d %d ",
-                            wdata->header.id,
-                            wdata->header.parent_id,
+                    this->Printf("%d %d %d %d ",
+                                 wdata->header.id,
+                                 wdata->header.parent_id,
 			    wdata->header.origin);
 
-		    fprintf (this->file, "%d %d ", wdata->command, wdata->parameters_count);
+		    this->Printf ("%d %d ", wdata->command, wdata->parameters_count);
 		    for (i = 0; i < wdata->parameters_count; i++)
-			fprintf (this->file,"%d ", wdata->parameters[i]);
+			this->Printf ("%d ", wdata->parameters[i]);
 
                     return(0);
 				break;
@@ -2145,24 +2862,24 @@ WriteLog::WriteCoopObject(player_msghdr_t* hdr, void *data)
             }
 
 /*		case PLAYER_MSGTYPE_CMD:
-		fprintf(this->file,"cmd\n");
+		this->Printf("cmd\n");
       // Check the subtype
             switch(hdr->subtype)
             {
                 case PLAYER_COOPOBJECT_CMD_DATA:
 				{
                     player_coopobject_cmd_data_t *wdata = (player_coopobject_cmd_data_t*)data;
-                    fprintf(this->file,"%d %d %f %f %f %d ",
-                            wdata->node_id,
-                            wdata->source_id,
+                    this->Printf("%d %d %f %f %f %d ",
+                                 wdata->node_id,
+                                 wdata->source_id,
 			    wdata->pos.px,
 			    wdata->pos.py,
 			    wdata->pos.pa,
 		wdata->status );
 
-			    fprintf (this->file, "%d %d ", wdata->data_type, wdata->data_count);
+			    this->Printf ("%d %d ", wdata->data_type, wdata->data_count);
 			    for (i = 0; i < wdata->data_count; i++)
-			      fprintf (this->file,"%d ", wdata->data[i]);
+			      this->Printf ("%d ", wdata->data[i]);
 
                     return(0);
 				break;
@@ -2255,7 +2972,7 @@ WriteLog::WriteIMU (player_msghdr_t* hdr, void *data)
 		{
 		    player_imu_data_state_t* idata;
                     idata = (player_imu_data_state_t*)data;
-                    fprintf (this->file,"%f %f %f %f %f %f",
+                    this->Printf ("%f %f %f %f %f %f",
                             idata->pose.px,
                             idata->pose.py,
                             idata->pose.pz,
@@ -2269,7 +2986,7 @@ WriteLog::WriteIMU (player_msghdr_t* hdr, void *data)
 		{
 		    player_imu_data_calib_t* idata;
                     idata = (player_imu_data_calib_t*)data;
-                    fprintf (this->file,"%f %f %f %f %f %f %f %f %f",
+                    this->Printf ("%f %f %f %f %f %f %f %f %f",
                             idata->accel_x,
                             idata->accel_y,
                             idata->accel_z,
@@ -2286,7 +3003,7 @@ WriteLog::WriteIMU (player_msghdr_t* hdr, void *data)
 		{
 		    player_imu_data_quat_t* idata;
                     idata = (player_imu_data_quat_t*)data;
-                    fprintf (this->file,"%f %f %f %f %f %f %f %f %f %f %f %f %f",
+                    this->Printf ("%f %f %f %f %f %f %f %f %f %f %f %f %f",
                             idata->calib_data.accel_x,
                             idata->calib_data.accel_y,
                             idata->calib_data.accel_z,
@@ -2307,7 +3024,7 @@ WriteLog::WriteIMU (player_msghdr_t* hdr, void *data)
 		{
 		    player_imu_data_euler_t* idata;
                     idata = (player_imu_data_euler_t*)data;
-                    fprintf (this->file,"%f %f %f %f %f %f %f %f %f %f %f %f",
+                    this->Printf ("%f %f %f %f %f %f %f %f %f %f %f %f",
                             idata->calib_data.accel_x,
                             idata->calib_data.accel_y,
                             idata->calib_data.accel_z,
@@ -2327,7 +3044,7 @@ WriteLog::WriteIMU (player_msghdr_t* hdr, void *data)
 				{
 					player_imu_data_fullstate_t* idata;
 					idata = (player_imu_data_fullstate_t*)data;
-					fprintf (this->file,"%f %f %f %f %f %f %f %f %f %f %f %f %f %f %f",
+					this->Printf ("%f %f %f %f %f %f %f %f %f %f %f %f %f %f %f",
 							  idata->pose.px,
 							  idata->pose.py,
 							  idata->pose.pz,
@@ -2382,9 +3099,9 @@ WriteLog::WritePointCloud3d (player_msghdr_t* hdr, void *data)
 		{
 		    player_pointcloud3d_data_t* pdata;
                     pdata = (player_pointcloud3d_data_t*)data;
-		    fprintf (this->file, "%d ", pdata->points_count);
+		    this->Printf ("%d ", pdata->points_count);
 		    for (i = 0; i < pdata->points_count; i++)
-			fprintf (this->file,"%f %f %f ",
+			this->Printf ("%f %f %f ",
                             pdata->points[i].point.px,
                             pdata->points[i].point.py,
                             pdata->points[i].point.pz);
@@ -2429,15 +3146,15 @@ WriteLog::WriteActarray (player_msghdr_t* hdr, void *data)
           case PLAYER_ACTARRAY_DATA_STATE:
             player_actarray_data_t* pdata;
             pdata = (player_actarray_data_t*)data;
-            fprintf (this->file, "%d ", pdata->actuators_count);
+            this->Printf ("%d ", pdata->actuators_count);
             for (i = 0; i < pdata->actuators_count; i++)
-              fprintf (this->file,"%f %f %f %f %d ",
+              this->Printf ("%f %f %f %f %d ",
                         pdata->actuators[i].position,
                         pdata->actuators[i].speed,
                         pdata->actuators[i].acceleration,
                         pdata->actuators[i].current,
                         pdata->actuators[i].state);
-              fprintf (this->file, "%d ", pdata->motor_state);
+              this->Printf ("%d ", pdata->motor_state);
             delete[] pdata->actuators;
             return (0);
           default:
@@ -2471,11 +3188,11 @@ WriteLog::WriteAIO(player_msghdr_t* hdr, void* data)
         case PLAYER_AIO_DATA_STATE: {
             player_aio_data_t* inputs(static_cast<player_aio_data_t*>(data));
 
-            fprintf(this->file, "%04d ", inputs->voltages_count);
+            this->Printf("%04d ", inputs->voltages_count);
 
             for (float *v(inputs->voltages);
                  v != inputs->voltages + inputs->voltages_count; ++v)
-              fprintf(this->file, "%.3f ", *v);
+              this->Printf("%.3f ", *v);
 
             return 0;
           }
@@ -2519,10 +3236,10 @@ WriteLog::WriteDIO(player_msghdr_t* hdr, void* data)
                 return -1;
             }
 
-            fprintf(this->file, "%04d ", inputs->count);
+            this->Printf("%04d ", inputs->count);
 
             for (uint32_t mask(1); mask != (1ul << inputs->count); mask <<= 1)
-              fprintf(this->file, "%d ", !!(mask & inputs->bits));
+              this->Printf("%d ", !!(mask & inputs->bits));
 
             return 0;
           }
@@ -2560,7 +3277,7 @@ WriteLog::WriteRFID(player_msghdr_t* hdr, void* data)
         case PLAYER_RFID_DATA_TAGS: {
             player_rfid_data_t* rdata(static_cast<player_rfid_data_t*>(data));
 
-            fprintf(file, "%04lu ", (long)rdata->tags_count);
+            this->Printf("%04lu ", (long)rdata->tags_count);
 
             for (player_rfid_tag_t *t(rdata->tags);
                  t != rdata->tags + rdata->tags_count; ++t) {
@@ -2570,9 +3287,9 @@ WriteLog::WriteRFID(player_msghdr_t* hdr, void* data)
                 PLAYER_ERROR("Failed to allocate space for str");
 				return -1;
               }
-              memset(str, '\0', sizeof(str));
-              EncodeHex(str, sizeof(str), t->guid, t->guid_count);
-              fprintf(file, "%04lu %s ", (long)t->type, str);
+              memset(str, '\0', t->guid_count * 2 + 1);
+              EncodeHex(str, t->guid_count * 2 + 1, t->guid, t->guid_count);
+              this->Printf("%04lu %s ", (long)t->type, str);
 			  delete[] str;
             }
 
@@ -2620,10 +3337,10 @@ WriteLog::WriteIR(player_msghdr_t* hdr, void *data)
           // Format:
           //   bumpers_count bumper0 bumper1 ...
           ir_data = ( player_ir_data_t*)data;
-          fprintf(this->file, "%u ", ir_data->ranges_count);
+          this->Printf("%u ", ir_data->ranges_count);
           for(i=0;i<ir_data->ranges_count;i++)
             // P2OS infrared lights are binary but I will use the %3.3f format
-            fprintf(this->file, "%3.3f ", ir_data->ranges[i]);
+            this->Printf("%3.3f ", ir_data->ranges[i]);
 
           return(0);
         default:
@@ -2637,12 +3354,12 @@ WriteLog::WriteIR(player_msghdr_t* hdr, void *data)
           // Format:
           //   bumper_def_count x0 y0 a0 l0 r0 x1 y1 a1 l1 r1...
           geom = (player_ir_pose_t*)data;
-          fprintf(this->file, "%u ", geom->poses_count);
+          this->Printf("%u ", geom->poses_count);
           for(i=0;i<geom->poses_count;i++)
-            fprintf(this->file, "%+07.3f %+07.3f %+07.4f ",
-                    geom->poses[i].px,
-                    geom->poses[i].py,
-                    geom->poses[i].pyaw);
+            this->Printf("%+07.3f %+07.3f %+07.4f ",
+                         geom->poses[i].px,
+                         geom->poses[i].py,
+                         geom->poses[i].pyaw);
           return(0);
         default:
           return(-1);
@@ -2683,12 +3400,12 @@ WriteLog::WriteBumper(player_msghdr_t* hdr, void *data)
           // Format:
           //   bumper_def_count x0 y0 a0 l0 r0 x1 y1 a1 l1 r1...
           geom = (player_bumper_geom_t*)data;
-          fprintf(this->file, "%u ", geom->bumper_def_count);
+          this->Printf("%u ", geom->bumper_def_count);
           for(i=0;i<geom->bumper_def_count;i++)
-            fprintf(this->file, "%+07.3f %+07.3f %+07.4f %+07.4f %+07.4f ",
-                    geom->bumper_def[i].pose.px,
-                    geom->bumper_def[i].pose.py,
-                    geom->bumper_def[i].pose.pyaw,
+            this->Printf("%+07.3f %+07.3f %+07.4f %+07.4f %+07.4f ",
+                         geom->bumper_def[i].pose.px,
+                         geom->bumper_def[i].pose.py,
+                         geom->bumper_def[i].pose.pyaw,
 		    geom->bumper_def[i].length,
 		    geom->bumper_def[i].radius);
           return(0);
@@ -2697,9 +3414,9 @@ WriteLog::WriteBumper(player_msghdr_t* hdr, void *data)
           // Format:
           //   bumpers_count bumper0 bumper1 ...
           bumper_data = ( player_bumper_data_t*)data;
-          fprintf(this->file, "%u ", bumper_data->bumpers_count);
+          this->Printf("%u ", bumper_data->bumpers_count);
           for(i=0;i<bumper_data->bumpers_count;i++)
-            fprintf(this->file, "%u ", bumper_data->bumpers[i]);
+            this->Printf("%u ", bumper_data->bumpers[i]);
 
           return(0);
         default:
@@ -2713,12 +3430,12 @@ WriteLog::WriteBumper(player_msghdr_t* hdr, void *data)
           // Format:
           //   bumper_def_count x0 y0 a0 l0 r0 x1 y1 a1 l1 r1...
           geom = (player_bumper_geom_t*)data;
-          fprintf(this->file, "%u ", geom->bumper_def_count);
+          this->Printf("%u ", geom->bumper_def_count);
           for(i=0;i<geom->bumper_def_count;i++)
-            fprintf(this->file, "%+07.3f %+07.3f %+07.4f %+07.4f %+07.4f ",
-                    geom->bumper_def[i].pose.px,
-                    geom->bumper_def[i].pose.py,
-                    geom->bumper_def[i].pose.pyaw,
+            this->Printf("%+07.3f %+07.3f %+07.4f %+07.4f %+07.4f ",
+                         geom->bumper_def[i].pose.px,
+                         geom->bumper_def[i].pose.py,
+                         geom->bumper_def[i].pose.pyaw,
 		    geom->bumper_def[i].length,
 		    geom->bumper_def[i].radius);
 
@@ -2759,14 +3476,14 @@ int WriteLog::WriteBlobfinder(player_msghdr_t* hdr, void *data)
   switch(hdr->type){
     case PLAYER_MSGTYPE_DATA:
 
-	  fprintf(this->file, "%d %d %d",
+	  this->Printf("%d %d %d",
 		bdata->width,
 		bdata->height,
 		bdata->blobs_count);
 
 	  for(int i=0; i < (int)bdata->blobs_count; i++)
 	  {
-	  	fprintf(this->file, " %d %d %d %d %d %d %d %d %d %f",
+	  	this->Printf(" %d %d %d %d %d %d %d %d %d %f",
 		  	bdata->blobs[i].id,
 		  	bdata->blobs[i].color,
 		  	bdata->blobs[i].area,
@@ -2812,10 +3529,10 @@ int WriteLog::WriteCamera(WriteLogDevice *device, player_msghdr_t* hdr, void *da
                     camera_data = (player_camera_data_t *) data;
 
                     // Image format
-                    fprintf(this->file, "%d %d %d %d %d %d " ,
-                            camera_data->width, camera_data->height,
-                            camera_data->bpp, camera_data->format,
-                            camera_data->compression, camera_data->image_count);
+                    this->Printf("%d %d %d %d %d %d " ,
+                                 camera_data->width, camera_data->height,
+                                 camera_data->bpp, camera_data->format,
+                                 camera_data->compression, camera_data->image_count);
 
                     if(this->cameraLogImages)
                     {
@@ -2831,55 +3548,11 @@ int WriteLog::WriteCamera(WriteLogDevice *device, player_msghdr_t* hdr, void *da
                         ::EncodeHex(str, dst_size, camera_data->image, src_size);
 
                         // Write image bytes
-                        fprintf(this->file, "%s", str);
+                        this->Printf("%s", str);
                         free(str);
                     }
                     if(this->cameraSaveImages)
-                    {
-                        FILE *file;
-                        char filename[1024];
-
-			
-			if (camera_data->compression == PLAYER_CAMERA_COMPRESS_RAW) {
-			  snprintf(filename, sizeof(filename), "%s/%s_camera_%02d_%06d.pnm",
-				   this->log_directory, this->filestem, device->addr.index, device->cameraFrame++);
-			} else if (camera_data->compression == PLAYER_CAMERA_COMPRESS_JPEG) {
-			  snprintf(filename, sizeof(filename), "%s/%s_camera_%02d_%06d.jpg",
-				   this->log_directory, this->filestem, device->addr.index, device->cameraFrame++);
-			} else {
-                          PLAYER_WARN("unsupported compression method");
-                          return -1;
-			}
-
-			file = fopen(filename, "w+");
-			if (file == NULL)
-			  return -1;
-			
-			if (camera_data->compression == PLAYER_CAMERA_COMPRESS_RAW) {
-			  
-			  if (camera_data->format == PLAYER_CAMERA_FORMAT_RGB888)
-			    {
-			      // Write ppm header
-			      fprintf(file, "P6\n%d %d\n%d\n", camera_data->width, camera_data->height, 255);
-			      fwrite(camera_data->image, 1, camera_data->image_count, file);
-			    }
-			  else if (camera_data->format == PLAYER_CAMERA_FORMAT_MONO8)
-			    {
-			      // Write pgm header
-			      fprintf(file, "P5\n%d %d\n%d\n", camera_data->width, camera_data->height, 255);
-			      fwrite(camera_data->image, 1, camera_data->image_count, file);
-			    }
-			  else
-			    {
-			      PLAYER_WARN("unsupported image format");
-			    }
-			  
-			} else if (camera_data->compression == PLAYER_CAMERA_COMPRESS_JPEG) {
-			  fwrite(camera_data->image, 1, camera_data->image_count, file);
-			}
-
-			fclose(file);
-		    }
+                        return this->SaveCameraImage(device, camera_data);
                     return 0;
                 default:
                     return -1;
@@ -2890,6 +3563,55 @@ int WriteLog::WriteCamera(WriteLogDevice *device, player_msghdr_t* hdr, void *da
     return -1;
 }
 
+
+////////////////////////////////////////////////////////////////////////////
+// Save a camera frame to its own image file in the log directory
+int WriteLog::SaveCameraImage(WriteLogDevice *device,
+                              player_camera_data_t *camera_data)
+{
+    FILE *file;
+    char filename[1024];
+
+    if (camera_data->compression == PLAYER_CAMERA_COMPRESS_RAW) {
+      snprintf(filename, sizeof(filename), "%s/%s_camera_%02d_%06d.pnm",
+               this->log_directory, this->filestem, device->addr.index, device->cameraFrame++);
+    } else if (camera_data->compression == PLAYER_CAMERA_COMPRESS_JPEG) {
+      snprintf(filename, sizeof(filename), "%s/%s_camera_%02d_%06d.jpg",
+               this->log_directory, this->filestem, device->addr.index, device->cameraFrame++);
+    } else {
+      PLAYER_WARN("unsupported compression method");
+      return -1;
+    }
+
+    file = fopen(filename, "w+");
+    if (file == NULL)
+      return -1;
+
+    if (camera_data->compression == PLAYER_CAMERA_COMPRESS_RAW) {
+      if (camera_data->format == PLAYER_CAMERA_FORMAT_RGB888)
+        {
+          // Write ppm header
+          fprintf(file, "P6\n%d %d\n%d\n", camera_data->width, camera_data->height, 255);
+          fwrite(camera_data->image, 1, camera_data->image_count, file);
+        }
+      else if (camera_data->format == PLAYER_CAMERA_FORMAT_MONO8)
+        {
+          // Write pgm header
+          fprintf(file, "P5\n%d %d\n%d\n", camera_data->width, camera_data->height, 255);
+          fwrite(camera_data->image, 1, camera_data->image_count, file);
+        }
+      else
+        {
+          PLAYER_WARN("unsupported image format");
+        }
+    } else if (camera_data->compression == PLAYER_CAMERA_COMPRESS_JPEG) {
+      fwrite(camera_data->image, 1, camera_data->image_count, file);
+    }
+
+    fclose(file);
+    return 0;
+}
+
 /** @ingroup tutorial_datalog
  * @defgroup player_driver_writelog_fiducial Fiducial format
 
@@ -2938,24 +3660,24 @@ int WriteLog::WriteFiducial(player_msghdr_t* hdr, void *data)
                 case PLAYER_FIDUCIAL_DATA_SCAN:
                     fiducial_data = (player_fiducial_data_t*) data;
                     // format: <count> [<id> <x> <y> <z> <roll> <pitch> <yaw> <ux> <uy> <uz> <uroll> <upitch> <uyaw>] ...
-                    fprintf(this->file, "%d", fiducial_data->fiducials_count);
+                    this->Printf("%d", fiducial_data->fiducials_count);
                     for (unsigned i = 0; i < fiducial_data->fiducials_count; i++) {
-                        fprintf(this->file, " %d"
-                                " %+07.3f %+07.3f %+07.3f %+07.3f %+07.3f %+07.3f"
-                                " %+07.3f %+07.3f %+07.3f %+07.3f %+07.3f %+07.3f",
-                                fiducial_data->fiducials[i].id,
-                                fiducial_data->fiducials[i].pose.px,
-                                fiducial_data->fiducials[i].pose.py,
-                                fiducial_data->fiducials[i].pose.pz,
-                                fiducial_data->fiducials[i].pose.proll,
-                                fiducial_data->fiducials[i].pose.ppitch,
-                                fiducial_data->fiducials[i].pose.pyaw,
-                                fiducial_data->fiducials[i].upose.px,
-                                fiducial_data->fiducials[i].upose.py,
-                                fiducial_data->fiducials[i].upose.pz,
-                                fiducial_data->fiducials[i].upose.proll,
-                                fiducial_data->fiducials[i].upose.ppitch,
-                                fiducial_data->fiducials[i].upose.pyaw);
+                        this->Printf(" %d"
+                                     " %+07.3f %+07.3f %+07.3f %+07.3f %+07.3f %+07.3f"
+                                     " %+07.3f %+07.3f %+07.3f %+07.3f %+07.3f %+07.3f",
+                                     fiducial_data->fiducials[i].id,
+                                     fiducial_data->fiducials[i].pose.px,
+                                     fiducial_data->fiducials[i].pose.py,
+                                     fiducial_data->fiducials[i].pose.pz,
+                                     fiducial_data->fiducials[i].pose.proll,
+                                     fiducial_data->fiducials[i].pose.ppitch,
+                                     fiducial_data->fiducials[i].pose.pyaw,
+                                     fiducial_data->fiducials[i].upose.px,
+                                     fiducial_data->fiducials[i].upose.py,
+                                     fiducial_data->fiducials[i].upose.pz,
+                                     fiducial_data->fiducials[i].upose.proll,
+                                     fiducial_data->fiducials[i].upose.ppitch,
+                                     fiducial_data->fiducials[i].upose.pyaw);
                     }
                     return(0);
                 default:
@@ -2967,19 +3689,19 @@ int WriteLog::WriteFiducial(player_msghdr_t* hdr, void *data)
                   fiducial_geom = (player_fiducial_geom_t*) data;
                   //format: <x> <y> <z> <roll> <pitch> <yaw> <length> ...
                   // <width> <height> <fiducial_length> <fiducial_width>
-                  fprintf(this->file, "%+7.3f %+7.3f %+7.3f %+7.3f %+7.3f"
-                          "%+7.3f %+7.3f %+7.3f %+7.3f %+7.3f %+7.3f",
-                          fiducial_geom->pose.px,
-                          fiducial_geom->pose.py,
-                          fiducial_geom->pose.pz,
-                          fiducial_geom->pose.proll,
-                          fiducial_geom->pose.ppitch,
-                          fiducial_geom->pose.pyaw,
-                          fiducial_geom->size.sl,
-                          fiducial_geom->size.sw,
-                          fiducial_geom->size.sh,
-                          fiducial_geom->fiducial_size.sl,
-                          fiducial_geom->fiducial_size.sw);
+                  this->Printf("%+7.3f %+7.3f %+7.3f %+7.3f %+7.3f"
+                               "%+7.3f %+7.3f %+7.3f %+7.3f %+7.3f %+7.3f",
+                               fiducial_geom->pose.px,
+                               fiducial_geom->pose.py,
+                               fiducial_geom->pose.pz,
+                               fiducial_geom->pose.proll,
+                               fiducial_geom->pose.ppitch,
+                               fiducial_geom->pose.pyaw,
+                               fiducial_geom->size.sl,
+                               fiducial_geom->size.sw,
+                               fiducial_geom->size.sh,
+                               fiducial_geom->fiducial_size.sl,
+                               fiducial_geom->fiducial_size.sw);
 
                   return(0);
               default:
@@ -3019,7 +3741,7 @@ int WriteLog::WriteGps(player_msghdr_t* hdr, void *data)
 	gdata = (player_gps_data_t*) data;
 	switch(hdr->type){
 		case PLAYER_MSGTYPE_DATA:
-			fprintf(this->file,
+			this->Printf(
 				"%.3f "
 				"%.7f %.7f %.7f "
 				"%.3f %.3f "
@@ -3067,7 +3789,7 @@ int WriteLog::WriteJoystick(player_msghdr_t* hdr, void *data)
 	jdata = (player_joystick_data_t*) data;
 	switch (hdr->type){
 		case PLAYER_MSGTYPE_DATA:
-			fprintf(this->file, "%+d %+d %+d %d %d %d %X",
+			this->Printf("%+d %+d %+d %d %d %d %X",
 				jdata->pos[0],
 				jdata->pos[1],
 				jdata->pos[2],
@@ -3134,7 +3856,7 @@ int WriteLog::WritePosition3d(player_msghdr_t* hdr, void *data)
 				case PLAYER_POSITION3D_DATA_STATE:
 					player_position3d_data_t *pdata;
 					pdata = (player_position3d_data_t*) data;
-					fprintf(this->file,
+					this->Printf(
 						"%+.4f %+.4f %+.4f "
 						"%+.4f %+.4f %+.4f "
 						"%+.4f %+.4f %+.4f "
@@ -3158,7 +3880,7 @@ int WriteLog::WritePosition3d(player_msghdr_t* hdr, void *data)
 				case PLAYER_POSITION3D_DATA_GEOMETRY:
 					player_position3d_geom_t *gdata;
 					gdata = (player_position3d_geom_t*) data;
-					fprintf(this->file,
+					this->Printf(
 						"%+.4f %+.4f %+.4f "
 						"%+.4f %+.4f %+.4f "
 						"%+.4f %+.4f %+.4f ",
@@ -3181,7 +3903,7 @@ int WriteLog::WritePosition3d(player_msghdr_t* hdr, void *data)
 					printf("w00t\n");
 					player_position3d_geom_t *gdata;
 					gdata = (player_position3d_geom_t*) data;
-					fprintf(this->file,
+					this->Printf(
 						"%+.4f %+.4f %+.4f "
 						"%+.4f %+.4f %+.4f "
 						"%+.4f %+.4f %+.4f ",
@@ -3237,7 +3959,7 @@ int WriteLog::WritePower(player_msghdr_t* hdr, void *data)
   		if (!(pdata->valid & PLAYER_POWER_MASK_CHARGING))
   			pdata->charging = 0;
   		
- 		fprintf(this->file, "%.3f %.3f %.3f %.3f %d %d", 
+ 		this->Printf("%.3f %.3f %.3f %.3f %d %d", 
  			pdata->volts,
  			pdata->percent,
  			pdata->joules,
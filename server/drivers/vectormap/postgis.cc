@@ -206,6 +206,9 @@ PostGIS::PostGIS(ConfigFile* cf, int section,
                  int debug)
   : Driver(cf, section, true, PLAYER_MSGQUEUE_DEFAULT_MAXLEN, PLAYER_VECTORMAP_CODE)
 {
+  // all our work is done in response to messages
+  this->event_driven = true;
+
   this->dbname = dbname;
   this->host = host;
   this->user = user;
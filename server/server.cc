@@ -51,7 +51,7 @@ The situation is essentially the same when running a simulation.
 @section Usage
 
 @code
-player [-q] [-d <level>] [-p <port>] [-h] <cfgfile>
+player [-q] [-d <level>] [-p <port>] [-t <threads>] [-b <seconds>] [-h] <cfgfile>
 @endcode
 Arguments:
 - -h : Give help info; also lists drivers that were compiled into the server.
@@ -62,6 +62,19 @@ more output.  Default: 1.
 - -p \<port\> : Establish the default TCP port, which will be assigned to
 any devices in the configuration file without an explicit port assignment.
 Default: 6665.
+- -t \<threads\> : Number of network threads that write to TCP clients.
+Each client connection is given to one of them, so that a slow client or a
+large message doesn't hold up the others.  Default: 0 (the main loop
+writes to every client).
+- -b \<seconds\> : How far behind a TCP client may fall before it is sent
+only the latest data.  How far behind a client is comes from what it has
+yet to be sent and how fast it has been taking data.  Past the limit, its
+queue keeps only the newest data message from each device (of each type
+and subtype), and what is queued already is collapsed the same way.
+Requests, replies and the client's own replace rules are unaffected.  The
+queue goes back to normal once the client is within a quarter of the
+limit.  Default: 0 (never).  At debug level 2 and above, how each TCP
+client is keeping up is reported every few seconds.
 - -l \<logfile\>: File to log messages to (default stdout only)
 - \<cfgfile\> : The configuration file to read.
 
@@ -129,10 +142,11 @@ void PrintCopyrightMsg();
 void PrintUsage();
 int ParseArgs(int* port, int* debuglevel,
               char** cfgfilename, int* gz_serverid, char** logfilename,
-              bool &shoud_daemonize,
-              int argc, char** argv);
+              bool &shoud_daemonize, int* netthreads,
+              double* max_lag, int argc, char** argv);
 void Quit(int signum);
 void Cleanup();
+double ReportClientStats();
 
 int lockfile_id = -1;
 bool process_is_daemon = false;
@@ -156,6 +170,8 @@ main(int argc, char** argv)
   int debuglevel = 1;
   int port = PLAYERTCP_DEFAULT_PORT;
   int gz_serverid = -1;
+  int netthreads = 0;
+  double max_lag = 0.0;
   int* ports = NULL;
   int* new_ports = NULL;
   int num_ports = 0;
@@ -212,7 +228,8 @@ main(int argc, char** argv)
   char *cfgfilename_unres = NULL;
 
   if(ParseArgs(&port, &debuglevel, &cfgfilename_unres, &gz_serverid,
-               &logfilename_unres, should_daemonize, argc, argv) < 0)
+               &logfilename_unres, should_daemonize, &netthreads,
+               &max_lag, argc, argv) < 0)
   {
     PrintUsage();
     exit(-1);
@@ -409,6 +426,10 @@ main(int argc, char** argv)
   free(ports);
   free(new_ports);
 
+  ptcp->SetMaxLag(max_lag);
+  if(ptcp->SetNetworkThreads(netthreads) < 0)
+    PLAYER_WARN("failed to start network threads; writing to clients from the main loop");
+
   if(deviceTable->StartAlwaysonDrivers() != 0)
   {
     PLAYER_ERROR("failed to start alwayson drivers");
@@ -416,10 +437,21 @@ main(int argc, char** argv)
     exit(-1);
   }
  
+  int polled = 0;
+  double report_in = -1;
   while(!player_quit)
   {
-    // wait until something other than driver requested watches happens
-    int numready = fileWatcher->Wait(0.01); // run at a minimum of 100Hz for other drivers
+    // wait until something other than driver requested watches happens:
+    // a client, a message for a non-threaded driver or data for a client.
+    // Non-threaded drivers that are not event-driven, and platforms where
+    // the watcher can't be woken, are still run at a minimum of 100Hz.  An idle server still wakes up for
+    // the next client report.
+    double timeout = -1;
+    if(polled || !fileWatcher->CanWake())
+      timeout = 0.01;
+    if((report_in >= 0) && ((timeout < 0) || (report_in < timeout)))
+      timeout = report_in;
+    int numready = fileWatcher->Wait(timeout);
     if (numready > 0)
     {
       if(ptcp->Accept(0) < 0)
@@ -440,7 +472,7 @@ main(int argc, char** argv)
         break;
       }
     }
-    deviceTable->UpdateDevices();
+    polled = deviceTable->UpdateDevices();
 
     if(ptcp->Write(false) < 0)
     {
@@ -448,6 +480,9 @@ main(int argc, char** argv)
       break;
     }
 
+    if(msgLevel >= 2)
+      report_in = ReportClientStats();
+
     if(pudp->Write() < 0)
     {
       PLAYER_ERROR("failed while writing to UDP clients");
@@ -499,10 +534,47 @@ Quit(int signum)
     case SIGTERM:
     default:
         player_quit = true;
+        // the main loop may be asleep
+        if(fileWatcher)
+          fileWatcher->Wake();
         break;
     }
 }
 
+// How often ReportClientStats() reports, in seconds
+#define CLIENT_STATS_INTERVAL 5.0
+
+// Report how each client is keeping up, every CLIENT_STATS_INTERVAL
+// seconds of wall clock time (GlobalTime may be log time, which stops,
+// jumps and goes back).  Returns the time until the next report.
+double
+ReportClientStats()
+{
+  static WallclockTime wallclock;
+  static double last = 0.0;
+  double now;
+
+  wallclock.GetTimeDouble(&now);
+  // catch a clock that was set back
+  if(now < last)
+    last = now;
+  if(now - last < CLIENT_STATS_INTERVAL)
+    return(last + CLIENT_STATS_INTERVAL - now);
+  last = now;
+
+  playertcp_client_stats_t stats;
+  for(int i=0;i<ptcp->GetNumClients();i++)
+  {
+    if(ptcp->GetClientStats(i, &stats) < 0)
+      continue;
+    PLAYER_MSG7(2, "client %d: %llu bytes sent, %.0f bytes/s, %lu bytes (%.2f s) behind, %u discarded%s",
+                i, (unsigned long long)stats.bytes_sent, stats.throughput,
+                (unsigned long)stats.backlog, stats.lag, stats.discarded,
+                stats.coalescing ? ", latest data only" : "");
+  }
+  return(CLIENT_STATS_INTERVAL);
+}
+
 void
 PrintVersion()
 {
@@ -531,6 +603,10 @@ PrintUsage()
   fprintf(stderr, "  -p <port>      : port where Player will listen. "
           "Default: %d\n", PLAYERTCP_DEFAULT_PORT);
   fprintf(stderr, "  -q             : quiet mode: minimizes the console output on startup.\n");
+  fprintf(stderr, "  -t <threads>   : number of network threads writing to TCP clients.\n"
+          "                   Default: 0 (the main loop writes)\n");
+  fprintf(stderr, "  -b <seconds>   : send only the latest data to TCP clients that fall\n"
+          "                   this far behind.  Default: 0 (never)\n");
   fprintf(stderr, "  -l <logfile>   : log player output to the specified file\n");
   fprintf(stderr, "  -s             : fork to a daemon process as the current user.\n");
   fprintf(stderr, "  <configfile>   : load the the indicated config file\n");
@@ -553,11 +629,11 @@ PrintUsage()
 
 int
 ParseArgs(int* port, int* debuglevel, char** cfgfilename, int* gz_serverid,
-          char **logfilename, bool &should_daemonize,
-          int argc, char** argv)
+          char **logfilename, bool &should_daemonize, int* netthreads,
+          double* max_lag, int argc, char** argv)
 {
   int ch;
-  const char* optflags = "d:p:l:hqs";
+  const char* optflags = "d:p:l:t:b:hqs";
 
   // Get letter options
   while((ch = getopt(argc, argv, optflags)) != -1)
@@ -579,6 +655,12 @@ ParseArgs(int* port, int* debuglevel, char** cfgfilename, int* gz_serverid,
       case 's':
         should_daemonize = true;
         break;
+      case 't':
+        *netthreads = atoi(optarg);
+        break;
+      case 'b':
+        *max_lag = atof(optarg);
+        break;
       case '?':
       case ':':
       case 'h':
@@ -61,7 +61,8 @@ for examples.
 When playervcr starts, a single window containing a few self-explanatory
 buttons will pop up.  The buttons will differ depending on whether the
 underlying driver reads from or writes to the log.  When reading data, you
-can rewind, start, and stop; when writing data, you can start and stop.
+can rewind, jump to a time in the log, start, and stop; when writing data,
+you can start and stop.
 
 @par Screenshots
 
@@ -99,6 +100,7 @@ typedef struct
   GtkFrame* label_frame;
   GtkLabel* label;
   GtkButton* rewindbutton;
+  GtkButton* seekbutton;
   GtkButton* playbutton;
   GtkButton* stopbutton;
   GtkButton* quitbutton;
@@ -251,12 +253,15 @@ init_gui(gui_data_t* gui_data, int argc, char** argv)
     gui_data->setfilenamebutton = NULL;
     g_assert((gui_data->rewindbutton =
               (GtkButton*)gtk_button_new_with_label("gtk-go-back")));
+    g_assert((gui_data->seekbutton =
+              (GtkButton*)gtk_button_new_with_label("gtk-jump-to")));
     g_assert((gui_data->playbutton =
               (GtkButton*)gtk_button_new_with_label("gtk-execute")));
   }
   else
   {
     gui_data->rewindbutton = NULL;
+    gui_data->seekbutton = NULL;
     g_assert((gui_data->playbutton =
               (GtkButton*)gtk_button_new_with_label("gtk-save")));
     g_assert((gui_data->setfilenamebutton =
@@ -268,7 +273,10 @@ init_gui(gui_data_t* gui_data, int argc, char** argv)
             (GtkButton*)gtk_button_new_with_label("gtk-quit")));
 
   if(gui_data->log->type == PLAYER_LOG_TYPE_READ)
+  {
     gtk_button_set_use_stock(gui_data->rewindbutton,TRUE);
+    gtk_button_set_use_stock(gui_data->seekbutton,TRUE);
+  }
   else
     gtk_button_set_use_stock(gui_data->setfilenamebutton,TRUE);
   gtk_button_set_use_stock(gui_data->playbutton,TRUE);
@@ -277,8 +285,12 @@ init_gui(gui_data_t* gui_data, int argc, char** argv)
 
   /* hook them up to callbacks */
   if(gui_data->log->type == PLAYER_LOG_TYPE_READ)
+  {
     gtk_signal_connect(GTK_OBJECT(gui_data->rewindbutton), "clicked",
                        (GtkSignalFunc)(button_callback),(void*)gui_data);
+    gtk_signal_connect(GTK_OBJECT(gui_data->seekbutton), "clicked",
+                       (GtkSignalFunc)(button_callback),(void*)gui_data);
+  }
   else
     gtk_signal_connect(GTK_OBJECT(gui_data->setfilenamebutton), "clicked",
                        (GtkSignalFunc)(button_callback),(void*)gui_data);
@@ -291,8 +303,12 @@ init_gui(gui_data_t* gui_data, int argc, char** argv)
 
   /* pack them */
   if(gui_data->log->type == PLAYER_LOG_TYPE_READ)
+  {
     gtk_box_pack_start(gui_data->hbox, (GtkWidget*)gui_data->rewindbutton,
                        FALSE, FALSE, 0);
+    gtk_box_pack_start(gui_data->hbox, (GtkWidget*)gui_data->seekbutton,
+                       FALSE, FALSE, 0);
+  }
   else
     gtk_box_pack_start(gui_data->hbox, (GtkWidget*)gui_data->setfilenamebutton,
                        FALSE, FALSE, 0);
@@ -389,6 +405,34 @@ button_callback(GtkWidget *widget, gpointer data)
       puts("Warning: Can't rewind while writing");
     }
   }
+  else if((GtkButton*)widget == gui_data->seekbutton)
+  {
+    gint result;
+    g_assert((dialog =
+              (GtkDialog*)gtk_dialog_new_with_buttons("Seek",
+                                                      gui_data->main_window,
+                                                      GTK_DIALOG_MODAL | GTK_DIALOG_DESTROY_WITH_PARENT,
+                                                      GTK_STOCK_OK,
+                                                      GTK_RESPONSE_ACCEPT,
+                                                      GTK_STOCK_CANCEL,
+                                                      GTK_RESPONSE_REJECT,
+                                                      NULL)));
+
+    g_assert((label = (GtkLabel*)gtk_label_new("Seconds from start of log:")));
+    g_assert((entry = (GtkEntry*)gtk_entry_new()));
+    gtk_container_add(GTK_CONTAINER (dialog->vbox), (GtkWidget*)label);
+    gtk_container_add(GTK_CONTAINER (dialog->vbox), (GtkWidget*)entry);
+    gtk_widget_show((GtkWidget*)entry);
+    gtk_widget_show((GtkWidget*)label);
+    result = gtk_dialog_run(dialog);
+    if(result == GTK_RESPONSE_ACCEPT)
+    {
+      if(playerc_log_set_read_seek(gui_data->log,
+                                   atof(gtk_entry_get_text(entry)), 1) < 0)
+        fprintf(stderr, "Error: Failed to seek playback\n");
+    }
+    gtk_widget_destroy((GtkWidget*)dialog);
+  }
   else if((GtkButton*)widget == gui_data->stopbutton)
   {
     if(gui_data->log->type == PLAYER_LOG_TYPE_WRITE)